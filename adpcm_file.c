@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include "adpcm_file.h"
+#include "decode_stats.h"
+#include "hot_path.h"
+/*
+   Plays IMA ADPCM WAV files, as written by e.g. sox -e ima-adpcm.
+   Each block starts with a 4 byte header per channel, holding the first
+   sample and the step index. Stereo data then alternates 4 bytes (8 samples)
+   of each channel. The low nibble of each byte is the earlier sample
+ */
+
+static const int16_t HOT_PATH_DATA("adpcm") adpcm_step[89] =
+{
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+static const int8_t HOT_PATH_DATA("adpcm") adpcm_index[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+static inline uint32_t adpcmGet16(const uint8_t* p) {return p[0] | (p[1] << 8);}
+static inline uint32_t adpcmGet32(const uint8_t* p) {return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);}
+
+/*
+ * adpcmFileCreate
+ * filename     Name of the WAV file
+ * buffer       Working memory, holds one compressed and one decoded block
+ * buffer_len   Size of buffer in bytes
+ *
+ * Returns true if the file is IMA ADPCM, and its blocks fit in buffer
+ */
+bool adpcmFileCreate(adpcm_file* af, const char* filename, unsigned char* buffer, uint32_t buffer_len)
+{
+    uint8_t header[8];
+    UINT read;
+    bool found_fmt = false;
+
+    if (f_open(&af->fil, filename, FA_OPEN_EXISTING | FA_READ) != FR_OK)
+    {
+        return false;
+    }
+
+    // Skip RIFF header, then walk the chunks to the data
+    if ((f_read(&af->fil, header, 4, &read) != FR_OK) || (read != 4) || memcmp(header, "RIFF", 4) ||
+        (f_lseek(&af->fil, 12) != FR_OK))
+    {
+        f_close(&af->fil);
+        return false;
+    }
+
+    while ((f_read(&af->fil, header, 8, &read) == FR_OK) && (read == 8))
+    {
+        uint32_t size = adpcmGet32(&header[4]);
+        FSIZE_t next = f_tell(&af->fil) + size + (size & 1);
+
+        if (!memcmp(header, "fmt ", 4) && (size >= 20))
+        {
+            uint8_t fmt[20];
+
+            if ((f_read(&af->fil, fmt, 20, &read) != FR_OK) || (read != 20))
+            {
+                break;
+            }
+            af->channels = adpcmGet16(&fmt[2]);
+            af->sample_rate = adpcmGet32(&fmt[4]);
+            af->block_align = adpcmGet16(&fmt[12]);
+            af->samples_per_block = adpcmGet16(&fmt[18]);
+            found_fmt = (adpcmGet16(&fmt[0]) == ADPCM_FILE_FORMAT) && (adpcmGet16(&fmt[14]) == 4) &&
+                        ((af->channels == 1) || (af->channels == 2)) && (af->block_align > 4 * af->channels);
+        }
+        else if (!memcmp(header, "data", 4) && found_fmt)
+        {
+            af->data_start = f_tell(&af->fil);
+            af->data_len = size;
+
+            // Check the blocks fit, samples per block follows from the block size
+            uint32_t samples = (af->block_align - 4 * af->channels) * 2 / af->channels + 1;
+            uint32_t decoded = samples * af->channels * sizeof(int16_t);
+
+            if ((af->samples_per_block != samples) || (af->block_align + decoded > buffer_len))
+            {
+                printf("Unsupported ADPCM block size %lu\n", (unsigned long)af->block_align);
+                break;
+            }
+
+            // Decoded block is aligned after the compressed block
+            af->block = buffer;
+            af->samples = (int16_t*)(buffer + ((af->block_align + 3) & ~3u));
+            af->data_pos = 0;
+            af->block_len = 0;
+            af->block_pos = 0;
+            return true;
+        }
+
+        if (f_lseek(&af->fil, next) != FR_OK)
+        {
+            break;
+        }
+    }
+    f_close(&af->fil);
+    return false;
+}
+
+bool adpcmFileClose(adpcm_file* af)
+{
+    return f_close(&af->fil) == FR_OK;
+}
+
+// Decode one nibble, updating the predictor and step index
+static inline int32_t adpcmNibble(uint32_t nibble, int32_t* predictor, int32_t* index)
+{
+    int32_t step = adpcm_step[*index];
+    int32_t diff = step >> 3;
+
+    if (nibble & 1) diff += step >> 2;
+    if (nibble & 2) diff += step >> 1;
+    if (nibble & 4) diff += step;
+
+    int32_t p = (nibble & 8) ? *predictor - diff : *predictor + diff;
+    int32_t i = *index + adpcm_index[nibble & 7];
+
+    *predictor = (p > INT16_MAX) ? INT16_MAX : ((p < INT16_MIN) ? INT16_MIN : p);
+    *index = (i < 0) ? 0 : ((i > 88) ? 88 : i);
+
+    return *predictor;
+}
+
+/*
+ * adpcmFileDecodeBlock
+ * bytes        Bytes of the block that were read, the last block may be short
+ *
+ * Decodes the compressed block into samples, returns the number of entries
+ */
+static uint32_t HOT_PATH(adpcmFileDecodeBlock)(adpcm_file* af, uint32_t bytes)
+{
+    uint32_t channels = af->channels;
+
+    if (bytes <= 4 * channels)
+    {
+        return 0;
+    }
+
+    uint32_t samples = (bytes - 4 * channels) * 2 / channels + 1;
+
+    for (uint32_t c = 0; c < channels; ++c)
+    {
+        const uint8_t* header = af->block + 4 * c;
+        int32_t predictor = (int16_t)adpcmGet16(header);
+        int32_t index = header[2] > 88 ? 88 : header[2];
+        int16_t* out = af->samples + c;
+
+        *out = predictor;
+        out += channels;
+
+        // Each group of 4 bytes holds 8 samples of one channel
+        for (uint32_t n = 1; n < samples; n += 8)
+        {
+            const uint8_t* p = af->block + 4 * channels + ((n - 1) >> 3) * 4 * channels + 4 * c;
+
+            for (uint32_t k = 0; (k < 8) && (n + k < samples); ++k)
+            {
+                *out = adpcmNibble((p[k >> 1] >> ((k & 1) << 2)) & 0xF, &predictor, &index);
+                out += channels;
+            }
+        }
+    }
+    return samples * channels;
+}
+
+/*
+ * adpcmFileRead
+ * buffer       Populated with samples, interleaved if stereo
+ * len          Number of entries to populate
+ * written      Number of entries populated
+ *
+ * Returns false if the file cannot be read
+ */
+bool adpcmFileRead(adpcm_file* af, int16_t* buffer, uint32_t len, uint32_t* written)
+{
+    uint32_t count = 0;
+    bool rewound = false;
+
+    while (count < len)
+    {
+        if (af->block_pos == af->block_len)
+        {
+            // Loop back to the start at the end of the data
+            if (af->data_pos >= af->data_len)
+            {
+                if (rewound || (f_lseek(&af->fil, af->data_start) != FR_OK))
+                {
+                    break;
+                }
+                af->data_pos = 0;
+                rewound = true;
+            }
+
+            UINT read;
+            uint32_t wanted = af->data_len - af->data_pos;
+
+            wanted = (wanted < af->block_align) ? wanted : af->block_align;
+
+            if ((f_read(&af->fil, af->block, wanted, &read) != FR_OK) || (read == 0))
+            {
+                break;
+            }
+
+            uint32_t start_us = time_us_32();
+            af->data_pos += (read == wanted) ? wanted : af->data_len;     // Short read means the file is shorter than its header
+            af->block_len = adpcmFileDecodeBlock(af, read);
+            af->block_pos = 0;
+            decodeStatsFrame(read, time_us_32() - start_us);
+            continue;
+        }
+
+        uint32_t n = af->block_len - af->block_pos;
+
+        n = (n < len - count) ? n : len - count;
+        memcpy(buffer + count, af->samples + af->block_pos, n * sizeof(int16_t));
+        af->block_pos += n;
+        count += n;
+        rewound = false;
+    }
+    *written = count;
+    return count == len;
+}
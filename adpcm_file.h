@@ -0,0 +1,33 @@
+#pragma once
+#include "pico/stdlib.h"
+#include "ff.h"
+
+/*
+ * IMA (DVI) ADPCM WAV file player.
+ * 4 bits per sample, decoded a block at a time with a few integer operations
+ * per sample. The file loops when the end is reached
+ */
+#define ADPCM_FILE_FORMAT   0x0011          // WAVE format tag of IMA ADPCM
+
+typedef struct adpcm_file
+{
+    FIL fil;
+    uint8_t* block;                 // Compressed block, read from file
+    int16_t* samples;               // Decoded block, interleaved if stereo
+    uint32_t block_align;           // Bytes in a compressed block
+    uint32_t samples_per_block;     // Samples per channel in a block
+    uint32_t channels;
+    uint32_t sample_rate;
+    FSIZE_t data_start;             // Offset of the first block
+    uint32_t data_len;              // Bytes of compressed data
+    uint32_t data_pos;              // Bytes of compressed data read
+    uint32_t block_len;             // Entries in the decoded block
+    uint32_t block_pos;             // Entries of the decoded block already returned
+} adpcm_file;
+
+extern bool adpcmFileCreate(adpcm_file* af, const char* filename, unsigned char* buffer, uint32_t buffer_len);
+extern bool adpcmFileClose(adpcm_file* af);
+extern bool adpcmFileRead(adpcm_file* af, int16_t* buffer, uint32_t len, uint32_t* written);
+
+inline uint32_t adpcmFileGetSampleRate(adpcm_file* af){return af->sample_rate;}
+inline bool adpcmFileIsStereo(adpcm_file* af){return af->channels == 2;}
@@ -0,0 +1,99 @@
+#include "audio_arena.h"
+/*
+   Block allocator for the source buffers.
+   Allocations are only made when a sound changes, so a linear search of the
+   block map is fast enough
+ */
+
+static inline bool audioArenaInUse(audio_arena* a, uint32_t block)
+{
+    return (a->used[block >> 5] & (1u << (block & 31))) != 0;
+}
+
+static void audioArenaMark(audio_arena* a, uint32_t first, uint32_t count, bool in_use)
+{
+    for (uint32_t block = first; block < first + count; ++block)
+    {
+        if (in_use)
+        {
+            a->used[block >> 5] |= (1u << (block & 31));
+        }
+        else
+        {
+            a->used[block >> 5] &= ~(1u << (block & 31));
+        }
+    }
+}
+
+/*
+ * audioArenaCreate
+ * memory       Start of the arena, aligned to 4 bytes
+ * size         Size of the arena in bytes, whole blocks are used
+ */
+void audioArenaCreate(audio_arena* a, void* memory, uint32_t size)
+{
+    a->memory = (uint8_t*)memory;
+    a->num_blocks = size / AUDIO_ARENA_BLOCK;
+
+    if (a->num_blocks > AUDIO_ARENA_MAX_BLOCKS)
+    {
+        a->num_blocks = AUDIO_ARENA_MAX_BLOCKS;
+    }
+
+    for (uint32_t i = 0; i < AUDIO_ARENA_MAX_BLOCKS / 32; ++i)
+    {
+        a->used[i] = 0;
+    }
+    a->blocks_used = 0;
+    a->blocks_max = 0;
+    a->failures = 0;
+}
+
+/*
+ * audioArenaAlloc
+ * size         Bytes needed
+ *
+ * Returns the first run of free blocks that is large enough, or NULL
+ */
+void* audioArenaAlloc(audio_arena* a, uint32_t size)
+{
+    uint32_t count = AUDIO_ARENA_BLOCKS(size);
+    uint32_t run = 0;
+
+    for (uint32_t block = 0; (count != 0) && (block < a->num_blocks); ++block)
+    {
+        run = audioArenaInUse(a, block) ? 0 : run + 1;
+
+        if (run == count)
+        {
+            uint32_t first = block + 1 - count;
+
+            audioArenaMark(a, first, count, true);
+            a->blocks_used += count;
+
+            if (a->blocks_used > a->blocks_max)
+            {
+                a->blocks_max = a->blocks_used;
+            }
+            return a->memory + first * AUDIO_ARENA_BLOCK;
+        }
+    }
+    a->failures++;
+    return NULL;
+}
+
+/*
+ * audioArenaRelease
+ * p            Buffer returned by audioArenaAlloc, NULL is ignored
+ * size         Size passed to audioArenaAlloc
+ */
+void audioArenaRelease(audio_arena* a, void* p, uint32_t size)
+{
+    if (p)
+    {
+        uint32_t count = AUDIO_ARENA_BLOCKS(size);
+
+        audioArenaMark(a, ((uint8_t*)p - a->memory) / AUDIO_ARENA_BLOCK, count, false);
+        a->blocks_used -= count;
+    }
+}
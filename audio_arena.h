@@ -0,0 +1,43 @@
+#pragma once
+#include "pico/stdlib.h"
+#include "audio_zone.h"
+
+/*
+ * Shared memory for the buffers of the sound sources.
+ * A source takes only the buffers it needs when it is selected, and returns
+ * them when it stops. The arena is divided into blocks, each buffer is a run
+ * of contiguous blocks, found first fit. Buffers are allocated separately, so
+ * runs stay short
+ */
+#define AUDIO_ARENA_BLOCK           1024            // Bytes in a block
+#define AUDIO_ARENA_MAX_BLOCKS      512             // Most blocks an arena can manage
+
+// Buffers needed by each type of source
+#define AUDIO_ARENA_NOISE_RAM_LENGTH    (2*AUDIO_ZONE_DMA_LENGTH)   // Noise is cheap, so can be refilled often
+#define AUDIO_ARENA_FILE_RAM_LENGTH     AUDIO_ZONE_RAM_LENGTH       // Absorbs decode and SD card delays
+#define AUDIO_ARENA_FILE_CACHE          8000                        // Working buffer for reading from file
+#define AUDIO_ARENA_TEXTURE_CLIP_LENGTH 32768                       // Mono samples of a texture clip, 1.5s at 22.05kHz
+
+// Blocks needed by each type of source, used to size the arena
+#define AUDIO_ARENA_BLOCKS(bytes)       (((bytes) + AUDIO_ARENA_BLOCK - 1) / AUDIO_ARENA_BLOCK)
+#define AUDIO_ARENA_NOISE_BLOCKS        (2 * AUDIO_ARENA_BLOCKS(AUDIO_ARENA_NOISE_RAM_LENGTH * 2))
+#define AUDIO_ARENA_FILE_BLOCKS         (2 * AUDIO_ARENA_BLOCKS(AUDIO_ARENA_FILE_RAM_LENGTH * 2) + AUDIO_ARENA_BLOCKS(AUDIO_ARENA_FILE_CACHE))
+#define AUDIO_ARENA_TEXTURE_BLOCKS      (AUDIO_ARENA_NOISE_BLOCKS + AUDIO_ARENA_BLOCKS(AUDIO_ARENA_FILE_CACHE) + \
+                                         AUDIO_ARENA_BLOCKS(AUDIO_ARENA_TEXTURE_CLIP_LENGTH * 2))
+
+typedef struct audio_arena
+{
+    uint8_t* memory;
+    uint32_t num_blocks;
+    uint32_t used[AUDIO_ARENA_MAX_BLOCKS / 32];     // Bit set for each block in use
+    uint32_t blocks_used;
+    uint32_t blocks_max;                            // Most blocks in use at once
+    uint32_t failures;                              // Allocations that did not fit
+} audio_arena;
+
+extern void audioArenaCreate(audio_arena* a, void* memory, uint32_t size);
+extern void* audioArenaAlloc(audio_arena* a, uint32_t size);
+extern void audioArenaRelease(audio_arena* a, void* p, uint32_t size);
+
+// Bytes not in use
+inline uint32_t audioArenaAvailable(audio_arena* a){return (a->num_blocks - a->blocks_used) * AUDIO_ARENA_BLOCK;}
@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include "hardware/dma.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "audio_zone.h"
+#include "hot_path.h"
+/*
+   Plays one stream of samples through a PWM slice.
+   The data channel copies a DMA block to the PWM, then chains to the control
+   channel. The control channel writes the next block address from the list
+   into the data channel, which triggers it. The list is read as a ring, so
+   playback continues without the CPU. The end of block interrupt only counts
+   blocks, the refills are run from the main loop by the scheduler
+ */
+
+#ifdef DEBUG_STATUS
+  #define STATUS(a) printf a
+#else
+  #define STATUS(a) (void)0
+#endif
+
+// To convert from 16 bit signed to unsigned
+#define MID_VALUE 0x8000
+
+// Number of DMA blocks between reports of the load
+#define AUDIO_ZONE_LOAD_BLOCKS 200
+
+static void audioZoneInitDma(audio_zone* z);
+static void audioZonePopulateDma(audio_zone* z);
+
+/*
+ * audioZoneCreate
+ * gpio_left    GPIO of the left channel, the right channel is the next GPIO
+ * play_stereo  false to play the mix of both channels on each output
+ *
+ * Claims the PWM slice and DMA channels. The zone is silent until started
+ */
+void audioZoneCreate(audio_zone* z, uint gpio_left, bool play_stereo)
+{
+    // Set up the PWMs with arbitrary values, will be updated when play starts
+    pwmChannelInit(&z->pwm[0], gpio_left);
+    pwmChannelInit(&z->pwm[1], gpio_left + 1);
+
+    z->block_list[0] = z->dma_buffer[0];
+    z->block_list[1] = z->dma_buffer[1];
+    z->dma_data_channel = dma_claim_unused_channel(true);
+    z->dma_control_channel = dma_claim_unused_channel(true);
+    audioZoneInitDma(z);
+
+    doubleBufferCreate(&z->double_buffers, NULL, NULL, 0);
+
+    z->play_stereo = play_stereo;
+    z->playing = false;
+    z->double_pending = false;
+    z->busy_us = 0;
+    z->busy_start_us = time_us_32();
+    z->flush_cache = false;
+}
+
+// Configure the DMA channels as a self reloading chain
+static void audioZoneInitDma(audio_zone* z)
+{
+    int slice = pwmChannelGetSlice(&z->pwm[0]);
+
+    dma_channel_config config = dma_channel_get_default_config(z->dma_data_channel);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, DREQ_PWM_WRAP0 + slice);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_chain_to(&config, z->dma_control_channel);
+
+    // Read address is written by the control channel
+    dma_channel_configure(z->dma_data_channel,
+                          &config,
+                          &pwm_hw->slice[slice].cc,
+                          NULL,
+                          AUDIO_ZONE_DMA_LENGTH,
+                          false);
+
+    config = dma_channel_get_default_config(z->dma_control_channel);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_ring(&config, false, AUDIO_ZONE_RING_BITS);
+
+    // One control block per trigger
+    dma_channel_configure(z->dma_control_channel,
+                          &config,
+                          &dma_hw->ch[z->dma_data_channel].al3_read_addr_trig,
+                          z->block_list,
+                          1,
+                          false);
+
+    // Only the data channel reports the end of a block
+    dma_channel_set_irq1_enabled(z->dma_data_channel, true);
+}
+
+/*
+ * audioZoneSetBuffers
+ * buff0, buff1     RAM buffers, need not be contiguous
+ * length           Number of samples in each buffer, including interleaved samples
+ *
+ * Must be called whilst the zone is stopped, before audioZoneStart
+ */
+void audioZoneSetBuffers(audio_zone* z, int16_t* buff0, int16_t* buff1, uint32_t length)
+{
+    doubleBufferCreate(&z->double_buffers, buff0, buff1, length);
+}
+
+/*
+ * audioZoneStart
+ * plan             PWM divider and wrap for the sample rate, at the current clock
+ * sample_rate      Rate of the samples supplied by fn
+ * sampled_stereo   true if fn supplies interleaved stereo samples
+ * gain             Q15 gain, faded in across the first block
+ * fn               Populates the RAM buffers
+ * context          Passed to fn
+ */
+void audioZoneStart(audio_zone* z, const clock_plan* plan, uint32_t sample_rate, bool sampled_stereo, int32_t gain, populateBuffer fn, void* context)
+{
+    // Reconfigure the PWM for the new wrap and clock
+    z->repeat_shift = plan->shift;
+    pwmChannelReconfigure(&z->pwm[0], plan->div_int, plan->div_frac, plan->wrap);
+    pwmChannelReconfigure(&z->pwm[1], plan->div_int, plan->div_frac, plan->wrap);
+    z->block_us = ((uint64_t)AUDIO_ZONE_DMA_LENGTH * 1000000) / (sample_rate << plan->shift);
+
+    // reset read positions
+    z->sampled_stereo = sampled_stereo;
+    z->ram_index = 0;
+    z->dma_buffer_index = 0;
+    z->generation = 0;
+    z->refilled = 0;
+    z->double_pending = false;
+    z->refill_max_us[0] = 0;
+    z->refill_max_us[1] = 0;
+
+    // Fade in from silence across the first DMA block
+    gainRampCreate(&z->gain, 0);
+    gainRampSetTarget(&z->gain, gain);
+
+    // Reinitialise the double buffers
+    doubleBufferInitialise(&z->double_buffers, fn, context, &z->current_ram, &z->current_length);
+
+    // Populate both DMA buffers
+    audioZonePopulateDma(z);
+    audioZonePopulateDma(z);
+
+    // Start the chain and both PWMs
+    uint32_t pwm_mask = 0;
+
+    pwmChannelAddStartList(&z->pwm[0], &pwm_mask);
+    pwmChannelAddStartList(&z->pwm[1], &pwm_mask);
+
+    // The control channel loads the first block into the data channel
+    z->complete_us = time_us_32();
+    z->playing = true;
+    dma_channel_set_read_addr(z->dma_control_channel, z->block_list, true);
+    pwmChannelStartList(pwm_mask);
+}
+
+void audioZoneStop(audio_zone* z)
+{
+    // Disable DMAs and PWMs
+    pwmChannelStop(&z->pwm[0]);
+    pwmChannelStop(&z->pwm[1]);
+    pwmChannelStop(&z->pwm[0]);
+
+    // Abort the control channel either side, as the data channel chains to it
+    dma_channel_abort(z->dma_control_channel);
+    dma_channel_abort(z->dma_data_channel);
+    dma_channel_abort(z->dma_control_channel);
+    dma_channel_acknowledge_irq1(z->dma_data_channel);
+
+    z->playing = false;
+    z->double_pending = false;
+}
+
+/*
+ * audioZoneIrq
+ *
+ * Called from the DMA interrupt handler. Returns true if this zone
+ * completed a block, so needs a refill
+ */
+bool HOT_PATH(audioZoneIrq)(audio_zone* z)
+{
+    if (dma_channel_get_irq1_status(z->dma_data_channel))
+    {
+        dma_channel_acknowledge_irq1(z->dma_data_channel);
+        z->complete_us = time_us_32();
+        z->generation++;
+        return true;
+    }
+    return false;
+}
+
+// Populate the next DMA buffer from the RAM buffers
+static void HOT_PATH(audioZonePopulateDma)(audio_zone* z)
+{
+    uint32_t left;
+    uint32_t right;
+    uint32_t* dma_buffer = z->dma_buffer[z->dma_buffer_index];
+    uint32_t shift = z->repeat_shift;
+
+    // Calculate the wrap point for the ram_index
+    uint32_t ram_buffer_wrap = (z->sampled_stereo) ? (z->current_length<<shift) : (z->current_length<<(shift+1));
+
+    // Ramp the gain to its target across this block
+    gainRampBlockStart(&z->gain, AUDIO_ZONE_DMA_LENGTH);
+
+    // Populate two bytes from each active buffer
+    for (int i=0; i<AUDIO_ZONE_DMA_LENGTH; ++i)
+    {
+        int32_t g = gainRampNext(&z->gain);
+
+        // build the 32 bit word from the two channels, adjusting for gain
+        if (z->sampled_stereo)
+        {
+            left = (((z->current_ram[(z->ram_index>>shift)<<1] * g) >> 15) + MID_VALUE) >> (16 - AUDIO_ZONE_PWM_BITS);
+            right = (((z->current_ram[((z->ram_index>>shift)<<1)+1] * g) >> 15) + MID_VALUE) >> (16 - AUDIO_ZONE_PWM_BITS);
+        }
+        else
+        {
+            left = (((z->current_ram[z->ram_index>>shift] * g) >> 15) + MID_VALUE) >> (16 - AUDIO_ZONE_PWM_BITS);
+            right = left;
+        }
+        z->ram_index++;
+
+        if (!z->play_stereo)
+        {
+            // Want mono, so average two channels
+            left = (left + right) >> 1;
+            right = left;
+        }
+
+        // Combine the two channels
+        dma_buffer[i] = (right << 16) + left;
+
+        // At or past the end, so a buffer shorter than expected cannot be read beyond
+        if ((z->ram_index<<1) >= ram_buffer_wrap)
+        {
+            // Need a new RAM buffer
+            doubleBufferGetLast(&z->double_buffers, &z->current_ram, &z->current_length);
+
+            // reset read position of RAM buffer to start
+            z->ram_index = 0;
+            ram_buffer_wrap = (z->sampled_stereo) ? (z->current_length<<shift) : (z->current_length<<(shift+1));
+
+            // The other buffer must be refilled before this one has been played
+            z->double_pending = true;
+            z->double_deadline_us = time_us_32() + (uint32_t)(((uint64_t)(ram_buffer_wrap >> 1) * z->block_us) / AUDIO_ZONE_DMA_LENGTH);
+        }
+    }
+    z->dma_buffer_index = 1 - z->dma_buffer_index;
+}
+
+/*
+ * audioZoneNextJob
+ * zones        Array of zones to schedule
+ * num_zones    Number of zones in the array
+ * job          Populated with the job to run
+ *
+ * Returns the zone with the earliest refill deadline, or NULL if no zone
+ * is waiting for a refill
+ */
+audio_zone* audioZoneNextJob(audio_zone* zones, uint32_t num_zones, audio_zone_job* job)
+{
+    audio_zone* next = NULL;
+    uint32_t now = time_us_32();
+    int32_t earliest = INT32_MAX;
+
+    *job = audio_zone_idle;
+
+    for (uint32_t i = 0; i < num_zones; ++i)
+    {
+        audio_zone* z = &zones[i];
+
+        if (!z->playing)
+        {
+            continue;
+        }
+
+        // The refilled DMA buffer is played again at the end of the current block
+        if ((int32_t)(z->generation - z->refilled) > 0)
+        {
+            int32_t deadline = (int32_t)(z->complete_us + z->block_us - now);
+
+            if (deadline < earliest)
+            {
+                earliest = deadline;
+                next = z;
+                *job = audio_zone_refill_dma;
+            }
+        }
+
+        if (z->double_pending)
+        {
+            int32_t deadline = (int32_t)(z->double_deadline_us - now);
+
+            if (deadline < earliest)
+            {
+                earliest = deadline;
+                next = z;
+                *job = audio_zone_refill_double;
+            }
+        }
+    }
+    return next;
+}
+
+/*
+ * audioZoneSlackUs
+ * zones        Array of zones
+ * num_zones    Number of zones in the array
+ *
+ * Returns how long the main loop could be held up before any zone misses a
+ * refill, 0 if a refill is already waiting
+ */
+uint32_t audioZoneSlackUs(audio_zone* zones, uint32_t num_zones)
+{
+    uint32_t now = time_us_32();
+    int32_t slack = INT32_MAX;
+
+    for (uint32_t i = 0; i < num_zones; ++i)
+    {
+        audio_zone* z = &zones[i];
+
+        if (!z->playing)
+        {
+            continue;
+        }
+
+        // When refilled, the next block to complete must be refilled before the one after it ends
+        int32_t deadline = ((int32_t)(z->generation - z->refilled) > 0) ? (int32_t)(z->complete_us + z->block_us - now) :
+                                                                          (int32_t)(z->complete_us + 2 * z->block_us - now);
+
+        if (z->double_pending && ((int32_t)(z->double_deadline_us - now) < deadline))
+        {
+            deadline = (int32_t)(z->double_deadline_us - now);
+        }
+
+        if (deadline < slack)
+        {
+            slack = deadline;
+        }
+    }
+    return (slack > 0) ? (uint32_t)slack : 0;
+}
+
+/*
+ * audioZoneRunJob
+ * job          Job returned by audioZoneNextJob
+ *
+ * Runs the refill, and records how long it took
+ */
+void audioZoneRunJob(audio_zone* z, audio_zone_job job)
+{
+    // Benchmark of the worst case, code and data in flash must be fetched again.
+    // Reading the flush register waits until the flush is complete
+    if (z->flush_cache)
+    {
+        xip_ctrl_hw->flush = 1;
+        (void)xip_ctrl_hw->flush;
+    }
+
+    uint32_t start_us = time_us_32();
+
+    if (job == audio_zone_refill_dma)
+    {
+        audioZonePopulateDma(z);
+
+        // The refilled buffer must not have started playing again
+        if ((int32_t)(z->generation - ++z->refilled) > 0)
+        {
+            z->underruns++;
+            STATUS(("DMA underrun %lu, block %lu\n", z->underruns, z->refilled));
+        }
+    }
+    else if (job == audio_zone_refill_double)
+    {
+        z->double_pending = false;
+        doubleBufferPopulateNext(&z->double_buffers);
+    }
+    else
+    {
+        return;
+    }
+
+    uint32_t elapsed_us = time_us_32() - start_us;
+
+    z->busy_us += elapsed_us;
+
+    if (elapsed_us > z->refill_max_us[job - 1])
+    {
+        z->refill_max_us[job - 1] = elapsed_us;
+        STATUS(("Worst case %s refill %lu us\n", (job == audio_zone_refill_dma) ? "DMA" : "RAM", elapsed_us));
+    }
+
+    if ((job == audio_zone_refill_dma) && ((z->refilled % AUDIO_ZONE_LOAD_BLOCKS) == 0))
+    {
+        STATUS(("Zone on GP%u load %lu%%\n", z->pwm[0].gpio_number, audioZoneLoad(z)));
+    }
+}
+
+/*
+ * audioZoneLoad
+ *
+ * Returns the percentage of time spent refilling this zone since the last
+ * call. The sum across zones shows how many more zones would fit
+ */
+uint32_t audioZoneLoad(audio_zone* z)
+{
+    uint32_t now = time_us_32();
+    uint32_t elapsed_us = now - z->busy_start_us;
+    uint32_t load = (elapsed_us) ? (uint32_t)(((uint64_t)z->busy_us * 100) / elapsed_us) : 0;
+
+    z->busy_us = 0;
+    z->busy_start_us = now;
+
+    return load;
+}
+
+/*
+ * audioZoneBenchmark
+ * flush_cache  true to flush the XIP cache before each refill
+ *
+ * Restarts the worst case refill times and the load, so that the cost of
+ * the source now playing can be measured. With a cold cache the refills of
+ * a build running from flash show their worst case, which can be compared
+ * with the PICOSOUNDS_RAM_HOT_PATH build
+ */
+void audioZoneBenchmark(audio_zone* z, bool flush_cache)
+{
+    z->flush_cache = flush_cache;
+    z->refill_max_us[0] = 0;
+    z->refill_max_us[1] = 0;
+    audioZoneLoad(z);
+}
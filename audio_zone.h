@@ -0,0 +1,75 @@
+#pragma once
+#include "pico/stdlib.h"
+#include "pwm_channel.h"
+#include "double_buffer.h"
+#include "gain_ramp.h"
+#include "clock_planner.h"
+
+/*
+ * An independent output zone.
+ * Each zone has its own PWM slice, self reloading DMA chain, gain and sample
+ * rate. The RAM double buffers are supplied by the source being played. All zones share the system clock. Refills
+ * for every zone are served by one scheduler, earliest deadline first
+ */
+#define AUDIO_ZONE_PWM_BITS     12                          // Resolution of the output samples
+#define AUDIO_ZONE_DMA_LENGTH   2200                        // 2200 samples @ 44kHz gives= 0.05 seconds = interrupt rate
+#define AUDIO_ZONE_RAM_LENGTH   (4*AUDIO_ZONE_DMA_LENGTH)    // Longest RAM buffer, a buffer must play for at least one DMA block
+#define AUDIO_ZONE_RING_BITS    3                           // Control block list is read as an aligned ring of 8 bytes
+
+typedef enum audio_zone_job         // Work that a zone is waiting for
+{
+    audio_zone_idle = 0,
+    audio_zone_refill_dma = audio_zone_idle + 1,            // A DMA block has been played
+    audio_zone_refill_double = audio_zone_refill_dma + 1    // A RAM buffer has been consumed
+} audio_zone_job;
+
+typedef struct audio_zone
+{
+    // Read by the control channel, so must be aligned to the size of the list
+    uint32_t* block_list[2] __attribute__((aligned(1 << AUDIO_ZONE_RING_BITS)));
+
+    pwm_data pwm[2];                            // Left and right PWM channels, on one slice
+    int dma_data_channel;                       // Copies the samples to the PWM
+    int dma_control_channel;                    // Reloads the data channel from the block list
+    uint32_t dma_buffer[2][AUDIO_ZONE_DMA_LENGTH];
+    int dma_buffer_index;                       // Next DMA buffer to populate
+
+    // Playback continues without the CPU, so refills are tracked with counters
+    volatile uint32_t generation;               // DMA blocks completed, incremented by IRQ
+    volatile uint32_t complete_us;              // Time the last DMA block completed
+    uint32_t refilled;                          // DMA blocks refilled
+    uint32_t underruns;                         // Refills that were too late, so a block was replayed
+    uint32_t block_us;                          // Time to play one DMA block
+
+    // RAM buffers, owned and filled by the source
+    double_buffer double_buffers;
+    const int16_t* current_ram;                 // RAM buffer being played
+    uint32_t current_length;                    // Number of samples in current RAM buffer
+    uint32_t ram_index;                         // Position in current RAM buffer
+    bool double_pending;                        // true if a RAM buffer needs to be refilled
+    uint32_t double_deadline_us;                // Time the RAM buffer must be refilled by
+
+    bool sampled_stereo;                        // true if the RAM buffers hold stereo samples
+    bool play_stereo;                           // false to play the same mix on both channels
+    uint32_t repeat_shift;                      // Each sample is repeated 2^repeat_shift times
+    gain_ramp gain;                             // Applied to samples, ramps each DMA block
+    bool playing;
+
+    // Statistics, used to find the capacity of the board
+    uint32_t refill_max_us[2];                  // Worst case time for each job type
+    uint32_t busy_us;                           // Total time spent refilling
+    uint32_t busy_start_us;                     // Time that busy_us was last reset
+    bool flush_cache;                           // true to flush the XIP cache before each refill, to time the worst case
+} audio_zone;
+
+extern void audioZoneCreate(audio_zone* z, uint gpio_left, bool play_stereo);
+extern void audioZoneSetBuffers(audio_zone* z, int16_t* buff0, int16_t* buff1, uint32_t length);
+extern void audioZoneStart(audio_zone* z, const clock_plan* plan, uint32_t sample_rate, bool sampled_stereo, int32_t gain, populateBuffer fn, void* context);
+extern void audioZoneStop(audio_zone* z);
+extern bool audioZoneIrq(audio_zone* z);
+extern audio_zone* audioZoneNextJob(audio_zone* zones, uint32_t num_zones, audio_zone_job* job);
+extern void audioZoneRunJob(audio_zone* z, audio_zone_job job);
+extern uint32_t audioZoneSlackUs(audio_zone* zones, uint32_t num_zones);
+extern uint32_t audioZoneLoad(audio_zone* z);
+extern void audioZoneBenchmark(audio_zone* z, bool flush_cache);
+
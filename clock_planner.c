@@ -0,0 +1,174 @@
+#include "clock_planner.h"
+/*
+   Searches the system PLL settings, PWM dividers and PWM wraps for a
+   configuration that plays a sample rate at the requested bit depth.
+   Plans with a rate error within CLOCK_PLANNER_MAX_PPM are ranked by lowest
+   system clock, to save power, then by lowest error. If no plan is within
+   tolerance, the plan with the lowest error is used.
+   Samples are repeated until the PWM frequency is at least 32kHz. A rate
+   that would then need a clock above the maximum, such as 7kHz repeated 8
+   times, is repeated one time fewer, giving a PWM frequency above 24kHz
+ */
+
+#define CLOCK_PLANNER_XOSC_KHZ  12000       // Crystal frequency, PLL reference
+#define CLOCK_PLANNER_MIN_VCO   750000      // PLL VCO limits, in kHz
+#define CLOCK_PLANNER_MAX_VCO   1600000
+
+// Return true if the candidate is better than the current best
+static bool clockPlannerBetter(const clock_plan* candidate, const clock_plan* best)
+{
+    bool candidate_ok = (candidate->error_ppm <= CLOCK_PLANNER_MAX_PPM);
+    bool best_ok = (best->error_ppm <= CLOCK_PLANNER_MAX_PPM);
+
+    if (candidate_ok != best_ok)
+    {
+        return candidate_ok;
+    }
+
+    if (candidate_ok && (candidate->sys_khz != best->sys_khz))
+    {
+        return candidate->sys_khz < best->sys_khz;
+    }
+    return candidate->error_ppm < best->error_ppm;
+}
+
+/*
+ * clockPlannerSearchDividers
+ *
+ * For a fixed system clock, try each PWM divider whose wrap still gives the
+ * required number of bits, updating best if a better plan is found
+ */
+static void clockPlannerSearchDividers(uint32_t sys_khz, uint32_t pwm_rate, uint32_t bits, uint32_t shift, clock_plan* best)
+{
+    uint64_t sys_hz16 = (uint64_t)sys_khz * 1000 * 16;
+
+    // Divider is held in 16ths, from 1.0 to 255 + 15/16
+    for (uint32_t div16 = 16; div16 < (256 * 16); ++div16)
+    {
+        uint64_t den = (uint64_t)div16 * pwm_rate;
+        uint64_t period = (sys_hz16 + (den >> 1)) / den;
+
+        if (period < (1u << bits))
+        {
+            // Larger dividers only reduce the resolution further
+            break;
+        }
+
+        if (period <= 65536)
+        {
+            // Error between achieved rate, sys / (div * period), and requested rate
+            uint64_t achieved = period * den;
+            uint64_t diff = (achieved > sys_hz16) ? achieved - sys_hz16 : sys_hz16 - achieved;
+
+            clock_plan candidate =
+            {
+                .sys_khz = sys_khz,
+                .shift = shift,
+                .wrap = period - 1,
+                .div_int = div16 >> 4,
+                .div_frac = div16 & 0xf,
+                .error_ppm = (diff * 1000000 + (achieved >> 1)) / achieved
+            };
+
+            if (clockPlannerBetter(&candidate, best))
+            {
+                *best = candidate;
+            }
+        }
+    }
+}
+
+// Number of times each sample is repeated, to keep the PWM frequency above the audio band
+static uint32_t clockPlannerShift(uint32_t sample_rate)
+{
+    uint32_t shift = 0;
+
+    while (((sample_rate << shift) < CLOCK_PLANNER_MIN_PWM_RATE) && (shift < CLOCK_PLANNER_MAX_SHIFT))
+    {
+        shift++;
+    }
+    return shift;
+}
+
+// Search all system clocks for a PWM frequency of sample_rate << shift
+static bool clockPlannerSearchClocks(uint32_t sample_rate, uint32_t bits, uint32_t min_khz, uint32_t shift, clock_plan* plan)
+{
+    clock_plan best = {.error_ppm = UINT32_MAX};
+    uint32_t pwm_rate = sample_rate << shift;
+
+    // Search all system clocks that the PLL can generate exactly
+    for (uint32_t vco = CLOCK_PLANNER_XOSC_KHZ * ((CLOCK_PLANNER_MIN_VCO + CLOCK_PLANNER_XOSC_KHZ - 1) / CLOCK_PLANNER_XOSC_KHZ);
+         vco <= CLOCK_PLANNER_MAX_VCO; vco += CLOCK_PLANNER_XOSC_KHZ)
+    {
+        for (uint32_t post_div1 = 1; post_div1 <= 7; ++post_div1)
+        {
+            for (uint32_t post_div2 = 1; post_div2 <= post_div1; ++post_div2)
+            {
+                uint32_t divide = post_div1 * post_div2;
+                uint32_t sys_khz = vco / divide;
+
+                if ((vco % divide == 0) && (sys_khz >= min_khz) && (sys_khz <= CLOCK_PLANNER_MAX_KHZ))
+                {
+                    clockPlannerSearchDividers(sys_khz, pwm_rate, bits, shift, &best);
+                }
+            }
+        }
+    }
+
+    *plan = best;
+    return (best.sys_khz != 0);
+}
+
+/*
+ * clockPlannerPlan
+ * sample_rate  Rate of the samples to be played
+ * bits         Resolution of the PWM, the wrap must be at least 2^bits - 1
+ * min_khz      Lowest system clock to consider, gives headroom for decoding
+ * plan         Populated with the best configuration found
+ *
+ * Returns false if no configuration can play the sample rate
+ */
+bool clockPlannerPlan(uint32_t sample_rate, uint32_t bits, uint32_t min_khz, clock_plan* plan)
+{
+    if (sample_rate == 0)
+    {
+        return false;
+    }
+
+    uint32_t shift = clockPlannerShift(sample_rate);
+
+    return clockPlannerSearchClocks(sample_rate, bits, min_khz, shift, plan) ||
+           ((shift > 0) && clockPlannerSearchClocks(sample_rate, bits, min_khz, shift - 1, plan));
+}
+
+/*
+ * clockPlannerPlanFixed
+ * sample_rate  Rate of the samples to be played
+ * bits         Resolution of the PWM, the wrap must be at least 2^bits - 1
+ * sys_khz      System clock, which cannot be changed
+ * plan         Populated with the best divider and wrap for the clock
+ *
+ * Used when the system clock is shared with sound that is already playing.
+ * Returns false if the sample rate cannot be played at the clock
+ */
+bool clockPlannerPlanFixed(uint32_t sample_rate, uint32_t bits, uint32_t sys_khz, clock_plan* plan)
+{
+    clock_plan best = {.error_ppm = UINT32_MAX};
+
+    if (sample_rate == 0)
+    {
+        return false;
+    }
+
+    uint32_t shift = clockPlannerShift(sample_rate);
+
+    clockPlannerSearchDividers(sys_khz, sample_rate << shift, bits, shift, &best);
+
+    if ((best.sys_khz == 0) && (shift > 0))
+    {
+        clockPlannerSearchDividers(sys_khz, sample_rate << (shift - 1), bits, shift - 1, &best);
+    }
+
+    *plan = best;
+    return (best.sys_khz != 0);
+}
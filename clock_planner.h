@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Derives the system clock, PWM wrap and PWM divider for a sample rate.
+ * The PWM runs at the sample rate multiplied by 2^shift, so that low sample
+ * rates are output by repeating samples
+ */
+#define CLOCK_PLANNER_MAX_KHZ       200000  // Highest system clock considered
+#define CLOCK_PLANNER_MIN_PWM_RATE  32000   // Lowest PWM frequency, keeps carrier out of audio band
+#define CLOCK_PLANNER_MAX_SHIFT     3       // Largest number of times a sample may be doubled
+#define CLOCK_PLANNER_MAX_PPM       500     // Rate error that is accepted for a lower clock
+
+typedef struct clock_plan
+{
+    uint32_t sys_khz;       // System clock in kHz
+    uint32_t shift;         // PWM frequency is sample rate << shift
+    uint32_t wrap;          // PWM counter wrap value
+    uint32_t div_int;       // Integer part of PWM divider
+    uint32_t div_frac;      // Fractional part of PWM divider, in 16ths
+    uint32_t error_ppm;     // Difference between achieved and requested rate
+} clock_plan;
+
+extern bool clockPlannerPlan(uint32_t sample_rate, uint32_t bits, uint32_t min_khz, clock_plan* plan);
+extern bool clockPlannerPlanFixed(uint32_t sample_rate, uint32_t bits, uint32_t sys_khz, clock_plan* plan);
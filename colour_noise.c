@@ -1,17 +1,16 @@
 #include "colour_noise.h"
 
-void colourNoiseCreate(colour_noise* cn, float m_white_scale)
+void colourNoiseCreate(colour_noise* cn, uint32_t white_shift)
 {
     cn->m_seed = 0;
-    cn->m_white = 0;
     cn->m_count = 1;
-    cn->m_white_scale = m_white_scale;
-    cn->m_brown = 0.0f;
-    cn->m_pink = 0.0f;
+    cn->m_white_shift = white_shift;
+    cn->m_brown = 0;
+    cn->m_pink = 0;
 
     for (int i = 0; i < NumPinkBins; i++)
     {
-        cn->m_pinkStore[i] = 0.0f;
+        cn->m_pinkStore[i] = 0;
     }
 }
 
@@ -8,31 +8,36 @@ enum
     NumPinkBins1 = NumPinkBins - 1
 };
 
+// All noise values are 16 bit signed, scaled so that 32768 represents 1.0
+#define COLOUR_NOISE_PINK_LIMIT  (4 << 15)      // Saturation limit of pink accumulator
+#define COLOUR_NOISE_BROWN_LIMIT (8 << 15)      // Saturation limit of brown accumulator
+#define COLOUR_NOISE_BROWN_LEAK  8              // Brown leak of 1/256 per sample, removes DC drift
+
 typedef struct colour_noise
 {
     uint32_t  m_seed;
     uint32_t  m_count;
-    union
-    {
-        uint32_t  m_white;
-        float     m_fwhite;
-    };
-
-    float     m_white_scale;
-    float     m_pink;
-    float     m_brown;
-    float     m_pinkStore[NumPinkBins];
+    uint32_t  m_white_shift;                    // Right shift applied to raw white noise
+    int32_t   m_pink;
+    int32_t   m_brown;
+    int32_t   m_pinkStore[NumPinkBins];
 } colour_noise;
 
-extern void colourNoiseCreate(colour_noise* cn, float m_white_scale);
+extern void colourNoiseCreate(colour_noise* cn, uint32_t white_shift);
 extern void colourNoiseSeed(colour_noise* cn, unsigned long seed);
 
-inline float colourNoiseWhite(colour_noise* cn)
+// Saturate an accumulator to +/- limit
+inline int32_t colourNoiseSaturate(int32_t value, int32_t limit)
+{
+    return (value > limit) ? limit : ((value < -limit) ? -limit : value);
+}
+
+// returns white noise, full scale 16 bit value shifted right by m_white_shift
+//
+inline int32_t colourNoiseWhite(colour_noise* cn)
 {
     cn->m_seed = (cn->m_seed * 196314165) + 907633515;
-    cn->m_white = cn->m_seed >> 9;
-    cn->m_white |= 0x40000000;
-    return (cn->m_fwhite - 3.0f) * cn->m_white_scale;
+    return ((int32_t)cn->m_seed >> 16) >> cn->m_white_shift;
 };
 
 int inline CTZ(int num)
@@ -41,7 +46,7 @@ int inline CTZ(int num)
     while (((num >> i) & 1) == 0 && i < (signed)sizeof(int)) i++;
     return i;
 
-    
+
     //if (num == 0) {
     //    return 32U;
     //}
@@ -49,63 +54,34 @@ int inline CTZ(int num)
     //}
 }
 
-// returns pink noise random number in the range -0.5 to 0.5
+// returns pink noise of about -0.5 to 0.5. The peak is (white + COLOUR_NOISE_PINK_LIMIT) / 8,
+// -18432 to 18432 with a white shift of 1, so leave headroom when mixing
 //
-inline float colourNoisePink(colour_noise* cn)
+inline int32_t colourNoisePink(colour_noise* cn)
 {
-    float prevr;
-    float r;
     unsigned long k;
     k = CTZ(cn->m_count);
     k = k & NumPinkBins1;
 
-    // get previous value of this octave 
-    prevr = cn->m_pinkStore[k];
+    // replace the value of this octave in the running total
+    int32_t r = colourNoiseWhite(cn);
 
-    while (true)
-    {
-        r = colourNoiseWhite(cn);
+    cn->m_pink = colourNoiseSaturate(cn->m_pink + r - cn->m_pinkStore[k], COLOUR_NOISE_PINK_LIMIT);
+    cn->m_pinkStore[k] = r;
 
-        // store new value 
-        cn->m_pinkStore[k] = r;
-
-        r -= prevr;
-
-        // update total 
-        cn->m_pink += r;
-
-        if (cn->m_pink < -4.0f || cn->m_pink > 4.0f)
-        {
-            cn->m_pink -= r;
-        }
-        else
-        {
-            break;
-        }
-    }
-
-    // update counter 
+    // update counter
     cn->m_count++;
 
-    return (colourNoiseWhite(cn) + cn->m_pink) * 0.125f;
+    return (colourNoiseWhite(cn) + cn->m_pink) >> 3;
 }
 
-// returns brown noise random number in the range -0.5 to 0.5
+// returns brown noise in the range -0.5 to 0.5 (-16384 to 16384)
 //
-inline float colourNoiseBrown(colour_noise* cn)
+inline int32_t colourNoiseBrown(colour_noise* cn)
 {
-    while (true)
-    {
-        float  r = colourNoiseWhite(cn);
-        cn->m_brown += r;
-        if (cn->m_brown < -8.0f || cn->m_brown>8.0f)
-        {
-            cn->m_brown -= r;
-        }
-        else
-        {
-            break;
-        }
-    }
-    return cn->m_brown * 0.0625f;
+    // Leaky integrator, saturated rather than rejecting out of range steps
+    cn->m_brown += colourNoiseWhite(cn) - (cn->m_brown >> COLOUR_NOISE_BROWN_LEAK);
+    cn->m_brown = colourNoiseSaturate(cn->m_brown, COLOUR_NOISE_BROWN_LIMIT);
+
+    return cn->m_brown >> 4;
 }
@@ -3,10 +3,20 @@
 #include <ff.h>
 
 static void configCreateInitialFile(void);
+static bool configWrite(fs_mount* fs, FSIZE_t offset, const void* data, UINT size, const char* name);
+
+// Position of each value in the config file
+#define CONFIG_OFFSET_SOUND     0
+#define CONFIG_OFFSET_VOLUME    (CONFIG_OFFSET_SOUND + sizeof(sound_state))
+#define CONFIG_OFFSET_LED       (CONFIG_OFFSET_VOLUME + sizeof(float))
+#define CONFIG_OFFSET_INTENSITY (CONFIG_OFFSET_LED + sizeof(led_state))
+#define CONFIG_OFFSET_SLEEP     (CONFIG_OFFSET_INTENSITY + sizeof(float))
+#define CONFIG_OFFSET_ZONE(z)   (CONFIG_OFFSET_SLEEP + sizeof(uint32_t) + ((z) - 1) * (sizeof(sound_state) + sizeof(float)))
+#define CONFIG_OFFSET_SYNTH     CONFIG_OFFSET_ZONE(CONFIG_MAX_ZONES)
 
 FIL fp;
 
-void configGetStatus(fs_mount* fs, sound_state* sound, float* volume, led_state* led, float* intensity)
+void configGetStatus(fs_mount* fs, sound_state* sound, float* volume, led_state* led, float* intensity, uint32_t* sleep_minutes)
 {
     UINT read;
     bool failed = false;
@@ -22,6 +32,7 @@ void configGetStatus(fs_mount* fs, sound_state* sound, float* volume, led_state*
             *volume = CONFIG_INITIAL_VOLUME;
             *led = CONFIG_INITIAL_LED;
             *intensity = CONFIG_INITIAL_INTENSITY;
+            *sleep_minutes = CONFIG_INITIAL_SLEEP;
         }
         else
         {
@@ -49,8 +60,16 @@ void configGetStatus(fs_mount* fs, sound_state* sound, float* volume, led_state*
             if (failed || (f_read(&fp, intensity, sizeof(float), &read) != FR_OK) || (read != sizeof(intensity)))
             {
                 printf("cannot read intensity\n");
+                failed = true;
                 *intensity = CONFIG_INITIAL_INTENSITY;
             }
+
+            // Sleep timer was added after the first release, so may be missing
+            if (failed || (f_read(&fp, sleep_minutes, sizeof(uint32_t), &read) != FR_OK) || (read != sizeof(uint32_t)))
+            {
+                printf("cannot read sleep\n");
+                *sleep_minutes = CONFIG_INITIAL_SLEEP;
+            }
             f_close(&fp);
         }
     }
@@ -60,120 +79,135 @@ void configGetStatus(fs_mount* fs, sound_state* sound, float* volume, led_state*
         *volume = CONFIG_INITIAL_VOLUME;
         *led = CONFIG_INITIAL_LED;
         *intensity = CONFIG_INITIAL_INTENSITY;
+        *sleep_minutes = CONFIG_INITIAL_SLEEP;
     }
 }
 
-bool configSetSoundState(fs_mount* fs, sound_state sound)
+/*
+ * configGetZone
+ *
+ * zone         Output zone, from 1. Zone 0 is read by configGetStatus
+ *
+ * Read the sound and volume of an additional output zone
+ *
+ */
+void configGetZone(fs_mount* fs, uint32_t zone, sound_state* sound, float* volume)
 {
-    bool ret = false;
+    UINT read;
 
-    if (fsMounted(fs))
-    {
-        UINT write;
+    *sound = CONFIG_INITIAL_ZONE_SOUND;
+    *volume = CONFIG_INITIAL_VOLUME;
 
-        if (f_open(&fp, CONFIG_FILENAME, FA_OPEN_ALWAYS | FA_WRITE) == FR_OK)
-        {
-            if ((f_write(&fp, &sound, sizeof(sound), &write) != FR_OK) || write != sizeof(sound))
-            {
-                printf("cannot write sound\n");
-            }
-            else
-            {
-                ret = true;
-            }
-
-            if (f_close(&fp) != FR_OK)
-            {
-                printf("Failed to close file\n");
-            }
-        }
-        else
+    if (fsMounted(fs) && (f_open(&fp, CONFIG_FILENAME, FA_OPEN_EXISTING | FA_READ) == FR_OK))
+    {
+        // Zones are only written once changed, so may be missing
+        if ((f_lseek(&fp, CONFIG_OFFSET_ZONE(zone)) != FR_OK) ||
+            (f_read(&fp, sound, sizeof(sound_state), &read) != FR_OK) || (read != sizeof(sound_state)) ||
+            (f_read(&fp, volume, sizeof(float), &read) != FR_OK) || (read != sizeof(float)) ||
+            (*sound >= end) || !(*volume >= 0.0f && *volume <= 1.0f))
         {
-            printf("fopen failed\n");
+            // Later values extend the file, so a zone that has not been written may hold anything
+            printf("cannot read zone %lu\n", zone);
+            *sound = CONFIG_INITIAL_ZONE_SOUND;
+            *volume = CONFIG_INITIAL_VOLUME;
         }
+        f_close(&fp);
     }
-    return ret;
 }
 
-bool configSetVolume(fs_mount* fs, float volume)
+/*
+ * configGetSynth
+ *
+ * params       Populated with the parameters of the generated sounds
+ *
+ */
+void configGetSynth(fs_mount* fs, synth_params* params)
 {
-    bool ret = false;
+    UINT read;
 
-    if (fsMounted(fs))
-    {
-        UINT write;
+    params->tone_mhz = CONFIG_INITIAL_TONE_MHZ;
+    params->beat_mhz = CONFIG_INITIAL_BEAT_MHZ;
+    params->breath_ms = CONFIG_INITIAL_BREATH_MS;
 
-        if (f_open(&fp, CONFIG_FILENAME, FA_OPEN_ALWAYS | FA_WRITE) == FR_OK)
-        {
-            if (f_lseek(&fp, sizeof(sound_state)) == FR_OK)
-            {
-                if ((f_write(&fp, &volume, sizeof(volume), &write) != FR_OK) || write != sizeof(volume))
-                {
-                    printf("cannot write volume\n");
-                }
-                else
-                {
-                    ret = true;
-                }
-            }
-            else
-            {
-                printf("Cannot seek to volume\n");
-            }
-
-            if (f_close(&fp) != FR_OK)
-            {
-                printf("Failed to close file\n");
-            }
-        }
-        else
+    if (fsMounted(fs) && (f_open(&fp, CONFIG_FILENAME, FA_OPEN_EXISTING | FA_READ) == FR_OK))
+    {
+        // Only written once changed, so may be missing
+        if ((f_lseek(&fp, CONFIG_OFFSET_SYNTH) != FR_OK) ||
+            (f_read(&fp, params, sizeof(synth_params), &read) != FR_OK) || (read != sizeof(synth_params)) ||
+            !configSynthValid(params))
         {
-            printf("fopen failed\n");
+            params->tone_mhz = CONFIG_INITIAL_TONE_MHZ;
+            params->beat_mhz = CONFIG_INITIAL_BEAT_MHZ;
+            params->breath_ms = CONFIG_INITIAL_BREATH_MS;
         }
+        f_close(&fp);
     }
-    return ret;
 }
 
-bool configSetLed(fs_mount* fs, led_state led)
+/*
+ * configSynthValid
+ *
+ * params       Parameters of the generated sounds
+ *
+ * Returns true if the tone, and the right channel of the binaural beat, are
+ * below CONFIG_MAX_SYNTH_MHZ and the breath is at least CONFIG_MIN_BREATH_MS.
+ * The beat is checked against the room left by the tone, so the sum cannot wrap
+ */
+bool configSynthValid(const synth_params* params)
 {
-    bool ret = false;
+    return (params->tone_mhz != 0) && (params->tone_mhz < CONFIG_MAX_SYNTH_MHZ) &&
+           (params->beat_mhz < CONFIG_MAX_SYNTH_MHZ - params->tone_mhz) &&
+           (params->breath_ms >= CONFIG_MIN_BREATH_MS);
+}
 
-    if (fsMounted(fs))
-    {
-        UINT write;
+bool configSetSoundState(fs_mount* fs, sound_state sound)
+{
+    return configWrite(fs, CONFIG_OFFSET_SOUND, &sound, sizeof(sound), "sound");
+}
 
-        if (f_open(&fp, CONFIG_FILENAME, FA_OPEN_ALWAYS | FA_WRITE) == FR_OK)
-        {
-            if (f_lseek(&fp, sizeof(sound_state) + sizeof(float)) == FR_OK)
-            {
-                if ((f_write(&fp, &led, sizeof(led), &write) != FR_OK) || write != sizeof(led))
-                {
-                    printf("cannot write led\n");
-                }
-                else
-                {
-                    ret = true;
-                }
-            }
-            else
-            {
-                printf("Cannot seek to led\n");
-            }
-            
-            if (f_close(&fp) != FR_OK)
-            {
-                printf("Failed to close file\n");
-            }
-        }
-        else
-        {
-            printf("fopen failed\n");
-        }
-    }
-    return ret;
+bool configSetVolume(fs_mount* fs, float volume)
+{
+    return configWrite(fs, CONFIG_OFFSET_VOLUME, &volume, sizeof(volume), "volume");
+}
+
+bool configSetLed(fs_mount* fs, led_state led)
+{
+    return configWrite(fs, CONFIG_OFFSET_LED, &led, sizeof(led), "led");
 }
 
 bool configSetIntensity(fs_mount* fs, float intensity)
+{
+    return configWrite(fs, CONFIG_OFFSET_INTENSITY, &intensity, sizeof(intensity), "intensity");
+}
+
+bool configSetSleep(fs_mount* fs, uint32_t sleep_minutes)
+{
+    return configWrite(fs, CONFIG_OFFSET_SLEEP, &sleep_minutes, sizeof(sleep_minutes), "sleep");
+}
+
+bool configSetZone(fs_mount* fs, uint32_t zone, sound_state sound, float volume)
+{
+    return configWrite(fs, CONFIG_OFFSET_ZONE(zone), &sound, sizeof(sound), "zone sound") &&
+           configWrite(fs, CONFIG_OFFSET_ZONE(zone) + sizeof(sound), &volume, sizeof(volume), "zone volume");
+}
+
+bool configSetSynth(fs_mount* fs, const synth_params* params)
+{
+    return configWrite(fs, CONFIG_OFFSET_SYNTH, params, sizeof(synth_params), "synth");
+}
+
+/* 
+ * configWrite
+ *
+ * offset       Position of the value in the config file
+ * data         Value to write
+ * size         Size of value in bytes
+ * name         Name of value, for error reporting
+ * 
+ * Write a single value to the config file
+ * 
+ */
+static bool configWrite(fs_mount* fs, FSIZE_t offset, const void* data, UINT size, const char* name)
 {
     bool ret = false;
 
@@ -183,11 +217,11 @@ bool configSetIntensity(fs_mount* fs, float intensity)
 
         if (f_open(&fp, CONFIG_FILENAME, FA_OPEN_ALWAYS | FA_WRITE) == FR_OK)
         {
-            if (f_lseek(&fp, sizeof(sound_state) + sizeof(float) + sizeof(led_state)) == FR_OK)
+            if (f_lseek(&fp, offset) == FR_OK)
             {
-                if ((f_write(&fp, &intensity, sizeof(intensity), &write) != FR_OK) || write != sizeof(intensity))
+                if ((f_write(&fp, data, size, &write) != FR_OK) || write != size)
                 {
-                    printf("cannot write intensity\n");
+                    printf("cannot write %s\n", name);
                 }
                 else
                 {
@@ -196,9 +230,9 @@ bool configSetIntensity(fs_mount* fs, float intensity)
             }
             else
             {
-                printf("Cannot seek to intensity\n");
+                printf("Cannot seek to %s\n", name);
             }
-            
+
             if (f_close(&fp) != FR_OK)
             {
                 printf("Failed to close file\n");
@@ -226,6 +260,7 @@ static void configCreateInitialFile(void)
         float f = CONFIG_INITIAL_VOLUME;
         uint32_t l = CONFIG_INITIAL_LED;
         float i = CONFIG_INITIAL_INTENSITY;
+        uint32_t m = CONFIG_INITIAL_SLEEP;
         UINT write;
         bool failed = false;
 
@@ -253,6 +288,12 @@ static void configCreateInitialFile(void)
             failed = true;
         }
 
+        if (failed || (f_write(&fp, &m, sizeof(m), &write) != FR_OK) || (write != sizeof(m)))
+        {
+            printf("Cannot write sleep config\n");
+            failed = true;
+        }
+
         // Close the file
         if (f_close(&fp) != FR_OK)
         {
@@ -275,96 +316,3 @@ static void configCreateInitialFile(void)
         printf("Cannot create config file\n");
     }
 }
-
-// Determine configuration data, based on sample rate
-bool getSampleValues(uint sample_rate, uint* shift, uint* wrap, uint* mid_point, float* fraction)
-{
-    bool ret = true;
-
-    switch (sample_rate)
-    {
-        case 11000:
-            *shift = 2;
-            *wrap = 4091;
-            *fraction = 1.0f;
-        break;
-
-        case 22000:
-            *shift = 1;
-            *wrap = 4091;
-            *fraction = 1.0f;
-        break;
-
-        case 11025:
-            *shift = 2;
-            *wrap = 4082;
-            *fraction = 1.0f;
-        break;
-
-        case 22050:
-            *shift = 1;
-            *wrap = 4082;
-            *fraction = 1.0f;
-        break;
-
-        case 44000:
-            *shift = 0;
-            *wrap = 4091;
-            *fraction = 1.0f;
-        break;
-
-        case 44100:
-            *shift = 0;
-            *wrap = 4082;
-            *fraction = 1.0f;
-        break;
-
-        case 8000:
-            *shift = 2;
-            *wrap = 4091;
-            *fraction = 1.375f;
-        break;
-
-        case 16000:
-            *shift = 1;
-            *wrap = 4091;
-            *fraction = 1.375f;
-        break;
-
-        case 32000:
-            *shift = 0;
-            *wrap = 4091;
-            *fraction = 1.375f;
-        break;
-
-        case 12000:
-            *shift = 2;
-            *wrap = 3750;
-            *fraction = 1.0f;
-        break;
-
-        case 24000:
-            *shift = 1;
-            *wrap = 3750;
-            *fraction = 1.0f;
-        break;
-
-        case 48000:
-            *shift = 0;
-            *wrap = 3750;
-            *fraction = 1.0f;
-        break;
-
-        default:
-            // Not a supported rate
-            *wrap = 0;
-            ret = false;
-        break;
-    }
-
-    // mid point is half of wrap value
-    *mid_point = *wrap >> 1;
-
-    return ret;
-}
-
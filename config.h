@@ -12,7 +12,15 @@ typedef enum sound_state    // Describes the supported music and noise states
     file_3 = file_2 + 1,
     white = file_3 + 1,
     pink = white + 1,
-    end = pink + 1
+    blue = pink + 1,
+    violet = blue + 1,
+    grey = violet + 1,
+    custom = grey + 1,
+    tone = custom + 1,              // Steady sine tone
+    binaural = tone + 1,            // Sine tones, the right channel offset by the beat frequency
+    breathing = binaural + 1,       // Brown noise, slowly amplitude modulated
+    texture = breathing + 1,        // Endless granular texture from a short clip
+    end = texture + 1
 } sound_state;
 
 typedef enum led_state      // Describes the supported LED colours
@@ -30,13 +38,32 @@ typedef enum led_state      // Describes the supported LED colours
 #define CONFIG_INITIAL_SOUND  file_1
 #define CONFIG_INITIAL_LED led_black
 #define CONFIG_INITIAL_INTENSITY 1.0f
+#define CONFIG_INITIAL_SLEEP 0              // Sleep timer disabled
+#define CONFIG_INITIAL_ZONE_SOUND brown     // Sound of additional output zones
+#define CONFIG_INITIAL_TONE_MHZ 200000      // 200Hz
+#define CONFIG_INITIAL_BEAT_MHZ 4000        // 4Hz, so 204Hz in the right channel
+#define CONFIG_INITIAL_BREATH_MS 10000      // 6 breaths a minute
+#define CONFIG_MAX_SYNTH_MHZ 11000000       // Tone plus beat must be below 11kHz, half the rate of the generated sounds
+#define CONFIG_MIN_BREATH_MS 1000           // Shortest breath
+#define CONFIG_MAX_ZONES 4                  // Zones with space reserved in the config file
+
+typedef struct synth_params         // Parameters of the generated sounds
+{
+    uint32_t tone_mhz;              // Frequency of the tone, and of the left channel of the binaural beat
+    uint32_t beat_mhz;              // Difference between the right and left binaural frequencies
+    uint32_t breath_ms;             // Period of one breath
+} synth_params;
 
 #define CONFIG_FILENAME "config_2"          // Change name when have breaking changes to config
 
-extern void configGetStatus(fs_mount* fs, sound_state* sound, float* volume, led_state* led, float* intensity);
+extern void configGetStatus(fs_mount* fs, sound_state* sound, float* volume, led_state* led, float* intensity, uint32_t* sleep_minutes);
 extern bool configSetSoundState(fs_mount* fs, sound_state sound);
 extern bool configSetVolume(fs_mount* fs, float volume);
 extern bool configSetLed(fs_mount* fs, led_state led);
 extern bool configSetIntensity(fs_mount* fs, float intensity);
-
-extern bool getSampleValues(uint sample_rate, uint* shift, uint* wrap, uint* mid_point, float* fraction);
\ No newline at end of file
+extern bool configSetSleep(fs_mount* fs, uint32_t sleep_minutes);
+extern void configGetZone(fs_mount* fs, uint32_t zone, sound_state* sound, float* volume);
+extern bool configSetZone(fs_mount* fs, uint32_t zone, sound_state sound, float volume);
+extern void configGetSynth(fs_mount* fs, synth_params* params);
+extern bool configSynthValid(const synth_params* params);
+extern bool configSetSynth(fs_mount* fs, const synth_params* params);
\ No newline at end of file
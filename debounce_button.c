@@ -1,111 +1,194 @@
+#include "hardware/sync.h"
 #include "debounce_button.h"
-
-static debounce_button_data* debounce_list = NULL; // Holds head of list
-static void debounceButtonCallback(uint gpio, uint32_t events);
-static int64_t debounceButtonTimerCallback(alarm_id_t id, void *user_data);
+/*
+   Debounces all buttons from one periodic scan timer.
+   Each button has an integrator that counts towards integrator_max whilst the
+   input reads pressed, and towards 0 whilst it reads released. The debounced
+   state only changes at the ends of the range, so contact bounce is ignored.
+   The time spent in the timer interrupt is bounded by the number of buttons.
+   Whilst the board sleeps the scan stops once every button is released, and
+   an edge on any button restarts it, so the timer does not wake the CPU
+ */
+
+static debounce_button_data* debounce_table[DEBOUNCE_NUM_GPIOS];   // Indexed by gpio
+static uint32_t debounce_mask = 0;                                 // Bit set for each gpio in use
+static repeating_timer_t debounce_timer;
+static bool debounce_sleep = false;                                 // true to stop scanning when released
+static bool debounce_scanning = false;                              // true whilst the scan timer runs
+static bool debounceButtonScan(repeating_timer_t* rt);
+static void debounceButtonUpdate(debounce_button_data* db, bool raw, uint32_t now);
+static void debounceButtonEdge(uint gpio, uint32_t events);
+
+// Used for buttons that are only sampled, so no check is needed in the scan
+static void debounceButtonIgnore(uint gpio_number, debounce_event event, uint32_t time_ms) {}
 
 void debounceButtonCreate(debounce_button_data* db, uint pin, uint delay_ms, event_callback_t event_callback, bool up, bool high)
 {
-    // Add to end of list
-    if (!debounce_list)
-    {
-        debounce_list = db;
-    }
-    else
-    {
-        debounce_button_data* db_prev = debounce_list;
-
-        while (db_prev->next)
-        {
-            db_prev = db_prev->next;
-        }
-        db_prev->next = db;
-    }
-    db->next = NULL;
-
     db->pin = pin;
-    db->delay_ms = delay_ms;
-    db->event_callback = event_callback;
+    db->event_callback = event_callback ? event_callback : debounceButtonIgnore;
     db->up = up;
     db->high = high;
-    db->timer_id = -1;
+    db->integrator = 0;
+    db->integrator_max = (delay_ms + DEBOUNCE_SCAN_MS - 1) / DEBOUNCE_SCAN_MS;
+    db->pressed = false;
+    db->held = false;
+    db->double_armed = false;
+    db->press_ms = 0;
+    db->next_hold_ms = 0;
+
+    if (db->integrator_max == 0)
+    {
+        db->integrator_max = 1;
+    }
 
     gpio_init(db->pin);
     gpio_set_dir(db->pin, GPIO_IN);
 
     (db->up) ? gpio_pull_up(db->pin) : gpio_pull_down(db->pin);
 
-    // Attach the interrupt handler
-    gpio_set_irq_enabled_with_callback(db->pin, db->high ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL, true, &debounceButtonCallback);
+    // Start scanning when the first button is added
+    if (!debounce_mask)
+    {
+        debounce_scanning = add_repeating_timer_ms(-DEBOUNCE_SCAN_MS, debounceButtonScan, NULL, &debounce_timer);
+    }
+
+    debounce_table[db->pin] = db;
+    debounce_mask |= 1u << db->pin;
 }
 
 void debounceButtonDestroy(debounce_button_data* db)
 {
-    // Disable the IRQ
-    gpio_set_irq_enabled_with_callback(db->pin, db->high ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL, false, &debounceButtonCallback);
+    debounce_mask &= ~(1u << db->pin);
+    debounce_table[db->pin] = NULL;
 
-    // Kill any timer
-    if (db->timer_id != -1)
+    // Stop scanning when the last button is removed
+    if (!debounce_mask && debounce_scanning)
     {
-        // Cancel a timer if it was running
-        cancel_alarm(db->timer_id);
-        db->timer_id = -1;
+        cancel_repeating_timer(&debounce_timer);
+        debounce_scanning = false;
     }
+}
 
-    // Remove from linked list - strictly speaking this should be interrupt protected
+/*
+ * debounceButtonSleep
+ * sleep        true to stop scanning until a button is pressed
+ *
+ * Scanning stops once all buttons have been released. The next edge on a
+ * button restarts it, and the press is then reported as normal
+ */
+void debounceButtonSleep(bool sleep)
+{
+    uint32_t status = save_and_disable_interrupts();
+
+    debounce_sleep = sleep;
 
-    // Is this the head?
-    if (debounce_list == db)
+    if (!sleep && !debounce_scanning && debounce_mask)
     {
-        debounce_list = db->next;
-    } 
-    else
+        debounceButtonEdge(0, 0);
+    }
+    restore_interrupts(status);
+}
+
+// Called from the GPIO interrupt when a button changes whilst scanning is stopped
+static void debounceButtonEdge(uint gpio, uint32_t events)
+{
+    for (uint pin = 0; pin < DEBOUNCE_NUM_GPIOS; ++pin)
     {
-        // Walk the list to find our position
-        debounce_button_data* p = debounce_list;
-        while (p->next != db)
+        if (debounce_mask & (1u << pin))
         {
-            p = p->next;
+            gpio_set_irq_enabled(pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false);
         }
-    
-        // p is now the entry before us, so link to next
-        p->next = db->next; 
+    }
+
+    if (!debounce_scanning)
+    {
+        debounce_scanning = add_repeating_timer_ms(-DEBOUNCE_SCAN_MS, debounceButtonScan, NULL, &debounce_timer);
     }
 }
 
-static void debounceButtonCallback(uint gpio, uint32_t events)
+// Called from the timer interrupt, samples all gpios at once
+static bool debounceButtonScan(repeating_timer_t* rt)
 {
-    // Find this block in the linked list
-    debounce_button_data* db = debounce_list;
+    uint32_t levels = gpio_get_all();
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    bool idle = true;
 
-    while ((db != NULL) && db->pin != gpio)
+    for (uint gpio = 0; gpio < DEBOUNCE_NUM_GPIOS; ++gpio)
     {
-        db = db->next;
+        if (debounce_mask & (1u << gpio))
+        {
+            debounce_button_data* db = debounce_table[gpio];
+
+            debounceButtonUpdate(db, ((levels >> gpio) & 1) == db->high, now);
+            idle = idle && !db->pressed && (db->integrator == 0);
+        }
     }
 
-    if (db)
+    if (debounce_sleep && idle)
     {
-            if (db->timer_id == -1)
+        // Wake on the press, stopping the timer from the callback is the same as cancelling it
+        for (uint gpio = 0; gpio < DEBOUNCE_NUM_GPIOS; ++gpio)
+        {
+            if (debounce_mask & (1u << gpio))
             {
-                // Timer not running so create one
-                db->timer_id = add_alarm_in_ms(db->delay_ms, debounceButtonTimerCallback, db, true);
+                uint32_t edge = debounce_table[gpio]->high ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+
+                gpio_acknowledge_irq(gpio, edge);
+                gpio_set_irq_enabled_with_callback(gpio, edge, true, debounceButtonEdge);
             }
+        }
+        debounce_scanning = false;
+        return false;
     }
-    gpio_acknowledge_irq(gpio, events);
+    return true;
 }
 
-// Called when the timer fires
-// Send data back to the application
-static int64_t debounceButtonTimerCallback(alarm_id_t id, void* db) 
+// Run the integrator for one button, and report any events
+static void debounceButtonUpdate(debounce_button_data* db, bool raw, uint32_t now)
 {
-    // Is the button pressed?
-    if ((((debounce_button_data*)db)->timer_id != -1) && 
-          (gpio_get(((debounce_button_data*)db)->pin) == ((debounce_button_data*)db)->high))
+    if (raw)
+    {
+        if (db->integrator < db->integrator_max)
+        {
+            db->integrator++;
+        }
+    }
+    else if (db->integrator > 0)
     {
-        ((debounce_button_data*)db)->event_callback(((debounce_button_data*)db)->pin, single_press);
+        db->integrator--;
     }
 
-    // Clear timer indicator
-    ((debounce_button_data*)db)->timer_id = -1;
-    return 0;
+    if (!db->pressed && (db->integrator == db->integrator_max))
+    {
+        bool is_double = db->double_armed && ((now - db->press_ms) <= DEBOUNCE_DOUBLE_PRESS_MS);
+
+        db->pressed = true;
+        db->held = false;
+        db->press_ms = now;
+        db->next_hold_ms = now + DEBOUNCE_LONG_PRESS_MS;
+        db->event_callback(db->pin, single_press, now);
+
+        if (is_double)
+        {
+            db->event_callback(db->pin, double_press, now);
+        }
+
+        // A third press starts a new sequence
+        db->double_armed = !is_double;
+    }
+    else if (db->pressed && (db->integrator == 0))
+    {
+        db->pressed = false;
+        db->event_callback(db->pin, release, now);
+    }
+    else if (db->pressed && ((int32_t)(now - db->next_hold_ms) >= 0))
+    {
+        // First hold event is the long press, then repeats
+        db->next_hold_ms += DEBOUNCE_REPEAT_MS;
+        db->event_callback(db->pin, db->held ? repeat_press : long_press, now);
+        db->held = true;
+
+        // A long press cannot be the first of a double press
+        db->double_armed = false;
+    }
 }
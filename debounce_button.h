@@ -2,22 +2,37 @@
 #include "pico/stdlib.h"    
 #include "hardware/gpio.h" 
 
+#define DEBOUNCE_SCAN_MS            5       // All buttons sampled at this interval
+#define DEBOUNCE_LONG_PRESS_MS      800     // Time held before long press is reported
+#define DEBOUNCE_REPEAT_MS          200     // Interval between repeats whilst held after long press
+#define DEBOUNCE_DOUBLE_PRESS_MS    400     // Max time between presses for a double press
+#define DEBOUNCE_NUM_GPIOS          30      // Size of lookup table
+
 typedef enum debounce_event
 {
-    single_press = 1
+    single_press = 1,                       // Button pressed
+    release = single_press + 1,             // Button released
+    long_press = release + 1,               // Button held for DEBOUNCE_LONG_PRESS_MS
+    repeat_press = long_press + 1,          // Button still held, every DEBOUNCE_REPEAT_MS after long press
+    double_press = repeat_press + 1         // Second press within DEBOUNCE_DOUBLE_PRESS_MS, follows single_press
 } debounce_event;
 
-typedef void(* event_callback_t) (uint gpio_number, debounce_event event);
+typedef void(* event_callback_t) (uint gpio_number, debounce_event event, uint32_t time_ms);
 
 typedef struct debounce_button_data{
-    int delay_ms;                       // Debounce delay in ms
     uint pin;                           // Associated gpio pin number
-    event_callback_t event_callback;    // callback into application to report events
+    event_callback_t event_callback;    // callback into application to report events, NULL if only sampled
     bool up;                            // true if pulled up
     bool high;                          // true if active high (i.e. high = pressed)
-    alarm_id_t timer_id;                // Id of timer, if running - 1 otherwise
-    struct debounce_button_data* next;  // Pointer to next object in chain
+    uint8_t integrator;                 // Counts up whilst pressed, down whilst released
+    uint8_t integrator_max;             // Count at which state changes, debounce delay / scan interval
+    bool pressed;                       // Debounced state
+    bool held;                          // true once long press has been reported
+    bool double_armed;                  // true if next press can be a double press
+    uint32_t press_ms;                  // Time of last press
+    uint32_t next_hold_ms;              // Time of next long press or repeat event
 } debounce_button_data;
 
 extern void debounceButtonCreate(debounce_button_data* db, uint pin, uint delay_ms, event_callback_t event_callback, bool pull_up, bool high);
 extern void debounceButtonDestroy(debounce_button_data* db);
+extern void debounceButtonSleep(bool sleep);
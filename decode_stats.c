@@ -0,0 +1,135 @@
+#include "decode_stats.h"
+#include "pico/stdlib.h"
+#include "trace.h"
+/*
+   Built with -Wl,--wrap=MP3Decode, so each frame decode arrives here and
+   __real_MP3Decode is the decoder. Frames are attributed to the statistics
+   passed to decodeStatsBegin, as files are only read from the main loop
+ */
+
+static decode_stats* active = NULL;     // Statistics of the file being read
+
+int __real_MP3Decode(void* decoder, unsigned char** inbuf, int* bytes_left, short* outbuf, int use_size);
+
+int __wrap_MP3Decode(void* decoder, unsigned char** inbuf, int* bytes_left, short* outbuf, int use_size)
+{
+    int before = *bytes_left;
+    uint32_t start_us = time_us_32();
+    int res = __real_MP3Decode(decoder, inbuf, bytes_left, outbuf, use_size);
+
+    decodeStatsFrame((uint32_t)(before - *bytes_left), time_us_32() - start_us);
+    return res;
+}
+
+/*
+ * decodeStatsFrame
+ * bytes        Compressed bytes consumed by the frame
+ * elapsed_us   Time taken to decode the frame
+ *
+ * Called by each decoder once per frame
+ */
+void decodeStatsFrame(uint32_t bytes, uint32_t elapsed_us)
+{
+    TRACE(trace_decode, elapsed_us);
+
+    if (active)
+    {
+        uint32_t time_bin = elapsed_us / DECODE_STATS_TIME_BIN;
+        uint32_t bytes_bin = bytes / DECODE_STATS_BYTES_BIN;
+
+        active->decode_us[(time_bin < DECODE_STATS_BINS) ? time_bin : DECODE_STATS_BINS - 1]++;
+        active->frame_bytes[(bytes_bin < DECODE_STATS_BINS) ? bytes_bin : DECODE_STATS_BINS - 1]++;
+        active->frames++;
+
+        if (elapsed_us > active->decode_max_us)
+        {
+            active->decode_max_us = elapsed_us;
+        }
+    }
+}
+
+void decodeStatsCreate(decode_stats* ds)
+{
+    for (int i = 0; i < DECODE_STATS_BINS; ++i)
+    {
+        ds->decode_us[i] = 0;
+        ds->frame_bytes[i] = 0;
+    }
+    ds->frames = 0;
+    ds->decode_max_us = 0;
+    ds->sd_wait_max_us = 0;
+    ds->refill_max_us = 0;
+    ds->refill_samples = 0;
+}
+
+// Attribute the following frames to ds
+void decodeStatsBegin(decode_stats* ds)
+{
+    active = ds;
+}
+
+/*
+ * decodeStatsEnd
+ * samples      Number of samples requested by the refill
+ * refill_us    Time the refill took
+ * sd_wait_us   Part of the refill time spent waiting for the SD card
+ */
+void decodeStatsEnd(decode_stats* ds, uint32_t samples, uint32_t refill_us, uint32_t sd_wait_us)
+{
+    uint32_t decode_us = refill_us - sd_wait_us;
+
+    active = NULL;
+
+    if (sd_wait_us > ds->sd_wait_max_us)
+    {
+        ds->sd_wait_max_us = sd_wait_us;
+    }
+
+    // Keep the most expensive refill per sample
+    if ((ds->refill_samples == 0) ||
+        ((uint64_t)decode_us * ds->refill_samples > (uint64_t)ds->refill_max_us * samples))
+    {
+        ds->refill_max_us = decode_us;
+        ds->refill_samples = samples;
+    }
+}
+
+/*
+ * decodeStatsLatency
+ * sample_rate  Rate of the file
+ * stereo       true if the file has two channels
+ * min_len      Smallest number of samples to decode ahead
+ * max_len      Largest number of samples to decode ahead, the size of a RAM buffer
+ *
+ * Returns the number of samples to decode in each refill. The worst decode
+ * cost per sample, plus the longest SD card wait, must fit in 1/MARGIN of the
+ * time taken to play the buffer. Cheap streams are decoded in short steps,
+ * expensive streams or slow cards fill the whole buffer. The buffers are
+ * not resized, a later slow card read may need the full length again
+ */
+uint32_t decodeStatsLatency(decode_stats* ds, uint32_t sample_rate, bool stereo, uint32_t min_len, uint32_t max_len)
+{
+    if (ds->refill_samples == 0)
+    {
+        return max_len;
+    }
+
+    // Time budget per sample, and cost per sample, in ns
+    uint32_t channels = stereo ? 2 : 1;
+    uint64_t budget_ns = 1000000000ull / ((uint64_t)sample_rate * channels * DECODE_STATS_MARGIN);
+    uint64_t cost_ns = ((uint64_t)ds->refill_max_us * 1000) / ds->refill_samples;
+
+    if (cost_ns >= budget_ns)
+    {
+        // Cannot keep up with margin, so absorb as much as possible
+        return max_len;
+    }
+
+    // len * cost + wait <= len * budget
+    uint64_t len = ((uint64_t)ds->sd_wait_max_us * 1000) / (budget_ns - cost_ns);
+
+    // Whole frames of samples
+    len = (len + channels - 1) / channels * channels;
+
+    return (len < min_len) ? min_len : ((len > max_len) ? max_len : (uint32_t)len);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Decode profiling of a music file.
+ * The link wraps the MP3 frame decoder, so the time and the number of bytes
+ * of each frame are recorded without changing the decoder library. The ADPCM
+ * and FLAC decoders report their frames directly. The time
+ * to refill each RAM buffer, and the SD card wait within it, are recorded by
+ * the player. The results set how far ahead the player decodes, the latency
+ * between decoding and playing
+ */
+#define DECODE_STATS_BINS       12          // Number of histogram bins, the last holds all larger values
+#define DECODE_STATS_TIME_BIN   2000        // Width of a decode time bin, in us
+#define DECODE_STATS_BYTES_BIN  128         // Width of a frame size bin, in bytes
+#define DECODE_STATS_MARGIN     2           // A refill must take at most 1/MARGIN of the buffer play time
+
+typedef struct decode_stats
+{
+    uint32_t frames;                                // Frames decoded
+    uint32_t decode_us[DECODE_STATS_BINS];          // Histogram of decode time per frame
+    uint32_t frame_bytes[DECODE_STATS_BINS];        // Histogram of bytes read per frame
+    uint32_t decode_max_us;                         // Longest frame decode
+    uint32_t sd_wait_max_us;                        // Longest SD card wait in one refill
+    uint32_t refill_max_us;                         // Longest refill, excluding SD card wait
+    uint32_t refill_samples;                        // Samples requested by that refill
+} decode_stats;
+
+extern void decodeStatsCreate(decode_stats* ds);
+extern void decodeStatsBegin(decode_stats* ds);
+extern void decodeStatsFrame(uint32_t bytes, uint32_t elapsed_us);
+extern void decodeStatsEnd(decode_stats* ds, uint32_t samples, uint32_t refill_us, uint32_t sd_wait_us);
+extern uint32_t decodeStatsLatency(decode_stats* ds, uint32_t sample_rate, bool stereo, uint32_t min_len, uint32_t max_len);
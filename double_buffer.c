@@ -1,4 +1,5 @@
 #include "double_buffer.h"
+#include "hot_path.h"
 /*
    Manages double buffers in RAM.
    These are filled by calling a populate function
@@ -12,15 +13,19 @@ void doubleBufferCreate(double_buffer* db, int16_t* buff0, int16_t* buff1, uint3
     db->buffers[1] = buff1;
 
     db->buffer_len = buffer_len;
+    db->fill_len = buffer_len;
     db->len_used[0] = 0;
     db->len_used[1] = 0;
 
     db->fn = NULL;
+    db->context = NULL;
 }
 
-void doubleBufferInitialise(double_buffer* db, populateBuffer fn, const int16_t** buff, uint32_t* num_samples)
+void doubleBufferInitialise(double_buffer* db, populateBuffer fn, void* context, const int16_t** buff, uint32_t* num_samples)
 {
     db->fn = fn;
+    db->context = context;
+    db->fill_len = db->buffer_len;
     db->buffer_number = 1;  // Starts as 1, as swapped before first populate
 
     // Fill both of the buffers
@@ -33,7 +38,7 @@ void doubleBufferInitialise(double_buffer* db, populateBuffer fn, const int16_t*
 }
 
 // Populate the next buffer
-void doubleBufferPopulateNext(double_buffer* db)
+void HOT_PATH(doubleBufferPopulateNext)(double_buffer* db)
 {
     // Swap the active buffer number
     db->buffer_number = 1 - db->buffer_number;
@@ -41,6 +46,12 @@ void doubleBufferPopulateNext(double_buffer* db)
     // Use the callback to populate the buffer
     if (db->fn)
     {
-        db->len_used[db->buffer_number] = (*(db->fn))(db->buffers[db->buffer_number], db->buffer_len);
+        db->len_used[db->buffer_number] = (*(db->fn))(db->context, db->buffers[db->buffer_number], db->fill_len);
     }
 }
+
+// Set how much of each buffer is filled, from the next populate
+void doubleBufferSetLatency(double_buffer* db, uint32_t fill_len)
+{
+    db->fill_len = (fill_len < db->buffer_len) ? fill_len : db->buffer_len;
+}
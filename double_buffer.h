@@ -1,8 +1,8 @@
 #pragma once
 #include "pico/stdlib.h"
 
-// Function to populate buffer
-typedef uint32_t (*populateBuffer)(int16_t* pBuffer, uint32_t buffer_len);
+// Function to populate buffer, context identifies the caller's data
+typedef uint32_t (*populateBuffer)(void* context, int16_t* pBuffer, uint32_t buffer_len);
 
 // Data for buffers
 typedef struct double_buffer
@@ -11,18 +11,24 @@ typedef struct double_buffer
     int16_t*  buffers[2];            // Address of buffers
     uint32_t  len_used[2];           // Number of entries (16 bit words) populated in buffer
     uint32_t  buffer_len;            // Length of buffers
+    uint32_t  fill_len;              // Number of entries requested from population function
     populateBuffer fn;               // Population function
+    void* context;                   // Passed to population function
 } double_buffer;
 
 // Create the buffers
 extern void doubleBufferCreate(double_buffer* db, int16_t* buff0, int16_t* buff1, uint32_t buffer_len);
 
 // Restart the buffers
-extern void doubleBufferInitialise(double_buffer* db, populateBuffer fn, const int16_t** buff, uint32_t* num_samples);
+extern void doubleBufferInitialise(double_buffer* db, populateBuffer fn, void* context, const int16_t** buff, uint32_t* num_samples);
 
 // Populate the next buffer
 extern void doubleBufferPopulateNext(double_buffer* db);
 
+// Set how much of each buffer is filled, at most the buffer length. This sets the latency and
+// the size of each refill; the buffers keep their length, so no memory is freed
+extern void doubleBufferSetLatency(double_buffer* db, uint32_t fill_len);
+
 // Obtain the last populated buffer and number of samples in that buffer
 inline void doubleBufferGetLast(double_buffer* db, const int16_t** buff, uint32_t* num_samples){*buff = db->buffers[db->buffer_number]; 
                                                                                            *num_samples = db->len_used[db->buffer_number];}
\ No newline at end of file
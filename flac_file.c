@@ -0,0 +1,589 @@
+#include <stdio.h>
+#include <string.h>
+#include "flac_file.h"
+#include "decode_stats.h"
+#include "sd_stats.h"
+#include "hot_path.h"
+/*
+   Decodes FLAC frames: constant, verbatim, fixed and LPC subframes, Rice
+   coded residuals and the three stereo decorrelation modes. The frame CRCs
+   are not checked, a corrupt frame is skipped by searching for the next
+   frame sync. Channels are decoded to 32 bits, then packed to interleaved
+   16 bit samples in place
+ */
+
+#define FLAC_SYNC_SEARCH    65536           // Bytes searched for a frame sync before giving up
+
+/*
+ * Bit reader
+ */
+static uint32_t flacNextByte(flac_file* ff)
+{
+    if (ff->read_pos == ff->read_len)
+    {
+        UINT read;
+
+        if ((f_read(&ff->fil, ff->read_buffer, FLAC_FILE_READ, &read) != FR_OK) || (read == 0))
+        {
+            ff->eof = true;
+            return 0;
+        }
+        ff->read_len = read;
+        ff->read_pos = 0;
+    }
+    ff->consumed++;
+    return ff->read_buffer[ff->read_pos++];
+}
+
+// Read up to 24 bits
+static inline uint32_t flacReadBits(flac_file* ff, uint32_t n)
+{
+    while (ff->bit_count < n)
+    {
+        ff->bit_buffer = (ff->bit_buffer << 8) | flacNextByte(ff);
+        ff->bit_count += 8;
+    }
+    ff->bit_count -= n;
+
+    return (ff->bit_buffer >> ff->bit_count) & ((1u << n) - 1);
+}
+
+// Read up to 32 bits
+static inline uint32_t flacReadLong(flac_file* ff, uint32_t n)
+{
+    if (n > 24)
+    {
+        uint32_t high = flacReadBits(ff, n - 16);
+        return (high << 16) | flacReadBits(ff, 16);
+    }
+    return flacReadBits(ff, n);
+}
+
+// Read a two's complement value of 1 to 32 bits
+static inline int32_t flacReadSigned(flac_file* ff, uint32_t n)
+{
+    return (int32_t)(flacReadLong(ff, n) << (32 - n)) >> (32 - n);
+}
+
+// Count the zero bits before the next one bit, and skip the one
+static inline uint32_t flacReadUnary(flac_file* ff)
+{
+    uint32_t count = 0;
+
+    while (!ff->eof)
+    {
+        if (ff->bit_count == 0)
+        {
+            ff->bit_buffer = flacNextByte(ff);
+            ff->bit_count = 8;
+        }
+
+        uint32_t bits = ff->bit_buffer & ((1u << ff->bit_count) - 1);
+
+        if (bits)
+        {
+            uint32_t zeros = __builtin_clz(bits) - (32 - ff->bit_count);
+
+            ff->bit_count -= zeros + 1;
+            return count + zeros;
+        }
+        count += ff->bit_count;
+        ff->bit_count = 0;
+    }
+    return count;
+}
+
+// Drop the bits to the next byte boundary
+static inline void flacAlign(flac_file* ff)
+{
+    ff->bit_count &= ~7u;
+}
+
+// Position in the file of the next unread byte
+static FSIZE_t flacTell(flac_file* ff)
+{
+    return f_tell(&ff->fil) - (ff->read_len - ff->read_pos) - (ff->bit_count >> 3);
+}
+
+static bool flacSeek(flac_file* ff, FSIZE_t offset)
+{
+    ff->read_pos = 0;
+    ff->read_len = 0;
+    ff->bit_count = 0;
+    ff->eof = false;
+
+    return f_lseek(&ff->fil, offset) == FR_OK;
+}
+
+/*
+ * flacFileCreate
+ * filename     Name of the FLAC file
+ * buffer       Working memory, 4 byte aligned. Holds the read buffer and the decoded block
+ * buffer_len   Size of buffer in bytes
+ *
+ * Returns true if the stream can be played, and its largest block fits in buffer
+ */
+bool flacFileCreate(flac_file* ff, const char* filename, unsigned char* buffer, uint32_t buffer_len)
+{
+    bool last = false;
+    bool found_info = false;
+    uint32_t block_size = 0;
+
+    if ((buffer_len <= FLAC_FILE_READ) || (f_open(&ff->fil, filename, FA_OPEN_EXISTING | FA_READ) != FR_OK))
+    {
+        return false;
+    }
+
+    ff->read_buffer = buffer;
+    ff->max_block = (buffer_len - FLAC_FILE_READ) / (2 * sizeof(int32_t));
+    ff->samples[0] = (int32_t*)(buffer + FLAC_FILE_READ);
+    ff->samples[1] = ff->samples[0] + ff->max_block;
+    ff->consumed = 0;
+    flacSeek(ff, 0);
+
+    if ((flacReadBits(ff, 16) != 0x664C) || (flacReadBits(ff, 16) != 0x6143))     // "fLaC"
+    {
+        f_close(&ff->fil);
+        return false;
+    }
+
+    // Metadata blocks, only the stream information is used
+    while (!last && !ff->eof)
+    {
+        last = flacReadBits(ff, 1);
+        uint32_t type = flacReadBits(ff, 7);
+        uint32_t length = flacReadBits(ff, 24);
+
+        if ((type == 0) && (length == 34))
+        {
+            flacReadBits(ff, 16);                           // Minimum block size
+            block_size = flacReadBits(ff, 16);
+            flacReadBits(ff, 24);                           // Frame sizes
+            flacReadBits(ff, 24);
+            ff->sample_rate = flacReadBits(ff, 20);
+            ff->channels = flacReadBits(ff, 3) + 1;
+            ff->bits = flacReadBits(ff, 5) + 1;
+            flacSeek(ff, flacTell(ff) + 4 + 16);            // Total samples and MD5
+            found_info = true;
+        }
+        else
+        {
+            flacSeek(ff, flacTell(ff) + length);
+        }
+    }
+    ff->first_frame = flacTell(ff);
+    ff->block_len = 0;
+    ff->block_pos = 0;
+
+    if (!found_info || (ff->channels > 2) || (ff->bits < 8) || (ff->bits > 16))
+    {
+        printf("Unsupported FLAC stream\n");
+    }
+    else if (block_size > ff->max_block)
+    {
+        printf("FLAC block size %lu above %lu\n", (unsigned long)block_size, (unsigned long)ff->max_block);
+    }
+    else
+    {
+        return true;
+    }
+    f_close(&ff->fil);
+    return false;
+}
+
+bool flacFileClose(flac_file* ff)
+{
+    return f_close(&ff->fil) == FR_OK;
+}
+
+/*
+ * flacFileResidual
+ * out          Subframe samples, the residual follows the warm up samples
+ * block        Samples in the subframe
+ * order        Number of warm up samples
+ */
+static bool HOT_PATH(flacFileResidual)(flac_file* ff, int32_t* out, uint32_t block, uint32_t order)
+{
+    uint32_t method = flacReadBits(ff, 2);
+
+    if (method > 1)
+    {
+        return false;
+    }
+
+    uint32_t param_bits = method ? 5 : 4;
+    uint32_t escape = (1u << param_bits) - 1;
+    uint32_t partition_order = flacReadBits(ff, 4);
+    uint32_t partition_len = block >> partition_order;
+
+    if (((partition_len << partition_order) != block) || (partition_len < order))
+    {
+        return false;
+    }
+
+    uint32_t i = order;
+
+    for (uint32_t p = 0; p < (1u << partition_order); ++p)
+    {
+        uint32_t end = (p + 1) * partition_len;
+        uint32_t k = flacReadBits(ff, param_bits);
+
+        if (k == escape)
+        {
+            // Unencoded partition
+            uint32_t n = flacReadBits(ff, 5);
+
+            for (; i < end; ++i)
+            {
+                out[i] = n ? flacReadSigned(ff, n) : 0;
+            }
+        }
+        else
+        {
+            for (; i < end; ++i)
+            {
+                uint32_t value = (flacReadUnary(ff) << k) | (k ? flacReadLong(ff, k) : 0);
+
+                out[i] = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+            }
+        }
+    }
+    return !ff->eof;
+}
+
+// Fixed polynomial prediction, order 0 to 4
+static void HOT_PATH(flacFileFixed)(int32_t* out, uint32_t block, uint32_t order)
+{
+    switch (order)
+    {
+        case 1:
+            for (uint32_t i = 1; i < block; ++i)
+                out[i] += out[i-1];
+        break;
+
+        case 2:
+            for (uint32_t i = 2; i < block; ++i)
+                out[i] += 2 * out[i-1] - out[i-2];
+        break;
+
+        case 3:
+            for (uint32_t i = 3; i < block; ++i)
+                out[i] += 3 * (out[i-1] - out[i-2]) + out[i-3];
+        break;
+
+        case 4:
+            for (uint32_t i = 4; i < block; ++i)
+                out[i] += 4 * (out[i-1] + out[i-3]) - 6 * out[i-2] - out[i-4];
+        break;
+
+        default:
+        break;
+    }
+}
+
+// Linear prediction. 32 bit sums are used when they cannot overflow, as 64 bit multiplies are slow
+static void HOT_PATH(flacFileLpc)(int32_t* out, uint32_t block, const int32_t* coefs, uint32_t order, uint32_t shift, uint32_t sum_bits)
+{
+    if (sum_bits <= 32)
+    {
+        for (uint32_t i = order; i < block; ++i)
+        {
+            int32_t sum = 0;
+
+            for (uint32_t j = 0; j < order; ++j)
+            {
+                sum += coefs[j] * out[i-1-j];
+            }
+            out[i] += sum >> shift;
+        }
+    }
+    else
+    {
+        for (uint32_t i = order; i < block; ++i)
+        {
+            int64_t sum = 0;
+
+            for (uint32_t j = 0; j < order; ++j)
+            {
+                sum += (int64_t)coefs[j] * out[i-1-j];
+            }
+            out[i] += (int32_t)(sum >> shift);
+        }
+    }
+}
+
+/*
+ * flacFileSubframe
+ * out          Populated with the samples of one channel
+ * block        Number of samples in the frame
+ * bits         Bits per sample of this channel, one more for a side channel
+ */
+static bool flacFileSubframe(flac_file* ff, int32_t* out, uint32_t block, uint32_t bits)
+{
+    if (flacReadBits(ff, 1))
+    {
+        return false;
+    }
+
+    uint32_t type = flacReadBits(ff, 6);
+    uint32_t wasted = 0;
+
+    if (flacReadBits(ff, 1))
+    {
+        wasted = flacReadUnary(ff) + 1;
+
+        if (wasted >= bits)
+        {
+            return false;
+        }
+        bits -= wasted;
+    }
+
+    if (type == 0)
+    {
+        // Constant
+        int32_t value = flacReadSigned(ff, bits);
+
+        for (uint32_t i = 0; i < block; ++i)
+        {
+            out[i] = value;
+        }
+    }
+    else if (type == 1)
+    {
+        // Verbatim
+        for (uint32_t i = 0; i < block; ++i)
+        {
+            out[i] = flacReadSigned(ff, bits);
+        }
+    }
+    else if ((type >= 8) && (type <= 12))
+    {
+        uint32_t order = type - 8;
+
+        for (uint32_t i = 0; i < order; ++i)
+        {
+            out[i] = flacReadSigned(ff, bits);
+        }
+
+        if (!flacFileResidual(ff, out, block, order))
+        {
+            return false;
+        }
+        flacFileFixed(out, block, order);
+    }
+    else if (type >= 32)
+    {
+        uint32_t order = type - 31;
+        int32_t coefs[FLAC_FILE_MAX_ORDER];
+
+        for (uint32_t i = 0; i < order; ++i)
+        {
+            out[i] = flacReadSigned(ff, bits);
+        }
+
+        uint32_t precision = flacReadBits(ff, 4) + 1;
+        int32_t shift = flacReadSigned(ff, 5);
+
+        if ((precision == 16) || (shift < 0))
+        {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < order; ++i)
+        {
+            coefs[i] = flacReadSigned(ff, precision);
+        }
+
+        if (!flacFileResidual(ff, out, block, order))
+        {
+            return false;
+        }
+        flacFileLpc(out, block, coefs, order, shift, bits + precision + (32 - __builtin_clz(order)));
+    }
+    else
+    {
+        return false;
+    }
+
+    if (wasted)
+    {
+        for (uint32_t i = 0; i < block; ++i)
+        {
+            out[i] *= (1 << wasted);
+        }
+    }
+    return true;
+}
+
+/*
+ * flacFileFrame
+ *
+ * Decodes the next frame into the block. Returns false at the end of the
+ * file, or if no frame could be found
+ */
+static bool flacFileFrame(flac_file* ff)
+{
+    uint32_t start = ff->consumed;
+    uint32_t start_us = time_us_32();
+    uint32_t sd_start_us = sdStatsBusyUs();
+
+    for (uint32_t searched = 0; searched < FLAC_SYNC_SEARCH; ++searched)
+    {
+        flacAlign(ff);
+
+        // Frame sync, 14 bits, a reserved zero and the blocking strategy
+        if ((flacReadBits(ff, 8) != 0xFF) || ((flacReadBits(ff, 8) & 0xFE) != 0xF8))
+        {
+            if (ff->eof)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        uint32_t block_code = flacReadBits(ff, 4);
+        uint32_t rate_code = flacReadBits(ff, 4);
+        uint32_t channel_code = flacReadBits(ff, 4);
+        flacReadBits(ff, 4);                                // Sample size and reserved bit, the stream information is used
+
+        // Frame or sample number, UTF-8 coded
+        uint32_t first = flacReadBits(ff, 8);
+
+        for (uint32_t mask = 0x40; (first & 0x80) && (first & mask); mask >>= 1)
+        {
+            flacReadBits(ff, 8);
+        }
+
+        uint32_t block;
+
+        if (block_code == 1)
+            block = 192;
+        else if ((block_code >= 2) && (block_code <= 5))
+            block = 576 << (block_code - 2);
+        else if (block_code == 6)
+            block = flacReadBits(ff, 8) + 1;
+        else if (block_code == 7)
+            block = flacReadBits(ff, 16) + 1;
+        else if (block_code >= 8)
+            block = 256 << (block_code - 8);
+        else
+            continue;
+
+        if (rate_code == 12)
+            flacReadBits(ff, 8);
+        else if ((rate_code == 13) || (rate_code == 14))
+            flacReadBits(ff, 16);
+
+        flacReadBits(ff, 8);                                // Header CRC
+
+        uint32_t channels = (channel_code < 8) ? channel_code + 1 : 2;
+
+        if ((block > ff->max_block) || (channels != ff->channels) || (channel_code > 10))
+        {
+            continue;
+        }
+
+        // Side channels have one more bit
+        uint32_t bits = ff->bits;
+
+        if (!flacFileSubframe(ff, ff->samples[0], block, bits + (channel_code == 9)) ||
+            ((channels == 2) && !flacFileSubframe(ff, ff->samples[1], block, bits + ((channel_code == 8) || (channel_code == 10)))))
+        {
+            if (ff->eof)
+            {
+                return false;
+            }
+            continue;
+        }
+        flacAlign(ff);
+        flacReadBits(ff, 16);                               // Frame CRC
+
+        // Undo the stereo decorrelation, and pack to 16 bits in place
+        int32_t* a = ff->samples[0];
+        int32_t* b = ff->samples[1];
+        int16_t* out = (int16_t*)ff->samples[0];
+        uint32_t shift = 16 - bits;
+
+        if (channels == 1)
+        {
+            for (uint32_t i = 0; i < block; ++i)
+            {
+                out[i] = a[i] * (1 << shift);
+            }
+        }
+        else
+        {
+            for (uint32_t i = 0; i < block; ++i)
+            {
+                int32_t left = a[i];
+                int32_t right = b[i];
+
+                if (channel_code == 8)
+                {
+                    right = left - right;               // Left, side
+                }
+                else if (channel_code == 9)
+                {
+                    left = left + right;                // Side, right
+                }
+                else if (channel_code == 10)
+                {
+                    int32_t mid = (left * 2) | (right & 1);       // Mid, side
+                    left = (mid + right) >> 1;
+                    right = (mid - right) >> 1;
+                }
+                out[2*i] = left * (1 << shift);
+                out[2*i+1] = right * (1 << shift);
+            }
+        }
+        ff->block_len = block * channels;
+        ff->block_pos = 0;
+
+        decodeStatsFrame(ff->consumed - start, time_us_32() - start_us - (sdStatsBusyUs() - sd_start_us));
+        return true;
+    }
+    return false;
+}
+
+/*
+ * flacFileRead
+ * buffer       Populated with samples, interleaved if stereo
+ * len          Number of entries to populate
+ * written      Number of entries populated
+ *
+ * Returns false if the file cannot be read
+ */
+bool flacFileRead(flac_file* ff, int16_t* buffer, uint32_t len, uint32_t* written)
+{
+    const int16_t* block = (const int16_t*)ff->samples[0];
+    uint32_t count = 0;
+    bool rewound = false;
+
+    while (count < len)
+    {
+        if (ff->block_pos == ff->block_len)
+        {
+            if (!flacFileFrame(ff))
+            {
+                // Loop back to the first frame at the end of the file
+                if (rewound || !flacSeek(ff, ff->first_frame))
+                {
+                    break;
+                }
+                rewound = true;
+            }
+            continue;
+        }
+
+        uint32_t n = ff->block_len - ff->block_pos;
+
+        n = (n < len - count) ? n : len - count;
+        memcpy(buffer + count, block + ff->block_pos, n * sizeof(int16_t));
+        ff->block_pos += n;
+        count += n;
+        rewound = false;
+    }
+    *written = count;
+    return count == len;
+}
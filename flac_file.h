@@ -0,0 +1,40 @@
+#pragma once
+#include "pico/stdlib.h"
+#include "ff.h"
+
+/*
+ * FLAC file player.
+ * Integer only decode of 8 to 16 bit, mono or stereo streams. Decoded blocks
+ * are held in the working buffer, so the largest block size is limited by its
+ * size; encode with e.g. flac --blocksize=576. The file loops when the end is
+ * reached
+ */
+#define FLAC_FILE_READ          1024        // Bytes read from the file at a time
+#define FLAC_FILE_MAX_ORDER     32          // Highest prediction order
+
+typedef struct flac_file
+{
+    FIL fil;
+    uint8_t* read_buffer;           // Bytes read from the file
+    uint32_t read_pos;              // Next byte in read_buffer
+    uint32_t read_len;              // Bytes in read_buffer
+    uint32_t bit_buffer;            // Bits taken from read_buffer, not yet used
+    uint32_t bit_count;             // Number of bits in bit_buffer
+    uint32_t consumed;              // Bytes taken from read_buffer
+    bool eof;                       // true if a read was attempted past the end of the file
+    int32_t* samples[2];            // Decoded channels, then the interleaved block in place of samples[0]
+    uint32_t max_block;             // Largest block that fits in the working buffer
+    FSIZE_t first_frame;            // Offset of the first frame
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t bits;                  // Bits per sample
+    uint32_t block_len;             // Entries in the decoded block
+    uint32_t block_pos;             // Entries of the decoded block already returned
+} flac_file;
+
+extern bool flacFileCreate(flac_file* ff, const char* filename, unsigned char* buffer, uint32_t buffer_len);
+extern bool flacFileClose(flac_file* ff);
+extern bool flacFileRead(flac_file* ff, int16_t* buffer, uint32_t len, uint32_t* written);
+
+inline uint32_t flacFileGetSampleRate(flac_file* ff){return ff->sample_rate;}
+inline bool flacFileIsStereo(flac_file* ff){return ff->channels == 2;}
@@ -1,29 +1,118 @@
 #include <stdio.h>
 #include "fs_mount.h"
 #include "hw_config.h"
+#include "diskio.h"
+/*
+   Mounts the SD card, and tracks it being removed and replaced.
+   A failed mount is retried with an increasing wait, so a missing card does
+   not slow every change of sound. If the slot has a card detect switch,
+   mounting is only tried when a card is present
+ */
 
 // Mount the FatFS
 bool fsMount(fs_mount* fs)
 {
-    // Only allow mount to fail once, then ignore future requests
-    if ((fs->pSD == NULL) && (!fs->failed))
+    uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+
+    // Ignore requests until the retry time after a failure
+    if ((fs->pSD == NULL) && (!fs->failed || ((int32_t)(now_ms - fs->retry_at_ms) >= 0)) && fsCardPresent(fs))
     {
         fs->pSD = sd_get_by_num(0);
+        fs->card = fs->pSD;
         FRESULT fr = f_mount(&fs->pSD->fatfs, fs->pSD->pcName, 1);
         if (FR_OK != fr)
         {
             printf("f_mount error: %s (%d)\n", FRESULT_str(fr), fr);
             fs->pSD = NULL;
             fs->failed = true;
+            fs->retry_at_ms = to_ms_since_boot(get_absolute_time()) + fs->retry_ms;
+            fs->retry_ms = (fs->retry_ms * 2 > FS_MOUNT_RETRY_MAX_MS) ? FS_MOUNT_RETRY_MAX_MS : fs->retry_ms * 2;
+        }
+        else
+        {
+            fs->failed = false;
+            fs->lost = false;
+            fs->retry_ms = FS_MOUNT_RETRY_MS;
+            fs->mounts++;
         }
     }
     return (fs->pSD != NULL);
 }
 
+/*
+ * fsRequestMount
+ *
+ * Ask for the card to be mounted by the next fsService, rather than now, so
+ * that the caller does not wait for the card. A wait after a failed mount
+ * is kept
+ */
+void fsRequestMount(fs_mount* fs)
+{
+    if ((fs->pSD == NULL) && !fs->failed)
+    {
+        fs->failed = true;
+        fs->retry_at_ms = to_ms_since_boot(get_absolute_time());
+    }
+}
+
 // Unmount the FatFS
 void fsUnmount(fs_mount* fs)
 {
-    f_unmount(fs->pSD->pcName);
-    fs->pSD = NULL;
+    if (fs->pSD)
+    {
+        f_unmount(fs->pSD->pcName);
+        fs->pSD = NULL;
+    }
+}
+
+// Called when a read fails, the card is released at the next fsService
+void fsLost(fs_mount* fs)
+{
+    if (fs->pSD)
+    {
+        fs->lost = true;
+    }
+}
+
+// true if a card is in the slot, or the slot has no card detect switch
+bool fsCardPresent(fs_mount* fs)
+{
+    // Card detect is configured by the driver during the first mount
+    return (fs->card == NULL) || sd_card_detect(fs->card);
 }
 
+/*
+ * fsService
+ *
+ * Called regularly from the main loop. Releases a card that has gone, and
+ * mounts a card when the retry time is reached. Mounting reads the card, so
+ * only call when the audio can wait for it
+ */
+fs_card_event fsService(fs_mount* fs)
+{
+    fs_card_event event = fs_card_none;
+
+    if (fsMounted(fs))
+    {
+        if (fs->lost || !fsCardPresent(fs))
+        {
+            printf("SD card removed\n");
+
+            // Nothing is written to a card that has gone, it is reinitialised by the next mount
+            f_unmount(fs->pSD->pcName);
+            fs->pSD->m_Status |= STA_NOINIT;
+            fs->pSD = NULL;
+            fs->lost = false;
+            fs->failed = true;
+            fs->retry_ms = FS_MOUNT_RETRY_MS;
+            fs->retry_at_ms = to_ms_since_boot(get_absolute_time()) + fs->retry_ms;
+            event = fs_card_removed;
+        }
+    }
+    else if (fs->failed && fsMount(fs))
+    {
+        printf("SD card mounted\n");
+        event = fs_card_inserted;
+    }
+    return event;
+}
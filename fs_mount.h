@@ -3,15 +3,34 @@
 #include "ff.h"
 #include "hw_config.h"
 
+#define FS_MOUNT_RETRY_MS       500         // First wait after a failed mount
+#define FS_MOUNT_RETRY_MAX_MS   8000        // Longest wait between attempts
+
+typedef enum fs_card_event              // Change reported by fsService
+{
+    fs_card_none = 0,
+    fs_card_inserted = fs_card_none + 1,        // Card has been mounted
+    fs_card_removed = fs_card_inserted + 1      // Mounted card has gone, or failed a read
+} fs_card_event;
+
 // Data for buffers
 typedef struct fs_mount
 {
     sd_card_t* pSD;
-    bool       failed;     // true if mount failed              
+    sd_card_t* card;       // Card slot, set by the first mount attempt
+    bool       failed;     // true if a mount is waiting, tried by fsService at retry_at_ms
+    bool       lost;       // true if a read failed whilst mounted
+    uint32_t   retry_ms;   // Wait before the next attempt, doubles on each failure
+    uint32_t   retry_at_ms;// Time of the next attempt
+    uint32_t   mounts;     // Successful mounts
 } fs_mount;
 
 extern bool fsMount(fs_mount* fs);
+extern void fsRequestMount(fs_mount* fs);
 extern void fsUnmount(fs_mount* fs);
+extern void fsLost(fs_mount* fs);
+extern bool fsCardPresent(fs_mount* fs);
+extern fs_card_event fsService(fs_mount* fs);
 
-inline void fsInitialise(fs_mount* fs){ fs->pSD = NULL; fs->failed = false;}
+inline void fsInitialise(fs_mount* fs){ fs->pSD = NULL; fs->card = NULL; fs->failed = false; fs->lost = false; fs->retry_ms = FS_MOUNT_RETRY_MS; fs->retry_at_ms = 0; fs->mounts = 0;}
 inline bool fsMounted(fs_mount* fs){return (fs->pSD != NULL);}
@@ -0,0 +1,30 @@
+#include "gain_ramp.h"
+#include "hot_path.h"
+/*
+   Click free gain changes.
+   Rather than changing gain instantly, the gain moves linearly from its
+   current value to the target across a block of samples. The increment is
+   calculated once per block, so each sample costs one add and one multiply
+ */
+
+// Create the ramp, starting at the supplied Q15 gain
+void gainRampCreate(gain_ramp* gr, int32_t gain)
+{
+    gr->target = gain;
+    gr->current = gain << GAIN_RAMP_FRACTION;
+    gr->step = 0;
+}
+
+// Calculate the increment so that the target is reached after len samples
+void HOT_PATH(gainRampBlockStart)(gain_ramp* gr, uint32_t len)
+{
+    int32_t diff = (gr->target << GAIN_RAMP_FRACTION) - gr->current;
+
+    gr->step = (len) ? diff / (int32_t)len : 0;
+
+    // Remove any rounding error once the target has been reached
+    if (gr->step == 0)
+    {
+        gr->current = gr->target << GAIN_RAMP_FRACTION;
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Q15 gain with a linear ramp across each block of samples.
+ * The gain is held with GAIN_RAMP_FRACTION extra bits, so that the per sample
+ * increment is accurate for blocks of up to 32768 samples
+ */
+#define GAIN_RAMP_UNITY     32768       // Q15 representation of a gain of 1.0
+#define GAIN_RAMP_FRACTION  15          // Extra bits of precision held in current
+
+typedef struct gain_ramp
+{
+    int32_t target;                     // Q15 gain to reach at the end of the block
+    int32_t current;                    // Current gain, Q15 shifted by GAIN_RAMP_FRACTION
+    int32_t step;                       // Change to current for each sample
+} gain_ramp;
+
+extern void gainRampCreate(gain_ramp* gr, int32_t gain);
+extern void gainRampBlockStart(gain_ramp* gr, uint32_t len);
+
+/*
+ * Inline helper functions
+ */
+// Set the gain to reach at the end of the next block
+inline void gainRampSetTarget(gain_ramp* gr, int32_t target){gr->target = target;}
+
+// Return the Q15 gain for the next sample in the block
+inline int32_t gainRampNext(gain_ramp* gr){int32_t gain = gr->current >> GAIN_RAMP_FRACTION; gr->current += gr->step; return gain;}
+
+// True if the ramp has reached a gain of zero
+inline bool gainRampIsSilent(gain_ramp* gr){return (gr->target == 0) && ((gr->current >> GAIN_RAMP_FRACTION) == 0);}
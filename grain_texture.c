@@ -0,0 +1,75 @@
+#include "grain_texture.h"
+#include "oscillator.h"
+#include "hot_path.h"
+/*
+   Granular synthesis.
+   The window is the first half cycle of the oscillator sine table, so no
+   window table is needed. Voices are processed one at a time across the
+   block, in the same way as the oscillator bank
+ */
+
+// Limit a value to the range of a 16 bit sample
+static inline int32_t grainTextureClamp(int32_t value)
+{
+    return (value > INT16_MAX) ? INT16_MAX : ((value < INT16_MIN) ? INT16_MIN : value);
+}
+
+void grainTextureCreate(grain_texture* gt, const int16_t* clip)
+{
+    gt->clip = clip;
+    gt->length = 0;
+
+    // The first voice chooses its grain at once, the second starts half way through one
+    for (uint32_t v = 0; v < GRAIN_TEXTURE_VOICES; v++)
+    {
+        gt->start[v] = 0;
+        gt->pos[v] = GRAIN_TEXTURE_LENGTH - v * GRAIN_TEXTURE_LENGTH / GRAIN_TEXTURE_VOICES;
+    }
+}
+
+/*
+ * grainTextureProcess
+ * cn           Source of the random grain positions
+ * buffer       Populated with the texture
+ * len          Number of samples in buffer, including interleaved samples
+ * stride       Distance between samples of this channel (2 for interleaved stereo)
+ *
+ * Silent until the clip holds at least one grain
+ */
+void HOT_PATH(grainTextureProcess)(grain_texture* gt, colour_noise* cn, int16_t* buffer, uint32_t len, uint32_t stride)
+{
+    for (uint32_t i = 0; i < len; i += stride)
+    {
+        buffer[i] = 0;
+    }
+
+    if (gt->length < GRAIN_TEXTURE_LENGTH)
+    {
+        return;
+    }
+
+    uint32_t range = gt->length - GRAIN_TEXTURE_LENGTH + 1;
+
+    for (uint32_t v = 0; v < GRAIN_TEXTURE_VOICES; v++)
+    {
+        uint32_t pos = gt->pos[v];
+        const int16_t* grain = gt->clip + gt->start[v];
+
+        for (uint32_t i = 0; i < len; i += stride)
+        {
+            if (pos == GRAIN_TEXTURE_LENGTH)
+            {
+                // Next grain from a random position, 15 bits of the generator scaled to the range
+                gt->start[v] = ((uint32_t)(colourNoiseWhite(cn) & 0x7FFF) * range) >> 15;
+                grain = gt->clip + gt->start[v];
+                pos = 0;
+            }
+
+            int32_t window = oscillatorSine(pos << (31 - GRAIN_TEXTURE_BITS));
+
+            buffer[i] = (int16_t)grainTextureClamp(buffer[i] + ((grain[pos] * window) >> 15));
+            pos++;
+        }
+        gt->pos[v] = pos;
+    }
+}
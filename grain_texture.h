@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "colour_noise.h"
+
+/*
+ * Endless texture from a short clip held in RAM.
+ * Two voices per channel play grains from random positions in the clip, each
+ * shaped by a half sine window. The voices are half a grain apart, so the
+ * windows of uncorrelated grains sum to constant power. Positions come from
+ * the colour_noise generator, so each channel, and each zone, differs
+ */
+#define GRAIN_TEXTURE_BITS      11                          // log2 of the grain length
+#define GRAIN_TEXTURE_LENGTH    (1 << GRAIN_TEXTURE_BITS)   // 93ms at 22.05kHz
+#define GRAIN_TEXTURE_VOICES    2
+
+typedef struct grain_texture
+{
+    const int16_t* clip;                            // Mono samples
+    uint32_t length;                                // Samples of the clip that can be used
+    uint32_t start[GRAIN_TEXTURE_VOICES];           // Position in the clip of each grain
+    uint32_t pos[GRAIN_TEXTURE_VOICES];             // Position in each grain
+} grain_texture;
+
+extern void grainTextureCreate(grain_texture* gt, const int16_t* clip);
+extern void grainTextureProcess(grain_texture* gt, colour_noise* cn, int16_t* buffer, uint32_t len, uint32_t stride);
+
+/*
+ * Inline helper functions
+ */
+// Set the samples of the clip that can be used, grows as the clip is loaded
+inline void grainTextureSetLength(grain_texture* gt, uint32_t length){gt->length = length;}
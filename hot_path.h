@@ -0,0 +1,17 @@
+#pragma once
+#include "pico/platform.h"
+
+/*
+ * Placement of the audio hot path.
+ * Functions marked HOT_PATH normally run from XIP flash, so their timing
+ * depends on the 16KB XIP cache, which is shared with FatFs and the decoder.
+ * When built with the PICOSOUNDS_RAM_HOT_PATH option they are copied to SRAM
+ * at boot, together with any data marked HOT_PATH_DATA
+ */
+#ifdef RAM_HOT_PATH
+#define HOT_PATH(func) __not_in_flash_func(func)
+#define HOT_PATH_DATA(group) __not_in_flash(group)
+#else
+#define HOT_PATH(func) func
+#define HOT_PATH_DATA(group)
+#endif
@@ -0,0 +1,333 @@
+#include "hardware/dma.h"
+#include "led_engine.h"
+/*
+   WS2812 LED engine.
+   A repeating timer calculates the next frame and starts a DMA transfer of
+   it to the PIO. The work per frame is a few integer operations per pixel,
+   well under 100 cycles per pixel, so the timer interrupt cannot delay the
+   audio refill. The timer stops when frames stop changing, for example when
+   the LED is black, and is restarted by the next change.
+   Brightness is held as a 12 bit perceptual level. A gamma table converts
+   this to a 16 bit linear level, and the fraction below the 8 bits that a
+   WS2812 can show is carried from frame to frame, so very dim levels are
+   shown by alternating between adjacent values. Whilst a channel dithers the
+   timer wakes the processor for every frame, 250 times a second, so only
+   channels dimmer than dither_below are dithered, where one step is visible,
+   and brighter ones are rounded. Whilst the board sleeps every channel is
+   rounded, so the timer stops after the last change
+ */
+
+// RGB values for 5 colours (black, red, orange, yellow, white)
+static const uint8_t rgb_colours[led_wrap][3] = { {0,0,0}, {255,0,0,}, {255,64,0,}, {255,255,0,}, {255,255,255,} }; 
+
+// Gamma 2.2, 16 bit linear level for each 1/256th of perceptual level
+static const uint16_t gamma_table[257] =
+{
+        0,     0,     2,     4,     7,    11,    17,    24,    32,    41,    52,    64,
+       78,    93,   110,   128,   147,   168,   191,   215,   240,   267,   296,   327,
+      359,   392,   428,   465,   504,   544,   586,   630,   676,   723,   772,   823,
+      875,   930,   986,  1044,  1104,  1165,  1229,  1294,  1361,  1430,  1501,  1574,
+     1648,  1725,  1803,  1884,  1966,  2050,  2136,  2224,  2314,  2406,  2500,  2595,
+     2693,  2793,  2895,  2998,  3104,  3212,  3322,  3433,  3547,  3663,  3781,  3900,
+     4022,  4146,  4272,  4400,  4530,  4663,  4797,  4933,  5072,  5212,  5355,  5499,
+     5646,  5795,  5946,  6099,  6255,  6412,  6572,  6733,  6897,  7063,  7231,  7402,
+     7574,  7749,  7926,  8105,  8286,  8469,  8655,  8843,  9033,  9225,  9419,  9616,
+     9815, 10016, 10219, 10425, 10632, 10842, 11054, 11269, 11486, 11705, 11926, 12149,
+    12375, 12603, 12833, 13066, 13301, 13538, 13777, 14019, 14263, 14509, 14758, 15009,
+    15262, 15517, 15775, 16035, 16298, 16563, 16830, 17099, 17371, 17645, 17922, 18201,
+    18482, 18765, 19051, 19339, 19630, 19923, 20218, 20516, 20816, 21119, 21424, 21731,
+    22040, 22352, 22667, 22984, 23303, 23624, 23949, 24275, 24604, 24935, 25269, 25605,
+    25943, 26284, 26628, 26973, 27322, 27672, 28026, 28381, 28739, 29100, 29462, 29828,
+    30196, 30566, 30939, 31314, 31692, 32072, 32454, 32840, 33227, 33617, 34010, 34405,
+    34802, 35202, 35605, 36010, 36417, 36827, 37240, 37655, 38072, 38493, 38915, 39340,
+    39768, 40198, 40631, 41066, 41503, 41944, 42387, 42832, 43280, 43730, 44183, 44639,
+    45097, 45557, 46020, 46486, 46954, 47425, 47899, 48374, 48853, 49334, 49818, 50304,
+    50793, 51284, 51778, 52275, 52774, 53276, 53780, 54287, 54796, 55308, 55823, 56341,
+    56860, 57383, 57908, 58436, 58966, 59499, 60035, 60573, 61114, 61657, 62203, 62752,
+    63303, 63857, 64414, 64973, 65535
+};
+
+static bool ledEngineTimerCallback(repeating_timer_t* rt);
+static void ledEngineWake(led_engine* le);
+
+/*
+ * urgb_u32
+ *
+ * r, g , b     Colour channel intensity
+ * 
+ * Return a 32 bit rgb value for writing to the PIO FIFO
+ */
+static inline uint32_t urgb_u32(uint8_t r, uint8_t g, uint8_t b) 
+{
+    return
+            ((uint32_t) (r) << 8) |
+            ((uint32_t) (g) << 16) |
+            (uint32_t) (b);
+}
+
+void ledEngineCreate(led_engine* le, PIO pio, uint sm, uint32_t num_pixels)
+{
+    le->pio = pio;
+    le->sm = sm;
+    le->num_pixels = (num_pixels < LED_ENGINE_MAX_PIXELS) ? num_pixels : LED_ENGINE_MAX_PIXELS;
+    le->back = 0;
+    le->colour = led_black;
+    le->level = LED_ENGINE_LEVEL_MAX;
+    le->effect = led_effect_static;
+    le->effect_frame = 0;
+    le->effect_frames = 0;
+    le->dirty = true;
+    le->dithering = false;
+    le->sleeping = false;
+    le->dither_below = LED_ENGINE_DITHER_BELOW;
+
+    // Start each pixel at a different dither phase, to spread the changes
+    for (uint32_t i = 0; i < LED_ENGINE_MAX_PIXELS; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            le->error[i][c] = (uint8_t)((i * 3 + c) * 37);
+        }
+    }
+
+    // DMA paced by the state machine TX FIFO
+    le->dma_channel = dma_claim_unused_channel(true);
+
+    dma_channel_config config = dma_channel_get_default_config(le->dma_channel);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, pio_get_dreq(pio, sm, true));
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+
+    dma_channel_configure(le->dma_channel,
+                          &config,
+                          &pio->txf[sm],
+                          le->frame[0],
+                          le->num_pixels,
+                          false);
+
+    // Negative period, so frames are evenly spaced regardless of callback time
+    le->running = false;
+    ledEngineWake(le);
+}
+
+// Restart the frame timer, if it stopped because frames were not changing
+static void ledEngineWake(led_engine* le)
+{
+    __compiler_memory_barrier();
+
+    if (!le->running)
+    {
+        le->running = add_repeating_timer_ms(-LED_ENGINE_FRAME_MS, ledEngineTimerCallback, le, &le->timer);
+    }
+}
+
+/*
+ * ledEngineSetColour
+ *
+ * colour       Colour id
+ * intensity    Ranges from 0 (black) to 1 (full colour)
+ * 
+ */
+void ledEngineSetColour(led_engine* le, led_state colour, float intensity)
+{
+    le->colour = colour;
+    le->level = (uint32_t)(intensity * LED_ENGINE_LEVEL_MAX);
+    le->dirty = true;
+    ledEngineWake(le);
+}
+
+/*
+ * ledEngineSetEffect
+ *
+ * effect       Effect to run
+ * duration_ms  Length of sunrise or fade out, ignored for other effects
+ * 
+ */
+void ledEngineSetEffect(led_engine* le, led_effect effect, uint32_t duration_ms)
+{
+    // Fade from the brightness currently shown
+    le->fade_level = le->level;
+    le->effect_frames = (duration_ms / LED_ENGINE_FRAME_MS) + 1;
+    le->effect_frame = 0;
+    le->effect = effect;
+    le->dirty = true;
+    ledEngineWake(le);
+}
+
+/*
+ * ledEngineSleep
+ *
+ * sleeping     true when the board enters its low power state, false when it wakes
+ *
+ * Whilst sleeping each channel is rounded to a whole level rather than
+ * dithered, so the frame timer stops once the light stops changing
+ */
+void ledEngineSleep(led_engine* le, bool sleeping)
+{
+    le->sleeping = sleeping;
+    le->dirty = true;
+    ledEngineWake(le);
+}
+
+/*
+ * ledEngineSetDither
+ *
+ * below        Channels dimmer than this 8 bit level are dithered, brighter
+ *              channels are rounded. 0 turns dithering off, 256 dithers every level
+ */
+void ledEngineSetDither(led_engine* le, uint32_t below)
+{
+    le->dither_below = below;
+    le->dirty = true;
+    ledEngineWake(le);
+}
+
+// Convert a perceptual level to a 16 bit linear level
+static inline uint32_t ledEngineGamma(uint32_t level)
+{
+    uint32_t index = level >> (LED_ENGINE_LEVEL_BITS - 8);
+    uint32_t frac = level & ((1 << (LED_ENGINE_LEVEL_BITS - 8)) - 1);
+
+    if (index >= 256)
+    {
+        return gamma_table[256];
+    }
+
+    // Interpolate between table entries
+    return gamma_table[index] + (((gamma_table[index + 1] - gamma_table[index]) * frac) >> (LED_ENGINE_LEVEL_BITS - 8));
+}
+
+// Calculate the colour and perceptual brightness for this frame of the effect
+static void ledEngineEffect(led_engine* le, uint8_t rgb[3], uint32_t* level)
+{
+    const uint8_t* colour = rgb_colours[le->colour];
+    uint32_t scale = 256;
+
+    switch (le->effect)
+    {
+        case led_effect_breathe:
+        {
+            // Triangle wave between 1/8 and full brightness
+            uint32_t period = LED_ENGINE_BREATHE_MS / LED_ENGINE_FRAME_MS;
+            uint32_t phase = le->effect_frame % period;
+            uint32_t half = period >> 1;
+            uint32_t ramp = (phase < half) ? phase : period - phase;
+
+            scale = 32 + ((224 * ramp) / half);
+        }
+        break;
+
+        case led_effect_sunrise:
+        {
+            // Move along the colour table, whilst brightening
+            uint32_t pos = (le->effect_frame < le->effect_frames) ? le->effect_frame : le->effect_frames;
+            uint32_t step = (pos * ((led_wrap - 1) << 8)) / le->effect_frames;
+            uint32_t index = step >> 8;
+            uint32_t frac = step & 0xff;
+
+            if (index >= led_wrap - 1)
+            {
+                index = led_wrap - 2;
+                frac = 256;
+            }
+
+            for (int c = 0; c < 3; ++c)
+            {
+                rgb[c] = (rgb_colours[index][c] * (256 - frac) + rgb_colours[index + 1][c] * frac) >> 8;
+            }
+            *level = LED_ENGINE_LEVEL_MAX;
+            return;
+        }
+
+        case led_effect_fade_out:
+        {
+            uint32_t pos = (le->effect_frame < le->effect_frames) ? le->effect_frame : le->effect_frames;
+
+            *level = (uint32_t)(((uint64_t)le->fade_level * (le->effect_frames - pos)) / le->effect_frames);
+            rgb[0] = colour[0];
+            rgb[1] = colour[1];
+            rgb[2] = colour[2];
+            return;
+        }
+
+        default:
+        break;
+    }
+
+    rgb[0] = colour[0];
+    rgb[1] = colour[1];
+    rgb[2] = colour[2];
+    *level = (le->level * scale) >> 8;
+}
+
+// Called every frame, from the timer interrupt
+static bool ledEngineTimerCallback(repeating_timer_t* rt)
+{
+    led_engine* le = (led_engine*)rt->user_data;
+
+    // Frames only need sending when they change
+    bool animating = (le->effect == led_effect_breathe) ||
+                     ((le->effect != led_effect_static) && (le->effect_frame <= le->effect_frames));
+
+    if ((animating || le->dirty || le->dithering) && !dma_channel_is_busy(le->dma_channel))
+    {
+        uint8_t rgb[3];
+        uint32_t level;
+        uint32_t value[3];
+
+        le->dirty = false;
+        ledEngineEffect(le, rgb, &level);
+
+        // Channel values with 8 bits of fraction
+        uint32_t linear = ledEngineGamma(level);
+
+        for (int c = 0; c < 3; ++c)
+        {
+            value[c] = (rgb[c] * linear) >> 8;
+        }
+
+        // Need to keep sending frames whilst any dithered channel has a fraction
+        uint32_t below = le->sleeping ? 0 : (le->dither_below << 8);
+        bool dither[3];
+
+        le->dithering = false;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            dither[c] = (value[c] < below) && ((value[c] & 0xff) != 0);
+            le->dithering = le->dithering || dither[c];
+        }
+
+        for (uint32_t i = 0; i < le->num_pixels; ++i)
+        {
+            uint8_t out[3];
+
+            for (int c = 0; c < 3; ++c)
+            {
+                if (dither[c])
+                {
+                    uint32_t sum = value[c] + le->error[i][c];
+
+                    out[c] = sum >> 8;
+                    le->error[i][c] = sum & 0xff;
+                }
+                else
+                {
+                    uint32_t rounded = (value[c] + 0x80) >> 8;
+
+                    out[c] = (rounded > 255) ? 255 : rounded;
+                }
+            }
+            le->frame[le->back][i] = urgb_u32(out[0], out[1], out[2]) << 8u;
+        }
+
+        dma_channel_transfer_from_buffer_now(le->dma_channel, le->frame[le->back], le->num_pixels);
+        le->back = 1 - le->back;
+        le->effect_frame++;
+    }
+
+    // Returning false stops the timer, changes set dirty before ledEngineWake reads running
+    le->running = animating || le->dirty || le->dithering;
+    return le->running;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "config.h"
+
+/*
+ * Drives a chain of WS2812 pixels by DMA into the ws2812 PIO state machine.
+ * Frames are calculated in integer arithmetic from a low rate timer, so the
+ * CPU never waits on the PIO FIFO
+ */
+#define LED_ENGINE_MAX_PIXELS   16          // Largest chain supported
+#define LED_ENGINE_FRAME_MS     4           // 250 frames per second, fast enough to hide dithering
+#define LED_ENGINE_LEVEL_BITS   12          // Resolution of perceptual brightness
+#define LED_ENGINE_LEVEL_MAX    (1 << LED_ENGINE_LEVEL_BITS)
+#define LED_ENGINE_BREATHE_MS   4000        // Period of breathing effect
+#define LED_ENGINE_DITHER_BELOW 32          // Default 8 bit level below which channels are dithered, where one step is visible
+
+typedef enum led_effect
+{
+    led_effect_static = 0,                  // Constant colour
+    led_effect_breathe = led_effect_static + 1,     // Slow rise and fall in brightness
+    led_effect_sunrise = led_effect_breathe + 1,    // Black through red, orange and yellow to white
+    led_effect_fade_out = led_effect_sunrise + 1    // Fade from current brightness to off
+} led_effect;
+
+typedef struct led_engine
+{
+    PIO pio;                                // PIO and state machine running ws2812 program
+    uint sm;
+    int dma_channel;                        // Channel used to feed the PIO
+    uint32_t num_pixels;                    // Number of pixels in the chain
+    uint32_t frame[2][LED_ENGINE_MAX_PIXELS];   // GRB words, one buffer sent whilst other calculated
+    int back;                               // Index of frame being calculated
+    led_state colour;                       // Base colour
+    uint32_t level;                         // Base perceptual brightness, 0 to LED_ENGINE_LEVEL_MAX
+    led_effect effect;                      // Running effect
+    uint32_t effect_frame;                  // Frames since effect started
+    uint32_t effect_frames;                 // Length of effect in frames
+    uint32_t fade_level;                    // Brightness at start of fade out
+    volatile bool dirty;                    // true if frame must be resent
+    bool dithering;                         // true if frames alternate to show a fractional level
+    bool sleeping;                          // true whilst the board sleeps, levels are rounded so the timer can stop
+    uint32_t dither_below;                  // Channels dimmer than this 8 bit level are dithered, 0 never dithers
+    uint8_t error[LED_ENGINE_MAX_PIXELS][3];    // Temporal dither error of each channel, 1/256ths
+    repeating_timer_t timer;                // Frame timer
+    volatile bool running;                  // false once frames stop changing, so the timer is stopped
+} led_engine;
+
+extern void ledEngineCreate(led_engine* le, PIO pio, uint sm, uint32_t num_pixels);
+extern void ledEngineSetColour(led_engine* le, led_state colour, float intensity);
+extern void ledEngineSetEffect(led_engine* le, led_effect effect, uint32_t duration_ms);
+extern void ledEngineSleep(led_engine* le, bool sleeping);
+extern void ledEngineSetDither(led_engine* le, uint32_t below);
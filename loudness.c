@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <math.h>
+#include <ff.h>
+#include "loudness.h"
+#include "gain_ramp.h"
+
+/*
+   The loudness file holds a fixed size entry for each slot, as the config
+   file does for each value. Measurement runs on the blocks decoded for
+   playing, so it only costs time whilst a file without an entry plays
+ */
+
+/*
+ * loudnessLookup
+ * filename     File about to be played
+ * slot         Entry of the file in the loudness file
+ * ls           Holds the identity of the file, for a scan if it is needed
+ * gain         Set to the stored Q15 gain, or unity if there is none
+ *
+ * Returns true if the file has been measured
+ */
+bool loudnessLookup(fs_mount* fs, const char* filename, uint32_t slot, loudness_scan* ls, int32_t* gain)
+{
+    FILINFO info;
+    FIL fp;
+    UINT read;
+    loudness_entry stored;
+    bool found = false;
+
+    ls->running = false;
+    *gain = GAIN_RAMP_UNITY;
+
+    if (!fsMounted(fs) || (slot >= LOUDNESS_MAX_FILES) || (f_stat(filename, &info) != FR_OK))
+    {
+        return false;
+    }
+    ls->entry.size = (uint32_t)info.fsize;
+    ls->entry.date = info.fdate;
+    ls->entry.time = info.ftime;
+
+    if (f_open(&fp, LOUDNESS_FILENAME, FA_OPEN_EXISTING | FA_READ) == FR_OK)
+    {
+        if ((f_lseek(&fp, slot * sizeof(loudness_entry)) == FR_OK) &&
+            (f_read(&fp, &stored, sizeof(stored), &read) == FR_OK) && (read == sizeof(stored)) &&
+            (stored.valid == LOUDNESS_VALID) && (stored.size == ls->entry.size) &&
+            (stored.date == ls->entry.date) && (stored.time == ls->entry.time))
+        {
+            *gain = stored.gain;
+            found = true;
+        }
+        f_close(&fp);
+    }
+    return found;
+}
+
+// Start measuring the samples of a file
+void loudnessScanStart(loudness_scan* ls, uint32_t sample_rate, bool stereo)
+{
+    ls->running = true;
+    ls->energy = 0;
+    ls->measured = 0;
+    ls->scanned = 0;
+    ls->length = LOUDNESS_SCAN_SECONDS * sample_rate * (stereo ? 2 : 1);
+    ls->peak = 0;
+}
+
+/*
+ * loudnessScanBlock
+ * buffer       Samples decoded for playing
+ * len          Number of samples, including interleaved samples
+ *
+ * Returns true when enough has been measured
+ */
+bool loudnessScanBlock(loudness_scan* ls, const int16_t* buffer, uint32_t len)
+{
+    uint64_t energy = 0;
+    uint32_t peak = ls->peak;
+
+    if (!ls->running || (len == 0))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        int32_t s = buffer[i];
+        uint32_t a = (s < 0) ? -s : s;
+
+        energy += (uint32_t)(s * s);
+        peak = (a > peak) ? a : peak;
+    }
+    ls->peak = peak;
+
+    // Silent blocks would make quiet files seem quieter still. The gate is an
+    // integer so that no floating point is run for each block
+    if (energy > (uint64_t)len * LOUDNESS_GATE_POWER)
+    {
+        ls->energy += energy;
+        ls->measured += len;
+    }
+    ls->scanned += len;
+
+    if (ls->scanned >= ls->length)
+    {
+        ls->running = false;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * loudnessScanFinish
+ *
+ * Complete the entry from the measurement, and return its Q15 gain
+ */
+int32_t loudnessScanFinish(loudness_scan* ls)
+{
+    int32_t gain = GAIN_RAMP_UNITY;
+    float level_db = LOUDNESS_GATE_DB;
+
+    if (ls->measured != 0)
+    {
+        float mean_square = (float)ls->energy / ls->measured / (32768.0f * 32768.0f);
+
+        level_db = 10.0f * log10f(mean_square);
+
+        if (level_db > LOUDNESS_TARGET_DB)
+        {
+            gain = (int32_t)(GAIN_RAMP_UNITY * powf(10.0f, (LOUDNESS_TARGET_DB - level_db) / 20.0f));
+        }
+    }
+
+    ls->entry.gain = (uint16_t)gain;
+    ls->entry.peak = (uint16_t)((ls->peak > INT16_MAX) ? INT16_MAX : ls->peak);
+    ls->entry.level_cb = (int16_t)(level_db * 10.0f);
+    ls->entry.valid = LOUDNESS_VALID;
+    return gain;
+}
+
+// Write the entry of a measured file
+bool loudnessStore(fs_mount* fs, uint32_t slot, const loudness_scan* ls)
+{
+    FIL fp;
+    UINT written;
+    bool ret = false;
+
+    if (fsMounted(fs) && (slot < LOUDNESS_MAX_FILES) && (f_open(&fp, LOUDNESS_FILENAME, FA_OPEN_ALWAYS | FA_WRITE) == FR_OK))
+    {
+        if ((f_lseek(&fp, slot * sizeof(loudness_entry)) == FR_OK) &&
+            (f_write(&fp, &ls->entry, sizeof(ls->entry), &written) == FR_OK) && (written == sizeof(ls->entry)))
+        {
+            ret = true;
+        }
+        f_close(&fp);
+    }
+
+    if (!ret)
+    {
+        printf("Cannot write loudness of slot %lu\n", (unsigned long)slot);
+    }
+    return ret;
+}
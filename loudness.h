@@ -0,0 +1,51 @@
+#pragma once
+#include "pico/stdlib.h"
+#include "fs_mount.h"
+
+/*
+ * Per file loudness normalisation.
+ * The first time a file is played its level is measured, then a Q15 gain is
+ * stored for it in the loudness file on the SD card. That play is not
+ * changed, so the level does not step part way through. Later plays read the
+ * gain, which is folded into the zone gain, so nothing is measured or added
+ * per sample. The level is the mean square of the blocks that are above
+ * silence, a simplified form of gated integrated loudness. The gain only
+ * attenuates, so files quieter than the target play unchanged and no limiter
+ * is needed
+ */
+#define LOUDNESS_FILENAME       "loudness"
+#define LOUDNESS_SCAN_SECONDS   30          // Playing time measured
+#define LOUDNESS_TARGET_DB      -18         // Level that files are attenuated to, dB full scale
+#define LOUDNESS_GATE_DB        -70         // Blocks below this level are silence, and not measured
+#define LOUDNESS_GATE_POWER     107         // Mean square of a sample at the gate, 32768^2 * 10^(LOUDNESS_GATE_DB / 10)
+#define LOUDNESS_MAX_FILES      8           // Entries in the loudness file
+
+typedef struct loudness_entry           // Stored in the loudness file, one for each file name
+{
+    uint32_t size;                      // Size, date and time of the file measured, so a
+    uint16_t date;                      // replaced file is measured again
+    uint16_t time;
+    uint16_t gain;                      // Q15 gain applied to the file, up to 32768
+    uint16_t peak;                      // Largest sample measured
+    int16_t level_cb;                   // Level measured, in 0.1dB full scale
+    uint16_t valid;                     // LOUDNESS_VALID if the entry has been written
+} loudness_entry;
+
+#define LOUDNESS_VALID 0x4C44
+
+typedef struct loudness_scan
+{
+    bool running;
+    uint64_t energy;                    // Sum of squares of the blocks above silence
+    uint32_t measured;                  // Samples in the blocks above silence
+    uint32_t scanned;                   // Samples seen
+    uint32_t length;                    // Samples to scan
+    uint32_t peak;
+    loudness_entry entry;               // Identity of the file, completed by loudnessScanFinish
+} loudness_scan;
+
+extern bool loudnessLookup(fs_mount* fs, const char* filename, uint32_t slot, loudness_scan* ls, int32_t* gain);
+extern void loudnessScanStart(loudness_scan* ls, uint32_t sample_rate, bool stereo);
+extern bool loudnessScanBlock(loudness_scan* ls, const int16_t* buffer, uint32_t len);
+extern int32_t loudnessScanFinish(loudness_scan* ls);
+extern bool loudnessStore(fs_mount* fs, uint32_t slot, const loudness_scan* ls);
@@ -0,0 +1,202 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ff.h>
+#include "noise_shaper.h"
+#include "hot_path.h"
+
+/*
+   Shapes white noise into other colours.
+   Each section implements y[n] = x[n] - zero * x[n-1] + pole * y[n-1]
+   Sections are processed one at a time across the whole block, so the
+   state of a section stays in registers. Four sections cost approximately
+   50 cycles per sample
+ */
+
+// Blue noise, +3dB per octave. Inverse of the classic three pole pink filter
+const noise_shape HOT_PATH_DATA("noise_shape") noise_shape_blue =
+{
+    .input_shift = 1,
+    .gain = 32767,
+    .num_sections = 3,
+    .pole = {32258, 27326, 2480},
+    .zero = {32628, 31061, 17553}
+};
+
+// Violet noise, +6dB per octave. First difference of white noise
+const noise_shape HOT_PATH_DATA("noise_shape") noise_shape_violet =
+{
+    .input_shift = 1,
+    .gain = 22938,
+    .num_sections = 1,
+    .pole = {0},
+    .zero = {32768}
+};
+
+// Grey noise. Two low shelves approximating inverse A weighting below 1kHz
+const noise_shape HOT_PATH_DATA("noise_shape") noise_shape_grey =
+{
+    .input_shift = 2,
+    .gain = 32767,
+    .num_sections = 2,
+    .pole = {32604, 31785},
+    .zero = {31785, 26214}
+};
+
+#define NOISE_SHAPER_FILE_LENGTH 256
+
+// Limit a value to the range of a 16 bit sample
+static inline int32_t noiseShaperClamp(int32_t value)
+{
+    return (value > INT16_MAX) ? INT16_MAX : ((value < INT16_MIN) ? INT16_MIN : value);
+}
+
+void noiseShaperCreate(noise_shaper* ns, const noise_shape* shape)
+{
+    ns->shape = shape;
+
+    for (int i = 0; i < NOISE_SHAPER_MAX_SECTIONS; i++)
+    {
+        ns->x1[i] = 0;
+        ns->y1[i] = 0;
+    }
+}
+
+/*
+ * noiseShaperProcess
+ * buffer       Block of white noise, shaped in place
+ * len          Number of samples in buffer, including interleaved samples
+ * stride       Distance between samples of this channel (2 for interleaved stereo)
+ */
+void HOT_PATH(noiseShaperProcess)(noise_shaper* ns, int16_t* buffer, uint32_t len, uint32_t stride)
+{
+    const noise_shape* shape = ns->shape;
+
+    // Apply the input headroom
+    for (uint32_t i = 0; i < len; i += stride)
+    {
+        buffer[i] >>= shape->input_shift;
+    }
+
+    for (uint32_t s = 0; s < shape->num_sections; s++)
+    {
+        int32_t pole = shape->pole[s];
+        int32_t zero = shape->zero[s];
+        int32_t x1 = ns->x1[s];
+        int32_t y1 = ns->y1[s];
+
+        for (uint32_t i = 0; i < len; i += stride)
+        {
+            int32_t x = buffer[i];
+
+            y1 = noiseShaperClamp(x - ((zero * x1) >> 15) + ((pole * y1) >> 15));
+            x1 = x;
+            buffer[i] = (int16_t)y1;
+        }
+        ns->x1[s] = x1;
+        ns->y1[s] = y1;
+    }
+
+    // Apply the output gain
+    for (uint32_t i = 0; i < len; i += stride)
+    {
+        buffer[i] = (int16_t)noiseShaperClamp((buffer[i] * shape->gain) >> 15);
+    }
+}
+
+/*
+ * noiseShaperLoad
+ * shape        Shape to populate
+ * filename     Name of the coefficient file
+ *
+ * The file holds whitespace separated integers, # starts a comment:
+ *   input_shift gain pole_0 zero_0 [pole_1 zero_1 ...]
+ * gain, poles and zeros are Q15. Returns true if a valid shape was read,
+ * otherwise shape is left unchanged
+ */
+bool noiseShaperLoad(noise_shape* shape, const char* filename)
+{
+    FIL fp;
+    UINT read;
+    char text[NOISE_SHAPER_FILE_LENGTH];
+    int32_t values[2 + 2 * NOISE_SHAPER_MAX_SECTIONS];
+    uint32_t count = 0;
+
+    if (f_open(&fp, filename, FA_OPEN_EXISTING | FA_READ) != FR_OK)
+    {
+        printf("Cannot open noise file: %s\n", filename);
+        return false;
+    }
+
+    if (f_read(&fp, text, sizeof(text) - 1, &read) != FR_OK)
+    {
+        read = 0;
+    }
+    f_close(&fp);
+    text[read] = '\0';
+
+    char* p = text;
+
+    while (*p)
+    {
+        char* end;
+
+        if (*p == '#')
+        {
+            // Skip comment to end of line
+            while (*p && *p != '\n')
+            {
+                p++;
+            }
+            continue;
+        }
+
+        if (isspace((unsigned char)*p))
+        {
+            p++;
+            continue;
+        }
+
+        long value = strtol(p, &end, 0);
+
+        // Text that is not a number, or more values than there are sections for
+        if ((end == p) || (count == sizeof(values) / sizeof(values[0])))
+        {
+            printf("Invalid noise file: %s\n", filename);
+            return false;
+        }
+        values[count++] = (int32_t)value;
+        p = end;
+    }
+
+    // Need at least one section, and complete pole/zero pairs
+    if ((count < 4) || (count & 1) || (values[0] < 0) || (values[0] > 15) ||
+        (values[1] < 0) || (values[1] > 65535))
+    {
+        printf("Invalid noise file: %s\n", filename);
+        return false;
+    }
+
+    // Built separately, as the shape may be playing in another zone
+    noise_shape loaded;
+
+    loaded.input_shift = values[0];
+    loaded.gain = values[1];
+    loaded.num_sections = (count - 2) >> 1;
+
+    for (uint32_t s = 0; s < loaded.num_sections; s++)
+    {
+        loaded.pole[s] = values[2 + (s << 1)];
+        loaded.zero[s] = values[3 + (s << 1)];
+
+        // Reject unstable or overflowing sections
+        if ((loaded.pole[s] <= -32768) || (loaded.pole[s] >= 32768) ||
+            (loaded.zero[s] < -32768) || (loaded.zero[s] > 32768))
+        {
+            printf("Invalid noise section %lu in: %s\n", (unsigned long)s, filename);
+            return false;
+        }
+    }
+    *shape = loaded;
+    return true;
+}
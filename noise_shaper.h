@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Spectral shaping of white noise.
+ * A shape is a cascade of first order pole/zero sections, applied in place to
+ * a block of white noise. All coefficients are Q15 (32768 = 1.0)
+ */
+#define NOISE_SHAPER_MAX_SECTIONS 4
+
+typedef struct noise_shape
+{
+    uint32_t input_shift;                       // Headroom shift applied to the white noise
+    int32_t  gain;                              // Q15 output gain
+    uint32_t num_sections;                      // Number of sections in use
+    int32_t  pole[NOISE_SHAPER_MAX_SECTIONS];   // Q15 pole of each section, must be < 1.0
+    int32_t  zero[NOISE_SHAPER_MAX_SECTIONS];   // Q15 zero of each section
+} noise_shape;
+
+typedef struct noise_shaper
+{
+    const noise_shape* shape;                   // Shape being generated
+    int32_t x1[NOISE_SHAPER_MAX_SECTIONS];      // Previous input of each section
+    int32_t y1[NOISE_SHAPER_MAX_SECTIONS];      // Previous output of each section
+} noise_shaper;
+
+// Predefined shapes
+extern const noise_shape noise_shape_blue;
+extern const noise_shape noise_shape_violet;
+extern const noise_shape noise_shape_grey;
+
+extern void noiseShaperCreate(noise_shaper* ns, const noise_shape* shape);
+extern void noiseShaperProcess(noise_shaper* ns, int16_t* buffer, uint32_t len, uint32_t stride);
+extern bool noiseShaperLoad(noise_shape* shape, const char* filename);
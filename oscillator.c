@@ -0,0 +1,96 @@
+#include "oscillator.h"
+#include "hot_path.h"
+/*
+   Direct digital synthesis of sine waves.
+   The top 8 bits of the phase select the table entry, the next 15 bits
+   interpolate to the following entry. The table has a guard entry, so the
+   interpolation never wraps
+ */
+
+static const int16_t HOT_PATH_DATA("oscillator") oscillator_sine[(1 << OSCILLATOR_TABLE_BITS) + 1] =
+{
+    0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+    12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530, 18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+    32767, 32757, 32728, 32678, 32609, 32521, 32412, 32285, 32137, 31971, 31785, 31580, 31356, 31113, 30852, 30571,
+    30273, 29956, 29621, 29268, 28898, 28510, 28105, 27683, 27245, 26790, 26319, 25832, 25329, 24811, 24279, 23731,
+    23170, 22594, 22005, 21403, 20787, 20159, 19519, 18868, 18204, 17530, 16846, 16151, 15446, 14732, 14010, 13279,
+    12539, 11793, 11039, 10278, 9512, 8739, 7962, 7179, 6393, 5602, 4808, 4011, 3212, 2410, 1608, 804,
+    0, -804, -1608, -2410, -3212, -4011, -4808, -5602, -6393, -7179, -7962, -8739, -9512, -10278, -11039, -11793,
+    -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530, -18204, -18868, -19519, -20159, -20787, -21403, -22005, -22594,
+    -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790, -27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956,
+    -30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971, -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+    -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285, -32137, -31971, -31785, -31580, -31356, -31113, -30852, -30571,
+    -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683, -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731,
+    -23170, -22594, -22005, -21403, -20787, -20159, -19519, -18868, -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+    -12539, -11793, -11039, -10278, -9512, -8739, -7962, -7179, -6393, -5602, -4808, -4011, -3212, -2410, -1608, -804,
+    0
+};
+
+void oscillatorBankCreate(oscillator_bank* ob)
+{
+    ob->num = 0;
+}
+
+/*
+ * oscillatorBankAdd
+ * freq_mhz     Frequency in mHz, must be below half the sample rate
+ * sample_rate  Rate of the samples generated
+ * amplitude    Q15 amplitude. The sum of the amplitudes in a bank must not exceed 32767
+ *
+ * Returns false if the bank is full
+ */
+bool oscillatorBankAdd(oscillator_bank* ob, uint32_t freq_mhz, uint32_t sample_rate, int32_t amplitude)
+{
+    if (ob->num == OSCILLATOR_BANK_SIZE)
+    {
+        return false;
+    }
+
+    ob->phase[ob->num] = 0;
+    ob->step[ob->num] = (uint32_t)(((uint64_t)freq_mhz << 32) / ((uint64_t)sample_rate * 1000));
+    ob->amplitude[ob->num] = amplitude;
+    ob->num++;
+
+    return true;
+}
+
+int32_t HOT_PATH(oscillatorSine)(uint32_t phase)
+{
+    uint32_t index = phase >> (32 - OSCILLATOR_TABLE_BITS);
+    int32_t fraction = (phase >> (32 - OSCILLATOR_TABLE_BITS - 15)) & 0x7FFF;
+    int32_t a = oscillator_sine[index];
+    int32_t b = oscillator_sine[index + 1];
+
+    return a + (((b - a) * fraction) >> 15);
+}
+
+/*
+ * oscillatorBankProcess
+ * buffer       Populated with the sum of the oscillators
+ * len          Number of samples in buffer, including interleaved samples
+ * stride       Distance between samples of this channel (2 for interleaved stereo)
+ */
+void HOT_PATH(oscillatorBankProcess)(oscillator_bank* ob, int16_t* buffer, uint32_t len, uint32_t stride)
+{
+    for (uint32_t i = 0; i < len; i += stride)
+    {
+        buffer[i] = 0;
+    }
+
+    // One oscillator at a time across the block, so its state stays in registers
+    for (uint32_t n = 0; n < ob->num; ++n)
+    {
+        uint32_t phase = ob->phase[n];
+        uint32_t step = ob->step[n];
+        int32_t amplitude = ob->amplitude[n];
+
+        for (uint32_t i = 0; i < len; i += stride)
+        {
+            buffer[i] += (int16_t)((oscillatorSine(phase) * amplitude) >> 15);
+            phase += step;
+        }
+        ob->phase[n] = phase;
+    }
+}
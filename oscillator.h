@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Bank of sine oscillators.
+ * Each oscillator is a 32 bit phase accumulator indexing a 256 entry Q15 sine
+ * table, with linear interpolation between entries. There is no trig or
+ * floating point per sample; the phase step is calculated when the frequency
+ * is set. Frequencies are in mHz, so slow modulation can be generated
+ */
+#define OSCILLATOR_BANK_SIZE    4           // Most oscillators in one bank
+#define OSCILLATOR_TABLE_BITS   8           // log2 of the number of sine table entries
+
+typedef struct oscillator_bank
+{
+    uint32_t num;                               // Oscillators in use
+    uint32_t phase[OSCILLATOR_BANK_SIZE];       // Phase, a full cycle is 2^32
+    uint32_t step[OSCILLATOR_BANK_SIZE];        // Phase increment per sample
+    int32_t  amplitude[OSCILLATOR_BANK_SIZE];   // Q15 amplitude
+} oscillator_bank;
+
+extern void oscillatorBankCreate(oscillator_bank* ob);
+extern bool oscillatorBankAdd(oscillator_bank* ob, uint32_t freq_mhz, uint32_t sample_rate, int32_t amplitude);
+extern void oscillatorBankProcess(oscillator_bank* ob, int16_t* buffer, uint32_t len, uint32_t stride);
+
+// Q15 sine of a 32 bit phase
+extern int32_t oscillatorSine(uint32_t phase);
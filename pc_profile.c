@@ -0,0 +1,152 @@
+#ifdef PC_PROFILE
+#include "hardware/irq.h"
+#include "hardware/timer.h"
+#include "hardware/structs/timer.h"
+#include "hardware/regs/addressmap.h"
+#include "pc_profile.h"
+/*
+   The alarm handler finds the exception frame stacked on entry, then passes
+   it to pcProfileSample. The interrupted program counter is the seventh word
+   of the frame. Buckets are counted in 32 bits, as the idle loop would fill a
+   16 bit bucket in seconds
+ */
+
+static uint32_t histogram[PC_PROFILE_BUCKETS];
+static uint32_t samples = 0;                // Samples taken, including those outside the buckets
+static uint32_t other = 0;                  // Samples outside the buckets
+static bool paused = false;                 // true whilst the histogram is being read
+static uint alarm_num;
+
+void pcProfileSample(const uint32_t* frame);
+
+// Pass the stack the exception frame was pushed to, then return from the exception through pcProfileSample
+static void __attribute__((naked)) __not_in_flash_func(pcProfileIrq)(void)
+{
+    __asm volatile(
+        "movs r0, #4        \n"
+        "mov r1, lr         \n"
+        "tst r0, r1         \n"
+        "bne 1f             \n"
+        "mrs r0, msp        \n"
+        "b 2f               \n"
+        "1:                 \n"
+        "mrs r0, psp        \n"
+        "2:                 \n"
+        "ldr r1, 3f         \n"
+        "bx r1              \n"
+        ".align 2           \n"
+        "3:                 \n"
+        ".word pcProfileSample\n");
+}
+
+void __attribute__((used)) __not_in_flash_func(pcProfileSample)(const uint32_t* frame)
+{
+    uint32_t pc = frame[6];
+    uint32_t index = PC_PROFILE_BUCKETS;
+
+    // Acknowledge and rearm from the alarm time, so the rate does not drift. If
+    // that has already passed, as after a long critical section, rearm from now
+    // as the alarm only fires when the time matches
+    uint32_t target = timer_hw->alarm[alarm_num] + PC_PROFILE_INTERVAL_US;
+
+    timer_hw->intr = 1u << alarm_num;
+
+    if ((int32_t)(target - timer_hw->timerawl) <= 0)
+    {
+        target = timer_hw->timerawl + PC_PROFILE_INTERVAL_US;
+    }
+    timer_hw->alarm[alarm_num] = target;
+
+    if (paused)
+    {
+        return;
+    }
+
+    if ((pc >= XIP_BASE) && (pc < XIP_BASE + (PC_PROFILE_FLASH_BUCKETS << PC_PROFILE_SHIFT)))
+    {
+        index = (pc - XIP_BASE) >> PC_PROFILE_SHIFT;
+    }
+    else if ((pc >= SRAM_BASE) && (pc < SRAM_BASE + (PC_PROFILE_RAM_BUCKETS << PC_PROFILE_SHIFT)))
+    {
+        index = PC_PROFILE_FLASH_BUCKETS + ((pc - SRAM_BASE) >> PC_PROFILE_SHIFT);
+    }
+    else if (pc < (PC_PROFILE_ROM_BUCKETS << PC_PROFILE_SHIFT))
+    {
+        index = PC_PROFILE_FLASH_BUCKETS + PC_PROFILE_RAM_BUCKETS + (pc >> PC_PROFILE_SHIFT);
+    }
+
+    samples++;
+
+    if (index == PC_PROFILE_BUCKETS)
+    {
+        other++;
+    }
+    else
+    {
+        histogram[index]++;
+    }
+}
+
+// Claim an alarm, and start sampling
+void pcProfileStart(void)
+{
+    alarm_num = hardware_alarm_claim_unused(true);
+
+    uint irq = TIMER_IRQ_0 + alarm_num;
+
+    irq_set_exclusive_handler(irq, pcProfileIrq);
+    irq_set_priority(irq, PICO_HIGHEST_IRQ_PRIORITY);
+    hw_set_bits(&timer_hw->inte, 1u << alarm_num);
+    irq_set_enabled(irq, true);
+
+    timer_hw->alarm[alarm_num] = timer_hw->timerawl + PC_PROFILE_INTERVAL_US;
+}
+
+// Stop counting whilst the histogram is read. The alarm keeps running
+void pcProfilePause(bool pause)
+{
+    paused = pause;
+}
+
+void pcProfileClear(void)
+{
+    for (uint32_t i = 0; i < PC_PROFILE_BUCKETS; i++)
+    {
+        histogram[i] = 0;
+    }
+    samples = 0;
+    other = 0;
+}
+
+/*
+ * pcProfileNext
+ * index        First bucket to look at
+ * count        Set to the count of the bucket found
+ *
+ * Return the first bucket from index that has samples, or PC_PROFILE_BUCKETS
+ * if there are no more
+ */
+uint32_t pcProfileNext(uint32_t index, uint32_t* count)
+{
+    while ((index < PC_PROFILE_BUCKETS) && (histogram[index] == 0))
+    {
+        index++;
+    }
+
+    if (index < PC_PROFILE_BUCKETS)
+    {
+        *count = histogram[index];
+    }
+    return index;
+}
+
+uint32_t pcProfileSamples(void)
+{
+    return samples;
+}
+
+uint32_t pcProfileOther(void)
+{
+    return other;
+}
+#endif
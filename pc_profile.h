@@ -0,0 +1,23 @@
+#pragma once
+#include "pico/stdlib.h"
+
+/*
+ * Sampling profiler.
+ * The M0+ has no cycle counter, so a timer alarm at the highest interrupt
+ * priority reads the interrupted program counter into a histogram. Only built
+ * into the picosounds_profile target, tools/profile_report.py symbolises the
+ * histogram against the ELF
+ */
+#define PC_PROFILE_INTERVAL_US  97          // Not a divisor of the refill period, so does not lock to it
+#define PC_PROFILE_SHIFT        6           // Each bucket covers 64 bytes of code
+#define PC_PROFILE_FLASH_BUCKETS 4096       // First 256KB of flash
+#define PC_PROFILE_RAM_BUCKETS  1024        // First 64KB of SRAM, which holds the code copied to RAM
+#define PC_PROFILE_ROM_BUCKETS  256         // 16KB boot ROM, which holds the float and memory routines
+#define PC_PROFILE_BUCKETS      (PC_PROFILE_FLASH_BUCKETS + PC_PROFILE_RAM_BUCKETS + PC_PROFILE_ROM_BUCKETS)
+
+extern void pcProfileStart(void);
+extern void pcProfilePause(bool pause);
+extern void pcProfileClear(void);
+extern uint32_t pcProfileNext(uint32_t index, uint32_t* count);
+extern uint32_t pcProfileSamples(void);
+extern uint32_t pcProfileOther(void);
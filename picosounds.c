@@ -5,16 +5,36 @@
 #include "hardware/dma.h"  // dma 
 #include "hardware/sync.h" // wait for interrupt 
 #include "hardware/structs/ioqspi.h"
+#include "hardware/structs/timer.h"
+#include "hardware/clocks.h"
+#include "hardware/uart.h"
+#include "hardware/spi.h"
 #include "pico/util/queue.h" 
 #include "ws2812.pio.h"
 
 #include "fs_mount.h"
-#include "pwm_channel.h"
 #include "debounce_button.h"
-#include "double_buffer.h"
+#include "audio_zone.h"
+#include "audio_arena.h"
 #include "colour_noise.h"
-#include "music_file.h"
+#include "noise_shaper.h"
+#include "oscillator.h"
+#include "grain_texture.h"
+#include "gain_ramp.h"
+#include "sleep_timer.h"
+#include "clock_planner.h"
+#include "led_engine.h"
+#include "sound_file.h"
 #include "config.h"
+#include "hot_path.h"
+#include "protocol.h"
+#include "ring_buffer.h"
+#include "timeline.h"
+#include "loudness.h"
+#include "trace.h"
+#include "pc_profile.h"
+#include "sd_stats.h"
+#include "decode_stats.h"
 
 #ifdef DEBUG_STATUS
   #define STATUS(a) printf a
@@ -23,8 +43,14 @@
 #endif
  
 #define AUDIO_PIN 18  // Configured for the Maker board 18 left, 19 right
+#define AUDIO_PIN_ZONE_1 16 // Second zone, 16 left, 17 right
+#define NUM_ZONES 1   // Number of independent outputs, up to 2. 2 drives a second zone
+#define FILE_ZONES NUM_ZONES    // Zones that can play a file at the same time, the others play noise
 #define STEREO        // When stereo not enabled, DMA same l and r data to both channels
 #define VOLUME
+//#define LED_SLEEP_FADE  // When enabled, the night light fades out with the sleep timer
+#define LED_DITHER_BELOW LED_ENGINE_DITHER_BELOW  // LED channels dimmer than this 8 bit level are dithered, 0 never dithers
+//#define MODIFIER_GPIO 8 // When enabled, a button on this GPIO replaces BOOTSEL as the LED modifier
 
 #define IS_RGBW false
 #define NUM_PIXELS 1
@@ -41,49 +67,94 @@ bool play_stereo = true;
 bool play_stereo = false;
 #endif
 
-static colour_noise cn[2];          // Colour noise structures for left and right channels
+static noise_shape custom_shape;    // User defined shape, loaded from SD card
 
-#define SAMPLE_RATE 22000           // Used for coloured noise generation
-#define DMA_BUFFER_LENGTH 2200      // 2200 samples @ 44kHz gives= 0.05 seconds = interrupt rate
-
-#define RAM_BUFFER_LENGTH (4*DMA_BUFFER_LENGTH)
-
-/*
- * Static variable definitions
- */
-static uint wrap;                           // Largest value a sample can be + 1
-static int mid_point;                       // wrap divided by 2
-static float fraction = 1;                  // Divider used for PWM
-static int repeat_shift = 1;                // Defined by the sample rate
-
-static pwm_data pwm_channel[2];             // Represents the PWM channels
-static int dma_channel[2];                  // The 2 DMA channels used for DMA ping pong
-
- // Have 2 buffers in RAM that are used to DMA the samples to the PWM engine
-static uint32_t dma_buffer[2][DMA_BUFFER_LENGTH];
-static int dma_buffer_index = 0;            // Index into active DMA buffer
-
-// Have 2 or 4 8k buffers in RAM, copy data from Flash to these buffers - in future
-// will be buffers where noise is created, or music delivered from SD Card
+#if NUM_ZONES > 1
+#define SYSTEM_CLOCK_KHZ 196800     // Shared by the zones so fixed, plays every rate from 4kHz to 48kHz at 12 bits
+#else
+#define SYSTEM_CLOCK_KHZ 180000     // Clock used until the first sound is planned
+#endif
+#define SLEEP_CLOCK_KHZ 18000       // Reduced clock used whilst asleep
+#define NOISE_CLOCK_KHZ 48000       // Lowest clock when generating noise
+#define FILE_CLOCK_KHZ 125000       // Lowest clock when decoding files
 
-// RAM buffers, controlled through double_buffer class
-static int16_t ram_buffer[2][RAM_BUFFER_LENGTH];
-static bool sampled_stereo = false;         // True if ram_buffer contains stereo, false for mono
+#define FALLBACK_SOUND brown        // Played when the file being played cannot be read
+#define CARD_MOUNT_SLACK_US 30000   // Sound that must be queued before the SD card is mounted
 
-// Control data blocks for the RAM double buffers
-static double_buffer double_buffers;
-uint32_t populateCallback(int16_t* buffer, uint32_t len);   // Call back to generate next buffer of sound
+#define SAMPLE_RATE 22000           // Used for coloured noise and tone generation, CONFIG_MAX_SYNTH_MHZ is half of it
+#define SYNTH_AMPLITUDE 16384       // Q15 amplitude of generated tones
+#define BREATH_FLOOR 8192           // Q15 level of breathing noise between breaths
+#define TIMELINE_RETRY_US 1000      // Delay before retrying a timeline event, if the queue is full
+#define TRACE_FRAME_RECORDS 7       // Trace records sent in each frame
+#define PROFILE_FRAME_BUCKETS 10    // Profile buckets sent in each frame, a 16 bit index and 32 bit count each
 
-// Working buffer for reading from file
-#define CACHE_BUFFER 8000
-unsigned char cache_buffer[CACHE_BUFFER];
+// Buffers for every zone, sized for the sources that can play at the same time. One
+// zone can play a texture in place of a file
+#define ARENA_SIZE (AUDIO_ARENA_BLOCK * (FILE_ZONES * AUDIO_ARENA_FILE_BLOCKS + (NUM_ZONES - FILE_ZONES) * AUDIO_ARENA_NOISE_BLOCKS + \
+                                      AUDIO_ARENA_TEXTURE_BLOCKS - AUDIO_ARENA_FILE_BLOCKS))
 
-// Pointer to the currently in use RAM buffer
-static const int16_t* current_RAM_Buffer = 0;
-static int ram_buffer_index = 0;            // Holds current position in ram_buffers for channels
-static uint32_t current_RAM_length = 0;     // number of active samples in current RAM buffer
+static uint8_t arena_memory[ARENA_SIZE] __attribute__((aligned(4)));
+static audio_arena arena;
 
-static float volume = 0.8;                  // Initial volume adjust, controlled by button
+/*
+ * Static variable definitions
+ */
+// Sound played by each zone
+typedef struct zone_source
+{
+    sound_state state;                          // Sound being played
+    float volume;                               // Volume adjust, controlled by button
+    bool fading;                                // true if fading out prior to a state change
+    int fade_blocks;                            // Number of silent DMA blocks populated during fade
+    sound_state fade_state;                     // State to move to when fade completes
+    sound_state wake_state;                     // State to restore on wake
+    sound_state resume_state;                   // File to resume when the SD card returns, off if none
+    bool ramping;                               // true if the timeline is ramping the volume
+    float ramp_from;                            // Volume at the start of the ramp
+    float ramp_to;                              // Volume at the end of the ramp
+    uint64_t ramp_start_us;                     // Time the ramp started
+    uint64_t ramp_us;                           // Length of the ramp
+    bool file_failed;                           // true if a read of the file failed
+    colour_noise cn[2];                         // Colour noise for left and right channels
+    noise_shaper ns[2];                         // Spectral shaping for left and right channels
+    oscillator_bank osc[2];                     // Tones of the left and right channels
+    oscillator_bank breath;                     // Envelope of breathing noise
+    grain_texture gt[2];                        // Texture of the left and right channels
+    int16_t* clip;                              // Mono clip of the texture, from the arena
+    uint32_t clip_loaded;                       // Samples of the clip loaded
+    bool clip_reading;                          // true whilst the clip is read from the file
+    sound_file sf;                              // File being played, any supported format
+    int32_t file_gain;                          // Q15 loudness normalisation of the file
+    uint32_t file_slot;                         // Entry of the file in the loudness file
+    loudness_scan scan;                         // Measures the file if it has no entry
+    bool scan_done;                             // true when the measurement is ready to store
+    decode_stats stats;                         // Decode profile of the file
+    int16_t* ram[2];                            // RAM double buffers, from the arena
+    uint32_t ram_length;                        // Number of samples in each RAM buffer
+    unsigned char* cache;                       // Working buffer for reading from file, from the arena
+    uint32_t cache_size;
+} zone_source;
+
+static const uint zone_pin[] = {AUDIO_PIN, AUDIO_PIN_ZONE_1};
+static audio_zone zones[NUM_ZONES];             // Output of each zone
+static zone_source sources[NUM_ZONES];          // Sound of each zone
+static uint32_t selected_zone = 0;              // Zone controlled by the buttons
+
+uint32_t populateCallback(void* context, int16_t* buffer, uint32_t len);   // Call back to generate next buffer of sound
+
+// Sleep timer, fades then stops the sound
+static sleep_timer sleep_countdown;
+static bool asleep = false;                 // true when in low power state
+
+// Control and telemetry over the stdio UART
+#define COMMAND_BUFFER_SIZE 128             // Must be a power of 2
+#define TELEMETRY_MIN_MS 100                // Shortest telemetry period
+
+static uint8_t command_data[COMMAND_BUFFER_SIZE];
+static ring_buffer command_buffer;          // Received bytes, filled by UART IRQ
+static protocol_parser parser;
+static repeating_timer_t telemetry_timer;
+static bool telemetry_running = false;
 
 // Event queue, used to leave ISR context
 static queue_t eventQueue;
@@ -95,29 +166,79 @@ typedef enum Event
     increase_volume = empty + 1, 
     decrease_volume = increase_volume + 1,
     populate_dma = decrease_volume + 1,
-    populate_double = populate_dma + 1,
-    change_music = populate_double + 1,
+    change_music = populate_dma + 1,
     increase_intensity = change_music + 1, 
     decrease_intensity = increase_intensity + 1,
     change_led = decrease_intensity + 1,
-    quit = change_led + 1, 
+    change_sleep = change_led + 1,
+    quit = change_sleep + 1, 
+    change_button = quit + 1,           // Button events, the modifier is applied by the main loop
+    increase_button = change_button + 1,
+    decrease_button = increase_button + 1,
+    change_zone = decrease_button + 1,
+    command_received = change_zone + 1,
+    send_telemetry = command_received + 1,
+    timeline_due = send_telemetry + 1,  // Next timeline action has been reached
+    send_trace = timeline_due + 1,      // Send the next frame of the trace dump
+    send_profile = send_trace + 1,      // Send the next frame of the profile histogram
 } Event; 
 
-// To convert from 16 bit signed to unsigned
-#define MID_VALUE 0x8000
-
 // Helper to determine if state is a colour state
-static inline bool isColour(sound_state state) {return (state == white || state == pink || state == brown);}
+static inline bool isShaped(sound_state state) {return (state == blue || state == violet || state == grey || state == custom);}
+static inline bool isColour(sound_state state) {return (state == white || state == pink || state == brown || isShaped(state));}
+static inline bool isSynth(sound_state state) {return (state == tone || state == binaural || state == breathing);}
 static inline bool isFile(sound_state state) {return (state == file_1 || state == file_2 || state == file_3);}
 
-static void changeState(sound_state new_state);
-sound_state current_state = off; 
-
-// RGB values for 5 colours (black, red, orange, yellow, white)
-static const uint8_t rgb_colours[5][3] = { {0,0,0}, {255,0,0,}, {255,64,0,}, {255,255,0,}, {255,255,255,} }; 
+static void changeState(uint32_t zone, sound_state new_state);
+static void fadeToState(uint32_t zone, sound_state new_state);
+static int32_t zoneGain(uint32_t zone);
+static void updateGain(uint32_t zone);
+static void storeZone(uint32_t zone);
+static void serviceZones(void);
+static void enterSleep(void);
+static void exitSleep(void);
+static bool setSystemClock(uint32_t khz);
+static void commandCallback(void* param);
+static bool telemetryCallback(repeating_timer_t* rt);
+static void handleCommands(void);
+static void handleFrame(const protocol_frame* frame);
+static void sendFrame(uint8_t cmd, const uint8_t* payload, uint8_t len);
+static void sendStatus(void);
+static void sendTelemetry(void);
+static void sendDecodeStats(uint32_t zone);
+static void sendTrace(void);
+static void sendProfile(void);
+static void sendBench(bool flush_cache);
+static void startTimeline(uint64_t start_us, uint64_t now_us);
+static void scheduleTimeline(void);
+static int64_t timelineCallback(alarm_id_t id, void* user_data);
+static void runTimeline(void);
+static void runAction(const timeline_action* action);
+static void startRamp(uint32_t zone, float volume, uint32_t duration_ms);
+static void rampVolume(zone_source* src);
 
 static led_state led = led_black;   // Initially LED is not illuminated
+static synth_params synth;          // Frequencies of the generated sounds
 static float intensity = 1.0f;
+static led_engine leds;             // Drives the WS2812 LEDs
+static bool led_fading = false;     // true if LEDs are fading with sleep timer
+
+// Night programme, read from the SD card
+static timeline programme;
+static uint64_t programme_start_us;         // Time the programme started
+static alarm_id_t timeline_alarm = 0;       // Alarm at the next action, 0 if none
+static bool clock_set = false;              // true once the host has sent the time of day
+static uint32_t clock_time_of_day_ms;       // Time of day when the clock was set
+static uint64_t clock_set_us;               // Time since boot when the clock was set
+
+#ifdef EVENT_TRACE
+static uint32_t trace_count;                // Records in the frozen trace
+static uint32_t trace_sent;                 // Records of the trace sent to the host
+#endif
+
+#ifdef PC_PROFILE
+static uint32_t profile_index;              // Next histogram bucket to send to the host
+#endif
 
 // GPIO for Maker buttons, plus extra off board debug
 enum Buttons
@@ -129,186 +250,108 @@ enum Buttons
     button_debug_quit = 7,
 };
 
+#ifdef MODIFIER_GPIO
+static debounce_button_data button[6];
+#else
 static debounce_button_data button[5];
+#endif
+
+// Time BOOTSEL is allowed to settle, whilst interrupts are disabled
+#define BOOTSEL_SETTLE_US 20
+
+// Longest time that interrupts have been disabled to read BOOTSEL
+static uint32_t bootsel_irq_off_us = 0;
+static uint32_t bootsel_irq_off_max_us = 0;
 
 /* 
  * Function declarations
  */
-static void populateDmaBuffer(void);
-static void claimDmaChannels(int num_channels);
-static void initDma(int buffer_index, int slice, int chain_index);
 static void dmaInterruptHandler();
 
-void startMusic(uint32_t sample_rate);
-void stopMusic();
+static bool planMusic(uint32_t sample_rate, uint32_t min_khz, clock_plan* plan);
+void startMusic(uint32_t zone, const clock_plan* plan, uint32_t sample_rate, bool sampled_stereo);
+void stopMusic(uint32_t zone);
 void exitMusic();
 
-static inline uint32_t urgb_u32(uint8_t r, uint8_t g, uint8_t b);
-static void set_pixel(PIO pio, led_state led, float intensity);
 bool __no_inline_not_in_flash_func(getBootselButton)(void);
-
-void buttonCallback(uint gpio_number, debounce_event event);
-
-static bool loadFile(const char* filename);
+static bool getModifier(void);
+static Event applyModifier(Event event);
+
+void buttonCallback(uint gpio_number, debounce_event event, uint32_t time_ms);
+
+static bool loadFile(zone_source* src, const char* filename, uint32_t slot);
+static bool loadClip(zone_source* src, const char* filename);
+static void readClip(zone_source* src, uint32_t len);
+static void fallBack(uint32_t zone);
+static void startSynth(zone_source* src, sound_state state);
+static void serviceCard(void);
+static bool cardReady(void);
+static bool allocateBuffers(zone_source* src, uint32_t ram_length, uint32_t cache_size);
+static void releaseBuffers(zone_source* src);
 static fs_mount mount;
-static music_file mf;
 
 #define FILE_NAME_1 "1"
 #define FILE_NAME_2 "2"
 #define FILE_NAME_3 "3"
+#define FILE_NAME_NOISE "noise"
+#define FILE_NAME_TIMELINE "timeline"
+#define FILE_NAME_TEXTURE "texture"
 
 /* 
  * Function definitions
  */
 
-// Handles interrupts for the DMA chain
-// Resets start address for DMA and requests buffer that is exhausted to be refilled
-static void dmaInterruptHandler() 
-{
-    // Determine which DMA caused the interrupt
-    for (int i = 0 ; i<2; ++i)
-    {
-        if (dma_channel_get_irq1_status(dma_channel[i]))
-        {
-            dma_channel_acknowledge_irq1(dma_channel[i]);
-            dma_channel_set_read_addr(dma_channel[i], dma_buffer[i], false);
-
-            // Populate buffer outside of IRQ
-            Event e = populate_dma;
-            queue_try_add(&eventQueue, &e);
-        }
-    }    
-}
-
-// Populate the DMA buffer, referenced by index
-static void populateDmaBuffer(void)
+// Handles the end of block interrupt for the DMA chains
+// The chains reload themselves, so this only counts the block and requests
+// that the exhausted buffers are refilled. Latency here is not audible
+static void HOT_PATH(dmaInterruptHandler)() 
 {
-    uint32_t left;
-    uint32_t right;
+    bool refill = false;
 
-    // Calculate the wrap point for the ram_buffer_index
-    uint32_t ram_buffer_wrap = (sampled_stereo) ? (current_RAM_length<<repeat_shift) : (current_RAM_length<<(repeat_shift+1));
-
-    // Populate two bytes from each active buffer
-    for (int i=0; i<DMA_BUFFER_LENGTH; ++i)
+    for (int i = 0; i < NUM_ZONES; ++i)
     {
-        // build the 32 bit word from the two channels
-        if (sampled_stereo)
-        {
-#ifdef VOLUME        
-        // Write to buffer, adjusting for volume
-            left = ((int32_t)(current_RAM_Buffer[(ram_buffer_index>>repeat_shift)<<1] * volume) + MID_VALUE) >> 4;
-            right =((int32_t)(current_RAM_Buffer[((ram_buffer_index>>repeat_shift)<<1)+1] * volume) + MID_VALUE) >> 4;
-#else
-            left = (current_RAM_Buffer[(ram_buffer_index>>repeat_shift)<<1] + MID_VALUE) >> 4;
-            right =(current_RAM_Buffer[((ram_buffer_index>>repeat_shift)<<1)+1] + MID_VALUE) >> 4;
-#endif        
-        }
-        else
-        {
-#ifdef VOLUME        
-        // Write to buffer, adjusting for volume
-            left = ((int32_t)(current_RAM_Buffer[ram_buffer_index>>repeat_shift] * volume) + MID_VALUE) >> 4;
-#else            
-            left = (current_RAM_Buffer[ram_buffer_index>>repeat_shift] + MID_VALUE) >> 4;
-#endif            
-            right = left;
-        }
-        ram_buffer_index++;
-
-        if (!play_stereo)
+        if (audioZoneIrq(&zones[i]))
         {
-            // Want mono, so average two channels
-            left = (left + right) >> 1;
-            right = left;
-        }
-
-        // Combine the two channels
-        dma_buffer[dma_buffer_index][i] = (right << 16) + left;
-
-        if ((ram_buffer_index<<1) == ram_buffer_wrap) 
-        {
-            // Need a new RAM buffer
-            doubleBufferGetLast(&double_buffers, &current_RAM_Buffer, &current_RAM_length);
-
-            // reset read position of RAM buffer to start
-            ram_buffer_index = 0;
-
-            // Signal to populate a new RAM buffer
-            Event e = populate_double;
-            queue_try_add(&eventQueue, &e);
+            TRACE(trace_dma_irq, i);
+            refill = true;
         }
     }
-    dma_buffer_index = 1 - dma_buffer_index;
-}
 
-// Obtain the DMA channels - need 2 
-static void claimDmaChannels(int num_channels)
-{
-    for (int i=0; i<num_channels; ++i)
+    if (refill)
     {
-        dma_channel[i] = dma_claim_unused_channel(true); 
+        // Populate buffer outside of IRQ
+        Event e = populate_dma;
+        queue_try_add(&eventQueue, &e);
     }
 }
 
-// Configure the DMA channels - including chaining
-static void initDma(int buffer_index, int slice, int chain_index)
-{
-    dma_channel_config config = dma_channel_get_default_config(dma_channel[buffer_index]); 
-    channel_config_set_read_increment(&config, true); 
-    channel_config_set_write_increment(&config, false); 
-    channel_config_set_dreq(&config, DREQ_PWM_WRAP0 + slice); 
-    channel_config_set_transfer_data_size(&config, DMA_SIZE_32); 
-    channel_config_set_chain_to(&config, dma_channel[chain_index]);
-
-    // Set up config
-    dma_channel_configure(dma_channel[buffer_index], 
-                          &config, 
-                          &pwm_hw->slice[slice].cc, 
-                          dma_buffer[buffer_index],
-                          DMA_BUFFER_LENGTH,
-                          false);
-}
-
 int main(void) 
 {
     // Overclock to 180MHz so that system clock is a multiple of typical
     // audio sampling rates
-    bool clock_set = set_sys_clock_khz(180000, true);
+    bool sys_clock_ok = set_sys_clock_khz(SYSTEM_CLOCK_KHZ, true);
     
     // Adjust frequency before initialising, so serial port will work
     stdio_init_all();
 
     // Now stdio is available, check the frequency was set
-    if (!clock_set)
+    if (!sys_clock_ok)
     {
         printf("Cannot set clock rate\n");
         return -1;
     }   
 
-    // Set up the PWMs with arbitrary values, will be updated when play starts
-    pwmChannelInit(&pwm_channel[0], AUDIO_PIN);
-    pwmChannelInit(&pwm_channel[1], AUDIO_PIN+1);
-
-    // Get the DMA channels for the chain
-    claimDmaChannels(2);
-
-    // Initialise and Chain the two DMAs together
-    initDma(0, pwmChannelGetSlice(&pwm_channel[0]), 1);
-    initDma(1, pwmChannelGetSlice(&pwm_channel[0]), 0);
-
-    // Set the DMA interrupt handler
-    irq_set_exclusive_handler(DMA_IRQ_1, dmaInterruptHandler); 
-
-    // Enable the interrupts for both of the chained dma channels
-    int mask = 0;
+    // Source buffers are taken from the arena as sounds are selected
+    audioArenaCreate(&arena, arena_memory, ARENA_SIZE);
 
-    for (int i=0;i<2;++i)
+    // Set up the PWMs and DMA chain of each zone
+    for (int i = 0; i < NUM_ZONES; ++i)
     {
-        mask |= 0x01 << dma_channel[i];
+        audioZoneCreate(&zones[i], zone_pin[i], play_stereo);
     }
 
-    dma_set_irq1_channel_mask_enabled(mask, true);
+    // Set the DMA interrupt handler, shared by all zones
+    irq_set_exclusive_handler(DMA_IRQ_1, dmaInterruptHandler); 
     irq_set_enabled(DMA_IRQ_1, true);
 
     // Initialise the buttons
@@ -320,18 +363,29 @@ int main(void)
     debounceButtonCreate(&button[3], button_debug_change, 40, buttonCallback, false, true);
     debounceButtonCreate(&button[4], button_debug_quit, 40, buttonCallback, false, true);
 
+#ifdef MODIFIER_GPIO
+    // Modifier is only sampled, so reports no events
+    debounceButtonCreate(&button[5], MODIFIER_GPIO, 40, NULL, false, true);
+#endif
+
     // Create the event queue
     Event event = empty;
-    queue_init(&eventQueue, sizeof(event), 6);
+    queue_init(&eventQueue, sizeof(event), 8);
 
-    // Set up noise buffer
-    colourNoiseCreate(&cn[0], 0.5);
-    colourNoiseSeed(&cn[0], 0);
-    colourNoiseCreate(&cn[1], 0.5);
-    colourNoiseSeed(&cn[1], 2^15-1);
+    // Receive commands from the UART without blocking the main loop
+    ringBufferCreate(&command_buffer, command_data, COMMAND_BUFFER_SIZE);
+    protocolParserCreate(&parser);
+    stdio_set_chars_available_callback(commandCallback, NULL);
 
-    // Create the double buffers
-    doubleBufferCreate(&double_buffers, ram_buffer[0], ram_buffer[1], RAM_BUFFER_LENGTH);
+    // Set up noise buffers, seeded differently for each zone, with files unnormalised until loaded
+    for (int i = 0; i < NUM_ZONES; ++i)
+    {
+        sources[i].file_gain = GAIN_RAMP_UNITY;
+        colourNoiseCreate(&sources[i].cn[0], 1);
+        colourNoiseSeed(&sources[i].cn[0], 2*i);
+        colourNoiseCreate(&sources[i].cn[1], 1);
+        colourNoiseSeed(&sources[i].cn[1], (2^15-1) + 2*i);
+    }
 
     // Initialise the file system
     fsInitialise(&mount);
@@ -342,14 +396,41 @@ int main(void)
     int sm = 0;
     uint offset = pio_add_program(pio, &ws2812_program);
     ws2812_program_init(pio, sm, offset, WS2812_PIN, 800000, IS_RGBW);
+    ledEngineCreate(&leds, pio, sm, NUM_PIXELS);
+    ledEngineSetDither(&leds, LED_DITHER_BELOW);
 
     // Get the initial states
     sound_state new_state;
-    configGetStatus(&mount, &new_state, &volume, &led, &intensity);
+    uint32_t sleep_minutes;
+    configGetStatus(&mount, &new_state, &sources[0].volume, &led, &intensity, &sleep_minutes);
+    configGetSynth(&mount, &synth);
     
     // Use the initial states
-    changeState(new_state);
-    set_pixel(pio, led, intensity);
+    changeState(0, new_state);
+    ledEngineSetColour(&leds, led, intensity);
+
+    for (int i = 1; i < NUM_ZONES; ++i)
+    {
+        configGetZone(&mount, i, &new_state, &sources[i].volume);
+        changeState(i, new_state);
+    }
+
+    // Sleep timer runs from power on
+    sleepTimerCreate(&sleep_countdown, sleep_minutes);
+    sleepTimerStart(&sleep_countdown);
+
+    // The programme also runs from power on
+    if (fsMounted(&mount) && timelineLoad(&programme, FILE_NAME_TIMELINE))
+    {
+        STATUS(("Timeline of %lu actions\n", programme.num));
+    }
+    uint64_t now_us = time_us_64();
+    startTimeline(now_us, now_us);
+
+#ifdef PC_PROFILE
+    // Profile from here, so the histogram only holds the main loop
+    pcProfileStart();
+#endif
 
     /*
      * Main loop 
@@ -357,11 +438,35 @@ int main(void)
     while (true)
     {
         queue_remove_blocking(&eventQueue, &event);
+
+        // Any button or command wakes from sleep. Buttons are otherwise ignored, but
+        // the command is still run. The timeline runs whilst asleep, and wakes if it
+        // changes the sound
+        if (asleep && (event != timeline_due))
+        {
+            if (event != populate_dma && event != send_telemetry)
+            {
+                exitSleep();
+            }
+
+            if (event != command_received)
+            {
+                continue;
+            }
+        }
+
+        // Button events become volume, intensity or LED events depending on the modifier
+        event = applyModifier(event);
         
         switch (event)
         {
             case change_music:
-                changeState(current_state + 1);
+                fadeToState(selected_zone, sources[selected_zone].state + 1);
+            break;
+
+            case change_zone:
+                selected_zone = (selected_zone + 1) % NUM_ZONES;
+                STATUS(("Buttons control zone %lu\n", selected_zone));
             break;
 
             case change_led:
@@ -369,38 +474,70 @@ int main(void)
                 {
                     led = led_start;
                 }
-                set_pixel(pio, led, intensity);
+                ledEngineSetColour(&leds, led, intensity);
                 configSetLed(&mount, led);
             break;
 
             case increase_volume:
-                volume = fminf(1.0, volume+0.1);
-                configSetVolume(&mount, volume);
+                sources[selected_zone].volume = fminf(1.0, sources[selected_zone].volume+0.1);
+                sources[selected_zone].ramping = false;
+                updateGain(selected_zone);
+                storeZone(selected_zone);
             break;
 
             case decrease_volume:
-                volume = fmaxf(0.0, volume-0.1);
-                configSetVolume(&mount, volume);
+                sources[selected_zone].volume = fmaxf(0.0, sources[selected_zone].volume-0.1);
+                sources[selected_zone].ramping = false;
+                updateGain(selected_zone);
+                storeZone(selected_zone);
+            break;
+
+            case change_sleep:
+                sleep_countdown.minutes = sleepTimerNextMinutes(sleep_countdown.minutes);
+                sleepTimerStart(&sleep_countdown);
+                for (int i = 0; i < NUM_ZONES; ++i)
+                {
+                    updateGain(i);
+                }
+                configSetSleep(&mount, sleep_countdown.minutes);
+                STATUS(("Sleep timer: %lu minutes\n", sleep_countdown.minutes));
             break;
 
             case increase_intensity:
                 intensity = fminf(1.0, intensity+0.1);
-                set_pixel(pio, led, intensity);
+                ledEngineSetColour(&leds, led, intensity);
                 configSetIntensity(&mount, intensity);
             break;
 
             case decrease_intensity:
                 intensity = fmaxf(0.0, intensity-0.1);
-                set_pixel(pio, led, intensity);
+                ledEngineSetColour(&leds, led, intensity);
                 configSetIntensity(&mount, intensity);
             break;
 
             case populate_dma:
-                populateDmaBuffer();
+                serviceZones();
+                serviceCard();
+            break;
+
+            case command_received:
+                handleCommands();
             break;
 
-            case populate_double:
-                doubleBufferPopulateNext(&double_buffers);
+            case send_telemetry:
+                sendTelemetry();
+            break;
+
+            case timeline_due:
+                runTimeline();
+            break;
+
+            case send_trace:
+                sendTrace();
+            break;
+
+            case send_profile:
+                sendProfile();
             break;
 
             case quit:
@@ -415,8 +552,34 @@ int main(void)
     return 0;
 }
 
-static void changeState(sound_state new_state)
+/*
+ * fadeToState
+ * zone         Zone to change
+ * new_state    State to change to
+ *
+ * Ramp the gain to zero, then change state once the silent block is playing
+ */
+static void fadeToState(uint32_t zone, sound_state new_state)
+{
+    zone_source* src = &sources[zone];
+
+    if (src->state == off)
+    {
+        changeState(zone, new_state);
+    }
+    else
+    {
+        src->fade_state = new_state;
+        src->fade_blocks = 0;
+        src->fading = true;
+        gainRampSetTarget(&zones[zone].gain, 0);
+    }
+}
+
+static void changeState(uint32_t zone, sound_state new_state)
 {
+    zone_source* src = &sources[zone];
+
     // Handle wrap
     if (new_state == end)
     {
@@ -424,21 +587,41 @@ static void changeState(sound_state new_state)
     }
 
     // Stop playing if we are, and close the file if it is open
-    if (current_state != off)
+    if (src->state != off)
     {
-        stopMusic();
+        stopMusic(zone);
 
         // Close the file, if it was open
-        if (isFile(current_state))
+        if (isFile(src->state) || src->clip_reading)
         {
-            musicFileClose(&mf);
+            soundFileClose(&src->sf);
+            src->clip_reading = false;
         }
     }
 
+    // Only files are normalised
+    src->file_gain = GAIN_RAMP_UNITY;
+    src->scan.running = false;
+    src->scan_done = false;
+
+    // Silence the zone. This is not stored, so the zone plays again after a restart
+    if (new_state == off)
+    {
+        src->state = off;
+        return;
+    }
+
+    // Without a card, noise plays until serviceCard has mounted it, then the file resumes
+    if (isFile(new_state) && !cardReady() && (src->resume_state == off))
+    {
+        src->resume_state = new_state;
+        new_state = FALLBACK_SOUND;
+    }
+
     // If moving to file state try to open the file
     if (new_state == file_1)
     {
-        if (!loadFile(FILE_NAME_1))
+        if (!loadFile(src, FILE_NAME_1, 0))
         {
             new_state += 1;
         }
@@ -446,7 +629,7 @@ static void changeState(sound_state new_state)
 
     if (new_state == file_2)
     {
-        if (!loadFile(FILE_NAME_2))
+        if (!loadFile(src, FILE_NAME_2, 1))
         {
             new_state += 1;
         }
@@ -454,7 +637,25 @@ static void changeState(sound_state new_state)
 
     if (new_state == file_3)
     {
-        if (!loadFile(FILE_NAME_3))
+        if (!loadFile(src, FILE_NAME_3, 2))
+        {
+            new_state += 1;
+        }
+    }
+
+    // If moving to the user defined noise, try to load its shape
+    if (new_state == custom)
+    {
+        if (!(cardReady() && noiseShaperLoad(&custom_shape, FILE_NAME_NOISE)))
+        {
+            new_state += 1;
+        }
+    }
+
+    // If moving to the texture, start loading its clip
+    if (new_state == texture)
+    {
+        if (!loadClip(src, FILE_NAME_TEXTURE))
         {
             new_state += 1;
         }
@@ -466,232 +667,1496 @@ static void changeState(sound_state new_state)
         new_state = start;
     }
 
-    // State needs to be changed before buffers populated
-    current_state = new_state;
-
-    // Store the state
-    configSetSoundState(&mount, current_state);
+    // Generated sources take their buffers here, files when they are loaded
+    if ((isColour(new_state) || isSynth(new_state)) && !allocateBuffers(src, AUDIO_ARENA_NOISE_RAM_LENGTH, 0))
+    {
+        src->state = off;
+        return;
+    }
 
-    // Now in a position to start playing the sound
+    // Plan the clock before the state is changed, so an unsupported rate leaves the zone silent
     uint32_t sample_rate;
+    uint32_t min_khz;
+    bool sampled_stereo;
+    clock_plan plan;
 
-    if (isColour(current_state))
+    if (isColour(new_state) || isSynth(new_state))
     {
         sample_rate = SAMPLE_RATE;
         sampled_stereo = true;
+        min_khz = NOISE_CLOCK_KHZ;
     }
-    else if (isFile(current_state))
+    else if (new_state == texture)
     {
-        STATUS(("Sample rate is %u\n", mf.sample_rate));
-        sample_rate = musicFileGetSampleRate(&mf);
-        sampled_stereo = musicFileIsStereo(&mf);
+        // Grains are played at the rate of the clip, with the channels independent
+        sample_rate = soundFileGetSampleRate(&src->sf);
+        sampled_stereo = true;
+        min_khz = FILE_CLOCK_KHZ;
+    }
+    else
+    {
+        STATUS(("Sample rate is %lu\n", soundFileGetSampleRate(&src->sf)));
+        sample_rate = soundFileGetSampleRate(&src->sf);
+        sampled_stereo = soundFileIsStereo(&src->sf);
+        min_khz = FILE_CLOCK_KHZ;
     }
-    startMusic(sample_rate);
-}
 
-void startMusic(uint32_t sample_rate)
-{ 
-    Event skip = empty;
+    if (!planMusic(sample_rate, min_khz, &plan))
+    {
+        if (isFile(new_state) || src->clip_reading)
+        {
+            soundFileClose(&src->sf);
+            src->clip_reading = false;
+        }
+        releaseBuffers(src);
+        src->state = off;
+        return;
+    }
 
-    // Reconfigure the PWM for the new wrap and clock
-    getSampleValues(sample_rate, &repeat_shift, &wrap, &mid_point, &fraction);
-    pwmChannelReconfigure(&pwm_channel[0], fraction, wrap);
-    pwmChannelReconfigure(&pwm_channel[1], fraction, wrap);
+    // Reset the spectral shaping for the new colour
+    if (isShaped(new_state))
+    {
+        const noise_shape* shape = (new_state == blue) ? &noise_shape_blue :
+                                   (new_state == violet) ? &noise_shape_violet :
+                                   (new_state == grey) ? &noise_shape_grey : &custom_shape;
 
-    // reset read positions
-    ram_buffer_index = 0;
-    dma_buffer_index = 0;
+        noiseShaperCreate(&src->ns[0], shape);
+        noiseShaperCreate(&src->ns[1], shape);
+    }
+    else if (isSynth(new_state))
+    {
+        startSynth(src, new_state);
+    }
 
-    // Reinitialise the double buffers
-    doubleBufferInitialise(&double_buffers, &populateCallback, &current_RAM_Buffer, &current_RAM_length);
+    // State needs to be changed before buffers populated
+    src->state = new_state;
+    TRACE(trace_state, (zone << 8) | new_state);
 
-    // Populate the first DMA buffer
-    populateDmaBuffer();
+    // Store the state, unless playing noise until the file can be resumed
+    if ((new_state != FALLBACK_SOUND) || (src->resume_state == off))
+    {
+        src->resume_state = off;
+        storeZone(zone);
+    }
 
-    // Empty the message queue, to avoid processing populate messages
-    while(queue_try_remove(&eventQueue, &skip));
+    // Now in a position to start playing the sound
+    startMusic(zone, &plan, sample_rate, sampled_stereo);
+}
 
-    // Populate the second DMA buffer
-    populateDmaBuffer();
+/*
+ * planMusic
+ * sample_rate  Rate of the sound to be played
+ * min_khz      Lowest system clock, gives headroom for decoding
+ * plan         Populated with the clock, wrap and divider
+ *
+ * Returns false if the rate cannot be played
+ */
+static bool planMusic(uint32_t sample_rate, uint32_t min_khz, clock_plan* plan)
+{
+#if NUM_ZONES > 1
+    // Zones share the system clock, which is fixed at a clock that plays every supported rate
+    bool planned = clockPlannerPlanFixed(sample_rate, AUDIO_ZONE_PWM_BITS, SYSTEM_CLOCK_KHZ, plan);
+#else
+    // Find the clock, wrap and divider for the sample rate
+    bool planned = clockPlannerPlan(sample_rate, AUDIO_ZONE_PWM_BITS, min_khz, plan);
+#endif
 
-    // Start the first DMA channel in the chain and both PWMs
-    uint32_t pwm_mask = 0;
+    if (!planned)
+    {
+        printf("Unsupported sample rate %lu\n", sample_rate);
+    }
+    return planned;
+}
 
-    pwmChannelAddStartList(&pwm_channel[0], &pwm_mask);
-    pwmChannelAddStartList(&pwm_channel[1], &pwm_mask);
+void startMusic(uint32_t zone, const clock_plan* plan, uint32_t sample_rate, bool sampled_stereo)
+{ 
+    STATUS(("Clock %lu kHz, wrap %lu, error %lu ppm\n", plan->sys_khz, plan->wrap, plan->error_ppm));
 
-    // Build the DMA start mask
-    uint32_t chan_mask = 0x01 << dma_channel[0];
+    // Clock can only be changed whilst the PWM and DMA are stopped
+    if (plan->sys_khz * 1000 != clock_get_hz(clk_sys))
+    {
+        setSystemClock(plan->sys_khz);
+    }
 
-    dma_start_channel_mask(chan_mask);
-    pwmChannelStartList(pwm_mask);
+    // Reconfigure the PWM, then fade in from silence across the first DMA block
+    audioZoneSetBuffers(&zones[zone], sources[zone].ram[0], sources[zone].ram[1], sources[zone].ram_length);
+    audioZoneStart(&zones[zone], plan, sample_rate, sampled_stereo, zoneGain(zone), populateCallback, &sources[zone]);
 }
 
-void stopMusic(void)
+void stopMusic(uint32_t zone)
 {
-    // Disable DMAs and PWMs
-    pwmChannelStop(&pwm_channel[0]);
-    pwmChannelStop(&pwm_channel[1]);
-    pwmChannelStop(&pwm_channel[0]);
-    dma_channel_abort(dma_channel[0]);
-    dma_channel_abort(dma_channel[1]);
-    dma_channel_abort(dma_channel[0]);
+    // Disable DMAs and PWMs, then return the buffers of the source
+    audioZoneStop(&zones[zone]);
+    releaseBuffers(&sources[zone]);
 }
 
 void exitMusic(void)
 {
     // Stop music and unmount the file system
-    stopMusic();
+    for (int i = 0; i < NUM_ZONES; ++i)
+    {
+        stopMusic(i);
+        sources[i].state = off;
+    }
     fsUnmount(&mount);
-    current_state = off;
 }
 
 /*
- * urgb_u32
+ * serviceZones
  *
- * r, g , b     Colour channel intensity
- * 
- * Return a 32 bit rgb value for writing to the PIO FIFO
- */
-static inline uint32_t urgb_u32(uint8_t r, uint8_t g, uint8_t b) 
-{
-    return
-            ((uint32_t) (r) << 8) |
-            ((uint32_t) (g) << 16) |
-            (uint32_t) (b);
-}
-
-/*
- * set_pixel
- * 
- * led          Colour id
- * intensity    Ranges from 0 (black) to 1 (full colour)
- * 
- */ 
-static void set_pixel(PIO pio, led_state led, float intensity)
-{
-    STATUS(("set_pixel: led = %u intensity = %f\n", led, intensity));
-    
-    pio_sm_put_blocking(pio0, 0, urgb_u32(rgb_colours[led][0] * intensity, 
-                                          rgb_colours[led][1] * intensity, 
-                                          rgb_colours[led][2] * intensity) << 8u);
-}
-
-/*
- * populateCallback
- * buffer       Pointer to buffer to populate
- * len          Max number of 16 bit samples to copy into buffer
- * 
- * Write 16 bit stereo sound data to to the supplied buffer
- * callback function called from circular buffer class
- * 
+ * Runs the refills that the zones are waiting for, earliest deadline first.
+ * The fade and sleep timer are tracked at the start of each DMA block
  */
-uint32_t populateCallback(int16_t* buffer, uint32_t len)
+static void serviceZones(void)
 {
-    uint32_t written = len;
+    audio_zone_job job;
+    audio_zone* z;
 
-    switch (current_state)
+    while ((z = audioZoneNextJob(zones, NUM_ZONES, &job)) != NULL)
     {
-        case white:
-            for (int i=0;i<len;i+=2)
+        uint32_t zone = z - zones;
+        zone_source* src = &sources[zone];
+
+        if (job == audio_zone_refill_dma)
+        {
+            if (src->fading && (src->fade_blocks >= 2))
             {
-                // Divide the output by 2, to make similar volume to other colours
-                buffer[i] = (int16_t)(colourNoiseWhite(&cn[0]) * (MID_VALUE >> 1));
-                buffer[i+1] = (uint16_t)(colourNoiseWhite(&cn[1]) * (MID_VALUE >> 1));
+                // Faded block has been played, so safe to change
+                src->fading = false;
+                changeState(zone, src->fade_state);
+                continue;
             }
-        break;
-
-        case pink:
-            for (int i=0;i<len;i+=2)
+            else if (sleepTimerExpired(&sleep_countdown))
             {
-                buffer[i] = (int16_t)(colourNoisePink(&cn[0]) * MID_VALUE);
-                buffer[i+1] = (int16_t)(colourNoisePink(&cn[1]) * MID_VALUE);
+                enterSleep();
+                return;
             }
-        break;
 
-        case brown:
-            for (int i=0;i<len;i+=2)
+            // Track the sleep timer fade, and any timeline volume ramp
+            if (src->ramping)
             {
-                buffer[i] = (int16_t)(colourNoiseBrown(&cn[0]) * MID_VALUE);
-                buffer[i+1] = (int16_t)(colourNoiseBrown(&cn[1]) * MID_VALUE);
+                rampVolume(src);
             }
-        break;
-
-        default:
-            if (isFile(current_state))
+            updateGain(zone);
+#ifdef LED_SLEEP_FADE
+            if (!led_fading && (sleepTimerLevel(&sleep_countdown) < GAIN_RAMP_UNITY))
             {
-                musicFileRead(&mf, buffer, len, &written);
+                led_fading = true;
+                ledEngineSetEffect(&leds, led_effect_fade_out, sleepTimerRemainingMs(&sleep_countdown));
             }
-        break;
-    }
-    return written;
-}
+#endif
+        }
 
-/*
- * loadFile
- * filename     String containing name of music file to open
- * 
- * Returns true if music file was successfully opened and header read
- * 
- */
-static bool loadFile(const char* filename)
-{
-    bool success = false;
+        uint32_t underruns = z->underruns;
 
-    if (fsMount(&mount))
-    {
-        if (!musicFileCreate(&mf, filename, cache_buffer, CACHE_BUFFER))
+        TRACE((job == audio_zone_refill_dma) ? trace_dma_begin : trace_double_begin, zone);
+        audioZoneRunJob(z, job);
+        TRACE((job == audio_zone_refill_dma) ? trace_dma_end : trace_double_end, zone);
+
+        if (z->underruns != underruns)
         {
-            printf("Cannot open file: %s\n", filename);
-        }   
-        else
+            TRACE(trace_underrun, zone);
+        }
+
+        if (src->file_failed)
         {
-            success = true;
+            src->file_failed = false;
+            fallBack(zone);
+        }
+
+        // Store the loudness of a file once measured, between refills rather than in the decode.
+        // The gain is applied from the next play, so the level does not step part way through
+        if (src->scan_done)
+        {
+            src->scan_done = false;
+            loudnessScanFinish(&src->scan);
+            loudnessStore(&mount, src->file_slot, &src->scan);
+            STATUS(("Zone %lu level %d cB, gain %u\n", zone, src->scan.entry.level_cb, src->scan.entry.gain));
+        }
+
+        if ((job == audio_zone_refill_dma) && src->fading && gainRampIsSilent(&z->gain))
+        {
+            src->fade_blocks++;
+        }
+        else if ((job == audio_zone_refill_double) && isFile(src->state))
+        {
+            // Decode further ahead for expensive streams, less far for cheap ones
+            uint32_t latency = decodeStatsLatency(&src->stats, soundFileGetSampleRate(&src->sf), soundFileIsStereo(&src->sf),
+                                                  src->ram_length / 2, src->ram_length);
+
+            if (latency != z->double_buffers.fill_len)
+            {
+                STATUS(("Zone %lu decode ahead %lu samples\n", zone, latency));
+                doubleBufferSetLatency(&z->double_buffers, latency);
+            }
         }
     }
-    return success;
 }
 
-// Called when a button is pressed
-void buttonCallback(uint gpio_number, debounce_event event)
+/*
+ * startSynth
+ * src          Source of the zone
+ * state        Generated sound to start
+ *
+ * Set up the oscillators from the stored frequencies. The phase step is
+ * calculated here, so generation needs no division
+ */
+static void startSynth(zone_source* src, sound_state state)
 {
-    Event e = empty;
-    bool sel = getBootselButton();
+    oscillatorBankCreate(&src->osc[0]);
+    oscillatorBankCreate(&src->osc[1]);
+    oscillatorBankCreate(&src->breath);
 
-    switch (gpio_number)
+    switch (state)
     {
-        case button_change:
-        case button_debug_change:
-            e = sel ? change_led : change_music;
+        case tone:
+            oscillatorBankAdd(&src->osc[0], synth.tone_mhz, SAMPLE_RATE, SYNTH_AMPLITUDE);
+            oscillatorBankAdd(&src->osc[1], synth.tone_mhz, SAMPLE_RATE, SYNTH_AMPLITUDE);
         break;
-        case button_increase:
-#ifdef VOLUME        
-            e = sel ? increase_intensity : increase_volume;
-#else
-            e = increase_intensity;
-#endif
+
+        case binaural:
+            oscillatorBankAdd(&src->osc[0], synth.tone_mhz, SAMPLE_RATE, SYNTH_AMPLITUDE);
+            oscillatorBankAdd(&src->osc[1], synth.tone_mhz + synth.beat_mhz, SAMPLE_RATE, SYNTH_AMPLITUDE);
         break;
 
-        case button_decrease:
-#ifdef VOLUME        
-            e = sel ? decrease_intensity : decrease_volume;
-#else
-            e = decrease_intensity;
-#endif
+        case breathing:
+            oscillatorBankAdd(&src->breath, 1000000 / synth.breath_ms, SAMPLE_RATE, INT16_MAX);
         break;
 
-        case button_debug_quit:
-            e = quit;
+        default:
         break;
     }
-    queue_try_add(&eventQueue, &e);
 }
 
 /*
- * getBootselButton
+ * fallBack
+ * zone         Zone whose file cannot be read
  *
- * Check if boot select button is pressed
- * 
+ * Fade to noise, remembering the file so that it resumes when the SD card
+ * returns. The stored state is left as the file
+ */
+static void fallBack(uint32_t zone)
+{
+    zone_source* src = &sources[zone];
+
+    if (isFile(src->state) && (src->resume_state == off))
+    {
+        STATUS(("Zone %lu cannot read file, playing noise\n", zone));
+        src->resume_state = src->state;
+        fadeToState(zone, FALLBACK_SOUND);
+    }
+}
+
+/*
+ * serviceCard
+ *
+ * Tracks the SD card being removed and replaced. Mounting reads the card, so
+ * is only tried when every zone has enough sound queued to cover it
+ */
+static void serviceCard(void)
+{
+    if (!fsMounted(&mount) && (audioZoneSlackUs(zones, NUM_ZONES) < CARD_MOUNT_SLACK_US))
+    {
+        return;
+    }
+
+    switch (fsService(&mount))
+    {
+        case fs_card_removed:
+            for (int i = 0; i < NUM_ZONES; ++i)
+            {
+                fallBack(i);
+            }
+        break;
+
+        case fs_card_inserted:
+            for (int i = 0; i < NUM_ZONES; ++i)
+            {
+                if ((sources[i].resume_state != off) && !sources[i].fading)
+                {
+                    STATUS(("Zone %lu resuming file\n", i));
+                    fadeToState(i, sources[i].resume_state);
+                }
+            }
+        break;
+
+        default:
+        break;
+    }
+}
+
+/*
+ * cardReady
+ *
+ * Returns true if the SD card is mounted. Otherwise the mount is left to
+ * serviceCard, which waits until every zone has sound queued, so changing
+ * the sound of one zone never holds up the others
+ */
+static bool cardReady(void)
+{
+    if (!fsMounted(&mount))
+    {
+        fsRequestMount(&mount);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * storeZone
+ *
+ * Store the sound and volume of a zone. Zone 0 uses the original settings
+ */
+static void storeZone(uint32_t zone)
+{
+    if (zone == 0)
+    {
+        configSetSoundState(&mount, sources[0].state);
+        configSetVolume(&mount, sources[0].volume);
+    }
+    else
+    {
+        configSetZone(&mount, zone, sources[zone].state, sources[zone].volume);
+    }
+}
+
+/*
+ * updateGain
+ * zone         Zone to update
+ *
+ * Set the target of the gain ramp from the volume
+ * 
+ */
+static void updateGain(uint32_t zone)
+{
+    if (!sources[zone].fading)
+    {
+        gainRampSetTarget(&zones[zone].gain, zoneGain(zone));
+    }
+}
+
+// Q15 gain of a zone, from its volume, the loudness of its file and the sleep timer
+static int32_t zoneGain(uint32_t zone)
+{
+#ifdef VOLUME
+    int32_t target = (int32_t)(sources[zone].volume * GAIN_RAMP_UNITY);
+#else
+    int32_t target = GAIN_RAMP_UNITY;
+#endif
+    target = (target * sources[zone].file_gain) >> 15;
+    return (target * sleepTimerLevel(&sleep_countdown)) >> 15;
+}
+
+/*
+ * enterSleep
+ *
+ * Called when the sleep timer expires. Stops the sound, releases the SD card
+ * and lowers the clock. The LED keeps its last colour, as the WS2812 latches it
+ * 
+ */
+static void enterSleep(void)
+{
+    STATUS(("Entering sleep\n"));
+    sleepTimerStop(&sleep_countdown);
+
+    for (int i = 0; i < NUM_ZONES; ++i)
+    {
+        sources[i].wake_state = sources[i].state;
+
+        if (isFile(sources[i].state) || sources[i].clip_reading)
+        {
+            soundFileClose(&sources[i].sf);
+            sources[i].clip_reading = false;
+        }
+    }
+    exitMusic();
+
+    // Clocks that are not used whilst asleep
+    clock_stop(clk_usb);
+    clock_stop(clk_adc);
+
+    // Buttons wake the CPU by their GPIO edge, rather than being scanned
+    debounceButtonSleep(true);
+
+    // The night light stops dithering, so its frame timer stops
+    ledEngineSleep(&leds, true);
+
+    setSystemClock(SLEEP_CLOCK_KHZ);
+    asleep = true;
+}
+
+/*
+ * exitSleep
+ *
+ * Restore the clock, remount the SD card and resume playing the sound that
+ * was playing when sleep started
+ * 
+ */
+static void exitSleep(void)
+{
+    setSystemClock(SYSTEM_CLOCK_KHZ);
+    asleep = false;
+    STATUS(("Exiting sleep\n"));
+
+    // Restore the clocks stopped by enterSleep, as configured at boot
+    clock_configure(clk_usb, 0, CLOCKS_CLK_USB_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB, 48 * MHZ, 48 * MHZ);
+    clock_configure(clk_adc, 0, CLOCKS_CLK_ADC_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB, 48 * MHZ, 48 * MHZ);
+    debounceButtonSleep(false);
+    ledEngineSleep(&leds, false);
+
+    // Nothing is playing yet, so the card can be mounted straight away
+    fsMount(&mount);
+    sleepTimerStart(&sleep_countdown);
+
+    // Restore the night light, if it faded with the timer
+    if (led_fading)
+    {
+        led_fading = false;
+        ledEngineSetEffect(&leds, led_effect_static, 0);
+    }
+    for (int i = 0; i < NUM_ZONES; ++i)
+    {
+        changeState(i, sources[i].wake_state);
+    }
+}
+
+/*
+ * setSystemClock
+ * khz          New system clock frequency
+ *
+ * Change the system clock, and update the peripherals that derive their
+ * timing from it. Must only be called when sound is not playing
+ * 
+ */
+static bool setSystemClock(uint32_t khz)
+{
+    // Allow any queued debug output to complete at the old baud rate
+    uart_default_tx_wait_blocking();
+
+    if (!set_sys_clock_khz(khz, false))
+    {
+        printf("Cannot set clock rate %lu kHz\n", khz);
+        return false;
+    }
+
+    // The peripheral clock follows the system clock
+    uart_set_baudrate(uart_default, PICO_DEFAULT_UART_BAUD_RATE);
+
+    sd_card_t* pSD = sd_get_by_num(0);
+
+    if (pSD->spi->initialized)
+    {
+        spi_set_baudrate(pSD->spi->hw_inst, pSD->spi->baud_rate);
+    }
+    ws2812_program_set_freq(pio0, 0, 800000);
+
+    return true;
+}
+
+/*
+ * commandCallback
+ *
+ * Called from the stdio UART interrupt when characters arrive. Moves them to
+ * the ring buffer, so the main loop can parse them
+ */
+static void commandCallback(void* param)
+{
+    while (uart_is_readable(uart_default))
+    {
+        ringBufferPut(&command_buffer, (uint8_t)uart_getc(uart_default));
+    }
+
+    Event e = command_received;
+    queue_try_add(&eventQueue, &e);
+}
+
+// Called at the telemetry period
+static bool telemetryCallback(repeating_timer_t* rt)
+{
+    Event e = send_telemetry;
+    queue_try_add(&eventQueue, &e);
+    return true;
+}
+
+// Parse the received bytes, acting on each complete frame
+static void handleCommands(void)
+{
+    uint8_t byte;
+
+    while (ringBufferGet(&command_buffer, &byte))
+    {
+        if (protocolParse(&parser, byte))
+        {
+            handleFrame(&parser.frame);
+        }
+    }
+}
+
+/*
+ * handleFrame
+ * frame        Valid frame received from the host
+ *
+ * Perform the command, then acknowledge it
+ */
+static void handleFrame(const protocol_frame* frame)
+{
+    const uint8_t* p = frame->payload;
+    bool accepted = false;
+
+    TRACE(trace_command, frame->cmd);
+
+    switch (frame->cmd)
+    {
+        case protocol_set_state:
+            if ((frame->len == 2) && (p[0] < NUM_ZONES) && (p[1] >= start) && (p[1] < end))
+            {
+                fadeToState(p[0], p[1]);
+                accepted = true;
+            }
+        break;
+
+        case protocol_set_volume:
+            if ((frame->len == 2) && (p[0] < NUM_ZONES) && (p[1] <= 100))
+            {
+                sources[p[0]].volume = p[1] / 100.0f;
+                sources[p[0]].ramping = false;
+                updateGain(p[0]);
+                storeZone(p[0]);
+                accepted = true;
+            }
+        break;
+
+        case protocol_set_led:
+            if ((frame->len == 2) && (p[0] < led_wrap) && (p[1] <= 100))
+            {
+                led = p[0];
+                intensity = p[1] / 100.0f;
+                ledEngineSetColour(&leds, led, intensity);
+                configSetLed(&mount, led);
+                configSetIntensity(&mount, intensity);
+                accepted = true;
+            }
+        break;
+
+        case protocol_set_sleep:
+            if (frame->len == 2)
+            {
+                sleep_countdown.minutes = protocolGet16(p);
+                sleepTimerStart(&sleep_countdown);
+                for (int i = 0; i < NUM_ZONES; ++i)
+                {
+                    updateGain(i);
+                }
+                configSetSleep(&mount, sleep_countdown.minutes);
+                accepted = true;
+            }
+        break;
+
+        case protocol_set_synth:
+            if (frame->len == 12)
+            {
+                synth_params params = {protocolGet32(p), protocolGet32(p + 4), protocolGet32(p + 8)};
+
+                if (configSynthValid(&params))
+                {
+                    synth = params;
+                    configSetSynth(&mount, &synth);
+
+                    // Restart generated sounds with the new frequencies
+                    for (int i = 0; i < NUM_ZONES; ++i)
+                    {
+                        if (isSynth(sources[i].state))
+                        {
+                            startSynth(&sources[i], sources[i].state);
+                        }
+                    }
+                    accepted = true;
+                }
+            }
+        break;
+
+        case protocol_set_clock:
+            if ((frame->len == 4) && (protocolGet32(p) < TIMELINE_DAY_MS / 1000))
+            {
+                clock_set = true;
+                clock_time_of_day_ms = protocolGet32(p) * 1000;
+                clock_set_us = time_us_64();
+
+                // Times of day can now be resolved, actions that have run are skipped
+                startTimeline(programme_start_us, clock_set_us);
+                accepted = true;
+            }
+        break;
+
+        case protocol_get_status:
+            sendStatus();
+            return;
+
+#ifdef EVENT_TRACE
+        case protocol_get_trace:
+            // Sent a frame at a time from the main loop, so refills are not delayed
+            trace_count = traceFreeze();
+            trace_sent = 0;
+            sendTrace();
+            return;
+#endif
+
+        case protocol_bench:
+            if ((frame->len == 1) && (p[0] <= 1))
+            {
+                sendBench(p[0]);
+                return;
+            }
+        break;
+
+#ifdef PC_PROFILE
+        case protocol_get_profile:
+            // The histogram is not counted whilst it is sent
+            pcProfilePause(true);
+            profile_index = 0;
+            sendProfile();
+            return;
+#endif
+
+        case protocol_get_decode_stats:
+            if ((frame->len == 1) && (p[0] < NUM_ZONES))
+            {
+                sendDecodeStats(p[0]);
+                return;
+            }
+        break;
+
+        case protocol_telemetry:
+            if (frame->len == 2)
+            {
+                uint16_t period = protocolGet16(p);
+
+                if (telemetry_running)
+                {
+                    cancel_repeating_timer(&telemetry_timer);
+                    telemetry_running = false;
+                }
+
+                if (period)
+                {
+                    period = (period < TELEMETRY_MIN_MS) ? TELEMETRY_MIN_MS : period;
+                    telemetry_running = add_repeating_timer_ms(-period, telemetryCallback, NULL, &telemetry_timer);
+                }
+                accepted = true;
+            }
+        break;
+    }
+
+    uint8_t ack[2] = {frame->cmd, accepted};
+    sendFrame(protocol_ack, ack, sizeof(ack));
+}
+
+// Encode and send a frame, raw so that no line ending translation is applied
+static void sendFrame(uint8_t cmd, const uint8_t* payload, uint8_t len)
+{
+    uint8_t out[PROTOCOL_MAX_PAYLOAD + PROTOCOL_OVERHEAD];
+    uint32_t n = protocolEncode(cmd, payload, len, out);
+
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        putchar_raw(out[i]);
+    }
+}
+
+/*
+ * sendStatus
+ *
+ * Reply with the current settings. The sound state of a zone is also its
+ * track index when playing a file
+ */
+static void sendStatus(void)
+{
+    uint8_t payload[7 + 2 * NUM_ZONES];
+    uint32_t remaining_s = sleep_countdown.running ? sleepTimerRemainingMs(&sleep_countdown) / 1000 : 0;
+
+    payload[0] = NUM_ZONES;
+    payload[1] = led;
+    payload[2] = (uint8_t)(intensity * 100 + 0.5f);
+    protocolPut16(&payload[3], sleep_countdown.minutes);
+    protocolPut16(&payload[5], (remaining_s > UINT16_MAX) ? UINT16_MAX : remaining_s);
+
+    for (int i = 0; i < NUM_ZONES; ++i)
+    {
+        payload[7 + 2 * i] = sources[i].state;
+        payload[8 + 2 * i] = (uint8_t)(sources[i].volume * 100 + 0.5f);
+    }
+    sendFrame(protocol_status, payload, sizeof(payload));
+}
+
+/*
+ * sendTelemetry
+ *
+ * Report uptime, SD card reads since the last report, the longest time
+ * interrupts have been disabled to read BOOTSEL and the state of the buffers
+ * of each zone
+ */
+static void sendTelemetry(void)
+{
+    uint8_t payload[16 + 11 * NUM_ZONES];
+    sd_stats sd;
+
+    sdStatsTake(&sd);
+    protocolPut32(&payload[0], to_ms_since_boot(get_absolute_time()));
+    protocolPut32(&payload[4], sd.bytes);
+    protocolPut32(&payload[8], sd.busy_us);
+    payload[12] = (parser.errors > UINT8_MAX) ? UINT8_MAX : parser.errors;
+    protocolPut16(&payload[13], (bootsel_irq_off_max_us > UINT16_MAX) ? UINT16_MAX : bootsel_irq_off_max_us);
+    payload[15] = NUM_ZONES;
+
+    for (int i = 0; i < NUM_ZONES; ++i)
+    {
+        audio_zone* z = &zones[i];
+        uint8_t* p = &payload[16 + 11 * i];
+
+        p[0] = sources[i].state;
+        p[1] = (uint8_t)(z->generation - z->refilled);      // DMA blocks waiting to be refilled
+        protocolPut32(&p[2], z->underruns);
+        p[6] = audioZoneLoad(z);
+        protocolPut16(&p[7], (z->refill_max_us[0] > UINT16_MAX) ? UINT16_MAX : z->refill_max_us[0]);
+        protocolPut16(&p[9], (z->refill_max_us[1] > UINT16_MAX) ? UINT16_MAX : z->refill_max_us[1]);
+    }
+    sendFrame(protocol_telemetry_data, payload, sizeof(payload));
+}
+
+/*
+ * sendDecodeStats
+ * zone         Zone to report
+ *
+ * Reply with the decode histograms of the file playing in the zone.
+ * Counts are limited to 16 bits
+ */
+static void sendDecodeStats(uint32_t zone)
+{
+    decode_stats* ds = &sources[zone].stats;
+    uint8_t payload[11 + 4 * DECODE_STATS_BINS];
+
+    payload[0] = zone;
+    protocolPut32(&payload[1], ds->frames);
+    protocolPut16(&payload[5], zones[zone].double_buffers.fill_len);
+    protocolPut16(&payload[7], (ds->decode_max_us > UINT16_MAX) ? UINT16_MAX : ds->decode_max_us);
+    protocolPut16(&payload[9], (ds->sd_wait_max_us > UINT16_MAX) ? UINT16_MAX : ds->sd_wait_max_us);
+
+    for (int i = 0; i < DECODE_STATS_BINS; ++i)
+    {
+        protocolPut16(&payload[11 + 2 * i], (ds->decode_us[i] > UINT16_MAX) ? UINT16_MAX : ds->decode_us[i]);
+        protocolPut16(&payload[11 + 2 * (DECODE_STATS_BINS + i)], (ds->frame_bytes[i] > UINT16_MAX) ? UINT16_MAX : ds->frame_bytes[i]);
+    }
+    sendFrame(protocol_decode_stats, payload, sizeof(payload));
+}
+
+/*
+ * sendTrace
+ *
+ * Send the next records of the frozen trace, oldest first. An empty frame
+ * ends the dump, and recording starts again
+ */
+static void sendTrace(void)
+{
+#ifdef EVENT_TRACE
+    uint8_t payload[3 + TRACE_FRAME_RECORDS * 8];
+    uint32_t count = trace_count - trace_sent;
+
+    if (count > TRACE_FRAME_RECORDS)
+    {
+        count = TRACE_FRAME_RECORDS;
+    }
+    protocolPut16(&payload[0], trace_sent);
+    payload[2] = count;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const trace_record* r = traceGet(trace_sent + i);
+
+        protocolPut32(&payload[3 + 8 * i], r->time_us);
+        protocolPut16(&payload[7 + 8 * i], r->id);
+        protocolPut16(&payload[9 + 8 * i], r->arg);
+    }
+    sendFrame(protocol_trace_data, payload, 3 + 8 * count);
+    trace_sent += count;
+
+    if (count == 0)
+    {
+        traceRestart();
+    }
+    else
+    {
+        Event e = send_trace;
+        queue_try_add(&eventQueue, &e);
+    }
+#endif
+}
+
+/*
+ * sendProfile
+ *
+ * Send the next buckets of the profile that have samples. The last frame
+ * holds the layout of the buckets and the totals, then the histogram is
+ * cleared, so each dump covers the time since the last
+ */
+static void sendProfile(void)
+{
+#ifdef PC_PROFILE
+    uint8_t payload[1 + PROFILE_FRAME_BUCKETS * 6];
+    uint32_t count = 0;
+    uint32_t samples;
+
+    while ((count < PROFILE_FRAME_BUCKETS) &&
+           ((profile_index = pcProfileNext(profile_index, &samples)) < PC_PROFILE_BUCKETS))
+    {
+        protocolPut16(&payload[1 + 6 * count], profile_index);
+        protocolPut32(&payload[3 + 6 * count], samples);
+        profile_index++;
+        count++;
+    }
+    payload[0] = count;
+
+    if (count != 0)
+    {
+        sendFrame(protocol_profile_data, payload, 1 + 6 * count);
+
+        Event e = send_profile;
+        queue_try_add(&eventQueue, &e);
+    }
+    else
+    {
+        payload[1] = PC_PROFILE_SHIFT;
+        protocolPut16(&payload[2], PC_PROFILE_FLASH_BUCKETS);
+        protocolPut16(&payload[4], PC_PROFILE_RAM_BUCKETS);
+        protocolPut16(&payload[6], PC_PROFILE_ROM_BUCKETS);
+        protocolPut32(&payload[8], pcProfileSamples());
+        protocolPut32(&payload[12], pcProfileOther());
+        protocolPut16(&payload[16], PC_PROFILE_INTERVAL_US);
+        sendFrame(protocol_profile_data, payload, 18);
+
+        pcProfileClear();
+        pcProfilePause(false);
+    }
+#endif
+}
+
+/*
+ * sendBench
+ * flush_cache  true to flush the XIP cache before each of the next refills
+ *
+ * Reply with the refill time of each zone since the last benchmark, then
+ * restart the measurement. The flags show whether the cache was flushed and
+ * whether the audio code runs from SRAM, so the two builds can be compared
+ */
+static void sendBench(bool flush_cache)
+{
+    uint8_t payload[2 + 13 * NUM_ZONES];
+    uint32_t now = time_us_32();
+
+#ifdef RAM_HOT_PATH
+    payload[0] = zones[0].flush_cache | 2;
+#else
+    payload[0] = zones[0].flush_cache;
+#endif
+    payload[1] = NUM_ZONES;
+
+    for (int i = 0; i < NUM_ZONES; ++i)
+    {
+        audio_zone* z = &zones[i];
+        uint8_t* p = &payload[2 + 13 * i];
+
+        p[0] = sources[i].state;
+        protocolPut32(&p[1], z->busy_us);
+        protocolPut32(&p[5], now - z->busy_start_us);
+        protocolPut16(&p[9], (z->refill_max_us[0] > UINT16_MAX) ? UINT16_MAX : z->refill_max_us[0]);
+        protocolPut16(&p[11], (z->refill_max_us[1] > UINT16_MAX) ? UINT16_MAX : z->refill_max_us[1]);
+        audioZoneBenchmark(z, flush_cache);
+    }
+    sendFrame(protocol_bench_data, payload, sizeof(payload));
+}
+
+/*
+ * startTimeline
+ * start_us     Time since boot the programme started
+ * now_us       Actions due before this time are not run
+ *
+ * Resolve the programme, using the time of day if the host has sent it, and
+ * set the alarm for the first action
+ */
+static void startTimeline(uint64_t start_us, uint64_t now_us)
+{
+    uint32_t start_time_of_day_ms = 0;
+
+    if (clock_set)
+    {
+        uint32_t before_ms = (uint32_t)(((clock_set_us - start_us) / 1000) % TIMELINE_DAY_MS);
+
+        start_time_of_day_ms = (clock_time_of_day_ms + TIMELINE_DAY_MS - before_ms) % TIMELINE_DAY_MS;
+    }
+    programme_start_us = start_us;
+    timelineStart(&programme, start_us, now_us, clock_set, start_time_of_day_ms);
+    scheduleTimeline();
+}
+
+// Set the alarm for the next action, so nothing is polled between actions
+static void scheduleTimeline(void)
+{
+    if (timeline_alarm > 0)
+    {
+        cancel_alarm(timeline_alarm);
+        timeline_alarm = 0;
+    }
+
+    if (timelinePending(&programme))
+    {
+        timeline_alarm = add_alarm_at(from_us_since_boot(timelineNextUs(&programme)), timelineCallback, NULL, true);
+
+        if (timeline_alarm < 0)
+        {
+            printf("Cannot set timeline alarm\n");
+        }
+    }
+}
+
+// Called at the time of the next action
+static int64_t timelineCallback(alarm_id_t id, void* user_data)
+{
+    Event e = timeline_due;
+
+    // Try again shortly if the queue is full, as the event must not be lost
+    return queue_try_add(&eventQueue, &e) ? 0 : -TIMELINE_RETRY_US;
+}
+
+// Run the actions that are due, then wait for the next
+static void runTimeline(void)
+{
+    const timeline_action* action;
+
+    timeline_alarm = 0;
+
+    while ((action = timelineNext(&programme, time_us_64())) != NULL)
+    {
+        runAction(action);
+    }
+    scheduleTimeline();
+}
+
+/*
+ * runAction
+ * action       Timeline action that is due
+ *
+ * Changes made by the timeline are not stored as the settings, except where
+ * changing the sound stores it
+ */
+static void runAction(const timeline_action* action)
+{
+    // Sound needs the full clock, the LED can change whilst asleep
+    if (asleep && ((action->op == timeline_sound) || (action->op == timeline_volume)))
+    {
+        exitSleep();
+    }
+
+    switch (action->op)
+    {
+        case timeline_sound:
+            if (action->zone < NUM_ZONES)
+            {
+                if (action->percent >= 0)
+                {
+                    sources[action->zone].volume = action->percent / 100.0f;
+                    sources[action->zone].ramping = false;
+                }
+                fadeToState(action->zone, action->value);
+            }
+        break;
+
+        case timeline_volume:
+            if (action->zone < NUM_ZONES)
+            {
+                startRamp(action->zone, action->percent / 100.0f, action->duration_ms);
+            }
+        break;
+
+        case timeline_led:
+            led = action->value;
+            intensity = action->percent / 100.0f;
+            ledEngineSetColour(&leds, led, intensity);
+        break;
+
+        case timeline_sunrise:
+            ledEngineSetEffect(&leds, led_effect_sunrise, action->duration_ms);
+        break;
+    }
+    TRACE(trace_timeline, action->op);
+    STATUS(("Timeline action %d, zone %lu\n", action->op, action->zone));
+}
+
+/*
+ * startRamp
+ * zone         Zone to ramp
+ * volume       Volume at the end of the ramp
+ * duration_ms  Length of the ramp, 0 to change now
+ *
+ * The volume is moved at the start of each DMA block, by serviceZones
+ */
+static void startRamp(uint32_t zone, float volume, uint32_t duration_ms)
+{
+    zone_source* src = &sources[zone];
+
+    src->ramp_from = src->volume;
+    src->ramp_to = volume;
+    src->ramp_start_us = time_us_64();
+    src->ramp_us = (uint64_t)duration_ms * 1000;
+    src->ramping = true;
+
+    rampVolume(src);
+    updateGain(zone);
+}
+
+// Move the volume along the timeline ramp
+static void rampVolume(zone_source* src)
+{
+    uint64_t elapsed_us = time_us_64() - src->ramp_start_us;
+
+    if (elapsed_us >= src->ramp_us)
+    {
+        src->volume = src->ramp_to;
+        src->ramping = false;
+    }
+    else
+    {
+        src->volume = src->ramp_from + (src->ramp_to - src->ramp_from) * ((float)elapsed_us / (float)src->ramp_us);
+    }
+}
+
+/*
+ * populateCallback
+ * context      Source of the zone being populated
+ * buffer       Pointer to buffer to populate
+ * len          Max number of 16 bit samples to copy into buffer
+ * 
+ * Write 16 bit stereo sound data to to the supplied buffer
+ * callback function called from circular buffer class
+ * 
+ */
+uint32_t HOT_PATH(populateCallback)(void* context, int16_t* buffer, uint32_t len)
+{
+    zone_source* src = (zone_source*)context;
+    colour_noise* cn = src->cn;
+    noise_shaper* ns = src->ns;
+    uint32_t written = len;
+
+    switch (src->state)
+    {
+        case white:
+            for (int i=0;i<len;i+=2)
+            {
+                // Divide the output by 2, to make similar volume to other colours
+                buffer[i] = (int16_t)(colourNoiseWhite(&cn[0]) >> 1);
+                buffer[i+1] = (int16_t)(colourNoiseWhite(&cn[1]) >> 1);
+            }
+        break;
+
+        case pink:
+            for (int i=0;i<len;i+=2)
+            {
+                buffer[i] = (int16_t)colourNoisePink(&cn[0]);
+                buffer[i+1] = (int16_t)colourNoisePink(&cn[1]);
+            }
+        break;
+
+        case brown:
+            for (int i=0;i<len;i+=2)
+            {
+                buffer[i] = (int16_t)colourNoiseBrown(&cn[0]);
+                buffer[i+1] = (int16_t)colourNoiseBrown(&cn[1]);
+            }
+        break;
+
+        case blue:
+        case violet:
+        case grey:
+        case custom:
+            // Shape a block of white noise for each channel
+            for (int i=0;i<len;i+=2)
+            {
+                buffer[i] = (int16_t)colourNoiseWhite(&cn[0]);
+                buffer[i+1] = (int16_t)colourNoiseWhite(&cn[1]);
+            }
+            noiseShaperProcess(&ns[0], buffer, len, 2);
+            noiseShaperProcess(&ns[1], buffer + 1, len - 1, 2);
+        break;
+
+        case texture:
+            // The clip is read a block at a time, so there is no long pause for the SD card
+            if (src->clip_reading)
+            {
+                readClip(src, len);
+            }
+            grainTextureProcess(&src->gt[0], &cn[0], buffer, len, 2);
+            grainTextureProcess(&src->gt[1], &cn[1], buffer + 1, len - 1, 2);
+        break;
+
+        case tone:
+        case binaural:
+            oscillatorBankProcess(&src->osc[0], buffer, len, 2);
+            oscillatorBankProcess(&src->osc[1], buffer + 1, len - 1, 2);
+        break;
+
+        case breathing:
+            // Envelope is generated into the left samples, then replaced by the noise
+            oscillatorBankProcess(&src->breath, buffer, len, 2);
+
+            for (int i=0;i<len;i+=2)
+            {
+                int32_t envelope = BREATH_FLOOR + (((buffer[i] + 32768) * (GAIN_RAMP_UNITY - BREATH_FLOOR)) >> 16);
+
+                buffer[i] = (int16_t)((colourNoiseBrown(&cn[0]) * envelope) >> 15);
+                buffer[i+1] = (int16_t)((colourNoiseBrown(&cn[1]) * envelope) >> 15);
+            }
+        break;
+
+        default:
+            if (isFile(src->state))
+            {
+                uint32_t start_us = time_us_32();
+                uint32_t sd_start_us = sdStatsBusyUs();
+                uint32_t sd_errors = sdStatsErrors();
+
+                decodeStatsBegin(&src->stats);
+                soundFileRead(&src->sf, buffer, len, &written);
+                decodeStatsEnd(&src->stats, len, time_us_32() - start_us, sdStatsBusyUs() - sd_start_us);
+
+                if (src->scan.running && loudnessScanBlock(&src->scan, buffer, written))
+                {
+                    src->scan_done = true;
+                }
+
+                if (sdStatsErrors() != sd_errors)
+                {
+                    // Card has gone, play silence until the fade to noise completes
+                    for (uint32_t i = 0; i < len; ++i)
+                    {
+                        buffer[i] = 0;
+                    }
+                    written = len;
+                    src->file_failed = true;
+                    fsLost(&mount);
+                }
+            }
+        break;
+    }
+    return written;
+}
+
+/*
+ * loadFile
+ * src          Source of the zone
+ * filename     String containing name of music file to open
+ * slot         Entry of the file in the loudness file
+ * 
+ * Returns true if music file was successfully opened and header read. The
+ * stored loudness gain is applied, or the file is measured as it plays and
+ * the gain applied from the next play
+ * 
+ */
+static bool loadFile(zone_source* src, const char* filename, uint32_t slot)
+{
+    bool success = false;
+
+    if (cardReady() && allocateBuffers(src, AUDIO_ARENA_FILE_RAM_LENGTH, AUDIO_ARENA_FILE_CACHE))
+    {
+        decodeStatsCreate(&src->stats);
+
+        if (!soundFileCreate(&src->sf, filename, src->cache, src->cache_size))
+        {
+            printf("Cannot open file: %s\n", filename);
+            releaseBuffers(src);
+        }   
+        else
+        {
+            src->file_slot = slot;
+
+            if (!loudnessLookup(&mount, filename, slot, &src->scan, &src->file_gain))
+            {
+                loudnessScanStart(&src->scan, soundFileGetSampleRate(&src->sf), soundFileIsStereo(&src->sf));
+            }
+            success = true;
+        }
+    }
+    return success;
+}
+
+/*
+ * loadClip
+ * src          Source of the zone
+ * filename     File holding the clip, any supported format
+ *
+ * Take the buffers of the texture, and open its file. The clip is read
+ * whilst the texture plays, by readClip
+ */
+static bool loadClip(zone_source* src, const char* filename)
+{
+    if (!cardReady() || !allocateBuffers(src, AUDIO_ARENA_NOISE_RAM_LENGTH, AUDIO_ARENA_FILE_CACHE))
+    {
+        return false;
+    }
+
+    src->clip = audioArenaAlloc(&arena, AUDIO_ARENA_TEXTURE_CLIP_LENGTH * sizeof(int16_t));
+
+    if (!src->clip)
+    {
+        printf("Not enough memory for texture, %lu bytes free\n", audioArenaAvailable(&arena));
+        releaseBuffers(src);
+        return false;
+    }
+
+    if (!soundFileCreate(&src->sf, filename, src->cache, src->cache_size))
+    {
+        printf("Cannot open file: %s\n", filename);
+        releaseBuffers(src);
+        return false;
+    }
+
+    src->clip_loaded = 0;
+    src->clip_reading = true;
+    grainTextureCreate(&src->gt[0], src->clip);
+    grainTextureCreate(&src->gt[1], src->clip);
+    return true;
+}
+
+/*
+ * readClip
+ * src          Source of the zone
+ * len          Samples to read, as for the refill
+ *
+ * Read the next part of the clip, mixing stereo files to mono. Once the clip
+ * is full the file is closed, and the texture needs no more SD card reads.
+ * Files shorter than the clip repeat within it
+ */
+static void readClip(zone_source* src, uint32_t len)
+{
+    bool stereo = soundFileIsStereo(&src->sf);
+    uint32_t space = AUDIO_ARENA_TEXTURE_CLIP_LENGTH - src->clip_loaded;
+    int16_t* clip = src->clip + src->clip_loaded;
+    uint32_t written = 0;
+    uint32_t sd_errors = sdStatsErrors();
+
+    // Stereo is read into the free part of the clip, at most half as many frames
+    // as there are free samples, then mixed down in place
+    uint32_t read = (len < space) ? len : space;
+
+    soundFileRead(&src->sf, clip, stereo ? (read & ~1u) : read, &written);
+
+    if (stereo)
+    {
+        written >>= 1;
+
+        for (uint32_t i = 0; i < written; ++i)
+        {
+            clip[i] = (int16_t)((clip[2 * i] + clip[2 * i + 1]) >> 1);
+        }
+    }
+    src->clip_loaded += written;
+    grainTextureSetLength(&src->gt[0], src->clip_loaded);
+    grainTextureSetLength(&src->gt[1], src->clip_loaded);
+
+    // Stop when there is no room for another frame, or play what has been read if the card has gone
+    if (((AUDIO_ARENA_TEXTURE_CLIP_LENGTH - src->clip_loaded) < (1u << stereo)) || (sdStatsErrors() != sd_errors))
+    {
+        if (sdStatsErrors() != sd_errors)
+        {
+            fsLost(&mount);
+        }
+        soundFileClose(&src->sf);
+        src->clip_reading = false;
+
+        audioArenaRelease(&arena, src->cache, src->cache_size);
+        src->cache = NULL;
+        STATUS(("Texture clip of %lu samples\n", src->clip_loaded));
+    }
+}
+
+/*
+ * allocateBuffers
+ * src          Source that is starting
+ * ram_length   Number of samples in each RAM buffer
+ * cache_size   Bytes of file read buffer, 0 if not reading a file
+ *
+ * Takes the buffers from the arena. Returns false, holding nothing, if they
+ * do not fit
+ */
+static bool allocateBuffers(zone_source* src, uint32_t ram_length, uint32_t cache_size)
+{
+    src->ram_length = ram_length;
+    src->cache_size = cache_size;
+    src->ram[0] = audioArenaAlloc(&arena, ram_length * sizeof(int16_t));
+    src->ram[1] = audioArenaAlloc(&arena, ram_length * sizeof(int16_t));
+    src->cache = (cache_size != 0) ? audioArenaAlloc(&arena, cache_size) : NULL;
+
+    if (!src->ram[0] || !src->ram[1] || (cache_size && !src->cache))
+    {
+        printf("Not enough memory for sound, %lu bytes free\n", audioArenaAvailable(&arena));
+        releaseBuffers(src);
+        return false;
+    }
+    STATUS(("Arena %lu bytes free, %lu blocks most used\n", audioArenaAvailable(&arena), arena.blocks_max));
+    return true;
+}
+
+// Return the buffers of a source to the arena
+static void releaseBuffers(zone_source* src)
+{
+    audioArenaRelease(&arena, src->ram[0], src->ram_length * sizeof(int16_t));
+    audioArenaRelease(&arena, src->ram[1], src->ram_length * sizeof(int16_t));
+    audioArenaRelease(&arena, src->cache, src->cache_size);
+    audioArenaRelease(&arena, src->clip, AUDIO_ARENA_TEXTURE_CLIP_LENGTH * sizeof(int16_t));
+    src->ram[0] = NULL;
+    src->ram[1] = NULL;
+    src->cache = NULL;
+    src->clip = NULL;
+}
+
+#define SLEEP_STEP_REPEATS (1000 / DEBOUNCE_REPEAT_MS)     // Held repeats between sleep setting steps
+
+// Called from the button scan timer when a button event is reported
+// Only queues the button, the modifier is not read in interrupt context
+void buttonCallback(uint gpio_number, debounce_event event, uint32_t time_ms)
+{
+    static bool change_held = false;    // true if change button has been held down
+    static uint32_t change_repeats;     // Repeats since the sleep setting last stepped
+    Event e = empty;
+
+    TRACE(trace_button, gpio_number);
+
+    // Volume and intensity repeat whilst the button is held
+    bool step = (event == single_press || event == long_press || event == repeat_press);
+
+    switch (gpio_number)
+    {
+        case button_change:
+            // Acts on release, so holding the button can set the sleep timer instead
+            if (event == single_press)
+            {
+                change_held = false;
+            }
+            else if (event == long_press)
+            {
+                change_held = true;
+                change_repeats = 0;
+                e = change_sleep;
+            }
+            else if ((event == repeat_press) && (++change_repeats == SLEEP_STEP_REPEATS))
+            {
+                // Keep stepping whilst held, slowly enough to release at the wanted setting
+                change_repeats = 0;
+                e = change_sleep;
+            }
+            else if (event == release && !change_held)
+            {
+                e = change_button;
+            }
+        break;
+
+        case button_debug_change:
+            if (event == single_press)
+            {
+#if NUM_ZONES > 1
+                // Select the zone that the other buttons control
+                e = change_zone;
+#else
+                e = change_button;
+#endif
+            }
+        break;
+
+        case button_increase:
+            if (step)
+            {
+                e = increase_button;
+            }
+        break;
+
+        case button_decrease:
+            if (step)
+            {
+                e = decrease_button;
+            }
+        break;
+
+        case button_debug_quit:
+            if (event == single_press)
+            {
+                e = quit;
+            }
+        break;
+    }
+
+    if (e != empty)
+    {
+        queue_try_add(&eventQueue, &e);
+    }
+}
+
+/*
+ * applyModifier
+ *
+ * Converts a button event to the action selected by the modifier. Called from
+ * the main loop, so the modifier is sampled at a controlled point
+ */
+static Event applyModifier(Event event)
+{
+    switch (event)
+    {
+        case change_button:
+            return getModifier() ? change_led : change_music;
+
+        case increase_button:
+#ifdef VOLUME
+            return getModifier() ? increase_intensity : increase_volume;
+#else
+            return increase_intensity;
+#endif
+
+        case decrease_button:
+#ifdef VOLUME
+            return getModifier() ? decrease_intensity : decrease_volume;
+#else
+            return decrease_intensity;
+#endif
+
+        default:
+            return event;
+    }
+}
+
+/*
+ * getModifier
+ *
+ * Returns true if the modifier is held. Either BOOTSEL, or a button on MODIFIER_GPIO
+ */
+static bool getModifier(void)
+{
+#ifdef MODIFIER_GPIO
+    // Debounced by the button scan, QSPI is never touched
+    return button[5].pressed;
+#else
+    bool modifier = getBootselButton();
+
+    if (bootsel_irq_off_us > bootsel_irq_off_max_us)
+    {
+        bootsel_irq_off_max_us = bootsel_irq_off_us;
+        STATUS(("BOOTSEL interrupts disabled for %lu us (max)\n", bootsel_irq_off_max_us));
+    }
+    return modifier;
+#endif
+}
+
+/*
+ * getBootselButton
+ *
+ * Check if boot select button is pressed
+ * Runs from RAM with interrupts disabled, the time they are disabled is
+ * recorded in bootsel_irq_off_us
  */ 
 bool __no_inline_not_in_flash_func(getBootselButton)(void) 
 {
@@ -700,14 +2165,17 @@ bool __no_inline_not_in_flash_func(getBootselButton)(void)
     // Must disable interrupts, as interrupt handlers may be in flash, and we
     // are about to temporarily disable flash access!
     uint32_t flags = save_and_disable_interrupts();
+    uint32_t start = timer_hw->timerawl;
 
     // Set chip select to Hi-Z
     hw_write_masked(&ioqspi_hw->io[CS_PIN_INDEX].ctrl,
                     GPIO_OVERRIDE_LOW << IO_QSPI_GPIO_QSPI_SS_CTRL_OEOVER_LSB,
                     IO_QSPI_GPIO_QSPI_SS_CTRL_OEOVER_BITS);
 
-    // Note we can't call into any sleep functions in flash right now
-    for (volatile int i = 0; i < 1000; ++i);
+    // Note we can't call into any sleep functions in flash right now, so
+    // wait on the timer register. Unlike a counted loop this does not
+    // lengthen when the system clock is reduced
+    while ((timer_hw->timerawl - start) < BOOTSEL_SETTLE_US);
 
     // The HI GPIO registers in SIO can observe and control the 6 QSPI pins.
     // Note the button pulls the pin *low* when pressed.
@@ -719,6 +2187,7 @@ bool __no_inline_not_in_flash_func(getBootselButton)(void)
                     GPIO_OVERRIDE_NORMAL << IO_QSPI_GPIO_QSPI_SS_CTRL_OEOVER_LSB,
                     IO_QSPI_GPIO_QSPI_SS_CTRL_OEOVER_BITS);
 
+    bootsel_irq_off_us = timer_hw->timerawl - start;
     restore_interrupts(flags);
 
     return button_state;
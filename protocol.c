@@ -0,0 +1,123 @@
+#include "protocol.h"
+/*
+   Incremental frame parser and encoder.
+   Bytes are fed one at a time, so the parser can be run on whatever has been
+   received without waiting for a whole frame. An invalid frame returns the
+   parser to searching for the next sync byte
+ */
+
+void protocolParserCreate(protocol_parser* p)
+{
+    p->state = protocol_wait_sync;
+    p->index = 0;
+    p->crc = 0;
+    p->errors = 0;
+}
+
+// CRC-8, polynomial x^8 + x^2 + x + 1
+uint8_t protocolCrc(uint8_t crc, uint8_t byte)
+{
+    crc ^= byte;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+/*
+ * protocolParse
+ * byte         Next received byte
+ *
+ * Returns true when byte completes a valid frame, which is then in p->frame
+ */
+bool protocolParse(protocol_parser* p, uint8_t byte)
+{
+    bool complete = false;
+
+    switch (p->state)
+    {
+        case protocol_wait_sync:
+            if (byte == PROTOCOL_SYNC)
+            {
+                p->crc = 0;
+                p->state = protocol_wait_cmd;
+            }
+        break;
+
+        case protocol_wait_cmd:
+            p->frame.cmd = byte;
+            p->crc = protocolCrc(p->crc, byte);
+            p->state = protocol_wait_len;
+        break;
+
+        case protocol_wait_len:
+            if (byte > PROTOCOL_MAX_PAYLOAD)
+            {
+                p->errors++;
+                p->state = protocol_wait_sync;
+            }
+            else
+            {
+                p->frame.len = byte;
+                p->index = 0;
+                p->crc = protocolCrc(p->crc, byte);
+                p->state = (byte) ? protocol_wait_payload : protocol_wait_crc;
+            }
+        break;
+
+        case protocol_wait_payload:
+            p->frame.payload[p->index++] = byte;
+            p->crc = protocolCrc(p->crc, byte);
+
+            if (p->index == p->frame.len)
+            {
+                p->state = protocol_wait_crc;
+            }
+        break;
+
+        case protocol_wait_crc:
+            if (byte == p->crc)
+            {
+                complete = true;
+            }
+            else
+            {
+                p->errors++;
+            }
+            p->state = protocol_wait_sync;
+        break;
+    }
+    return complete;
+}
+
+/*
+ * protocolEncode
+ * cmd          Command or response
+ * payload      Data for the frame, may be NULL if len is 0
+ * len          Number of bytes of payload, at most PROTOCOL_MAX_PAYLOAD
+ * out          Populated with the frame, needs len + PROTOCOL_OVERHEAD bytes
+ *
+ * Returns the number of bytes in the frame
+ */
+uint32_t protocolEncode(uint8_t cmd, const uint8_t* payload, uint8_t len, uint8_t* out)
+{
+    uint8_t crc = 0;
+    uint32_t n = 0;
+
+    out[n++] = PROTOCOL_SYNC;
+    out[n++] = cmd;
+    crc = protocolCrc(crc, cmd);
+    out[n++] = len;
+    crc = protocolCrc(crc, len);
+
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        out[n++] = payload[i];
+        crc = protocolCrc(crc, payload[i]);
+    }
+    out[n++] = crc;
+
+    return n;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Framed binary control and telemetry protocol, carried over the stdio UART.
+ * Has no dependency on the Pico SDK, so can be built and tested on a host.
+ *
+ * Frame:   sync | cmd | len | payload[len] | crc
+ * crc is CRC-8 (polynomial 0x07) over cmd, len and payload. Multi byte values
+ * are little endian. Bytes that are not part of a valid frame, such as debug
+ * text, are skipped
+ */
+#define PROTOCOL_SYNC           0xA5
+#define PROTOCOL_MAX_PAYLOAD    64
+#define PROTOCOL_OVERHEAD       4           // sync, cmd, len and crc
+#define PROTOCOL_RESPONSE       0x80        // Set in cmd of frames sent by the board
+
+typedef enum protocol_cmd
+{
+    protocol_set_state = 0x01,                      // zone, sound_state
+    protocol_set_volume = protocol_set_state + 1,   // zone, volume percent
+    protocol_set_led = protocol_set_volume + 1,     // led_state, intensity percent
+    protocol_set_sleep = protocol_set_led + 1,      // minutes (16 bit)
+    protocol_get_status = protocol_set_sleep + 1,   // no payload, replied to with status
+    protocol_telemetry = protocol_get_status + 1,   // period ms (16 bit), 0 to stop
+    protocol_get_decode_stats = protocol_telemetry + 1, // zone, replied to with decode stats
+    protocol_set_synth = protocol_get_decode_stats + 1, // tone mHz (32 bit), beat mHz (32 bit), breath ms (32 bit)
+    protocol_set_clock = protocol_set_synth + 1,    // seconds after midnight (32 bit), times the timeline
+    protocol_get_trace = protocol_set_clock + 1,    // no payload, replied to with trace data, ending with an empty frame
+    protocol_get_profile = protocol_get_trace + 1,  // no payload, replied to with profile data, ending with the totals
+    protocol_bench = protocol_get_profile + 1,      // flags (1 flushes the XIP cache before each refill), replied to with the refills since the last
+
+    protocol_ack = PROTOCOL_RESPONSE,               // cmd, result (1 if accepted)
+    protocol_status = PROTOCOL_RESPONSE | protocol_get_status,
+    protocol_telemetry_data = PROTOCOL_RESPONSE | protocol_telemetry,
+    protocol_decode_stats = PROTOCOL_RESPONSE | protocol_get_decode_stats,
+    protocol_trace_data = PROTOCOL_RESPONSE | protocol_get_trace,
+    protocol_profile_data = PROTOCOL_RESPONSE | protocol_get_profile,
+    protocol_bench_data = PROTOCOL_RESPONSE | protocol_bench
+} protocol_cmd;
+
+typedef enum protocol_state
+{
+    protocol_wait_sync = 0,
+    protocol_wait_cmd = protocol_wait_sync + 1,
+    protocol_wait_len = protocol_wait_cmd + 1,
+    protocol_wait_payload = protocol_wait_len + 1,
+    protocol_wait_crc = protocol_wait_payload + 1
+} protocol_state;
+
+typedef struct protocol_frame
+{
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t payload[PROTOCOL_MAX_PAYLOAD];
+} protocol_frame;
+
+typedef struct protocol_parser
+{
+    protocol_state state;
+    protocol_frame frame;                   // Frame being received, valid when protocolParse returns true
+    uint8_t index;                          // Next payload byte
+    uint8_t crc;                            // Running crc of frame
+    uint32_t errors;                        // Frames rejected for length or crc
+} protocol_parser;
+
+extern void protocolParserCreate(protocol_parser* p);
+extern bool protocolParse(protocol_parser* p, uint8_t byte);
+extern uint32_t protocolEncode(uint8_t cmd, const uint8_t* payload, uint8_t len, uint8_t* out);
+extern uint8_t protocolCrc(uint8_t crc, uint8_t byte);
+
+/*
+ * Inline helper functions
+ */
+// Little endian access to payload values
+inline void protocolPut16(uint8_t* p, uint16_t value){p[0] = (uint8_t)value; p[1] = (uint8_t)(value >> 8);}
+inline void protocolPut32(uint8_t* p, uint32_t value){protocolPut16(p, (uint16_t)value); protocolPut16(p + 2, (uint16_t)(value >> 16));}
+inline uint16_t protocolGet16(const uint8_t* p){return (uint16_t)(p[0] | (p[1] << 8));}
+inline uint32_t protocolGet32(const uint8_t* p){return protocolGet16(p) | ((uint32_t)protocolGet16(p + 2) << 16);}
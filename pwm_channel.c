@@ -12,11 +12,11 @@ void pwmChannelInit(pwm_data* data, uint gpio_num)
     pwm_init(data->pin_slice, &config, false);
 }
 
-void pwmChannelReconfigure(pwm_data* data, float clk_div, uint16_t wrap)
+void pwmChannelReconfigure(pwm_data* data, uint8_t div_int, uint8_t div_frac, uint16_t wrap)
 {
     pwm_config config = pwm_get_default_config();
 
-    pwm_config_set_clkdiv(&config, clk_div); 
+    pwm_config_set_clkdiv_int_frac(&config, div_int, div_frac); 
     pwm_config_set_wrap(&config, wrap); 
 
     pwm_init(data->pin_slice, &config, false);
@@ -0,0 +1,43 @@
+#include "ring_buffer.h"
+/*
+   head and tail increase without wrapping to the size, so the buffer can be
+   completely filled. Each index is only written by one side
+ */
+
+void ringBufferCreate(ring_buffer* rb, uint8_t* data, uint32_t size)
+{
+    rb->data = data;
+    rb->mask = size - 1;
+    rb->head = 0;
+    rb->tail = 0;
+    rb->dropped = 0;
+}
+
+// Called by the producer, returns false if full
+bool ringBufferPut(ring_buffer* rb, uint8_t byte)
+{
+    uint32_t head = rb->head;
+
+    if ((head - rb->tail) > rb->mask)
+    {
+        rb->dropped++;
+        return false;
+    }
+    rb->data[head & rb->mask] = byte;
+    rb->head = head + 1;
+    return true;
+}
+
+// Called by the consumer, returns false if empty
+bool ringBufferGet(ring_buffer* rb, uint8_t* byte)
+{
+    uint32_t tail = rb->tail;
+
+    if (tail == rb->head)
+    {
+        return false;
+    }
+    *byte = rb->data[tail & rb->mask];
+    rb->tail = tail + 1;
+    return true;
+}
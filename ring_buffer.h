@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Byte ring buffer with a single producer and a single consumer, so an
+ * interrupt can add bytes whilst the main loop removes them without locking.
+ * The size must be a power of 2
+ */
+typedef struct ring_buffer
+{
+    uint8_t* data;
+    uint32_t mask;                          // size - 1
+    volatile uint32_t head;                 // Written by producer
+    volatile uint32_t tail;                 // Written by consumer
+    uint32_t dropped;                       // Bytes lost because the buffer was full
+} ring_buffer;
+
+extern void ringBufferCreate(ring_buffer* rb, uint8_t* data, uint32_t size);
+extern bool ringBufferPut(ring_buffer* rb, uint8_t byte);
+extern bool ringBufferGet(ring_buffer* rb, uint8_t* byte);
@@ -0,0 +1,58 @@
+#include "pico/stdlib.h"
+#include "sd_stats.h"
+#include "trace.h"
+/*
+   Built with -Wl,--wrap=f_read, so calls to f_read arrive here and
+   __real_f_read is the FatFs function. Reads are only made from the main
+   loop, so the totals need no locking
+ */
+
+static sd_stats totals;
+static uint32_t busy_total_us = 0;      // Never reset, so callers can measure a wait
+static uint32_t errors_total = 0;       // Never reset, so callers can detect a failure
+
+FRESULT __real_f_read(FIL* fp, void* buff, UINT btr, UINT* br);
+
+FRESULT __wrap_f_read(FIL* fp, void* buff, UINT btr, UINT* br)
+{
+    uint32_t start_us = time_us_32();
+    FRESULT res = __real_f_read(fp, buff, btr, br);
+
+    uint32_t elapsed_us = time_us_32() - start_us;
+
+    TRACE(trace_sd_read, elapsed_us);
+    totals.busy_us += elapsed_us;
+    busy_total_us += elapsed_us;
+    totals.bytes += *br;
+    totals.reads++;
+
+    if (res != FR_OK)
+    {
+        totals.errors++;
+        errors_total++;
+    }
+
+    return res;
+}
+
+// Copy the totals since the last call, then reset them
+void sdStatsTake(sd_stats* stats)
+{
+    *stats = totals;
+    totals.reads = 0;
+    totals.bytes = 0;
+    totals.busy_us = 0;
+    totals.errors = 0;
+}
+
+// Total time spent waiting for reads, the difference between two calls is the wait between them
+uint32_t sdStatsBusyUs(void)
+{
+    return busy_total_us;
+}
+
+// Total failed reads, a change between two calls shows a read failed between them
+uint32_t sdStatsErrors(void)
+{
+    return errors_total;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "ff.h"
+
+/*
+ * SD card read statistics.
+ * The link wraps f_read, so every read, including those made by the decoder
+ * library, is counted without changing the caller
+ */
+typedef struct sd_stats
+{
+    uint32_t reads;                         // Number of calls to f_read
+    uint32_t bytes;                         // Bytes read
+    uint32_t busy_us;                       // Time spent waiting for reads
+    uint32_t errors;                        // Reads that failed
+} sd_stats;
+
+extern void sdStatsTake(sd_stats* stats);
+extern uint32_t sdStatsBusyUs(void);
+extern uint32_t sdStatsErrors(void);
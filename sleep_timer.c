@@ -0,0 +1,70 @@
+#include "sleep_timer.h"
+/*
+   Sleep timer.
+   Sound plays at full volume until the fade starts, then fades linearly to
+   silence over SLEEP_TIMER_FADE_MINUTES, or over the whole time if the timer
+   is shorter than this
+ */
+
+// Durations that the timer steps through, in minutes
+static const uint32_t sleep_minutes[] = {0, 15, 30, 60, 90};
+
+void sleepTimerCreate(sleep_timer* st, uint32_t minutes)
+{
+    st->minutes = minutes;
+    st->running = false;
+}
+
+// Start (or restart) the timer from now, if it is enabled
+void sleepTimerStart(sleep_timer* st)
+{
+    uint32_t fade = (st->minutes < SLEEP_TIMER_FADE_MINUTES) ? st->minutes : SLEEP_TIMER_FADE_MINUTES;
+    absolute_time_t now = get_absolute_time();
+
+    st->end = delayed_by_ms(now, st->minutes * 60000);
+    st->fade_start = delayed_by_ms(now, (st->minutes - fade) * 60000);
+    st->running = (st->minutes != 0);
+}
+
+// Return the Q15 level that the sound should be played at
+int32_t sleepTimerLevel(sleep_timer* st)
+{
+    int32_t level = 32768;
+
+    if (st->running)
+    {
+        int64_t remaining = absolute_time_diff_us(get_absolute_time(), st->end);
+        int64_t fade = absolute_time_diff_us(st->fade_start, st->end);
+
+        if (remaining <= 0)
+        {
+            level = 0;
+        }
+        else if (remaining < fade)
+        {
+            level = (int32_t)((remaining << 15) / fade);
+        }
+    }
+    return level;
+}
+
+// Return the time until silence, 0 if not running
+uint32_t sleepTimerRemainingMs(sleep_timer* st)
+{
+    int64_t remaining = absolute_time_diff_us(get_absolute_time(), st->end);
+
+    return (st->running && remaining > 0) ? (uint32_t)(remaining / 1000) : 0;
+}
+
+// Return the duration that follows the supplied one
+uint32_t sleepTimerNextMinutes(uint32_t minutes)
+{
+    for (uint32_t i = 0; i < count_of(sleep_minutes) - 1; ++i)
+    {
+        if (minutes == sleep_minutes[i])
+        {
+            return sleep_minutes[i + 1];
+        }
+    }
+    return sleep_minutes[0];
+}
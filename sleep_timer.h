@@ -0,0 +1,27 @@
+#pragma once
+#include "pico/stdlib.h"
+
+#define SLEEP_TIMER_FADE_MINUTES 10         // Length of fade at end of timer
+
+typedef struct sleep_timer
+{
+    uint32_t minutes;                       // Time from start until silence, 0 if disabled
+    bool running;                           // true if timer has been started
+    absolute_time_t fade_start;             // Time at which fade out begins
+    absolute_time_t end;                    // Time at which sound is silent
+} sleep_timer;
+
+extern void sleepTimerCreate(sleep_timer* st, uint32_t minutes);
+extern void sleepTimerStart(sleep_timer* st);
+extern int32_t sleepTimerLevel(sleep_timer* st);
+extern uint32_t sleepTimerRemainingMs(sleep_timer* st);
+extern uint32_t sleepTimerNextMinutes(uint32_t minutes);
+
+/*
+ * Inline helper functions
+ */
+// Stop the timer
+inline void sleepTimerStop(sleep_timer* st){st->running = false;}
+
+// Return true if the timer has reached the end of the fade
+inline bool sleepTimerExpired(sleep_timer* st){return st->running && (absolute_time_diff_us(st->end, get_absolute_time()) >= 0);}
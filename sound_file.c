@@ -0,0 +1,129 @@
+#include <string.h>
+#include "sound_file.h"
+/*
+   Chooses the player for a file from its header. Files are named 1, 2 and 3,
+   so the name cannot be used
+ */
+
+#define SOUND_FILE_HEADER 64        // Bytes read to find the format
+
+/*
+ * soundFileFormat
+ * buffer       Working memory, used to hold the header
+ *
+ * Returns the format of the file, music_file is used if it is not recognised
+ */
+static sound_format soundFileFormat(const char* filename, unsigned char* buffer)
+{
+    FIL fp;
+    UINT read = 0;
+    sound_format format = sound_format_music;
+
+    if (f_open(&fp, filename, FA_OPEN_EXISTING | FA_READ) != FR_OK)
+    {
+        return format;
+    }
+
+    if (f_read(&fp, buffer, SOUND_FILE_HEADER, &read) != FR_OK)
+    {
+        read = 0;
+    }
+    f_close(&fp);
+
+    if ((read >= 4) && !memcmp(buffer, "fLaC", 4))
+    {
+        format = sound_format_flac;
+    }
+    else if ((read >= 22) && !memcmp(buffer, "RIFF", 4) && !memcmp(&buffer[8], "WAVE", 4))
+    {
+        // The fmt chunk is normally first, adpcm_file checks the whole header
+        if (!memcmp(&buffer[12], "fmt ", 4) && ((buffer[20] | (buffer[21] << 8)) == ADPCM_FILE_FORMAT))
+        {
+            format = sound_format_adpcm;
+        }
+    }
+    return format;
+}
+
+bool soundFileCreate(sound_file* sf, const char* filename, unsigned char* buffer, uint32_t buffer_len)
+{
+    sf->format = soundFileFormat(filename, buffer);
+
+    switch (sf->format)
+    {
+        case sound_format_adpcm:
+            return adpcmFileCreate(&sf->af, filename, buffer, buffer_len);
+
+        case sound_format_flac:
+            return flacFileCreate(&sf->ff, filename, buffer, buffer_len);
+
+        default:
+            return musicFileCreate(&sf->mf, filename, buffer, buffer_len);
+    }
+}
+
+bool soundFileClose(sound_file* sf)
+{
+    switch (sf->format)
+    {
+        case sound_format_adpcm:
+            return adpcmFileClose(&sf->af);
+
+        case sound_format_flac:
+            return flacFileClose(&sf->ff);
+
+        default:
+            return musicFileClose(&sf->mf);
+    }
+}
+
+/*
+ * soundFileRead
+ * buffer       Populated with samples, interleaved if stereo
+ * len          Number of entries to populate
+ * written      Number of entries populated
+ */
+bool soundFileRead(sound_file* sf, int16_t* buffer, uint32_t len, uint32_t* written)
+{
+    switch (sf->format)
+    {
+        case sound_format_adpcm:
+            return adpcmFileRead(&sf->af, buffer, len, written);
+
+        case sound_format_flac:
+            return flacFileRead(&sf->ff, buffer, len, written);
+
+        default:
+            return musicFileRead(&sf->mf, buffer, len, written);
+    }
+}
+
+uint32_t soundFileGetSampleRate(sound_file* sf)
+{
+    switch (sf->format)
+    {
+        case sound_format_adpcm:
+            return adpcmFileGetSampleRate(&sf->af);
+
+        case sound_format_flac:
+            return flacFileGetSampleRate(&sf->ff);
+
+        default:
+            return musicFileGetSampleRate(&sf->mf);
+    }
+}
+
+bool soundFileIsStereo(sound_file* sf)
+{
+    switch (sf->format)
+    {
+        case sound_format_adpcm:
+            return adpcmFileIsStereo(&sf->af);
+
+        case sound_format_flac:
+            return flacFileIsStereo(&sf->ff);
+
+        default:
+            return musicFileIsStereo(&sf->mf);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "pico/stdlib.h"
+#include "music_file.h"
+#include "adpcm_file.h"
+#include "flac_file.h"
+
+/*
+ * A sound file of any supported format.
+ * The format is found from the start of the file, not its name. mp3 and PCM
+ * WAV files are played by music_file, IMA ADPCM WAV by adpcm_file and FLAC by
+ * flac_file
+ */
+typedef enum sound_format
+{
+    sound_format_music = 0,                             // mp3 or PCM WAV
+    sound_format_adpcm = sound_format_music + 1,
+    sound_format_flac = sound_format_adpcm + 1
+} sound_format;
+
+typedef struct sound_file
+{
+    sound_format format;
+    union
+    {
+        music_file mf;
+        adpcm_file af;
+        flac_file ff;
+    };
+} sound_file;
+
+extern bool soundFileCreate(sound_file* sf, const char* filename, unsigned char* buffer, uint32_t buffer_len);
+extern bool soundFileClose(sound_file* sf);
+extern bool soundFileRead(sound_file* sf, int16_t* buffer, uint32_t len, uint32_t* written);
+extern uint32_t soundFileGetSampleRate(sound_file* sf);
+extern bool soundFileIsStereo(sound_file* sf);
@@ -0,0 +1,9 @@
+#pragma once
+#include "ff.h"
+
+/*
+ * Host stand in for the FatFs disk status flags
+ */
+#define STA_NOINIT      0x01
+#define STA_NODISK      0x02
+#define STA_PROTECT     0x04
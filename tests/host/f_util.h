@@ -0,0 +1,7 @@
+#pragma once
+#include "ff.h"
+
+/*
+ * Host stand in for the FatFs utilities of the SD card driver
+ */
+extern const char* FRESULT_str(FRESULT i);
@@ -0,0 +1,80 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Host stand in for FatFs.
+ * Files are read from a directory of the host that plays the part of the SD
+ * card. The card can be removed and inserted, after which files that were
+ * open fail, as they would on the board
+ */
+typedef unsigned int UINT;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef char TCHAR;
+typedef uint32_t FSIZE_t;
+
+typedef enum
+{
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT,
+    FR_WRITE_PROTECTED,
+    FR_INVALID_DRIVE,
+    FR_NOT_ENABLED,
+    FR_NO_FILESYSTEM
+} FRESULT;
+
+#define FA_READ             0x01
+#define FA_WRITE            0x02
+#define FA_OPEN_EXISTING    0x00
+#define FA_CREATE_NEW       0x04
+#define FA_CREATE_ALWAYS    0x08
+#define FA_OPEN_ALWAYS      0x10
+
+typedef struct FATFS
+{
+    bool mounted;
+} FATFS;
+
+typedef struct FIL
+{
+    FILE* fp;
+    FSIZE_t fptr;                   // Read/write position, as FatFs
+    uint32_t insertion;             // Insertion of the card the file was opened on
+} FIL;
+
+typedef struct FILINFO
+{
+    FSIZE_t fsize;
+    WORD fdate;
+    WORD ftime;
+    BYTE fattrib;
+    TCHAR fname[256];
+} FILINFO;
+
+#define f_tell(fp) ((fp)->fptr)
+
+extern FRESULT f_open(FIL* fp, const TCHAR* path, BYTE mode);
+extern FRESULT f_close(FIL* fp);
+extern FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br);
+extern FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw);
+extern FRESULT f_lseek(FIL* fp, FSIZE_t ofs);
+extern FRESULT f_stat(const TCHAR* path, FILINFO* fno);
+extern FRESULT f_unlink(const TCHAR* path);
+extern FRESULT f_mount(FATFS* fs, const TCHAR* path, BYTE opt);
+extern FRESULT f_unmount(const TCHAR* path);
+
+// Control of the simulated card
+extern void hostCardInsert(const char* directory);
+extern void hostCardRemove(void);
+extern bool hostCardPresent(void);
@@ -0,0 +1,43 @@
+#pragma once
+#include "pico/stdlib.h"
+
+/*
+ * Host stand in for the DMA channels that feed the PIO.
+ * A transfer completes at once. The words of the last transfer on each
+ * channel are kept, so a test can see what was sent
+ */
+#define HOST_DMA_CHANNELS   12
+#define HOST_DMA_WORDS      64
+
+typedef struct dma_channel_config
+{
+    uint32_t ctrl;
+} dma_channel_config;
+
+enum dma_channel_transfer_size
+{
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2
+};
+
+typedef struct host_dma_channel
+{
+    bool claimed;
+    uint32_t transfers;                     // Transfers started
+    uint32_t count;                         // Words in the last transfer
+    uint32_t words[HOST_DMA_WORDS];         // Last transfer
+} host_dma_channel;
+
+extern host_dma_channel host_dma[HOST_DMA_CHANNELS];
+
+extern int dma_claim_unused_channel(bool required);
+extern dma_channel_config dma_channel_get_default_config(uint channel);
+extern void channel_config_set_read_increment(dma_channel_config* c, bool incr);
+extern void channel_config_set_write_increment(dma_channel_config* c, bool incr);
+extern void channel_config_set_dreq(dma_channel_config* c, uint dreq);
+extern void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size);
+extern void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_addr,
+                                  const volatile void* read_addr, uint transfer_count, bool trigger);
+extern void dma_channel_transfer_from_buffer_now(uint channel, const volatile void* read_addr, uint32_t transfer_count);
+extern bool dma_channel_is_busy(uint channel);
@@ -0,0 +1,12 @@
+#pragma once
+#include "pico/stdlib.h"
+
+// Host stand in for a PIO block, only its TX FIFOs are used
+typedef struct pio_hw
+{
+    volatile uint32_t txf[4];
+} pio_hw_t;
+
+typedef pio_hw_t* PIO;
+
+extern uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
@@ -0,0 +1,177 @@
+#include <string.h>
+#include <sys/stat.h>
+#include "ff.h"
+#include "f_util.h"
+#include "hw_config.h"
+
+static bool present = false;
+static char root[256];
+static uint32_t insertion = 0;          // Incremented each time the card is inserted
+static sd_card_t card = {"0:", {false}, 0, true};
+
+void hostCardInsert(const char* directory)
+{
+    strncpy(root, directory, sizeof(root) - 1);
+    present = true;
+    insertion++;
+}
+
+void hostCardRemove(void)
+{
+    present = false;
+}
+
+bool hostCardPresent(void)
+{
+    return present;
+}
+
+static void hostPath(char* path, size_t len, const TCHAR* name)
+{
+    snprintf(path, len, "%s/%s", root, name);
+}
+
+// true if the file is on the card that is in the slot
+static bool hostReady(FIL* fp)
+{
+    return present && fp->fp && (fp->insertion == insertion);
+}
+
+FRESULT f_open(FIL* fp, const TCHAR* path, BYTE mode)
+{
+    char name[512];
+    const char* how = (mode & FA_WRITE) ? "r+b" : "rb";
+
+    fp->fp = NULL;
+
+    if (!present)
+    {
+        return FR_NOT_READY;
+    }
+    hostPath(name, sizeof(name), path);
+    fp->fp = fopen(name, how);
+
+    if (!fp->fp && (mode & (FA_OPEN_ALWAYS | FA_CREATE_ALWAYS | FA_CREATE_NEW)))
+    {
+        fp->fp = fopen(name, "w+b");
+    }
+    else if (fp->fp && (mode & FA_CREATE_ALWAYS))
+    {
+        fp->fp = freopen(name, "w+b", fp->fp);
+    }
+
+    fp->fptr = 0;
+    fp->insertion = insertion;
+    return fp->fp ? FR_OK : FR_NO_FILE;
+}
+
+FRESULT f_close(FIL* fp)
+{
+    if (fp->fp)
+    {
+        fclose(fp->fp);
+        fp->fp = NULL;
+    }
+    return FR_OK;
+}
+
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br)
+{
+    *br = 0;
+
+    if (!hostReady(fp))
+    {
+        return FR_DISK_ERR;
+    }
+    *br = (UINT)fread(buff, 1, btr, fp->fp);
+    fp->fptr += *br;
+    return FR_OK;
+}
+
+FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw)
+{
+    *bw = 0;
+
+    if (!hostReady(fp))
+    {
+        return FR_DISK_ERR;
+    }
+    *bw = (UINT)fwrite(buff, 1, btw, fp->fp);
+    fp->fptr += *bw;
+    return FR_OK;
+}
+
+// As FatFs, seeking past the end of a file opened for writing extends it
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs)
+{
+    if (!hostReady(fp) || fseek(fp->fp, ofs, SEEK_SET))
+    {
+        return FR_DISK_ERR;
+    }
+    fp->fptr = ofs;
+    return FR_OK;
+}
+
+FRESULT f_stat(const TCHAR* path, FILINFO* fno)
+{
+    char name[512];
+    struct stat st;
+
+    if (!present)
+    {
+        return FR_NOT_READY;
+    }
+    hostPath(name, sizeof(name), path);
+
+    if (stat(name, &st))
+    {
+        return FR_NO_FILE;
+    }
+
+    // Date and time are packed as FatFs, from the modification time in seconds
+    fno->fsize = (FSIZE_t)st.st_size;
+    fno->fdate = (WORD)(st.st_mtime / 86400);
+    fno->ftime = (WORD)((st.st_mtime % 86400) / 2);
+    fno->fattrib = 0;
+    strncpy(fno->fname, path, sizeof(fno->fname) - 1);
+    return FR_OK;
+}
+
+FRESULT f_unlink(const TCHAR* path)
+{
+    char name[512];
+
+    if (!present)
+    {
+        return FR_NOT_READY;
+    }
+    hostPath(name, sizeof(name), path);
+    return remove(name) ? FR_NO_FILE : FR_OK;
+}
+
+FRESULT f_mount(FATFS* fs, const TCHAR* path, BYTE opt)
+{
+    fs->mounted = present;
+    return present ? FR_OK : FR_NOT_READY;
+}
+
+FRESULT f_unmount(const TCHAR* path)
+{
+    return FR_OK;
+}
+
+const char* FRESULT_str(FRESULT i)
+{
+    return (i == FR_OK) ? "Succeeded" : (i == FR_NOT_READY) ? "The physical drive cannot work" : "Failed";
+}
+
+sd_card_t* sd_get_by_num(size_t num)
+{
+    return (num == 0) ? &card : NULL;
+}
+
+// As the driver, a slot without a card detect switch always has a card
+bool sd_card_detect(sd_card_t* pSD)
+{
+    return !pSD->use_card_detect || present;
+}
@@ -0,0 +1,69 @@
+#include <string.h>
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+
+host_dma_channel host_dma[HOST_DMA_CHANNELS];
+
+int dma_claim_unused_channel(bool required)
+{
+    for (int i = 0; i < HOST_DMA_CHANNELS; i++)
+    {
+        if (!host_dma[i].claimed)
+        {
+            host_dma[i].claimed = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+    dma_channel_config c = {0};
+
+    return c;
+}
+
+void channel_config_set_read_increment(dma_channel_config* c, bool incr)
+{
+}
+
+void channel_config_set_write_increment(dma_channel_config* c, bool incr)
+{
+}
+
+void channel_config_set_dreq(dma_channel_config* c, uint dreq)
+{
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size)
+{
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_addr,
+                           const volatile void* read_addr, uint transfer_count, bool trigger)
+{
+    if (trigger)
+    {
+        dma_channel_transfer_from_buffer_now(channel, read_addr, transfer_count);
+    }
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void* read_addr, uint32_t transfer_count)
+{
+    host_dma_channel* d = &host_dma[channel];
+
+    d->transfers++;
+    d->count = (transfer_count < HOST_DMA_WORDS) ? transfer_count : HOST_DMA_WORDS;
+    memcpy(d->words, (const void*)read_addr, d->count * sizeof(uint32_t));
+}
+
+bool dma_channel_is_busy(uint channel)
+{
+    return false;
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+{
+    return 0;
+}
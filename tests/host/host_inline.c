@@ -0,0 +1,37 @@
+#include "pico/stdlib.h"
+#include "colour_noise.h"
+#include "protocol.h"
+#include "timeline.h"
+#include "adpcm_file.h"
+#include "flac_file.h"
+
+/*
+   The modules define their helpers as C99 inline functions, which need one
+   external definition in case the compiler does not inline a call. The
+   firmware is always built optimised; the host tests are not
+ */
+extern inline uint32_t time_us_32(void);
+extern inline absolute_time_t get_absolute_time(void);
+extern inline uint32_t to_ms_since_boot(absolute_time_t t);
+
+extern inline int32_t colourNoiseSaturate(int32_t value, int32_t limit);
+extern inline int32_t colourNoiseWhite(colour_noise* cn);
+extern inline int CTZ(int num);
+extern inline int32_t colourNoisePink(colour_noise* cn);
+extern inline int32_t colourNoiseBrown(colour_noise* cn);
+
+extern inline void protocolPut16(uint8_t* p, uint16_t value);
+extern inline void protocolPut32(uint8_t* p, uint32_t value);
+extern inline uint16_t protocolGet16(const uint8_t* p);
+extern inline uint32_t protocolGet32(const uint8_t* p);
+
+extern inline void fsInitialise(fs_mount* fs);
+extern inline bool fsMounted(fs_mount* fs);
+
+extern inline bool timelinePending(timeline* tl);
+extern inline uint64_t timelineNextUs(timeline* tl);
+
+extern inline uint32_t adpcmFileGetSampleRate(adpcm_file* af);
+extern inline bool adpcmFileIsStereo(adpcm_file* af);
+extern inline uint32_t flacFileGetSampleRate(flac_file* ff);
+extern inline bool flacFileIsStereo(flac_file* ff);
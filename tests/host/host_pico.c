@@ -0,0 +1,115 @@
+#include <time.h>
+#include "pico/stdlib.h"
+
+static bool virtual_time = false;
+static uint64_t virtual_us;
+
+// Switch to virtual time, starting at us
+void hostTimeSet(uint64_t us)
+{
+    virtual_time = true;
+    virtual_us = us;
+}
+
+void hostTimeAdvance(uint64_t us)
+{
+    virtual_us += us;
+}
+
+uint64_t time_us_64(void)
+{
+    struct timespec ts;
+
+    if (virtual_time)
+    {
+        return virtual_us;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#define HOST_TIMERS 8
+
+static repeating_timer_t* timers[HOST_TIMERS];      // Active timers, NULL if free
+
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void* user_data, repeating_timer_t* out)
+{
+    for (uint32_t i = 0; i < HOST_TIMERS; i++)
+    {
+        if (!timers[i])
+        {
+            out->delay_us = (int64_t)delay_ms * 1000;
+            out->due_us = time_us_64() + ((delay_ms < 0) ? -out->delay_us : out->delay_us);
+            out->callback = callback;
+            out->user_data = user_data;
+            timers[i] = out;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool cancel_repeating_timer(repeating_timer_t* timer)
+{
+    for (uint32_t i = 0; i < HOST_TIMERS; i++)
+    {
+        if (timers[i] == timer)
+        {
+            timers[i] = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Advance virtual time by us, calling each timer as it falls due. Returns the number of calls
+uint32_t hostTimersRun(uint64_t us)
+{
+    uint64_t end_us = virtual_us + us;
+    uint32_t calls = 0;
+
+    while (true)
+    {
+        repeating_timer_t* next = NULL;
+        uint32_t slot = 0;
+
+        for (uint32_t i = 0; i < HOST_TIMERS; i++)
+        {
+            if (timers[i] && (!next || (timers[i]->due_us < next->due_us)))
+            {
+                next = timers[i];
+                slot = i;
+            }
+        }
+
+        if (!next || (next->due_us > end_us))
+        {
+            break;
+        }
+        virtual_us = next->due_us;
+        calls++;
+
+        if (next->callback(next))
+        {
+            next->due_us += (next->delay_us < 0) ? -next->delay_us : next->delay_us;
+        }
+        else if (timers[slot] == next)
+        {
+            timers[slot] = NULL;
+        }
+    }
+    virtual_us = end_us;
+    return calls;
+}
+
+// Number of timers that are still repeating
+uint32_t hostTimersActive(void)
+{
+    uint32_t active = 0;
+
+    for (uint32_t i = 0; i < HOST_TIMERS; i++)
+    {
+        active += (timers[i] != NULL);
+    }
+    return active;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stddef.h>
+#include "pico/stdlib.h"
+#include "ff.h"
+
+/*
+ * Host stand in for the SD card driver configuration.
+ * There is one card slot, with a card detect switch that follows the
+ * simulated card of ff.h
+ */
+typedef struct sd_card_t
+{
+    const char* pcName;
+    FATFS fatfs;
+    int m_Status;
+    bool use_card_detect;
+} sd_card_t;
+
+extern sd_card_t* sd_get_by_num(size_t num);
+extern bool sd_card_detect(sd_card_t* pSD);
@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand in for the SDK placement macros, every function is in host memory
+#define __not_in_flash_func(func) func
+#define __not_in_flash(group)
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/platform.h"
+
+/*
+ * Host stand in for the parts of the SDK used by the modules under test.
+ * Time is real unless a test sets it, so simulations can run a whole night
+ * in virtual time. Repeating timers only run when a test advances virtual
+ * time with hostTimersRun
+ */
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+
+extern void hostTimeSet(uint64_t us);
+extern void hostTimeAdvance(uint64_t us);
+extern uint64_t time_us_64(void);
+
+inline uint32_t time_us_32(void){return (uint32_t)time_us_64();}
+inline absolute_time_t get_absolute_time(void){return time_us_64();}
+inline uint32_t to_ms_since_boot(absolute_time_t t){return (uint32_t)(t / 1000);}
+
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t* rt);
+
+struct repeating_timer
+{
+    int64_t delay_us;
+    uint64_t due_us;
+    repeating_timer_callback_t callback;
+    void* user_data;
+};
+
+extern bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void* user_data, repeating_timer_t* out);
+extern bool cancel_repeating_timer(repeating_timer_t* timer);
+extern uint32_t hostTimersRun(uint64_t us);
+extern uint32_t hostTimersActive(void);
+
+#define __compiler_memory_barrier() __asm__ volatile ("" : : : "memory")
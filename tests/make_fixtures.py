@@ -0,0 +1,457 @@
+#!/usr/bin/env python3
+"""
+Write the files used by the decoder test, with their reference output.
+
+The FLAC and IMA ADPCM files are written by the small encoders here, so no
+codec tools are needed to build the tests. Between them the FLAC frames use
+every subframe type, residual coding and stereo mode that flac_file.c
+decodes. FLAC is lossless, so its reference is the signal that was encoded.
+The ADPCM reference is decoded from the file by the IMA reference algorithm.
+
+    make_fixtures.py DIRECTORY
+
+Writes, all samples 16 bit little endian:
+    stereo.raw          1s of 22.05kHz stereo, the source of stereo.flac and stereo.wav
+    mono.raw            3s of 11.025kHz mono, 12 bit values scaled to 16 bits
+    stereo.flac         Blocks of 576, 16 bit
+    mono.flac           Blocks of 192, 12 bit, 2 byte frame numbers
+    large.flac          Blocks of 4096, too large for the player's buffer
+    stereo.wav          IMA ADPCM, 512 byte blocks
+    mono.wav            IMA ADPCM, 256 byte blocks
+    stereo_adpcm.raw    Reference decode of stereo.wav
+    mono_adpcm.raw      Reference decode of mono.wav
+"""
+import hashlib
+import math
+import os
+import struct
+import sys
+
+
+class BitWriter:
+    def __init__(self):
+        self.data = bytearray()
+        self.acc = 0
+        self.count = 0
+
+    def write(self, value, n):
+        if n == 0:
+            return
+        self.acc = (self.acc << n) | (value & ((1 << n) - 1))
+        self.count += n
+        while self.count >= 8:
+            self.count -= 8
+            self.data.append((self.acc >> self.count) & 0xFF)
+        self.acc &= (1 << self.count) - 1
+
+    def unary(self, zeros):
+        while zeros >= 16:
+            self.write(0, 16)
+            zeros -= 16
+        self.write(1, zeros + 1)
+
+    def align(self):
+        if self.count:
+            self.write(0, 8 - self.count)
+
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def crc16(data):
+    crc = 0
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x8005) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def signal(rate, seconds, channels, bits):
+    """Tones with a little noise, a silent section, full scale steps and a section with wasted bits"""
+    peak = (1 << (bits - 1)) - 1
+    state = 12345
+    out = [[] for _ in range(channels)]
+    tones = [(440.0, 1234.5), (330.0, 2000.0)]
+
+    for i in range(int(rate * seconds)):
+        t = i / rate
+        for c in range(channels):
+            state = (state * 1103515245 + 12345) & 0x7FFFFFFF
+            noise = ((state >> 8) & 0xFFFF) / 32768.0 - 1.0
+            low, high = tones[c]
+            v = 0.45 * math.sin(2 * math.pi * low * t) + 0.2 * math.sin(2 * math.pi * high * t + 0.3) + 0.02 * noise
+            v = int(round(v * peak))
+            if 0.30 <= t < 0.36:
+                v = 0
+            elif 0.50 <= t < 0.56:
+                v = peak if (i // 50) % 2 == 0 else -peak - 1
+                v = v if c == 0 else -1 - v
+            elif 0.70 <= t < 0.76:
+                v = (v >> 3) << 3
+            out[c].append(max(-peak - 1, min(peak, v)))
+    return out
+
+
+def interleave(channels, shift=0):
+    return b"".join(struct.pack("<%dh" % len(channels), *[ch[i] << shift for ch in channels])
+                    for i in range(len(channels[0])))
+
+
+# FLAC
+
+def zigzag(v):
+    return (v << 1) if v >= 0 else ((-v << 1) - 1)
+
+
+def signed_bits(values):
+    return max([(v.bit_length() if v >= 0 else (-v - 1).bit_length()) + 1 for v in values if v] or [0])
+
+
+def rice_cost(values, k):
+    return sum((zigzag(v) >> k) + 1 + k for v in values)
+
+
+def write_residual(w, residual, block, order, partition_order, method, escape):
+    while (block % (1 << partition_order)) or ((block >> partition_order) < order):
+        partition_order -= 1
+    pbits = 5 if method else 4
+    limit = (1 << pbits) - 1
+    length = block >> partition_order
+    w.write(method, 2)
+    w.write(partition_order, 4)
+    start = 0
+    for p in range(1 << partition_order):
+        end = (p + 1) * length - order
+        values = residual[start:end]
+        start = end
+        if escape and p == 0:
+            n = signed_bits(values)
+            w.write(limit, pbits)
+            w.write(n, 5)
+            for v in values:
+                w.write(v, n)
+            continue
+        k = min(range(limit), key=lambda k: rice_cost(values, k))
+        w.write(k, pbits)
+        for v in values:
+            u = zigzag(v)
+            w.unary(u >> k)
+            w.write(u, k)
+
+
+def fixed_residual(x, order):
+    coefs = [[], [1], [2, -1], [3, -3, 1], [4, -6, 4, -1]][order]
+    return [x[i] - sum(c * x[i - 1 - j] for j, c in enumerate(coefs)) for i in range(order, len(x))]
+
+
+def lpc_coefs(x, order, precision):
+    """Levinson-Durbin on the autocorrelation, quantised to precision bits"""
+    r = [float(sum(x[i] * x[i + k] for i in range(len(x) - k))) for k in range(order + 1)]
+    a = [0.0] * (order + 1)
+    e = r[0]
+    for i in range(1, order + 1):
+        if e <= 0:
+            break
+        k = (r[i] - sum(a[j] * r[i - j] for j in range(1, i))) / e
+        a = [a[j] - k * a[i - j] if 0 < j < i else a[j] for j in range(order + 1)]
+        a[i] = k
+        e *= 1 - k * k
+    a = a[1:]
+    largest = max(abs(c) for c in a) or 1.0
+    shift = max(0, min(15, precision - 2 - int(math.floor(math.log2(largest)))))
+    limit = 1 << (precision - 1)
+    return [max(-limit, min(limit - 1, int(round(c * (1 << shift))))) for c in a], shift
+
+
+def lpc_residual(x, coefs, shift):
+    order = len(coefs)
+    return [x[i] - (sum(c * x[i - 1 - j] for j, c in enumerate(coefs)) >> shift) for i in range(order, len(x))]
+
+
+SUBFRAME_KINDS = ["verbatim", "fixed0", "fixed1", "fixed2", "fixed3", "fixed4", "lpc1", "lpc8", "lpc32", "lpc12"]
+
+
+def write_subframe(w, x, bits, kind, option):
+    wasted = 0
+    if any(x):
+        while wasted < bits - 1 and all((v >> wasted) & 1 == 0 for v in x):
+            wasted += 1
+    x = [v >> wasted for v in x]
+    bits -= wasted
+    block = len(x)
+
+    if all(v == x[0] for v in x):
+        kind = "constant"
+    elif kind.startswith("lpc") and int(kind[3:]) * 2 > block:
+        kind = "fixed2"
+
+    def header(subframe_type):
+        w.write(0, 1)
+        w.write(subframe_type, 6)
+        if wasted:
+            w.write(1, 1)
+            w.unary(wasted - 1)
+        else:
+            w.write(0, 1)
+
+    method = option % 2
+    partition_order = option % 4
+    escape = (option % 7) == 3
+
+    if kind == "constant":
+        header(0)
+        w.write(x[0], bits)
+    elif kind == "verbatim":
+        header(1)
+        for v in x:
+            w.write(v, bits)
+    elif kind.startswith("fixed"):
+        order = int(kind[5:])
+        header(8 + order)
+        for v in x[:order]:
+            w.write(v, bits)
+        write_residual(w, fixed_residual(x, order), block, order, partition_order, method, escape)
+    else:
+        order = int(kind[3:])
+        precision = 12 if order < 32 else 15
+        coefs, shift = lpc_coefs(x, order, precision)
+        header(31 + order)
+        for v in x[:order]:
+            w.write(v, bits)
+        w.write(precision - 1, 4)
+        w.write(shift, 5)
+        for c in coefs:
+            w.write(c, precision)
+        write_residual(w, lpc_residual(x, coefs, shift), block, order, partition_order, method, escape)
+
+
+def utf8(n):
+    if n < 0x80:
+        return [n]
+    if n < 0x800:
+        return [0xC0 | (n >> 6), 0x80 | (n & 0x3F)]
+    return [0xE0 | (n >> 12), 0x80 | ((n >> 6) & 0x3F), 0x80 | (n & 0x3F)]
+
+
+def block_code(block):
+    for code, size in [(1, 192), (2, 576), (3, 1152), (4, 2304), (5, 4608)]:
+        if block == size:
+            return code
+    for code in range(8, 16):
+        if block == 256 << (code - 8):
+            return code
+    return 6 if block <= 256 else 7
+
+
+def write_frame(number, channels, bits, rate, rate_code):
+    block = len(channels[0])
+    mode = 0 if len(channels) == 1 else [1, 8, 9, 10][number % 4]
+    h = BitWriter()
+    h.write(0xFFF8, 16)
+    code = block_code(block)
+    h.write(code, 4)
+    h.write(rate_code, 4)
+    h.write(mode, 4)
+    h.write({8: 1, 12: 2, 16: 4}[bits], 3)
+    h.write(0, 1)
+    for b in utf8(number):
+        h.write(b, 8)
+    if code == 6:
+        h.write(block - 1, 8)
+    elif code == 7:
+        h.write(block - 1, 16)
+    if rate_code == 12:
+        h.write(rate // 1000, 8)
+    elif rate_code == 13:
+        h.write(rate, 16)
+    elif rate_code == 14:
+        h.write(rate // 10, 16)
+
+    w = BitWriter()
+    w.data += h.data + bytes([crc8(h.data)])
+
+    if mode == 0:
+        subframes = [(channels[0], bits)]
+    else:
+        left, right = channels
+        side = [l - r for l, r in zip(left, right)]
+        mid = [(l + r) >> 1 for l, r in zip(left, right)]
+        subframes = {1: [(left, bits), (right, bits)], 8: [(left, bits), (side, bits + 1)],
+                     9: [(side, bits + 1), (right, bits)], 10: [(mid, bits), (side, bits + 1)]}[mode]
+
+    for c, (x, sub_bits) in enumerate(subframes):
+        kind = SUBFRAME_KINDS[(number + 3 * c) % len(SUBFRAME_KINDS)]
+        write_subframe(w, x, sub_bits, kind, number + c)
+
+    w.align()
+    return bytes(w.data) + struct.pack(">H", crc16(w.data))
+
+
+def write_flac(path, channels, bits, rate, block, rate_code):
+    frames = []
+    total = len(channels[0])
+    for number, start in enumerate(range(0, total, block)):
+        frames.append(write_frame(number, [ch[start:start + block] for ch in channels], bits, rate, rate_code))
+
+    md5 = hashlib.md5(interleave(channels)).digest()
+    info = BitWriter()
+    info.write(block, 16)
+    info.write(block, 16)
+    info.write(min(len(f) for f in frames), 24)
+    info.write(max(len(f) for f in frames), 24)
+    info.write(rate, 20)
+    info.write(len(channels) - 1, 3)
+    info.write(bits - 1, 5)
+    info.write(total, 36)
+
+    with open(path, "wb") as f:
+        f.write(b"fLaC")
+        f.write(struct.pack(">I", 34)[1:].rjust(4, b"\x00"))
+        f.write(bytes(info.data) + md5)
+        f.write(bytes([0x02]) + struct.pack(">I", 8)[1:] + b"test" + bytes(4))      # Application, skipped
+        f.write(bytes([0x81]) + struct.pack(">I", 13)[1:] + bytes(13))               # Last, padding
+        for frame in frames:
+            f.write(frame)
+    return len(frames)
+
+
+# IMA ADPCM
+
+ADPCM_STEP = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767]
+ADPCM_INDEX = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def adpcm_decode_nibble(nibble, predictor, index):
+    step = ADPCM_STEP[index]
+    diff = step >> 3
+    if nibble & 4:
+        diff += step
+    if nibble & 2:
+        diff += step >> 1
+    if nibble & 1:
+        diff += step >> 2
+    predictor = predictor - diff if nibble & 8 else predictor + diff
+    predictor = max(-32768, min(32767, predictor))
+    index = max(0, min(88, index + ADPCM_INDEX[nibble & 7]))
+    return predictor, index
+
+
+def adpcm_encode_nibble(sample, predictor, index):
+    step = ADPCM_STEP[index]
+    diff = sample - predictor
+    nibble = 0
+    if diff < 0:
+        nibble = 8
+        diff = -diff
+    if diff >= step:
+        nibble |= 4
+        diff -= step
+    if diff >= step >> 1:
+        nibble |= 2
+        diff -= step >> 1
+    if diff >= step >> 2:
+        nibble |= 1
+    predictor, index = adpcm_decode_nibble(nibble, predictor, index)
+    return nibble, predictor, index
+
+
+def adpcm_encode(channels, block_align):
+    count = len(channels)
+    per_block = (block_align - 4 * count) * 2 // count + 1
+    index = [0] * count
+    data = bytearray()
+
+    for start in range(0, len(channels[0]), per_block):
+        length = min(per_block, len(channels[0]) - start)
+        groups = (length - 1 + 7) // 8
+        nibbles = []
+        for c in range(count):
+            predictor = channels[c][start]
+            data += struct.pack("<hBB", predictor, index[c], 0)
+            coded = []
+            for s in channels[c][start + 1:start + length]:
+                nibble, predictor, index[c] = adpcm_encode_nibble(s, predictor, index[c])
+                coded.append(nibble)
+            nibbles.append(coded + [0] * (groups * 8 - len(coded)))
+        for g in range(groups):
+            for c in range(count):
+                for b in range(4):
+                    data.append(nibbles[c][g * 8 + 2 * b] | (nibbles[c][g * 8 + 2 * b + 1] << 4))
+    return bytes(data), per_block
+
+
+def adpcm_decode(data, count, block_align):
+    out = []
+    for start in range(0, len(data), block_align):
+        block = data[start:start + block_align]
+        samples = (len(block) - 4 * count) * 2 // count + 1
+        decoded = [[0] * samples for _ in range(count)]
+        for c in range(count):
+            predictor, index = struct.unpack_from("<hB", block, 4 * c)
+            index = min(index, 88)
+            decoded[c][0] = predictor
+            for n in range(1, samples):
+                group = (n - 1) // 8
+                k = (n - 1) % 8
+                byte = block[4 * count + group * 4 * count + 4 * c + k // 2]
+                predictor, index = adpcm_decode_nibble((byte >> (4 * (k % 2))) & 0xF, predictor, index)
+                decoded[c][n] = predictor
+        for n in range(samples):
+            out.extend(decoded[c][n] for c in range(count))
+    return struct.pack("<%dh" % len(out), *out)
+
+
+def write_adpcm(path, reference, channels, rate, block_align):
+    count = len(channels)
+    data, per_block = adpcm_encode(channels, block_align)
+    fmt = struct.pack("<HHIIHHHH", 0x11, count, rate, rate * block_align // per_block, block_align, 4, 2, per_block)
+    chunks = b"fmt " + struct.pack("<I", len(fmt)) + fmt
+    chunks += b"fact" + struct.pack("<II", 4, len(channels[0]))
+    chunks += b"LIST" + struct.pack("<I", 5) + b"INFO1" + b"\x00"                   # Odd size, padded
+    chunks += b"data" + struct.pack("<I", len(data)) + data
+
+    with open(path, "wb") as f:
+        f.write(b"RIFF" + struct.pack("<I", 4 + len(chunks)) + b"WAVE" + chunks)
+    with open(reference, "wb") as f:
+        f.write(adpcm_decode(data, count, block_align))
+
+
+def main():
+    directory = sys.argv[1]
+    os.makedirs(directory, exist_ok=True)
+
+    def path(name):
+        return os.path.join(directory, name)
+
+    stereo = signal(22050, 1.0, 2, 16)
+    mono = signal(11025, 3.0, 1, 12)
+
+    with open(path("stereo.raw"), "wb") as f:
+        f.write(interleave(stereo))
+    with open(path("mono.raw"), "wb") as f:
+        f.write(interleave(mono, 4))
+
+    write_flac(path("stereo.flac"), stereo, 16, 22050, 576, 6)
+    write_flac(path("mono.flac"), mono, 12, 11025, 192, 13)
+    write_flac(path("large.flac"), [ch[:4096] for ch in stereo], 16, 22050, 4096, 6)
+
+    write_adpcm(path("stereo.wav"), path("stereo_adpcm.raw"), stereo, 22050, 512)
+    write_adpcm(path("mono.wav"), path("mono_adpcm.raw"), [[v << 4 for v in mono[0]]], 11025, 256)
+
+
+if __name__ == "__main__":
+    main()
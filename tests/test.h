@@ -0,0 +1,58 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Host test support.
+ * CHECK records a failure and carries on, so one run reports every failure.
+ * Benchmarks print their results rather than checking them, as host timing
+ * varies from run to run. Cycles are host cycles, read from the time stamp
+ * counter where there is one, otherwise nanoseconds
+ */
+static uint32_t test_checks = 0;
+static uint32_t test_failures = 0;
+static volatile int32_t test_sink;
+
+#define CHECK(cond) testCheck((cond), #cond, __FILE__, __LINE__)
+
+static inline bool testCheck(bool ok, const char* text, const char* file, int line)
+{
+    test_checks++;
+
+    if (!ok)
+    {
+        test_failures++;
+        printf("%s:%d: check failed: %s\n", file, line, text);
+    }
+    return ok;
+}
+
+// Print the totals, and return the exit code of the test
+static inline int testResult(const char* name)
+{
+    printf("%s: %u checks, %u failed\n", name, test_checks, test_failures);
+    return (test_failures == 0) ? 0 : 1;
+}
+
+static inline uint64_t testCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// Stop the compiler discarding a result that is only timed
+static inline void testKeep(int32_t value)
+{
+    test_sink = value;
+}
@@ -0,0 +1,150 @@
+#include "test.h"
+#include "clock_planner.h"
+
+/*
+   Clock planner.
+   Plans the common rates and compares them with the table in the README,
+   then checks that every rate from 4kHz to 48kHz has a plan, and that the
+   rate each plan gives is within the error it reports. The clock shared by
+   multiple zones is checked the same way
+ */
+#define TEST_BITS       12              // AUDIO_ZONE_PWM_BITS
+#define TEST_MIN_KHZ    125000          // FILE_CLOCK_KHZ, the lowest clock used for files
+#define TEST_FIXED_KHZ  196800          // SYSTEM_CLOCK_KHZ when there is more than one zone
+
+typedef struct rate_case
+{
+    uint32_t rate;
+    uint32_t sys_khz;
+    uint32_t error_ppm;
+} rate_case;
+
+// As listed in "Supported sampling rates" in the README
+static const rate_case common_rates[] =
+{
+    {8000, 132000, 0},
+    {11000, 181500, 0},
+    {11025, 181500, 86},
+    {12000, 196800, 0},
+    {16000, 132000, 0},
+    {22000, 181500, 0},
+    {22050, 181500, 86},
+    {24000, 196800, 0},
+    {32000, 132000, 0},
+    {44000, 181500, 0},
+    {44100, 181500, 86},
+    {48000, 196800, 0}
+};
+
+// The rate a plan plays, in mHz, found independently of the planner
+static uint64_t achievedMhz(const clock_plan* plan)
+{
+    uint64_t sys_hz16 = (uint64_t)plan->sys_khz * 1000 * 16;
+    uint64_t div16 = (plan->div_int << 4) + plan->div_frac;
+
+    return (sys_hz16 * 1000) / (div16 * (plan->wrap + 1) << plan->shift);
+}
+
+// A plan is valid for the PWM, has its carrier above the audio band, and plays the rate with the error it reports
+static bool validPlan(uint32_t rate, const clock_plan* plan)
+{
+    uint64_t achieved = achievedMhz(plan);
+    uint64_t requested = (uint64_t)rate * 1000;
+    uint64_t diff = (achieved > requested) ? achieved - requested : requested - achieved;
+    uint64_t ppm = (diff * 1000000) / requested;
+
+    return (plan->wrap >= (1u << TEST_BITS) - 1) && (plan->wrap <= 65535) &&
+           (plan->div_int >= 1) && (plan->div_int <= 255) && (plan->div_frac <= 15) &&
+           ((rate << plan->shift) > 20000) && (ppm <= plan->error_ppm + 1);
+}
+
+static void testCommonRates(void)
+{
+    printf("Rate (Hz)  System clock (MHz)  Error (ppm)  Wrap   Divider  Shift\n");
+
+    for (uint32_t i = 0; i < sizeof(common_rates) / sizeof(common_rates[0]); i++)
+    {
+        const rate_case* c = &common_rates[i];
+        clock_plan plan;
+        bool planned = clockPlannerPlan(c->rate, TEST_BITS, TEST_MIN_KHZ, &plan);
+
+        printf("%-9u  %-18.1f  %-11u  %-5u  %3u+%2u/16  %u\n", c->rate, plan.sys_khz / 1000.0, plan.error_ppm,
+               plan.wrap, plan.div_int, plan.div_frac, plan.shift);
+
+        CHECK(planned);
+        CHECK(plan.sys_khz == c->sys_khz);
+        CHECK(plan.error_ppm == c->error_ppm);
+        CHECK(validPlan(c->rate, &plan));
+    }
+}
+
+static void testAllRates(void)
+{
+    uint32_t failed = 0;
+    uint32_t worst_ppm = 0;
+    uint32_t worst_rate = 0;
+
+    for (uint32_t rate = 4000; rate <= 48000; rate += 25)
+    {
+        clock_plan plan;
+
+        if (!clockPlannerPlan(rate, TEST_BITS, TEST_MIN_KHZ, &plan) || !validPlan(rate, &plan) ||
+            (plan.error_ppm > CLOCK_PLANNER_MAX_PPM))
+        {
+            failed++;
+        }
+        else if (plan.error_ppm > worst_ppm)
+        {
+            worst_ppm = plan.error_ppm;
+            worst_rate = rate;
+        }
+    }
+    printf("4kHz to 48kHz in 25Hz steps: %u without a plan, worst error %u ppm at %u Hz\n", failed, worst_ppm, worst_rate);
+    CHECK(failed == 0);
+}
+
+// With more than one zone the clock is fixed, so it must play every rate without replanning
+static void testFixedClock(void)
+{
+    uint32_t failed = 0;
+    uint32_t worst_ppm = 0;
+
+    for (uint32_t rate = 4000; rate <= 48000; rate += 25)
+    {
+        clock_plan plan;
+
+        if (!clockPlannerPlanFixed(rate, TEST_BITS, TEST_FIXED_KHZ, &plan) || !validPlan(rate, &plan) ||
+            (plan.sys_khz != TEST_FIXED_KHZ))
+        {
+            failed++;
+        }
+        else if (plan.error_ppm > worst_ppm)
+        {
+            worst_ppm = plan.error_ppm;
+        }
+    }
+    printf("Fixed %.1f MHz clock: %u rates without a plan, worst error %u ppm\n", TEST_FIXED_KHZ / 1000.0, failed, worst_ppm);
+    CHECK(failed == 0);
+    CHECK(worst_ppm <= CLOCK_PLANNER_MAX_PPM);
+}
+
+static void testInvalid(void)
+{
+    clock_plan plan;
+
+    CHECK(!clockPlannerPlan(0, TEST_BITS, TEST_MIN_KHZ, &plan));
+    CHECK(!clockPlannerPlanFixed(0, TEST_BITS, 180000, &plan));
+
+    // 16 bit output at 48kHz needs a 3.1GHz clock
+    CHECK(!clockPlannerPlan(48000, 16, TEST_MIN_KHZ, &plan));
+}
+
+int main(void)
+{
+    testCommonRates();
+    testAllRates();
+    testFixedClock();
+    testInvalid();
+
+    return testResult("clock_planner");
+}
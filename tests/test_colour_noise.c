@@ -0,0 +1,221 @@
+#include <math.h>
+#include "test.h"
+#include "colour_noise.h"
+
+/*
+   Integer colour noise.
+   Checks the range, mean and correlation of each colour, then compares them
+   with the float generator they replaced. The host has a floating point
+   unit, so its times do not show the cost of the RP2040, where each float
+   operation is a library call; they are printed for reference only. What the
+   host can show is the work per sample: the float pink and brown generators
+   draw again whenever a step leaves the range, so their worst case is
+   unbounded, where the integer generators take one draw per sample
+ */
+#define TEST_SAMPLES    (1 << 20)
+
+// The float generator that was replaced, kept to compare the cost
+typedef struct float_noise
+{
+    uint32_t seed;
+    uint32_t count;
+    union
+    {
+        uint32_t white;
+        float fwhite;
+    };
+    float pink;
+    float brown;
+    float pink_store[NumPinkBins];
+    uint32_t draws;                 // White values drawn for the current sample
+    uint32_t max_draws;             // Most drawn for one sample
+} float_noise;
+
+static float floatNoiseWhite(float_noise* fn)
+{
+    fn->draws++;
+    fn->seed = (fn->seed * 196314165) + 907633515;
+    fn->white = (fn->seed >> 9) | 0x40000000;
+    return (fn->fwhite - 3.0f) * 0.5f;
+}
+
+static float floatNoisePink(float_noise* fn)
+{
+    uint32_t k = CTZ(fn->count) & NumPinkBins1;
+    float prev = fn->pink_store[k];
+    float r;
+
+    while (true)
+    {
+        r = floatNoiseWhite(fn);
+        fn->pink_store[k] = r;
+        r -= prev;
+        fn->pink += r;
+
+        if (fn->pink < -4.0f || fn->pink > 4.0f)
+        {
+            fn->pink -= r;
+        }
+        else
+        {
+            break;
+        }
+    }
+    fn->count++;
+    return (floatNoiseWhite(fn) + fn->pink) * 0.125f;
+}
+
+static float floatNoiseBrown(float_noise* fn)
+{
+    while (true)
+    {
+        float r = floatNoiseWhite(fn);
+
+        fn->brown += r;
+
+        if (fn->brown < -8.0f || fn->brown > 8.0f)
+        {
+            fn->brown -= r;
+        }
+        else
+        {
+            break;
+        }
+    }
+    return fn->brown * 0.0625f;
+}
+
+typedef enum colour
+{
+    colour_white = 0,
+    colour_pink = colour_white + 1,
+    colour_brown = colour_pink + 1
+} colour;
+
+static const char* const colour_names[] = {"white", "pink", "brown"};
+
+static int32_t nextSample(colour_noise* cn, colour c)
+{
+    return (c == colour_white) ? colourNoiseWhite(cn) : ((c == colour_pink) ? colourNoisePink(cn) : colourNoiseBrown(cn));
+}
+
+// Range, mean and lag 1 correlation of a colour, as played with a white shift of 1
+static void testColour(colour c, int32_t limit, double min_correlation, double max_correlation)
+{
+    colour_noise cn;
+    int32_t min = 0;
+    int32_t max = 0;
+    double sum = 0.0;
+    double square = 0.0;
+    double lag = 0.0;
+    int32_t previous = 0;
+
+    colourNoiseCreate(&cn, 1);
+    colourNoiseSeed(&cn, 1234);
+
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++)
+    {
+        int32_t s = nextSample(&cn, c);
+
+        min = (s < min) ? s : min;
+        max = (s > max) ? s : max;
+        sum += s;
+        square += (double)s * s;
+        lag += (double)s * previous;
+        previous = s;
+    }
+
+    double mean = sum / TEST_SAMPLES;
+    double variance = square / TEST_SAMPLES - mean * mean;
+    double correlation = (lag / TEST_SAMPLES - mean * mean) / variance;
+
+    printf("%-6s min %6d max %6d mean %8.1f rms %8.1f lag 1 correlation %.3f\n",
+           colour_names[c], min, max, mean, sqrt(variance), correlation);
+
+    CHECK((min >= -limit) && (max <= limit));
+    CHECK((min < -limit / 4) && (max > limit / 4));
+    CHECK(fabs(mean) < limit / 16);
+    CHECK((correlation >= min_correlation) && (correlation <= max_correlation));
+}
+
+// A seed gives the same sequence, different seeds give different sequences
+static void testSeed(void)
+{
+    colour_noise a;
+    colour_noise b;
+    colour_noise c;
+    bool same = true;
+    bool different = false;
+
+    colourNoiseCreate(&a, 1);
+    colourNoiseCreate(&b, 1);
+    colourNoiseCreate(&c, 1);
+    colourNoiseSeed(&a, 7);
+    colourNoiseSeed(&b, 7);
+    colourNoiseSeed(&c, 8);
+
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+        int32_t s = colourNoisePink(&a);
+
+        same = same && (s == colourNoisePink(&b));
+        different = different || (s != colourNoisePink(&c));
+    }
+    CHECK(same);
+    CHECK(different);
+}
+
+static void benchmark(void)
+{
+    static const uint32_t integer_draws[] = {1, 2, 1};      // White values drawn per sample
+    colour_noise cn;
+    float_noise fn = {.seed = 1234, .count = 1};
+
+    colourNoiseCreate(&cn, 1);
+
+    for (colour c = colour_white; c <= colour_brown; c++)
+    {
+        int32_t total = 0;
+        uint64_t start = testCycles();
+
+        for (uint32_t i = 0; i < TEST_SAMPLES; i++)
+        {
+            total += nextSample(&cn, c);
+        }
+        uint64_t integer_cycles = testCycles() - start;
+
+        testKeep(total);
+        fn.max_draws = 0;
+        uint64_t draws = 0;
+        start = testCycles();
+
+        for (uint32_t i = 0; i < TEST_SAMPLES; i++)
+        {
+            fn.draws = 0;
+            float f = (c == colour_white) ? floatNoiseWhite(&fn) : ((c == colour_pink) ? floatNoisePink(&fn) : floatNoiseBrown(&fn));
+
+            total += (int32_t)(f * 32768.0f);
+            draws += fn.draws;
+            fn.max_draws = (fn.draws > fn.max_draws) ? fn.draws : fn.max_draws;
+        }
+        uint64_t float_cycles = testCycles() - start;
+
+        testKeep(total);
+        printf("%-6s integer %u draws, float %.3f draws and at worst %u per sample\n", colour_names[c],
+               integer_draws[c], (double)draws / TEST_SAMPLES, fn.max_draws);
+        printf("%-6s integer %.2f, float %.2f host cycles per sample, the float cost is not that of the RP2040\n",
+               colour_names[c], (double)integer_cycles / TEST_SAMPLES, (double)float_cycles / TEST_SAMPLES);
+    }
+}
+
+int main(void)
+{
+    // Output limits are the saturated accumulators scaled to the output
+    testColour(colour_white, 16384, -0.01, 0.01);
+    testColour(colour_pink, (16384 + COLOUR_NOISE_PINK_LIMIT) >> 3, 0.3, 0.99);
+    testColour(colour_brown, COLOUR_NOISE_BROWN_LIMIT >> 4, 0.99, 1.0);
+    testSeed();
+    benchmark();
+
+    return testResult("colour_noise");
+}
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include "test.h"
+#include "pico/stdlib.h"
+#include "config.h"
+
+/*
+   Stored settings.
+   The card is a directory of the host. Checks the limits of the generated
+   sound parameters, including values whose sum would wrap in 32 bits, and
+   that parameters read from the card outside the limits are replaced by the
+   defaults, as the protocol refuses them
+ */
+
+static bool valid(uint32_t tone_mhz, uint32_t beat_mhz, uint32_t breath_ms)
+{
+    synth_params params = {tone_mhz, beat_mhz, breath_ms};
+
+    return configSynthValid(&params);
+}
+
+static void testLimits(void)
+{
+    CHECK(valid(CONFIG_INITIAL_TONE_MHZ, CONFIG_INITIAL_BEAT_MHZ, CONFIG_INITIAL_BREATH_MS));
+    CHECK(valid(CONFIG_MAX_SYNTH_MHZ - 1, 0, CONFIG_MIN_BREATH_MS));
+    CHECK(valid(1, CONFIG_MAX_SYNTH_MHZ - 2, CONFIG_MIN_BREATH_MS));
+
+    CHECK(!valid(0, CONFIG_INITIAL_BEAT_MHZ, CONFIG_INITIAL_BREATH_MS));
+    CHECK(!valid(CONFIG_MAX_SYNTH_MHZ, 0, CONFIG_INITIAL_BREATH_MS));
+    CHECK(!valid(CONFIG_MAX_SYNTH_MHZ - 1, 1, CONFIG_INITIAL_BREATH_MS));
+    CHECK(!valid(CONFIG_INITIAL_TONE_MHZ, CONFIG_INITIAL_BEAT_MHZ, CONFIG_MIN_BREATH_MS - 1));
+
+    // Each sum is below the limit once wrapped
+    CHECK(!valid(UINT32_MAX, 2, CONFIG_INITIAL_BREATH_MS));
+    CHECK(!valid(CONFIG_INITIAL_TONE_MHZ, UINT32_MAX - CONFIG_INITIAL_TONE_MHZ + 2, CONFIG_INITIAL_BREATH_MS));
+}
+
+static void testStored(void)
+{
+    fs_mount fs;
+    synth_params params = {150000, 6000, 8000};
+    synth_params read;
+
+    fsInitialise(&fs);
+    CHECK(fsMount(&fs));
+
+    // Nothing stored gives the defaults
+    configGetSynth(&fs, &read);
+    CHECK((read.tone_mhz == CONFIG_INITIAL_TONE_MHZ) && (read.beat_mhz == CONFIG_INITIAL_BEAT_MHZ) &&
+          (read.breath_ms == CONFIG_INITIAL_BREATH_MS));
+
+    CHECK(configSetSynth(&fs, &params));
+    configGetSynth(&fs, &read);
+    CHECK((read.tone_mhz == params.tone_mhz) && (read.beat_mhz == params.beat_mhz) && (read.breath_ms == params.breath_ms));
+
+    // A file written by an older build with a wrapping beat is not used
+    params.beat_mhz = UINT32_MAX - params.tone_mhz + 2;
+    CHECK(configSetSynth(&fs, &params));
+    configGetSynth(&fs, &read);
+    CHECK((read.tone_mhz == CONFIG_INITIAL_TONE_MHZ) && (read.beat_mhz == CONFIG_INITIAL_BEAT_MHZ));
+    fsUnmount(&fs);
+}
+
+int main(void)
+{
+    char directory[] = "/tmp/picosounds_configXXXXXX";
+
+    if (!mkdtemp(directory))
+    {
+        return 1;
+    }
+    hostCardInsert(directory);
+
+    testLimits();
+    testStored();
+
+    return testResult("config");
+}
@@ -0,0 +1,378 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "pico/stdlib.h"
+#include "adpcm_file.h"
+#include "flac_file.h"
+#include "decode_stats.h"
+#include "sd_stats.h"
+
+/*
+   IMA ADPCM and FLAC decoding.
+   The files and their reference output are written by make_fixtures.py into
+   the directory given as the argument, which is used as the SD card. Each
+   file is decoded in reads of varying length and compared with its reference,
+   then decoded again to check the loop. The FLAC files use every subframe
+   type, residual coding and stereo mode the decoder handles. The benchmark
+   reports host cycles and bytes read for each second of audio, against a
+   plain read of 16 bit WAV data. The decode ahead is checked against refill
+   costs and SD card waits. MP3 needs picomp3lib, so is not covered here
+ */
+#define TEST_CACHE          8000                // AUDIO_ARENA_FILE_CACHE, the working buffer of the player
+#define TEST_LARGE_CACHE    40000               // Holds a block of 4096
+#define TEST_BLOCK          4400                // Interleaved samples in a RAM buffer refill
+#define TEST_SECONDS        20                  // Audio decoded by the benchmark of each format
+#define TEST_ADPCM_SNR_DB   24.0                // Least signal to noise ratio of ADPCM against the source
+#define TEST_TONES_MS       300                 // Tones at the start of the source, before the silence and full scale steps
+
+typedef enum test_format
+{
+    test_pcm = 0,
+    test_adpcm = test_pcm + 1,
+    test_flac = test_adpcm + 1
+} test_format;
+
+typedef struct test_case
+{
+    const char* name;
+    const char* reference;          // Expected output
+    const char* source;             // Signal that was encoded
+    test_format format;
+    uint32_t sample_rate;
+    bool stereo;
+    uint32_t frames;                // Frames or blocks in the file
+} test_case;
+
+static const test_case cases[] =
+{
+    {"stereo.flac", "stereo.raw", "stereo.raw", test_flac, 22050, true, 39},            // 576 samples per frame
+    {"mono.flac", "mono.raw", "mono.raw", test_flac, 11025, false, 173},                // 192 samples per frame
+    {"stereo.wav", "stereo_adpcm.raw", "stereo.raw", test_adpcm, 22050, true, 44},      // 505 samples per block
+    {"mono.wav", "mono_adpcm.raw", "mono.raw", test_adpcm, 11025, false, 66}
+};
+
+static const char* directory;
+static uint32_t cache[TEST_LARGE_CACHE / sizeof(uint32_t)];     // 4 byte aligned
+
+// A decoder of any format
+typedef struct test_decoder
+{
+    test_format format;
+    union
+    {
+        FIL fil;
+        adpcm_file af;
+        flac_file ff;
+    };
+} test_decoder;
+
+// decode_stats.c wraps the MP3 decoder, which is not built here
+int __real_MP3Decode(void* decoder, unsigned char** inbuf, int* bytes_left, short* outbuf, int use_size)
+{
+    return -1;
+}
+
+// Read a file of 16 bit samples, returns the number of samples
+static uint32_t loadSamples(const char* name, int16_t** samples)
+{
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    FILE* f = fopen(path, "rb");
+
+    if (!f)
+    {
+        *samples = NULL;
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+
+    fseek(f, 0, SEEK_SET);
+    *samples = malloc(len);
+    uint32_t count = fread(*samples, sizeof(int16_t), len / sizeof(int16_t), f);
+
+    fclose(f);
+    return count;
+}
+
+static bool decoderCreate(test_decoder* d, test_format format, const char* name, uint32_t cache_len)
+{
+    d->format = format;
+
+    if (format == test_adpcm)
+    {
+        return adpcmFileCreate(&d->af, name, (unsigned char*)cache, cache_len);
+    }
+    else if (format == test_flac)
+    {
+        return flacFileCreate(&d->ff, name, (unsigned char*)cache, cache_len);
+    }
+    return f_open(&d->fil, name, FA_OPEN_EXISTING | FA_READ) == FR_OK;
+}
+
+static void decoderClose(test_decoder* d)
+{
+    if (d->format == test_adpcm)
+    {
+        adpcmFileClose(&d->af);
+    }
+    else if (d->format == test_flac)
+    {
+        flacFileClose(&d->ff);
+    }
+    else
+    {
+        f_close(&d->fil);
+    }
+}
+
+// Read 16 bit WAV data as the player does, looping at the end
+static bool pcmRead(FIL* fil, int16_t* buffer, uint32_t len, uint32_t* written)
+{
+    UINT read;
+
+    *written = 0;
+
+    while (*written < len)
+    {
+        if ((f_read(fil, buffer + *written, (len - *written) * sizeof(int16_t), &read) != FR_OK))
+        {
+            return false;
+        }
+        if (read == 0)
+        {
+            if (f_lseek(fil, 0) != FR_OK)
+            {
+                return false;
+            }
+            continue;
+        }
+        *written += read / sizeof(int16_t);
+    }
+    return true;
+}
+
+static bool decoderRead(test_decoder* d, int16_t* buffer, uint32_t len, uint32_t* written)
+{
+    if (d->format == test_adpcm)
+    {
+        return adpcmFileRead(&d->af, buffer, len, written);
+    }
+    else if (d->format == test_flac)
+    {
+        return flacFileRead(&d->ff, buffer, len, written);
+    }
+    return pcmRead(&d->fil, buffer, len, written);
+}
+
+// Decode len samples in reads of varying length, returns the number decoded
+static uint32_t decodeAll(test_decoder* d, int16_t* out, uint32_t len)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; count < len; i++)
+    {
+        uint32_t n = 1 + (i * 397) % 1500;
+        uint32_t written;
+
+        n = (n < len - count) ? n : len - count;
+
+        if (!decoderRead(d, out + count, n, &written) || (written != n))
+        {
+            break;
+        }
+        count += n;
+    }
+    return count;
+}
+
+// Signal to noise ratio of decoded against source, in dB
+static double snrDb(const int16_t* decoded, const int16_t* source, uint32_t len)
+{
+    double signal = 0;
+    double noise = 0;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        double error = (double)decoded[i] - source[i];
+
+        signal += (double)source[i] * source[i];
+        noise += error * error;
+    }
+    return 10.0 * log10(signal / (noise + 1.0));
+}
+
+static void testCase(const test_case* tc)
+{
+    test_decoder d;
+    decode_stats ds;
+    int16_t* reference;
+    uint32_t len = loadSamples(tc->reference, &reference);
+
+    if (!CHECK(len > 0) || !CHECK(decoderCreate(&d, tc->format, tc->name, TEST_CACHE)))
+    {
+        free(reference);
+        return;
+    }
+
+    if (tc->format == test_adpcm)
+    {
+        CHECK(adpcmFileGetSampleRate(&d.af) == tc->sample_rate);
+        CHECK(adpcmFileIsStereo(&d.af) == tc->stereo);
+    }
+    else
+    {
+        CHECK(flacFileGetSampleRate(&d.ff) == tc->sample_rate);
+        CHECK(flacFileIsStereo(&d.ff) == tc->stereo);
+    }
+
+    int16_t* out = malloc(len * sizeof(int16_t));
+
+    // Every frame is decoded, and reported to the statistics
+    decodeStatsCreate(&ds);
+    decodeStatsBegin(&ds);
+    CHECK(decodeAll(&d, out, len) == len);
+    CHECK(memcmp(out, reference, len * sizeof(int16_t)) == 0);
+    CHECK(ds.frames == tc->frames);
+    decodeStatsBegin(NULL);
+
+    // At the end the file loops to the first frame
+    memset(out, 0, len * sizeof(int16_t));
+    CHECK(decodeAll(&d, out, len) == len);
+    CHECK(memcmp(out, reference, len * sizeof(int16_t)) == 0);
+
+    if (tc->format == test_adpcm)
+    {
+        int16_t* source;
+        uint32_t source_len = loadSamples(tc->source, &source);
+        uint32_t tones = tc->sample_rate * (tc->stereo ? 2 : 1) * TEST_TONES_MS / 1000;
+
+        // Measured over the tones, the full scale steps are beyond the slew rate of ADPCM
+        if (CHECK((source_len <= len) && (tones <= source_len)))
+        {
+            double snr = snrDb(out, source, tones);
+
+            printf("%s, %.1fdB signal to noise\n", tc->name, snr);
+            CHECK(snr >= TEST_ADPCM_SNR_DB);
+        }
+        free(source);
+    }
+    decoderClose(&d);
+    free(out);
+    free(reference);
+}
+
+// A block that does not fit the working buffer is refused when the file is opened
+static void testLargeBlock(void)
+{
+    test_decoder d;
+    int16_t* reference;
+    uint32_t len = loadSamples("stereo.raw", &reference);
+    int16_t out[2 * 4096];
+
+    CHECK(!decoderCreate(&d, test_flac, "large.flac", TEST_CACHE));
+
+    if (CHECK(decoderCreate(&d, test_flac, "large.flac", TEST_LARGE_CACHE)))
+    {
+        CHECK(decodeAll(&d, out, 2 * 4096) == 2 * 4096);
+        CHECK((len >= 2 * 4096) && (memcmp(out, reference, sizeof(out)) == 0));
+        decoderClose(&d);
+    }
+    CHECK(!decoderCreate(&d, test_adpcm, "stereo.flac", TEST_CACHE));
+    CHECK(!decoderCreate(&d, test_flac, "stereo.wav", TEST_CACHE));
+    free(reference);
+}
+
+// The decode ahead is sized from the worst refill cost and SD card wait, between half and all of a RAM buffer
+static void testLatency(void)
+{
+    decode_stats ds;
+    uint32_t min_len = TEST_BLOCK;
+    uint32_t max_len = 2 * TEST_BLOCK;
+
+    decodeStatsCreate(&ds);
+    CHECK(decodeStatsLatency(&ds, 22050, true, min_len, max_len) == max_len);
+
+    // A cheap stream on a quick card is decoded in the shortest steps
+    decodeStatsEnd(&ds, TEST_BLOCK, 11000, 10000);
+    CHECK(decodeStatsLatency(&ds, 22050, true, min_len, max_len) == min_len);
+
+    // A slow card read needs more ahead, in whole stereo frames
+    decodeStatsEnd(&ds, TEST_BLOCK, 61000, 60000);
+    uint32_t latency = decodeStatsLatency(&ds, 22050, true, min_len, max_len);
+
+    CHECK((latency > min_len) && (latency < max_len) && ((latency & 1) == 0));
+
+    // A stream that costs more than half its play time fills the whole buffer
+    decodeStatsEnd(&ds, TEST_BLOCK, 150000, 0);
+    CHECK(decodeStatsLatency(&ds, 22050, true, min_len, max_len) == max_len);
+}
+
+static void benchmark(void)
+{
+    static int16_t buffer[TEST_BLOCK];
+    static const test_case formats[] =
+    {
+        {"stereo.raw", NULL, NULL, test_pcm, 22050, true, 0},
+        {"stereo.wav", NULL, NULL, test_adpcm, 22050, true, 0},
+        {"stereo.flac", NULL, NULL, test_flac, 22050, true, 0}
+    };
+    static const char* names[] = {"WAV", "ADPCM", "FLAC"};
+
+    for (uint32_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    {
+        test_decoder d;
+        sd_stats stats;
+        struct timespec t0;
+        struct timespec t1;
+        uint32_t blocks = TEST_SECONDS * formats[f].sample_rate * 2 / TEST_BLOCK;
+        uint32_t written;
+
+        if (!CHECK(decoderCreate(&d, formats[f].format, formats[f].name, TEST_CACHE)))
+        {
+            continue;
+        }
+        sdStatsTake(&stats);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        uint64_t start = testCycles();
+
+        for (uint32_t b = 0; b < blocks; b++)
+        {
+            decoderRead(&d, buffer, TEST_BLOCK, &written);
+            testKeep(buffer[b % TEST_BLOCK]);
+        }
+        uint64_t cycles = testCycles() - start;
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        sdStatsTake(&stats);
+        decoderClose(&d);
+
+        double seconds = (double)blocks * TEST_BLOCK / 2 / formats[f].sample_rate;
+        double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+        printf("%s, %.0f host cycles and %.0f bytes read per second of audio, %.3f%% of real time\n", names[f],
+               (double)cycles / seconds, stats.bytes / seconds, 100.0 * elapsed / seconds);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        return 1;
+    }
+    directory = argv[1];
+    hostCardInsert(directory);
+
+    for (uint32_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        testCase(&cases[i]);
+    }
+    testLargeBlock();
+    testLatency();
+    benchmark();
+
+    return testResult("decode");
+}
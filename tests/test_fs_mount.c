@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "pico/stdlib.h"
+#include "fs_mount.h"
+#include "sd_stats.h"
+#include "diskio.h"
+
+/*
+   SD card mounting and hot swap.
+   The card is a directory of the host, which the test removes and inserts
+   in virtual time. Reads go through the f_read wrapper of sd_stats.c, so a
+   read that fails on a removed card is seen as the player sees it. Checks
+   the retry backoff without a card, the release of a card that is removed
+   whilst a file plays, and the remount when it is inserted again. A mount
+   requested by the player is made by fsService, within the backoff
+ */
+#define TEST_STEP_MS    10                  // Virtual time between calls of fsService, as the main loop
+#define TEST_FILE_SIZE  4096
+
+static void advanceMs(uint32_t ms)
+{
+    hostTimeAdvance((uint64_t)ms * 1000);
+}
+
+// Call fsService as the main loop does, until an event or the time has passed
+static fs_card_event serviceFor(fs_mount* fs, uint32_t ms, uint32_t* waited_ms)
+{
+    fs_card_event event = fs_card_none;
+
+    for (*waited_ms = 0; (*waited_ms < ms) && (event == fs_card_none); *waited_ms += TEST_STEP_MS)
+    {
+        advanceMs(TEST_STEP_MS);
+        event = fsService(fs);
+    }
+    return event;
+}
+
+static void writeFile(const char* directory, const char* name)
+{
+    char path[512];
+    uint8_t data[TEST_FILE_SIZE];
+
+    for (uint32_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(i * 7);
+    }
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    FILE* f = fopen(path, "wb");
+
+    fwrite(data, 1, sizeof(data), f);
+    fclose(f);
+}
+
+// A slot without a card detect switch is retried with a doubling wait
+static void testBackoff(const char* directory)
+{
+    fs_mount fs;
+    uint32_t expected_ms = FS_MOUNT_RETRY_MS;
+
+    sd_get_by_num(0)->use_card_detect = false;
+    hostCardRemove();
+    hostTimeSet(1000000);
+    fsInitialise(&fs);
+
+    CHECK(!fsMount(&fs));
+    CHECK(fs.failed);
+
+    for (uint32_t attempt = 0; attempt < 6; attempt++)
+    {
+        uint32_t failed_at_ms = to_ms_since_boot(get_absolute_time());
+
+        CHECK(fs.retry_at_ms == failed_at_ms + expected_ms);
+
+        // Requests before the retry time do not touch the card
+        advanceMs(expected_ms - 1);
+        CHECK(!fsMount(&fs));
+        CHECK(fs.retry_at_ms == failed_at_ms + expected_ms);
+
+        advanceMs(1);
+        CHECK(!fsMount(&fs));
+        expected_ms = (expected_ms * 2 > FS_MOUNT_RETRY_MAX_MS) ? FS_MOUNT_RETRY_MAX_MS : expected_ms * 2;
+    }
+    CHECK(fs.retry_ms == FS_MOUNT_RETRY_MAX_MS);
+
+    // Inserted, the card is mounted at the next retry, within the longest wait
+    hostCardInsert(directory);
+    uint32_t waited_ms;
+
+    CHECK(serviceFor(&fs, FS_MOUNT_RETRY_MAX_MS + TEST_STEP_MS, &waited_ms) == fs_card_inserted);
+    CHECK(waited_ms <= FS_MOUNT_RETRY_MAX_MS + TEST_STEP_MS);
+    CHECK(fsMounted(&fs) && (fs.mounts == 1) && (fs.retry_ms == FS_MOUNT_RETRY_MS));
+    fsUnmount(&fs);
+}
+
+// A card removed whilst a file plays is released, and mounted again when it returns
+static void testHotSwap(const char* directory)
+{
+    fs_mount fs;
+    FIL fp;
+    UINT read;
+    uint8_t buffer[512];
+    uint32_t waited_ms;
+
+    sd_get_by_num(0)->use_card_detect = true;
+    hostCardInsert(directory);
+    hostTimeSet(1000000);
+    fsInitialise(&fs);
+
+    CHECK(fsMount(&fs));
+    CHECK(serviceFor(&fs, 100, &waited_ms) == fs_card_none);
+    CHECK(f_open(&fp, "1", FA_READ) == FR_OK);
+    CHECK((f_read(&fp, buffer, sizeof(buffer), &read) == FR_OK) && (read == sizeof(buffer)));
+
+    // The read after removal fails, as the player sees it
+    uint32_t errors = sdStatsErrors();
+
+    hostCardRemove();
+    CHECK(f_read(&fp, buffer, sizeof(buffer), &read) != FR_OK);
+    CHECK(sdStatsErrors() == errors + 1);
+    fsLost(&fs);
+
+    // Released at the next service, with the card marked for reinitialising
+    CHECK(fsService(&fs) == fs_card_removed);
+    CHECK(!fsMounted(&fs));
+    CHECK(sd_get_by_num(0)->m_Status & STA_NOINIT);
+
+    // With no card in the slot, nothing is tried however long it is out
+    CHECK(serviceFor(&fs, 60000, &waited_ms) == fs_card_none);
+    CHECK(!fsMount(&fs));
+    CHECK(fs.mounts == 1);
+
+    // A file open on the old insertion still fails after the card returns
+    hostCardInsert(directory);
+    CHECK(serviceFor(&fs, FS_MOUNT_RETRY_MS + TEST_STEP_MS, &waited_ms) == fs_card_inserted);
+    CHECK(fs.mounts == 2);
+    CHECK(f_read(&fp, buffer, sizeof(buffer), &read) != FR_OK);
+    f_close(&fp);
+
+    // The file can be opened again, and resumed from where it was
+    CHECK(f_open(&fp, "1", FA_READ) == FR_OK);
+    CHECK(f_lseek(&fp, 512) == FR_OK);
+    CHECK((f_read(&fp, buffer, sizeof(buffer), &read) == FR_OK) && (read == sizeof(buffer)));
+    CHECK((buffer[0] == (uint8_t)(512 * 7)) && (buffer[1] == (uint8_t)(513 * 7)));
+    f_close(&fp);
+
+    // Removal is also found from the card detect switch, without a failed read
+    hostCardRemove();
+    CHECK(fsService(&fs) == fs_card_removed);
+    hostCardInsert(directory);
+    CHECK(serviceFor(&fs, FS_MOUNT_RETRY_MS + TEST_STEP_MS, &waited_ms) == fs_card_inserted);
+    CHECK(fs.mounts == 3);
+
+    // The bytes and failed reads are counted
+    sd_stats stats;
+
+    sdStatsTake(&stats);
+    CHECK((stats.reads == 4) && (stats.errors == 2) && (stats.bytes == 2 * sizeof(buffer)));
+    fsUnmount(&fs);
+}
+
+// A requested mount is left to fsService, and does not cut short the wait after a failure
+static void testRequest(const char* directory)
+{
+    fs_mount fs;
+    uint32_t waited_ms;
+
+    sd_get_by_num(0)->use_card_detect = false;
+    hostCardInsert(directory);
+    hostTimeSet(1000000);
+    fsInitialise(&fs);
+
+    fsRequestMount(&fs);
+    CHECK(!fsMounted(&fs) && (fs.mounts == 0));
+    CHECK(serviceFor(&fs, TEST_STEP_MS, &waited_ms) == fs_card_inserted);
+    CHECK(fsMounted(&fs) && (fs.mounts == 1));
+
+    // Requests whilst mounted change nothing
+    fsRequestMount(&fs);
+    CHECK(!fs.failed);
+    fsUnmount(&fs);
+
+    // After a failure the request waits for the retry time
+    hostCardRemove();
+    CHECK(!fsMount(&fs));
+    uint32_t retry_at_ms = fs.retry_at_ms;
+
+    hostCardInsert(directory);
+    fsRequestMount(&fs);
+    CHECK(fs.retry_at_ms == retry_at_ms);
+    CHECK(serviceFor(&fs, FS_MOUNT_RETRY_MS + TEST_STEP_MS, &waited_ms) == fs_card_inserted);
+    CHECK(waited_ms >= FS_MOUNT_RETRY_MS - TEST_STEP_MS);
+    fsUnmount(&fs);
+}
+
+int main(void)
+{
+    char directory[] = "/tmp/picosounds_cardXXXXXX";
+
+    if (!mkdtemp(directory))
+    {
+        return 1;
+    }
+    writeFile(directory, "1");
+
+    testBackoff(directory);
+    testHotSwap(directory);
+    testRequest(directory);
+
+    return testResult("fs_mount");
+}
@@ -0,0 +1,164 @@
+#include <string.h>
+#include "test.h"
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "led_engine.h"
+
+/*
+   WS2812 LED engine.
+   The frame timer runs in virtual time, and each frame sent by DMA is kept
+   by the host stand in. Checks that a dim level is shown on average by
+   dithering, that only channels below the dither limit are dithered, and
+   that whilst asleep the light is rounded to whole levels so no repeating
+   timer is left running to wake the processor. The benchmark reports host
+   cycles per frame, and the wake ups a second whilst dithering
+ */
+#define TEST_PIXELS     4
+#define TEST_FRAMES     256                 // Frames for the dither to average out
+
+static pio_hw_t pio;
+
+// Red, green and blue of a pixel in the last frame sent
+static void lastPixel(led_engine* le, uint32_t pixel, uint32_t rgb[3])
+{
+    uint32_t word = host_dma[le->dma_channel].words[pixel];
+
+    rgb[0] = (word >> 16) & 0xff;
+    rgb[1] = (word >> 24) & 0xff;
+    rgb[2] = (word >> 8) & 0xff;
+}
+
+static uint32_t transfers(led_engine* le)
+{
+    return host_dma[le->dma_channel].transfers;
+}
+
+// Run the frame timer for one frame at a time, summing the red of the first pixel
+static uint32_t sumRed(led_engine* le, uint32_t frames)
+{
+    uint32_t sum = 0;
+    uint32_t rgb[3];
+
+    for (uint32_t f = 0; f < frames; f++)
+    {
+        hostTimersRun(LED_ENGINE_FRAME_MS * 1000);
+        lastPixel(le, 0, rgb);
+        sum += rgb[0];
+    }
+    return sum;
+}
+
+static void testSleep(void)
+{
+    led_engine le;
+    uint32_t rgb[3];
+
+    hostTimeSet(1000000);
+    ledEngineCreate(&le, &pio, 0, TEST_PIXELS);
+
+    // A dim orange has fractional channels, so frames keep being sent
+    ledEngineSetColour(&le, led_orange, 0.3f);
+    hostTimersRun(100000);
+    CHECK(le.dithering && le.running);
+    CHECK(hostTimersActive() == 1);
+
+    // On average the dithered red is the fractional level
+    uint32_t sum = sumRed(&le, TEST_FRAMES);
+    uint32_t dim = sum / TEST_FRAMES;
+
+    CHECK((dim >= 17) && (dim <= 19));
+    CHECK(sum % TEST_FRAMES != 0);
+
+    // Asleep, the light is rounded and the timer stops after the next frame
+    ledEngineSleep(&le, true);
+    hostTimersRun(2 * LED_ENGINE_FRAME_MS * 1000);
+    CHECK(!le.dithering && !le.running);
+    CHECK(hostTimersActive() == 0);
+
+    uint32_t sent = transfers(&le);
+
+    lastPixel(&le, 0, rgb);
+    CHECK((rgb[0] >= dim) && (rgb[0] <= dim + 1));
+    hostTimersRun(60000000);
+    CHECK(transfers(&le) == sent);
+
+    // A sunrise from the timeline runs whilst asleep, and the timer stops at its end
+    ledEngineSetEffect(&le, led_effect_sunrise, 1000);
+    CHECK(hostTimersActive() == 1);
+    hostTimersRun(1100000);
+    CHECK(hostTimersActive() == 0);
+    CHECK(transfers(&le) > sent + 1000 / LED_ENGINE_FRAME_MS);
+
+    // Awake, dim levels are dithered again
+    ledEngineSetEffect(&le, led_effect_static, 0);
+    ledEngineSetColour(&le, led_orange, 0.3f);
+    ledEngineSleep(&le, false);
+    hostTimersRun(1000000);
+    CHECK(le.dithering && (hostTimersActive() == 1));
+
+    // A black light stops the timer whether asleep or not
+    ledEngineSetColour(&le, led_black, 1.0f);
+    hostTimersRun(100000);
+    CHECK(hostTimersActive() == 0);
+}
+
+static void testDitherLimit(void)
+{
+    led_engine le;
+    uint32_t rgb[3];
+
+    hostTimeSet(1000000);
+    ledEngineCreate(&le, &pio, 0, TEST_PIXELS);
+
+    // Bright channels are rounded, so a bright light needs no frame timer
+    ledEngineSetColour(&le, led_white, 0.6f);
+    hostTimersRun(100000);
+    CHECK(!le.dithering && (hostTimersActive() == 0));
+
+    // With a limit of 8, the dim orange red of about 18 is rounded and only the green dithers
+    ledEngineSetColour(&le, led_orange, 0.3f);
+    ledEngineSetDither(&le, 8);
+    hostTimersRun(100000);
+    CHECK(le.dithering && (hostTimersActive() == 1));
+
+    uint32_t sum = sumRed(&le, TEST_FRAMES);
+
+    lastPixel(&le, 0, rgb);
+    CHECK(sum == rgb[0] * TEST_FRAMES);
+
+    // Off, nothing dithers and the timer stops
+    ledEngineSetDither(&le, 0);
+    hostTimersRun(100000);
+    CHECK(!le.dithering && (hostTimersActive() == 0));
+    ledEngineSetColour(&le, led_black, 1.0f);
+    hostTimersRun(100000);
+}
+
+static void benchmark(void)
+{
+    led_engine le;
+
+    hostTimeSet(1000000);
+    ledEngineCreate(&le, &pio, 0, 1);
+    ledEngineSetColour(&le, led_orange, 0.1f);
+    hostTimersRun(100000);
+
+    uint32_t sent = transfers(&le);
+    uint64_t start = testCycles();
+    uint32_t calls = hostTimersRun(60000000);
+    uint64_t cycles = testCycles() - start;
+
+    printf("Dithering, %u wake ups a second, %.0f host cycles per frame of one pixel\n",
+           (transfers(&le) - sent) / 60, (double)cycles / calls);
+    ledEngineSetColour(&le, led_black, 1.0f);
+    hostTimersRun(100000);
+}
+
+int main(void)
+{
+    testSleep();
+    testDitherLimit();
+    benchmark();
+
+    return testResult("led_engine");
+}
@@ -0,0 +1,222 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "ff.h"
+#include "colour_noise.h"
+#include "noise_shaper.h"
+
+/*
+   Spectral shaping of white noise.
+   Checks the tilt of each colour from its lag 1 correlation, that stereo
+   channels are shaped independently, and the coefficient file. Then times
+   each colour, including generating the white noise, against the refill
+   period of a noise RAM buffer
+ */
+#define TEST_RATE       22000                   // Sample rate of noise, as the player
+#define TEST_BLOCK      4400                    // Interleaved samples in a noise RAM buffer
+#define TEST_BLOCKS     256
+
+typedef struct colour_case
+{
+    const char* name;
+    const noise_shape* shape;
+    double min_correlation;
+    double max_correlation;
+} colour_case;
+
+static noise_shape custom;
+
+static const colour_case colours[] =
+{
+    {"blue", &noise_shape_blue, -0.6, -0.05},
+    {"violet", &noise_shape_violet, -0.55, -0.45},
+    {"grey", &noise_shape_grey, 0.05, 0.9},
+    {"custom", &custom, 0.05, 0.9}
+};
+
+// Generate a stereo block as the player does, white noise shaped in place
+static void populate(colour_noise* cn, noise_shaper* ns, int16_t* buffer)
+{
+    for (uint32_t i = 0; i < TEST_BLOCK; i += 2)
+    {
+        buffer[i] = (int16_t)colourNoiseWhite(&cn[0]);
+        buffer[i + 1] = (int16_t)colourNoiseWhite(&cn[1]);
+    }
+    noiseShaperProcess(&ns[0], buffer, TEST_BLOCK, 2);
+    noiseShaperProcess(&ns[1], buffer + 1, TEST_BLOCK - 1, 2);
+}
+
+static void testColour(const colour_case* c)
+{
+    colour_noise cn[2];
+    noise_shaper ns[2];
+    int16_t buffer[TEST_BLOCK];
+    double square = 0.0;
+    double lag = 0.0;
+    uint32_t clipped = 0;
+    int32_t previous = 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        colourNoiseCreate(&cn[i], 0);
+        colourNoiseSeed(&cn[i], 11 + i);
+        noiseShaperCreate(&ns[i], c->shape);
+    }
+
+    for (uint32_t b = 0; b < TEST_BLOCKS; b++)
+    {
+        populate(cn, ns, buffer);
+
+        for (uint32_t i = 0; i < TEST_BLOCK; i += 2)
+        {
+            square += (double)buffer[i] * buffer[i];
+            lag += (double)buffer[i] * previous;
+            clipped += (buffer[i] == INT16_MAX) || (buffer[i] == INT16_MIN);
+            previous = buffer[i];
+        }
+    }
+
+    uint32_t samples = TEST_BLOCKS * TEST_BLOCK / 2;
+    double correlation = lag / square;
+
+    printf("%-7s rms %8.1f lag 1 correlation %6.3f clipped %u\n", c->name, sqrt(square / samples), correlation, clipped);
+
+    CHECK((correlation >= c->min_correlation) && (correlation <= c->max_correlation));
+    CHECK(sqrt(square / samples) > 1000.0);
+    CHECK(clipped < samples / 1000);
+}
+
+// Shaping one channel of an interleaved block leaves the other unchanged
+static void testStride(void)
+{
+    noise_shaper ns;
+    int16_t buffer[64];
+    bool unchanged = true;
+
+    for (int i = 0; i < 64; i++)
+    {
+        buffer[i] = (int16_t)(i * 300);
+    }
+    noiseShaperCreate(&ns, &noise_shape_violet);
+    noiseShaperProcess(&ns, buffer, 64, 2);
+
+    for (int i = 1; i < 64; i += 2)
+    {
+        unchanged = unchanged && (buffer[i] == i * 300);
+    }
+    CHECK(unchanged);
+}
+
+static bool writeFile(const char* directory, const char* name, const char* text)
+{
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    FILE* f = fopen(path, "w");
+
+    if (!f)
+    {
+        return false;
+    }
+    fputs(text, f);
+    fclose(f);
+    return true;
+}
+
+static void testLoad(const char* directory)
+{
+    noise_shape shape;
+
+    // The example from the README, which is the built in grey
+    CHECK(writeFile(directory, "noise", "# grey\n2 32767\n32604 31785 # low shelf\n31785 26214\n"));
+    CHECK(noiseShaperLoad(&shape, "noise"));
+    CHECK(shape.input_shift == noise_shape_grey.input_shift);
+    CHECK(shape.gain == noise_shape_grey.gain);
+    CHECK(shape.num_sections == noise_shape_grey.num_sections);
+
+    for (uint32_t s = 0; s < shape.num_sections; s++)
+    {
+        CHECK((shape.pole[s] == noise_shape_grey.pole[s]) && (shape.zero[s] == noise_shape_grey.zero[s]));
+    }
+    custom = shape;
+
+    // Unstable pole, incomplete section, shift out of range, missing file
+    CHECK(writeFile(directory, "bad_pole", "0 32767 32768 0\n"));
+    CHECK(!noiseShaperLoad(&shape, "bad_pole"));
+    CHECK(writeFile(directory, "bad_pair", "0 32767 1000\n"));
+    CHECK(!noiseShaperLoad(&shape, "bad_pair"));
+    CHECK(writeFile(directory, "bad_shift", "16 32767 1000 0\n"));
+    CHECK(!noiseShaperLoad(&shape, "bad_shift"));
+    CHECK(!noiseShaperLoad(&shape, "missing"));
+
+    // More sections than are supported, and text that is not a number
+    CHECK(writeFile(directory, "bad_count", "0 32767 1 0 2 0 3 0 4 0 5 0\n"));
+    CHECK(!noiseShaperLoad(&shape, "bad_count"));
+    CHECK(writeFile(directory, "bad_text", "0 32767 1000 O\n"));
+    CHECK(!noiseShaperLoad(&shape, "bad_text"));
+
+    // A file rejected part way through leaves the shape, which may be playing, as it was
+    CHECK(writeFile(directory, "bad_second", "1 16384 1000 0 40000 0\n"));
+    CHECK(!noiseShaperLoad(&shape, "bad_second"));
+    CHECK(memcmp(&shape, &custom, sizeof(shape)) == 0);
+}
+
+static void benchmark(void)
+{
+    colour_noise cn[2];
+    noise_shaper ns[2];
+    int16_t buffer[TEST_BLOCK];
+    double refill_ns = 1e9 * TEST_BLOCK / 2 / TEST_RATE;
+
+    for (uint32_t c = 0; c < sizeof(colours) / sizeof(colours[0]); c++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            colourNoiseCreate(&cn[i], 0);
+            noiseShaperCreate(&ns[i], colours[c].shape);
+        }
+
+        uint64_t start = testCycles();
+        struct timespec t0;
+        struct timespec t1;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        for (uint32_t b = 0; b < TEST_BLOCKS; b++)
+        {
+            populate(cn, ns, buffer);
+            testKeep(buffer[b]);
+        }
+        uint64_t cycles = testCycles() - start;
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double block_ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / TEST_BLOCKS;
+
+        printf("%-7s %lu sections, %.2f host cycles per sample, %.3f%% of the refill period\n", colours[c].name,
+               (unsigned long)colours[c].shape->num_sections, (double)cycles / TEST_BLOCKS / TEST_BLOCK,
+               100.0 * block_ns / refill_ns);
+    }
+}
+
+int main(void)
+{
+    char directory[] = "/tmp/picosounds_shaperXXXXXX";
+
+    if (!mkdtemp(directory))
+    {
+        return 1;
+    }
+    hostCardInsert(directory);
+
+    testLoad(directory);
+    testStride();
+
+    for (uint32_t c = 0; c < sizeof(colours) / sizeof(colours[0]); c++)
+    {
+        testColour(&colours[c]);
+    }
+    benchmark();
+
+    return testResult("noise_shaper");
+}
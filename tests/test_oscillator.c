@@ -0,0 +1,188 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "oscillator.h"
+
+/*
+   Oscillator bank.
+   Checks the interpolated sine against the library sine, the frequency of a
+   tone and of a binaural beat from their zero crossings, and that a block
+   split in two gives the same samples. The benchmark reports host cycles per
+   sample for each oscillator in the bank, against a float sinf per sample
+ */
+#define TEST_RATE       22000                   // SAMPLE_RATE of the player
+#define TEST_BLOCK      4400                    // Interleaved samples in a noise RAM buffer
+#define TEST_BLOCKS     256
+#define TEST_AMPLITUDE  16384                   // SYNTH_AMPLITUDE, half scale
+
+static void testSine(void)
+{
+    double worst = 0;
+
+    for (uint64_t phase = 0; phase < (1ull << 32); phase += 65537)
+    {
+        double expected = 32767.0 * sin(2.0 * M_PI * phase / 4294967296.0);
+        double error = fabs(oscillatorSine((uint32_t)phase) - expected);
+
+        worst = (error > worst) ? error : worst;
+    }
+    printf("Sine worst error %.2f of 32767\n", worst);
+
+    // 256 entries with linear interpolation are within 4 of full scale
+    CHECK(worst < 4.0);
+    CHECK(oscillatorSine(0) == 0);
+    CHECK(oscillatorSine(1u << 30) == 32767);
+    CHECK(oscillatorSine(3u << 30) == -32767);
+}
+
+// Rising zero crossings of one channel of interleaved samples
+static uint32_t crossings(const int16_t* buffer, uint32_t len, uint32_t stride)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = stride; i < len; i += stride)
+    {
+        count += (buffer[i - stride] < 0) && (buffer[i] >= 0);
+    }
+    return count;
+}
+
+static void testBinaural(void)
+{
+    static int16_t buffer[2 * TEST_RATE * 10];
+    oscillator_bank ob[2];
+    int32_t peak = 0;
+
+    // 200Hz left, 204Hz right for 10 seconds, as the default binaural beat
+    oscillatorBankCreate(&ob[0]);
+    oscillatorBankCreate(&ob[1]);
+    CHECK(oscillatorBankAdd(&ob[0], 200000, TEST_RATE, TEST_AMPLITUDE));
+    CHECK(oscillatorBankAdd(&ob[1], 204000, TEST_RATE, TEST_AMPLITUDE));
+
+    // Generated in blocks, so the phase is carried between them
+    for (uint32_t i = 0; i < sizeof(buffer) / sizeof(buffer[0]); i += TEST_BLOCK)
+    {
+        oscillatorBankProcess(&ob[0], buffer + i, TEST_BLOCK, 2);
+        oscillatorBankProcess(&ob[1], buffer + i + 1, TEST_BLOCK - 1, 2);
+    }
+
+    uint32_t left = crossings(buffer, sizeof(buffer) / sizeof(buffer[0]), 2);
+    uint32_t right = crossings(buffer + 1, sizeof(buffer) / sizeof(buffer[0]) - 1, 2);
+
+    CHECK((left >= 1999) && (left <= 2000));
+    CHECK((right >= 2039) && (right <= 2040));
+
+    // The beat is the difference, 4 cycles a second
+    CHECK(right - left == 40);
+
+    for (uint32_t i = 0; i < sizeof(buffer) / sizeof(buffer[0]); i++)
+    {
+        peak = (abs(buffer[i]) > peak) ? abs(buffer[i]) : peak;
+    }
+    CHECK((peak > TEST_AMPLITUDE - 8) && (peak <= TEST_AMPLITUDE));
+}
+
+static void testBank(void)
+{
+    int16_t whole[TEST_BLOCK];
+    int16_t split[TEST_BLOCK];
+    oscillator_bank a;
+    oscillator_bank b;
+
+    oscillatorBankCreate(&a);
+
+    for (uint32_t n = 0; n < OSCILLATOR_BANK_SIZE; n++)
+    {
+        CHECK(oscillatorBankAdd(&a, 100000 + 37000 * n, TEST_RATE, 32767 / OSCILLATOR_BANK_SIZE));
+    }
+    CHECK(!oscillatorBankAdd(&a, 1000, TEST_RATE, 1000));
+    b = a;
+
+    // A block split anywhere is the same as one block
+    oscillatorBankProcess(&a, whole, TEST_BLOCK, 1);
+    oscillatorBankProcess(&b, split, 1234, 1);
+    oscillatorBankProcess(&b, split + 1234, TEST_BLOCK - 1234, 1);
+    CHECK(memcmp(whole, split, sizeof(whole)) == 0);
+
+    // A slow oscillator, as the breathing envelope of 10 seconds, steps the phase by the rate
+    oscillatorBankCreate(&a);
+    oscillatorBankAdd(&a, 100, TEST_RATE, INT16_MAX);
+    CHECK(a.step[0] == (uint32_t)((100ull << 32) / (TEST_RATE * 1000ull)));
+
+    // Interleaved samples of the other channel are left alone
+    memset(whole, 0x55, sizeof(whole));
+    oscillatorBankProcess(&b, whole, TEST_BLOCK, 2);
+
+    for (uint32_t i = 1; i < TEST_BLOCK; i += 2)
+    {
+        if (!CHECK(whole[i] == 0x5555))
+        {
+            break;
+        }
+    }
+}
+
+static void benchmark(void)
+{
+    static int16_t buffer[TEST_BLOCK];
+    double refill_ns = 1e9 * TEST_BLOCK / 2 / TEST_RATE;
+
+    for (uint32_t num = 1; num <= OSCILLATOR_BANK_SIZE; num++)
+    {
+        oscillator_bank ob;
+        struct timespec t0;
+        struct timespec t1;
+
+        oscillatorBankCreate(&ob);
+
+        for (uint32_t n = 0; n < num; n++)
+        {
+            oscillatorBankAdd(&ob, 200000 + 4000 * n, TEST_RATE, 32767 / OSCILLATOR_BANK_SIZE);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        uint64_t start = testCycles();
+
+        for (uint32_t b = 0; b < TEST_BLOCKS; b++)
+        {
+            oscillatorBankProcess(&ob, buffer, TEST_BLOCK, 2);
+            oscillatorBankProcess(&ob, buffer + 1, TEST_BLOCK - 1, 2);
+            testKeep(buffer[b]);
+        }
+        uint64_t cycles = testCycles() - start;
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double block_ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / TEST_BLOCKS;
+
+        printf("%u oscillators, %.2f host cycles per sample per oscillator, %.3f%% of the refill period\n", num,
+               (double)cycles / TEST_BLOCKS / TEST_BLOCK / num, 100.0 * block_ns / refill_ns);
+    }
+
+    // The float sine it replaces, one call per sample
+    float phase = 0;
+    float step = 2.0f * (float)M_PI * 200.0f / TEST_RATE;
+    uint64_t start = testCycles();
+
+    for (uint32_t b = 0; b < TEST_BLOCKS; b++)
+    {
+        for (uint32_t i = 0; i < TEST_BLOCK; i++)
+        {
+            buffer[i] = (int16_t)(TEST_AMPLITUDE * sinf(phase));
+            phase += step;
+            phase = (phase > 2.0f * (float)M_PI) ? phase - 2.0f * (float)M_PI : phase;
+        }
+        testKeep(buffer[b]);
+    }
+    printf("sinf, %.2f host cycles per sample\n", (double)(testCycles() - start) / TEST_BLOCKS / TEST_BLOCK);
+}
+
+int main(void)
+{
+    testSine();
+    testBinaural();
+    testBank();
+    benchmark();
+
+    return testResult("oscillator");
+}
@@ -0,0 +1,241 @@
+#include <string.h>
+#include "test.h"
+#include "protocol.h"
+#include "ring_buffer.h"
+
+/*
+   Control protocol.
+   Frames are encoded, then parsed whole, split at every byte, after debug
+   text and garbage, and through the ring buffer the UART interrupt fills.
+   Frames with a bad crc or an oversize length are rejected, and the parser
+   finds the next frame
+ */
+
+// Parse bytes, counting the complete frames and keeping the last
+static uint32_t parseBytes(protocol_parser* p, const uint8_t* bytes, uint32_t len, protocol_frame* last)
+{
+    uint32_t frames = 0;
+
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        if (protocolParse(p, bytes[i]))
+        {
+            frames++;
+            *last = p->frame;
+        }
+    }
+    return frames;
+}
+
+static bool sameFrame(const protocol_frame* f, uint8_t cmd, const uint8_t* payload, uint8_t len)
+{
+    return (f->cmd == cmd) && (f->len == len) && ((len == 0) || (memcmp(f->payload, payload, len) == 0));
+}
+
+static void testCrc(void)
+{
+    const char* check = "123456789";
+    uint8_t crc = 0;
+
+    // Standard check value of CRC-8 with polynomial 0x07
+    for (const char* c = check; *c; ++c)
+    {
+        crc = protocolCrc(crc, (uint8_t)*c);
+    }
+    CHECK(crc == 0xF4);
+}
+
+static void testRoundTrip(void)
+{
+    uint8_t payload[PROTOCOL_MAX_PAYLOAD];
+    uint8_t out[PROTOCOL_MAX_PAYLOAD + PROTOCOL_OVERHEAD];
+    protocol_parser p;
+    protocol_frame f;
+
+    for (uint32_t i = 0; i < PROTOCOL_MAX_PAYLOAD; ++i)
+    {
+        payload[i] = (uint8_t)(i * 37 + 5);
+    }
+    protocolParserCreate(&p);
+
+    // Empty, short and largest payloads
+    const uint8_t lengths[] = {0, 1, 2, PROTOCOL_MAX_PAYLOAD - 1, PROTOCOL_MAX_PAYLOAD};
+
+    for (uint32_t i = 0; i < sizeof(lengths); ++i)
+    {
+        uint32_t n = protocolEncode(protocol_set_synth, payload, lengths[i], out);
+
+        CHECK(n == lengths[i] + PROTOCOL_OVERHEAD);
+        CHECK(parseBytes(&p, out, n, &f) == 1);
+        CHECK(sameFrame(&f, protocol_set_synth, payload, lengths[i]));
+    }
+    CHECK(p.errors == 0);
+
+    // Multi byte values are little endian
+    protocolPut32(payload, 0x12345678);
+    CHECK((payload[0] == 0x78) && (payload[3] == 0x12));
+    CHECK(protocolGet32(payload) == 0x12345678);
+    CHECK(protocolGet16(payload + 2) == 0x1234);
+}
+
+static void testBadCrc(void)
+{
+    uint8_t payload[] = {1, 42};
+    uint8_t out[sizeof(payload) + PROTOCOL_OVERHEAD];
+    protocol_parser p;
+    protocol_frame f;
+    uint32_t n = protocolEncode(protocol_set_volume, payload, sizeof(payload), out);
+
+    protocolParserCreate(&p);
+
+    // Corrupt the cmd, payload and crc in turn, the frame is never accepted. A
+    // corrupt length makes the parser wait for more payload, see testResync
+    for (uint32_t i = 1; i < n; ++i)
+    {
+        if (i == 2)
+        {
+            continue;
+        }
+
+        uint8_t bad[sizeof(out)];
+
+        memcpy(bad, out, n);
+        bad[i] ^= 0x10;
+        CHECK(parseBytes(&p, bad, n, &f) == 0);
+
+        // And the next good frame is
+        CHECK(parseBytes(&p, out, n, &f) == 1);
+        CHECK(sameFrame(&f, protocol_set_volume, payload, sizeof(payload)));
+    }
+    CHECK(p.errors == n - 2);
+}
+
+static void testOversize(void)
+{
+    const uint8_t oversize[] = {PROTOCOL_SYNC, protocol_set_state, PROTOCOL_MAX_PAYLOAD + 1, 0, 1};
+    uint8_t payload[] = {0, 3};
+    uint8_t out[sizeof(payload) + PROTOCOL_OVERHEAD];
+    protocol_parser p;
+    protocol_frame f;
+    uint32_t n = protocolEncode(protocol_set_state, payload, sizeof(payload), out);
+
+    protocolParserCreate(&p);
+    CHECK(parseBytes(&p, oversize, sizeof(oversize), &f) == 0);
+    CHECK(p.errors == 1);
+    CHECK(p.state == protocol_wait_sync);
+
+    CHECK(parseBytes(&p, out, n, &f) == 1);
+    CHECK(sameFrame(&f, protocol_set_state, payload, sizeof(payload)));
+}
+
+static void testResync(void)
+{
+    const char* text = "Sample rate is 44100\nClock 181500 kHz, wrap 4095, error 86 ppm\n";
+    const uint8_t garbage[] = {0x00, 0xFF, 0x13, PROTOCOL_SYNC, protocol_set_led, 3, 9, 9};
+    uint8_t payload[] = {2, 50};
+    uint8_t out[sizeof(payload) + PROTOCOL_OVERHEAD];
+    protocol_parser p;
+    protocol_frame f;
+    uint32_t n = protocolEncode(protocol_set_led, payload, sizeof(payload), out);
+
+    protocolParserCreate(&p);
+
+    // Debug text has no sync bytes, so is skipped without errors
+    CHECK(parseBytes(&p, (const uint8_t*)text, strlen(text), &f) == 0);
+    CHECK(parseBytes(&p, out, n, &f) == 1);
+    CHECK(sameFrame(&f, protocol_set_led, payload, sizeof(payload)));
+    CHECK(p.errors == 0);
+
+    // A truncated frame in the garbage is rejected by its crc. As the parser does
+    // not look back, the frame it runs into is lost, but the one after is received
+    CHECK(parseBytes(&p, garbage, sizeof(garbage), &f) == 0);
+    CHECK(parseBytes(&p, out, n, &f) == 0);
+    CHECK(parseBytes(&p, out, n, &f) == 1);
+    CHECK(sameFrame(&f, protocol_set_led, payload, sizeof(payload)));
+    CHECK(p.errors >= 1);
+}
+
+static void testSplit(void)
+{
+    uint8_t payload[] = {0x10, 0x0E, 0x00, 0x00};
+    uint8_t out[2 * (sizeof(payload) + PROTOCOL_OVERHEAD)];
+    protocol_parser p;
+    protocol_frame f;
+    uint32_t n = protocolEncode(protocol_set_sleep, payload, 2, out);
+
+    n += protocolEncode(protocol_set_clock, payload, sizeof(payload), out + n);
+    protocolParserCreate(&p);
+
+    // Whatever has been received is parsed, so a frame can arrive in any number of pieces
+    for (uint32_t split = 0; split <= n; ++split)
+    {
+        uint32_t frames = parseBytes(&p, out, split, &f);
+
+        frames += parseBytes(&p, out + split, n - split, &f);
+        CHECK(frames == 2);
+        CHECK(sameFrame(&f, protocol_set_clock, payload, sizeof(payload)));
+    }
+    CHECK(p.errors == 0);
+}
+
+static void testRingBuffer(void)
+{
+    uint8_t data[16];
+    uint8_t payload[] = {0, 1};
+    uint8_t out[sizeof(payload) + PROTOCOL_OVERHEAD];
+    ring_buffer rb;
+    protocol_parser p;
+    protocol_frame f;
+    uint32_t n = protocolEncode(protocol_set_state, payload, sizeof(payload), out);
+    uint32_t frames = 0;
+    uint32_t sent = 0;
+    uint8_t byte;
+
+    ringBufferCreate(&rb, data, sizeof(data));
+    protocolParserCreate(&p);
+
+    // The interrupt adds a few bytes at a time, and the main loop takes whatever is there
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+        uint32_t put = (i % 3) + 1;
+
+        for (uint32_t j = 0; j < put; ++j)
+        {
+            CHECK(ringBufferPut(&rb, out[sent++ % n]));
+        }
+
+        while (ringBufferGet(&rb, &byte))
+        {
+            if (protocolParse(&p, byte))
+            {
+                frames++;
+                f = p.frame;
+            }
+        }
+    }
+    CHECK(rb.dropped == 0);
+    CHECK(frames == sent / n);
+    CHECK(sameFrame(&f, protocol_set_state, payload, sizeof(payload)));
+
+    // A full buffer drops bytes rather than overwriting them
+    for (uint32_t i = 0; i < sizeof(data); ++i)
+    {
+        CHECK(ringBufferPut(&rb, (uint8_t)i));
+    }
+    CHECK(!ringBufferPut(&rb, 0xFF));
+    CHECK(rb.dropped == 1);
+    CHECK(ringBufferGet(&rb, &byte) && (byte == 0));
+}
+
+int main(void)
+{
+    testCrc();
+    testRoundTrip();
+    testBadCrc();
+    testOversize();
+    testResync();
+    testSplit();
+    testRingBuffer();
+
+    return testResult("protocol");
+}
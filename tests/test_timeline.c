@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "pico/stdlib.h"
+#include "timeline.h"
+
+/*
+   Night programme.
+   Parses lines and a programme file, then runs whole nights in virtual time
+   as the main loop does, checking that each action runs once, at its time
+   and in order. Covers times of day that wrap past midnight, the clock being
+   set part way through, actions that are already past, and actions due at
+   the same time
+ */
+#define TEST_MINUTE_US  (60ull * 1000000)
+#define TEST_HOUR_US    (60 * TEST_MINUTE_US)
+#define TEST_STEP_US    1000000             // Virtual time between checks of the programme
+#define TEST_BOOT_US    5000000             // Programme starts once the card is mounted
+
+typedef struct test_run
+{
+    uint32_t count;
+    uint64_t at_us[TIMELINE_MAX_ACTIONS];   // Virtual time each action ran
+    const timeline_action* action[TIMELINE_MAX_ACTIONS];
+} test_run;
+
+static uint32_t ofDay(uint32_t hours, uint32_t minutes)
+{
+    return (hours * 60 + minutes) * 60000;
+}
+
+// Parse the lines of a programme, all of which must be valid
+static void testProgramme(timeline* tl, const char* const* lines, uint32_t num)
+{
+    timelineCreate(tl);
+
+    for (uint32_t i = 0; i < num; i++)
+    {
+        CHECK(timelineParseLine(tl, lines[i]));
+    }
+}
+
+// Advance virtual time to end_us, running the actions as they come due
+static void testRunUntil(timeline* tl, uint64_t end_us, test_run* run)
+{
+    while (time_us_64() < end_us)
+    {
+        hostTimeAdvance(TEST_STEP_US);
+
+        const timeline_action* action;
+
+        while ((action = timelineNext(tl, time_us_64())) != NULL)
+        {
+            if (run->count < TIMELINE_MAX_ACTIONS)
+            {
+                run->at_us[run->count] = time_us_64();
+                run->action[run->count] = action;
+            }
+            run->count++;
+        }
+    }
+}
+
+// Ran at the given time after the start, to the step the programme is checked at
+static bool ranAt(const test_run* run, uint32_t i, uint64_t after_start_us)
+{
+    uint64_t due = TEST_BOOT_US + after_start_us;
+
+    return (i < run->count) && (run->at_us[i] >= due) && (run->at_us[i] <= due + TEST_STEP_US) &&
+           (run->action[i]->due_us == due);
+}
+
+static void testParse(void)
+{
+    timeline tl;
+
+    timelineCreate(&tl);
+    CHECK(timelineParseLine(&tl, ""));
+    CHECK(timelineParseLine(&tl, "   # comment only"));
+    CHECK(tl.num == 0);
+
+    CHECK(timelineParseLine(&tl, "+20 sound 0 file_2 60  # fade"));
+    CHECK(tl.actions[0].op == timeline_sound);
+    CHECK(!tl.actions[0].clock && (tl.actions[0].at_ms == 20 * 60000));
+    CHECK((tl.actions[0].value == file_2) && (tl.actions[0].percent == 60));
+
+    CHECK(timelineParseLine(&tl, "00:50\tvolume 1 0 10\r"));
+    CHECK(tl.actions[1].clock && (tl.actions[1].at_ms == ofDay(0, 50)));
+    CHECK((tl.actions[1].zone == 1) && (tl.actions[1].duration_ms == 10 * 60000));
+
+    CHECK(timelineParseLine(&tl, "6:45 sunrise 30"));
+    CHECK(tl.actions[2].at_ms == ofDay(6, 45));
+    CHECK(timelineParseLine(&tl, "23:59 led white 50"));
+    CHECK((tl.actions[3].value == led_white) && (tl.actions[3].percent == 50));
+    CHECK(tl.num == 4);
+
+    const char* invalid[] =
+    {
+        "24:00 sound 0 off", "07:60 sound 0 off", ":30 sound 0 off", "+ sound 0 off", "+20",
+        "+20 dance 0", "+20 sound 4 pink", "+20 sound 0 purple", "+20 sound 0 pink 101",
+        "+20 sound 0 pink 50 extra", "+20 volume 0", "+20 led blue 50", "+20 sunrise", "+99999 sunrise 10"
+    };
+
+    for (uint32_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        if (!CHECK(!timelineParseLine(&tl, invalid[i])))
+        {
+            printf("Accepted: %s\n", invalid[i]);
+        }
+    }
+    CHECK(tl.num == 4);
+
+    // The programme is limited to TIMELINE_MAX_ACTIONS
+    while (tl.num < TIMELINE_MAX_ACTIONS)
+    {
+        CHECK(timelineParseLine(&tl, "+1 sound 0 pink"));
+    }
+    CHECK(!timelineParseLine(&tl, "+1 sound 0 pink"));
+}
+
+static void testLoad(const char* directory)
+{
+    char path[512];
+    timeline tl;
+
+    snprintf(path, sizeof(path), "%s/%s", directory, "timeline");
+    FILE* f = fopen(path, "wb");
+
+    // Lines are split across the read chunks, invalid lines are skipped and the last line has no newline
+    fprintf(f, "# Night\r\n+20   sound 0 file_2 60     # after 20 minutes fade to file 2 at 60%% volume\r\n");
+    fprintf(f, "00:50 volume 0 0 10\nnot a line\n\n01:00 sound 0 off\n06:45 sunrise 30\n07:15 led white 50");
+    fclose(f);
+
+    CHECK(timelineLoad(&tl, "timeline"));
+    CHECK(tl.num == 5);
+    CHECK((tl.actions[0].op == timeline_sound) && (tl.actions[0].percent == 60));
+    CHECK((tl.actions[4].op == timeline_led) && (tl.actions[4].at_ms == ofDay(7, 15)));
+
+    CHECK(!timelineLoad(&tl, "missing"));
+    CHECK(tl.num == 0);
+}
+
+// Power on at 22:00 with the clock already sent, and run until the next evening
+static void testNight(void)
+{
+    const char* lines[] =
+    {
+        "07:15 led white 50",
+        "+20 sound 0 file_2 60",
+        "00:50 volume 0 0 10",
+        "23:30 led red 10",
+        "01:00 sound 0 off",
+        "06:45 sunrise 30",
+        "22:00 sound 0 brown",
+        "21:59 led black 0"
+    };
+    timeline tl;
+    test_run run = {0};
+
+    testProgramme(&tl, lines, sizeof(lines) / sizeof(lines[0]));
+    hostTimeSet(TEST_BOOT_US);
+    timelineStart(&tl, TEST_BOOT_US, TEST_BOOT_US, true, ofDay(22, 0));
+    CHECK(tl.num_due == tl.num);
+
+    testRunUntil(&tl, TEST_BOOT_US + 24 * TEST_HOUR_US, &run);
+    CHECK(run.count == 8);
+
+    // Times of day are the first after the start, past midnight into the morning
+    CHECK(ranAt(&run, 0, 0) && (run.action[0]->value == brown));
+    CHECK(ranAt(&run, 1, 20 * TEST_MINUTE_US) && (run.action[1]->value == file_2));
+    CHECK(ranAt(&run, 2, 90 * TEST_MINUTE_US) && (run.action[2]->op == timeline_led));
+    CHECK(ranAt(&run, 3, 170 * TEST_MINUTE_US) && (run.action[3]->op == timeline_volume));
+    CHECK(ranAt(&run, 4, 3 * TEST_HOUR_US) && (run.action[4]->value == off));
+    CHECK(ranAt(&run, 5, 525 * TEST_MINUTE_US) && (run.action[5]->op == timeline_sunrise));
+    CHECK(ranAt(&run, 6, 555 * TEST_MINUTE_US) && (run.action[6]->value == led_white));
+    CHECK(ranAt(&run, 7, 1439 * TEST_MINUTE_US) && (run.action[7]->value == led_black));
+
+    // Nothing runs twice
+    testRunUntil(&tl, TEST_BOOT_US + 48 * TEST_HOUR_US, &run);
+    CHECK(run.count == 8);
+    CHECK(!timelinePending(&tl));
+}
+
+// Power on with no clock, then have the time sent part way through, as startTimeline in picosounds.c
+static void testClockSetLater(void)
+{
+    const char* lines[] =
+    {
+        "+20 sound 0 pink",
+        "01:00 sound 0 off",
+        "+150 led red 10",
+        "06:45 sunrise 30"
+    };
+    timeline tl;
+    test_run run = {0};
+
+    testProgramme(&tl, lines, sizeof(lines) / sizeof(lines[0]));
+    hostTimeSet(TEST_BOOT_US);
+    timelineStart(&tl, TEST_BOOT_US, TEST_BOOT_US, false, 0);
+
+    // Times of day wait for the clock
+    CHECK(tl.num_due == 2);
+    testRunUntil(&tl, TEST_BOOT_US + 2 * TEST_HOUR_US, &run);
+    CHECK(run.count == 1);
+    CHECK(ranAt(&run, 0, 20 * TEST_MINUTE_US));
+
+    // Clock set to 01:30 two hours after the start, so the programme started at 23:30.
+    // The relative action already run, and 01:00, are past and skipped
+    uint64_t clock_set_us = time_us_64();
+    uint32_t clock_time_of_day_ms = ofDay(1, 30);
+    uint32_t before_ms = (uint32_t)(((clock_set_us - TEST_BOOT_US) / 1000) % TIMELINE_DAY_MS);
+    uint32_t start_time_of_day_ms = (clock_time_of_day_ms + TIMELINE_DAY_MS - before_ms) % TIMELINE_DAY_MS;
+
+    CHECK(start_time_of_day_ms == ofDay(23, 30));
+    timelineStart(&tl, TEST_BOOT_US, clock_set_us, true, start_time_of_day_ms);
+    CHECK(tl.num_due == 4);
+
+    testRunUntil(&tl, TEST_BOOT_US + 24 * TEST_HOUR_US, &run);
+    CHECK(run.count == 3);
+    CHECK(ranAt(&run, 1, 150 * TEST_MINUTE_US) && (run.action[1]->op == timeline_led));
+    CHECK(ranAt(&run, 2, 435 * TEST_MINUTE_US) && (run.action[2]->op == timeline_sunrise));
+}
+
+// Actions before now are skipped, an action due exactly now still runs
+static void testSkipPast(void)
+{
+    const char* lines[] =
+    {
+        "+10 sound 0 pink",
+        "+30 sound 0 white",
+        "+60 sound 0 brown"
+    };
+    timeline tl;
+    test_run run = {0};
+
+    testProgramme(&tl, lines, sizeof(lines) / sizeof(lines[0]));
+    hostTimeSet(TEST_BOOT_US + 30 * TEST_MINUTE_US);
+    timelineStart(&tl, TEST_BOOT_US, time_us_64(), false, 0);
+    CHECK(tl.next == 1);
+
+    CHECK(timelineNext(&tl, time_us_64()) == &tl.actions[1]);
+    CHECK(timelineNext(&tl, time_us_64()) == NULL);
+    CHECK(timelineNextUs(&tl) == TEST_BOOT_US + 60 * TEST_MINUTE_US);
+
+    testRunUntil(&tl, TEST_BOOT_US + 2 * TEST_HOUR_US, &run);
+    CHECK(run.count == 1);
+    CHECK(ranAt(&run, 0, 60 * TEST_MINUTE_US) && (run.action[0]->value == brown));
+
+    // Started after the end of the programme, nothing runs
+    hostTimeSet(TEST_BOOT_US + 2 * TEST_HOUR_US);
+    timelineStart(&tl, TEST_BOOT_US, time_us_64(), false, 0);
+    CHECK(!timelinePending(&tl));
+}
+
+// Actions due at the same time run in file order, whether relative or times of day
+static void testEqualTimes(void)
+{
+    const char* lines[] =
+    {
+        "00:30 led red 10",
+        "+60 sound 0 pink",
+        "+30 sound 0 off",
+        "+60 sound 1 white",
+        "00:30 led orange 20",
+        "+30 sound 0 brown"
+    };
+    timeline tl;
+    test_run run = {0};
+
+    // 00:30 is 30 minutes after the start
+    testProgramme(&tl, lines, sizeof(lines) / sizeof(lines[0]));
+    hostTimeSet(TEST_BOOT_US);
+    timelineStart(&tl, TEST_BOOT_US, TEST_BOOT_US, true, ofDay(0, 0));
+
+    testRunUntil(&tl, TEST_BOOT_US + 2 * TEST_HOUR_US, &run);
+    CHECK(run.count == 6);
+    CHECK(ranAt(&run, 0, 30 * TEST_MINUTE_US) && (run.action[0]->value == led_red));
+    CHECK(ranAt(&run, 1, 30 * TEST_MINUTE_US) && (run.action[1]->value == off));
+    CHECK(ranAt(&run, 2, 30 * TEST_MINUTE_US) && (run.action[2]->value == led_orange));
+    CHECK(ranAt(&run, 3, 30 * TEST_MINUTE_US) && (run.action[3]->value == brown));
+    CHECK(ranAt(&run, 4, 60 * TEST_MINUTE_US) && (run.action[4]->zone == 0));
+    CHECK(ranAt(&run, 5, 60 * TEST_MINUTE_US) && (run.action[5]->zone == 1));
+}
+
+int main(void)
+{
+    char directory[] = "/tmp/picosounds_timelineXXXXXX";
+
+    if (!mkdtemp(directory))
+    {
+        return 1;
+    }
+    hostCardInsert(directory);
+
+    testParse();
+    testLoad(directory);
+    testNight();
+    testClockSetLater();
+    testSkipPast();
+    testEqualTimes();
+
+    return testResult("timeline");
+}
@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ff.h>
+#include "timeline.h"
+/*
+   Night programme.
+   Each line of the file is: TIME ACTION ARGUMENTS, # starts a comment
+     +20   sound 0 file_2 60     fade zone 0 to file 2, at 60% volume
+     00:50 volume 0 0 10         ramp zone 0 to silence over 10 minutes
+     01:00 sound 0 off
+     06:45 sunrise 30            sunrise LED effect over 30 minutes
+     07:15 led white 50
+   Parsing has no dependency on the hardware, so can be run on a host
+ */
+
+#define TIMELINE_MAX_TOKENS 6
+#define TIMELINE_READ_LENGTH 64
+#define TIMELINE_MAX_MINUTES (7 * 24 * 60)      // Longest relative time or duration
+
+// Names used in the file, indexed by state
+static const char* const sound_names[end] =
+{
+    [off] = "off", [brown] = "brown", [file_1] = "file_1", [file_2] = "file_2", [file_3] = "file_3",
+    [white] = "white", [pink] = "pink", [blue] = "blue", [violet] = "violet", [grey] = "grey",
+    [custom] = "custom", [tone] = "tone", [binaural] = "binaural", [breathing] = "breathing",
+    [texture] = "texture"
+};
+
+static const char* const led_names[led_wrap] =
+{
+    [led_black] = "black", [led_red] = "red", [led_orange] = "orange", [led_yellow] = "yellow", [led_white] = "white"
+};
+
+// Return the index of the token in the names, or -1 if not found
+static int32_t timelineFind(const char* const* names, uint32_t num, const char* token)
+{
+    for (uint32_t i = 0; i < num; i++)
+    {
+        if (names[i] && (strcmp(names[i], token) == 0))
+        {
+            return (int32_t)i;
+        }
+    }
+    return -1;
+}
+
+// Read an unsigned number that must be the whole token
+static bool timelineNumber(const char* token, uint32_t max, uint32_t* value)
+{
+    char* last;
+    unsigned long number = strtoul(token, &last, 10);
+
+    if ((last == token) || (*last != '\0') || (number > max))
+    {
+        return false;
+    }
+    *value = (uint32_t)number;
+    return true;
+}
+
+// Read +MINUTES or HH:MM
+static bool timelineTime(const char* token, uint32_t* ms, bool* clock)
+{
+    uint32_t hours;
+    uint32_t minutes;
+
+    if (token[0] == '+')
+    {
+        if (!timelineNumber(token + 1, TIMELINE_MAX_MINUTES, &minutes))
+        {
+            return false;
+        }
+        *ms = minutes * 60000;
+        *clock = false;
+        return true;
+    }
+
+    const char* colon = strchr(token, ':');
+    char text[3];
+
+    if ((colon == NULL) || (colon - token > 2) || (colon == token))
+    {
+        return false;
+    }
+    memcpy(text, token, colon - token);
+    text[colon - token] = '\0';
+
+    if (!timelineNumber(text, 23, &hours) || !timelineNumber(colon + 1, 59, &minutes))
+    {
+        return false;
+    }
+    *ms = (hours * 60 + minutes) * 60000;
+    *clock = true;
+    return true;
+}
+
+void timelineCreate(timeline* tl)
+{
+    tl->num = 0;
+    tl->num_due = 0;
+    tl->next = 0;
+}
+
+/*
+ * timelineParseLine
+ * line         One line of the programme, without the newline
+ *
+ * Adds the action on the line. Returns false if the line is not valid, blank
+ * lines and comments are valid
+ */
+bool timelineParseLine(timeline* tl, const char* line)
+{
+    char text[TIMELINE_LINE_LENGTH];
+    char* token[TIMELINE_MAX_TOKENS];
+    uint32_t count = 0;
+
+    strncpy(text, line, sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+
+    char* comment = strchr(text, '#');
+
+    if (comment)
+    {
+        *comment = '\0';
+    }
+
+    // Split at whitespace
+    for (char* p = strtok(text, " \t\r\n"); p && (count < TIMELINE_MAX_TOKENS); p = strtok(NULL, " \t\r\n"))
+    {
+        token[count++] = p;
+    }
+
+    if (count == 0)
+    {
+        return true;
+    }
+
+    if ((count < 2) || (tl->num == TIMELINE_MAX_ACTIONS))
+    {
+        return false;
+    }
+
+    timeline_action* action = &tl->actions[tl->num];
+    uint32_t value;
+
+    if (!timelineTime(token[0], &action->at_ms, &action->clock))
+    {
+        return false;
+    }
+    action->zone = 0;
+    action->value = 0;
+    action->percent = -1;
+    action->duration_ms = 0;
+
+    if (strcmp(token[1], "sound") == 0)
+    {
+        int32_t sound = (count >= 4) ? timelineFind(sound_names, end, token[3]) : -1;
+
+        if ((count > 5) || (sound < 0) || !timelineNumber(token[2], CONFIG_MAX_ZONES - 1, &action->zone))
+        {
+            return false;
+        }
+        if (count == 5)
+        {
+            if (!timelineNumber(token[4], 100, &value))
+            {
+                return false;
+            }
+            action->percent = (int32_t)value;
+        }
+        action->op = timeline_sound;
+        action->value = (uint32_t)sound;
+    }
+    else if (strcmp(token[1], "volume") == 0)
+    {
+        if ((count < 4) || (count > 5) || !timelineNumber(token[2], CONFIG_MAX_ZONES - 1, &action->zone) ||
+            !timelineNumber(token[3], 100, &value))
+        {
+            return false;
+        }
+        action->percent = (int32_t)value;
+
+        if (count == 5)
+        {
+            if (!timelineNumber(token[4], TIMELINE_MAX_MINUTES, &value))
+            {
+                return false;
+            }
+            action->duration_ms = value * 60000;
+        }
+        action->op = timeline_volume;
+    }
+    else if (strcmp(token[1], "led") == 0)
+    {
+        int32_t colour = (count == 4) ? timelineFind(led_names, led_wrap, token[2]) : -1;
+
+        if ((colour < 0) || !timelineNumber(token[3], 100, &value))
+        {
+            return false;
+        }
+        action->op = timeline_led;
+        action->value = (uint32_t)colour;
+        action->percent = (int32_t)value;
+    }
+    else if (strcmp(token[1], "sunrise") == 0)
+    {
+        if ((count != 3) || !timelineNumber(token[2], TIMELINE_MAX_MINUTES, &value))
+        {
+            return false;
+        }
+        action->op = timeline_sunrise;
+        action->duration_ms = value * 60000;
+    }
+    else
+    {
+        return false;
+    }
+
+    tl->num++;
+    return true;
+}
+
+/*
+ * timelineLoad
+ * filename     Name of the programme file
+ *
+ * Read the programme, skipping lines that are not valid. Returns true if any
+ * actions were read
+ */
+bool timelineLoad(timeline* tl, const char* filename)
+{
+    FIL fp;
+    UINT read;
+    char chunk[TIMELINE_READ_LENGTH];
+    char line[TIMELINE_LINE_LENGTH];
+    uint32_t length = 0;
+    uint32_t line_number = 1;
+
+    timelineCreate(tl);
+
+    if (f_open(&fp, filename, FA_OPEN_EXISTING | FA_READ) != FR_OK)
+    {
+        return false;
+    }
+
+    do
+    {
+        if (f_read(&fp, chunk, sizeof(chunk), &read) != FR_OK)
+        {
+            read = 0;
+        }
+
+        for (UINT i = 0; i <= read; i++)
+        {
+            // The end of the file also ends the last line
+            bool end_of_line = (i == read) ? (read < sizeof(chunk)) : (chunk[i] == '\n');
+
+            if (end_of_line)
+            {
+                line[length] = '\0';
+
+                if (!timelineParseLine(tl, line))
+                {
+                    printf("Invalid timeline line %lu in: %s\n", (unsigned long)line_number, filename);
+                }
+                length = 0;
+                line_number++;
+            }
+            else if ((i < read) && (length < sizeof(line) - 1))
+            {
+                line[length++] = chunk[i];
+            }
+        }
+    } while (read == sizeof(chunk));
+
+    f_close(&fp);
+    return tl->num != 0;
+}
+
+/*
+ * timelineStart
+ * start_us             Time since boot the programme started
+ * now_us               Current time since boot, earlier actions are skipped
+ * clock_set            true if the time of day is known
+ * start_time_of_day_ms Time after midnight the programme started
+ *
+ * Resolve the time of each action and sort them. Times of day are the first
+ * one after the start, and are not run if the time of day is not known
+ */
+void timelineStart(timeline* tl, uint64_t start_us, uint64_t now_us, bool clock_set, uint32_t start_time_of_day_ms)
+{
+    tl->num_due = 0;
+
+    for (uint32_t i = 0; i < tl->num; i++)
+    {
+        timeline_action* action = &tl->actions[i];
+
+        if (!action->clock)
+        {
+            action->due_us = start_us + (uint64_t)action->at_ms * 1000;
+        }
+        else if (clock_set)
+        {
+            uint32_t offset_ms = (action->at_ms + TIMELINE_DAY_MS - start_time_of_day_ms % TIMELINE_DAY_MS) % TIMELINE_DAY_MS;
+
+            action->due_us = start_us + (uint64_t)offset_ms * 1000;
+        }
+        else
+        {
+            action->due_us = UINT64_MAX;
+        }
+
+        if (action->due_us != UINT64_MAX)
+        {
+            tl->num_due++;
+        }
+    }
+
+    // Insertion sort, so actions at the same time run in file order
+    for (uint32_t i = 1; i < tl->num; i++)
+    {
+        timeline_action action = tl->actions[i];
+        uint32_t j = i;
+
+        while ((j > 0) && (tl->actions[j - 1].due_us > action.due_us))
+        {
+            tl->actions[j] = tl->actions[j - 1];
+            j--;
+        }
+        tl->actions[j] = action;
+    }
+
+    // Skip actions that were due before now
+    tl->next = 0;
+
+    while ((tl->next < tl->num_due) && (tl->actions[tl->next].due_us < now_us))
+    {
+        tl->next++;
+    }
+}
+
+/*
+ * timelineNext
+ * now_us       Current time since boot
+ *
+ * Return the next action if it is due, otherwise NULL
+ */
+const timeline_action* timelineNext(timeline* tl, uint64_t now_us)
+{
+    if (timelinePending(tl) && (timelineNextUs(tl) <= now_us))
+    {
+        return &tl->actions[tl->next++];
+    }
+    return NULL;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+
+/*
+ * A night programme, read from a text file on the SD card.
+ * Each line is an action and the time it runs, either minutes after the
+ * programme starts (+20) or a time of day (06:45). Actions are resolved to
+ * times since boot when the programme starts, and sorted, so running the
+ * programme only compares the time with the next action
+ */
+#define TIMELINE_MAX_ACTIONS    32              // Longest programme supported
+#define TIMELINE_LINE_LENGTH    80              // Longest line in the file
+#define TIMELINE_DAY_MS         (24 * 60 * 60 * 1000)
+
+typedef enum timeline_op
+{
+    timeline_sound = 0,                         // Fade a zone to a sound, optionally at a new volume
+    timeline_volume = timeline_sound + 1,       // Ramp the volume of a zone
+    timeline_led = timeline_volume + 1,         // Set the LED colour and intensity
+    timeline_sunrise = timeline_led + 1         // Run the sunrise LED effect
+} timeline_op;
+
+typedef struct timeline_action
+{
+    uint32_t at_ms;                             // Time after the start, or after midnight for clock times
+    bool clock;                                 // true if at_ms is a time of day
+    timeline_op op;
+    uint32_t zone;                              // Zone of sound and volume actions
+    uint32_t value;                             // Sound or LED state
+    int32_t percent;                            // Volume or intensity, -1 to leave unchanged
+    uint32_t duration_ms;                       // Length of volume ramp or LED effect
+    uint64_t due_us;                            // Time since boot the action runs, set by timelineStart
+} timeline_action;
+
+typedef struct timeline
+{
+    timeline_action actions[TIMELINE_MAX_ACTIONS];
+    uint32_t num;                               // Actions read from the file
+    uint32_t num_due;                           // Actions with a resolved time, sorted first
+    uint32_t next;                              // Next action to run
+} timeline;
+
+extern void timelineCreate(timeline* tl);
+extern bool timelineParseLine(timeline* tl, const char* line);
+extern bool timelineLoad(timeline* tl, const char* filename);
+extern void timelineStart(timeline* tl, uint64_t start_us, uint64_t now_us, bool clock_set, uint32_t start_time_of_day_ms);
+extern const timeline_action* timelineNext(timeline* tl, uint64_t now_us);
+
+/*
+ * Inline helper functions
+ */
+// Return true if an action is waiting to run
+inline bool timelinePending(timeline* tl){return tl->next < tl->num_due;}
+
+// Return the time since boot of the next action, only valid if one is pending
+inline uint64_t timelineNextUs(timeline* tl){return tl->actions[tl->next].due_us;}
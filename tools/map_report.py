@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""
+Placement report from a GNU ld map file.
+
+Lists where each input section of the application has been placed (flash,
+RAM or the scratch banks), its size, and the space remaining in each memory
+region. Used to check the PICOSOUNDS_RAM_HOT_PATH build profile.
+
+    map_report.py picosounds.elf.map [--all]
+
+By default only sections from the picosounds sources, and any section placed
+in RAM by __not_in_flash, are listed. --all lists every input section.
+"""
+import argparse
+import os
+import re
+import sys
+
+# Input section, either on one line or with the name on the line above
+SECTION = re.compile(r"^ (\.\S+)\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)\s+(\S.*)$")
+SECTION_NAME = re.compile(r"^ (\.\S+)$")
+SECTION_ADDR = re.compile(r"^\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)\s+(\S.*)$")
+REGION = re.compile(r"^(\S+)\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)")
+
+# Prefixes removed from section names to give the symbol
+PREFIXES = (".time_critical.", ".text.", ".rodata.", ".data.", ".bss.", ".scratch_x.", ".scratch_y.")
+
+
+def read_map(path):
+    regions = []
+    sections = []
+    in_memory = False
+    in_layout = False
+    pending = None
+
+    with open(path) as f:
+        for line in f:
+            line = line.rstrip("\n")
+
+            if line.startswith("Memory Configuration"):
+                in_memory = True
+                continue
+            if line.startswith("Linker script and memory map"):
+                in_memory = False
+                in_layout = True
+                continue
+
+            if in_memory:
+                m = REGION.match(line)
+                if m and m.group(1) != "*default*" and m.group(1) != "Name":
+                    regions.append((m.group(1), int(m.group(2), 16), int(m.group(3), 16)))
+                continue
+
+            if not in_layout:
+                continue
+
+            m = SECTION.match(line)
+            if m:
+                sections.append((m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4)))
+                pending = None
+                continue
+
+            m = SECTION_NAME.match(line)
+            if m:
+                pending = m.group(1)
+                continue
+
+            if pending:
+                m = SECTION_ADDR.match(line)
+                if m:
+                    sections.append((pending, int(m.group(1), 16), int(m.group(2), 16), m.group(3)))
+                pending = None
+
+    return regions, sections
+
+
+def region_of(regions, address):
+    for name, origin, length in regions:
+        if origin <= address < origin + length:
+            return name
+    return None
+
+
+def symbol_of(section):
+    for prefix in PREFIXES:
+        if section.startswith(prefix):
+            return section[len(prefix):]
+    return section
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Report symbol placement from a linker map")
+    parser.add_argument("map", help="linker map file, normally picosounds.elf.map")
+    parser.add_argument("--all", action="store_true", help="list every input section")
+    args = parser.parse_args()
+
+    regions, sections = read_map(args.map)
+    if not regions:
+        sys.exit("No memory configuration found in " + args.map)
+
+    used = {name: 0 for name, _, _ in regions}
+    listed = []
+
+    for section, address, size, source in sections:
+        region = region_of(regions, address)
+        if size == 0 or region is None:
+            continue
+        used[region] += size
+
+        ours = "picosounds.dir" in source
+        if args.all or (ours and section.startswith(".text")) or section.startswith(".time_critical"):
+            listed.append((region, symbol_of(section), size, os.path.basename(source.split("(")[0])))
+
+    print("%-10s %-40s %8s  %s" % ("Region", "Symbol", "Size", "Object"))
+    for region, symbol, size, source in sorted(listed, key=lambda s: (s[0], -s[2])):
+        print("%-10s %-40s %8d  %s" % (region, symbol, size, source))
+
+    print()
+    print("%-10s %10s %10s %10s" % ("Region", "Size", "Used", "Free"))
+    for name, origin, length in regions:
+        print("%-10s %10d %10d %10d" % (name, length, used[name], length - used[name]))
+
+
+if __name__ == "__main__":
+    main()
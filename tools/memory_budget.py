@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""
+Worst case SRAM for each type of sound source.
+
+The buffers of each source are taken from a shared arena when the sound is
+selected (see audio_arena.h). This report combines the arena sizes from the
+headers with the static RAM found in the linker map, so the cost of each
+source type, and the room left for other uses, is known at build time.
+
+    memory_budget.py picosounds.elf.map SOURCE_DIR
+"""
+import argparse
+import os
+import re
+import sys
+
+from map_report import read_map, region_of
+
+DEFINE = re.compile(r"^\s*#define\s+(\w+)(\((\w+)\))?\s+(.+?)\s*(//.*)?$")
+HEADERS = ("audio_zone.h", "audio_arena.h", "picosounds.c")
+
+
+def read_macros(source_dir):
+    """Evaluates the object like and single argument macros that are arithmetic"""
+    text = {}
+    for name in HEADERS:
+        with open(os.path.join(source_dir, name)) as f:
+            for line in f:
+                m = DEFINE.match(line)
+                if m and m.group(1) not in text:
+                    text[m.group(1)] = (m.group(3), m.group(4).replace("/", "//"))
+
+    # Repeat until no more can be evaluated, as macros refer to later macros
+    macros = {}
+    progress = True
+    while progress:
+        progress = False
+        for name, (arg, body) in text.items():
+            if name in macros:
+                continue
+            try:
+                macros[name] = eval("lambda %s: %s" % (arg, body) if arg else body, macros)
+                progress = True
+            except Exception:
+                pass
+    return macros
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Report the worst case SRAM of each source type")
+    parser.add_argument("map", help="linker map file, normally picosounds.elf.map")
+    parser.add_argument("source", help="directory holding audio_arena.h")
+    args = parser.parse_args()
+
+    macros = read_macros(args.source)
+    regions, sections = read_map(args.map)
+    if not regions:
+        sys.exit("No memory configuration found in " + args.map)
+
+    # Static RAM, split into the arena, the mp3 decoder and everything else
+    arena = decoder = other = 0
+    for section, address, size, source in sections:
+        region = region_of(regions, address)
+        if size == 0 or region is None or region == "FLASH" or not section.startswith((".bss", ".data")):
+            continue
+        if section == ".bss.arena_memory":
+            arena += size
+        elif "picomp3lib" in source and "picosounds.dir" not in source:
+            decoder += size
+        else:
+            other += size
+
+    block = macros["AUDIO_ARENA_BLOCK"]
+    noise = macros["AUDIO_ARENA_NOISE_BLOCKS"] * block
+    files = macros["AUDIO_ARENA_FILE_BLOCKS"] * block
+    texture = macros["AUDIO_ARENA_TEXTURE_BLOCKS"] * block
+
+    print("Static RAM, excluding arena and decoder %8d" % other)
+    print("Decoder static RAM                      %8d" % decoder)
+    print("Arena, %d zones, %d can play files       %8d" % (macros["NUM_ZONES"], macros["FILE_ZONES"], arena))
+    print()
+    print("%-8s %12s %12s %12s" % ("Source", "Arena", "Decoder", "Total"))
+    for name, buffers, decode in (("noise", noise, 0), ("wav", files, 0), ("mp3", files, decoder), ("texture", texture, decoder)):
+        print("%-8s %12d %12d %12d" % (name, buffers, decode, buffers + decode))
+    print()
+    print("Arena left while every zone plays noise %8d" % (arena - macros["NUM_ZONES"] * noise))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,353 @@
+#!/usr/bin/env python3
+"""
+Host control of picosounds over the stdio UART, using the framed binary
+protocol described in protocol.h. Needs pyserial.
+
+    picosounds_cli.py PORT status
+    picosounds_cli.py PORT state ZONE STATE
+    picosounds_cli.py PORT volume ZONE PERCENT
+    picosounds_cli.py PORT led LED PERCENT
+    picosounds_cli.py PORT sleep MINUTES
+    picosounds_cli.py PORT telemetry PERIOD_MS [--duration S] [--fail-on-underrun]
+    picosounds_cli.py PORT decode ZONE
+    picosounds_cli.py PORT synth TONE_HZ BEAT_HZ BREATH_S
+    picosounds_cli.py PORT clock
+    picosounds_cli.py PORT trace FILE
+    picosounds_cli.py PORT profile FILE
+    picosounds_cli.py PORT bench ZONE [--seconds S] [--states STATE ...]
+
+telemetry prints one line per report, so can be used for soak tests. With
+--fail-on-underrun the exit status is 1 if any zone reports a new underrun.
+trace saves the event trace of a PICOSOUNDS_TRACE build, for trace2chrome.py.
+profile saves the histogram of the picosounds_profile build, for profile_report.py.
+bench plays each sound in turn and prints its worst case refill times and
+processor time per zone, with the XIP cache warm and then flushed before every
+refill, so the flash and PICOSOUNDS_RAM_HOT_PATH builds can be compared, and
+how many zones of each sound would fit.
+"""
+import argparse
+import json
+import struct
+import sys
+import time
+
+import serial
+
+SYNC = 0xA5
+RESPONSE = 0x80
+
+SET_STATE = 0x01
+SET_VOLUME = 0x02
+SET_LED = 0x03
+SET_SLEEP = 0x04
+GET_STATUS = 0x05
+TELEMETRY = 0x06
+GET_DECODE_STATS = 0x07
+SET_SYNTH = 0x08
+SET_CLOCK = 0x09
+GET_TRACE = 0x0A
+GET_PROFILE = 0x0B
+BENCH = 0x0C
+
+ACK = RESPONSE
+STATUS = RESPONSE | GET_STATUS
+TELEMETRY_DATA = RESPONSE | TELEMETRY
+DECODE_STATS = RESPONSE | GET_DECODE_STATS
+TRACE_DATA = RESPONSE | GET_TRACE
+TRACE_RECORD = 8
+PROFILE_DATA = RESPONSE | GET_PROFILE
+DECODE_BINS = 12
+TIME_BIN_US = 2000
+BYTES_BIN = 128
+BENCH_DATA = RESPONSE | BENCH
+BENCH_RECORD = 13
+
+STATES = ["off", "brown", "file_1", "file_2", "file_3", "white", "pink", "blue", "violet", "grey", "custom",
+          "tone", "binaural", "breathing", "texture"]
+LEDS = ["black", "red", "orange", "yellow", "white"]
+GENERATED = ["white", "pink", "brown", "blue", "violet", "grey", "tone", "binaural", "breathing", "texture"]
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def encode(cmd, payload=b""):
+    body = bytes([cmd, len(payload)]) + payload
+    return bytes([SYNC]) + body + bytes([crc8(body)])
+
+
+class Parser:
+    """Incremental parser, matches protocolParse on the board"""
+
+    def __init__(self):
+        self.buffer = bytearray()
+
+    def feed(self, data):
+        self.buffer += data
+        frames = []
+
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                self.buffer.clear()
+                break
+            del self.buffer[:start]
+
+            if len(self.buffer) < 3:
+                break
+            length = self.buffer[2]
+            if length > 64:
+                del self.buffer[:1]
+                continue
+            if len(self.buffer) < length + 4:
+                break
+
+            body = bytes(self.buffer[1:3 + length])
+            if crc8(body) == self.buffer[3 + length]:
+                frames.append((body[0], body[2:]))
+                del self.buffer[:length + 4]
+            else:
+                del self.buffer[:1]
+        return frames
+
+
+def name(names, index):
+    return names[index] if index < len(names) else str(index)
+
+
+def wait_for(port, parser, cmd, timeout=2.0):
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        for frame_cmd, payload in parser.feed(port.read(64)):
+            if frame_cmd == cmd:
+                return payload
+    sys.exit("No response from board")
+
+
+def command(port, parser, cmd, payload):
+    port.write(encode(cmd, payload))
+    ack = wait_for(port, parser, ACK)
+    if ack[0] != cmd or not ack[1]:
+        sys.exit("Command rejected")
+
+
+def show_status(payload):
+    zones, led, intensity, minutes, remaining = struct.unpack_from("<BBBHH", payload)
+    print("LED %s %d%%, sleep %d minutes, %d s remaining" % (name(LEDS, led), intensity, minutes, remaining))
+    for zone in range(zones):
+        state, volume = struct.unpack_from("<BB", payload, 7 + 2 * zone)
+        print("Zone %d: %s, volume %d%%" % (zone, name(STATES, state), volume))
+
+
+def show_telemetry(payload, last_underruns):
+    uptime, sd_bytes, sd_busy, errors, irq_off, zones = struct.unpack_from("<IIIBHB", payload)
+    line = "%10.1f s  sd %7d bytes %7d us  errors %d  irq off %d us" % (uptime / 1000.0, sd_bytes, sd_busy, errors, irq_off)
+    new_underrun = False
+
+    for zone in range(zones):
+        state, pending, underruns, load, dma_us, ram_us = struct.unpack_from("<BBIBHH", payload, 16 + 11 * zone)
+        line += "  | %d %s pending %d underruns %d load %d%% dma %d us ram %d us" % \
+            (zone, name(STATES, state), pending, underruns, load, dma_us, ram_us)
+        if zone in last_underruns and underruns > last_underruns[zone]:
+            new_underrun = True
+        last_underruns[zone] = underruns
+
+    print(line, flush=True)
+    return new_underrun
+
+
+def show_histogram(title, counts, width, unit):
+    print(title)
+    total = max(sum(counts), 1)
+    for i, count in enumerate(counts):
+        low = i * width
+        label = ">= %d %s" % (low, unit) if i == len(counts) - 1 else "%d-%d %s" % (low, low + width - 1, unit)
+        print("  %-18s %6d %s" % (label, count, "#" * (count * 50 // total)))
+
+
+def show_decode_stats(payload):
+    zone, frames, depth, decode_max, sd_wait_max = struct.unpack_from("<BIHHH", payload)
+    bins = struct.unpack_from("<%dH" % (2 * DECODE_BINS), payload, 11)
+    print("Zone %d: %d frames, decode ahead %d samples, worst decode %d us, worst SD wait %d us" %
+          (zone, frames, depth, decode_max, sd_wait_max))
+    show_histogram("Decode time per frame", bins[:DECODE_BINS], TIME_BIN_US, "us")
+    show_histogram("Bytes read per frame", bins[DECODE_BINS:], BYTES_BIN, "bytes")
+
+
+def save_trace(port, parser, path):
+    port.write(encode(GET_TRACE))
+    records = b""
+    end = time.monotonic() + 10.0
+
+    # Frames are sent between refills, until an empty one
+    while time.monotonic() < end:
+        for cmd, payload in parser.feed(port.read(64)):
+            if cmd == ACK and payload[0] == GET_TRACE:
+                sys.exit("Trace not built, configure with -DPICOSOUNDS_TRACE=ON")
+            if cmd == TRACE_DATA:
+                count = payload[2]
+                if count == 0:
+                    with open(path, "wb") as f:
+                        f.write(records)
+                    print("%d records written to %s" % (len(records) // TRACE_RECORD, path))
+                    return
+                records += payload[3:3 + count * TRACE_RECORD]
+    sys.exit("Trace incomplete")
+
+
+def save_profile(port, parser, path):
+    port.write(encode(GET_PROFILE))
+    buckets = {}
+    end = time.monotonic() + 10.0
+
+    # Buckets with samples are sent between refills, then the totals
+    while time.monotonic() < end:
+        for cmd, payload in parser.feed(port.read(64)):
+            if cmd == ACK and payload[0] == GET_PROFILE:
+                sys.exit("Not a profile build, use the picosounds_profile target")
+            if cmd != PROFILE_DATA:
+                continue
+            count = payload[0]
+            if count == 0:
+                shift, flash, ram, rom, samples, other, interval = struct.unpack_from("<BHHHIIH", payload, 1)
+                profile = {"shift": shift, "flash_buckets": flash, "ram_buckets": ram, "rom_buckets": rom,
+                           "samples": samples, "other": other, "interval_us": interval, "buckets": buckets}
+                with open(path, "w") as f:
+                    json.dump(profile, f, indent=1)
+                print("%d samples in %d buckets written to %s" % (samples, len(buckets), path))
+                return
+            for i in range(count):
+                index, samples = struct.unpack_from("<HI", payload, 1 + 6 * i)
+                buckets[index] = samples
+    sys.exit("Profile incomplete")
+
+
+def measure_bench(port, parser, flush_cache):
+    port.write(encode(BENCH, bytes([flush_cache])))
+    payload = wait_for(port, parser, BENCH_DATA)
+    return payload[0], [struct.unpack_from("<BIIHH", payload, 2 + BENCH_RECORD * zone) for zone in range(payload[1])]
+
+
+def run_bench(port, parser, zone, states, seconds):
+    # Telemetry also restarts the load, so is stopped
+    command(port, parser, TELEMETRY, struct.pack("<H", 0))
+    flags, _ = measure_bench(port, parser, 0)
+    print("Audio code in %s, worst case refill and processor time per zone over %.0f s" %
+          ("SRAM" if flags & 2 else "flash", seconds))
+    print("%-10s %33s %33s %6s" % ("", "warm cache", "cache flushed", "zones"))
+
+    for state in states:
+        command(port, parser, SET_STATE, bytes([zone, STATES.index(state)]))
+        time.sleep(1.0)
+
+        # Warm, then flushed before every refill, then warm again
+        measure_bench(port, parser, 0)
+        time.sleep(seconds)
+        _, warm = measure_bench(port, parser, 1)
+        time.sleep(seconds)
+        _, cold = measure_bench(port, parser, 0)
+
+        # Zones that would fit, from the processor time with the cache flushed
+        warm_load = 100.0 * warm[zone][1] / max(warm[zone][2], 1)
+        cold_load = 100.0 * cold[zone][1] / max(cold[zone][2], 1)
+        print("%-10s dma %5d ram %5d us %5.1f%%  dma %5d ram %5d us %5.1f%% %6d" %
+              (name(STATES, warm[zone][0]), warm[zone][3], warm[zone][4], warm_load,
+               cold[zone][3], cold[zone][4], cold_load, int(100 // max(cold_load, 0.1))), flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Control picosounds over the UART")
+    parser.add_argument("port", help="serial port, e.g. /dev/ttyACM0")
+    parser.add_argument("--baud", type=int, default=115200)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    sub.add_parser("status")
+    p = sub.add_parser("state")
+    p.add_argument("zone", type=int)
+    p.add_argument("state", choices=STATES[1:])
+    p = sub.add_parser("volume")
+    p.add_argument("zone", type=int)
+    p.add_argument("percent", type=int)
+    p = sub.add_parser("led")
+    p.add_argument("led", choices=LEDS)
+    p.add_argument("percent", type=int)
+    p = sub.add_parser("sleep")
+    p.add_argument("minutes", type=int)
+    p = sub.add_parser("telemetry")
+    p.add_argument("period", type=int, help="report period in ms")
+    p.add_argument("--duration", type=float, default=0, help="seconds to run, 0 for ever")
+    p.add_argument("--fail-on-underrun", action="store_true")
+    p = sub.add_parser("decode")
+    p.add_argument("zone", type=int)
+    p = sub.add_parser("synth")
+    p.add_argument("tone", type=float, help="tone frequency in Hz")
+    p.add_argument("beat", type=float, help="binaural beat frequency in Hz")
+    p.add_argument("breath", type=float, help="breath period in seconds")
+    sub.add_parser("clock", help="send the local time of day, for the timeline")
+    p = sub.add_parser("trace")
+    p.add_argument("file", help="binary trace to write, convert with trace2chrome.py")
+    p = sub.add_parser("profile")
+    p.add_argument("file", help="histogram to write, symbolise with profile_report.py")
+    p = sub.add_parser("bench")
+    p.add_argument("zone", type=int)
+    p.add_argument("--seconds", type=float, default=5.0, help="time to measure each sound, warm and flushed")
+    p.add_argument("--states", nargs="+", choices=STATES[1:], default=GENERATED, help="sounds to measure")
+
+    args = parser.parse_args()
+    port = serial.Serial(args.port, args.baud, timeout=0.1)
+    frames = Parser()
+
+    if args.cmd == "status":
+        port.write(encode(GET_STATUS))
+        show_status(wait_for(port, frames, STATUS))
+    elif args.cmd == "state":
+        command(port, frames, SET_STATE, bytes([args.zone, STATES.index(args.state)]))
+    elif args.cmd == "volume":
+        command(port, frames, SET_VOLUME, bytes([args.zone, args.percent]))
+    elif args.cmd == "led":
+        command(port, frames, SET_LED, bytes([LEDS.index(args.led), args.percent]))
+    elif args.cmd == "sleep":
+        command(port, frames, SET_SLEEP, struct.pack("<H", args.minutes))
+    elif args.cmd == "synth":
+        command(port, frames, SET_SYNTH, struct.pack("<III", round(args.tone * 1000), round(args.beat * 1000),
+                                                     round(args.breath * 1000)))
+    elif args.cmd == "clock":
+        now = time.localtime()
+        command(port, frames, SET_CLOCK, struct.pack("<I", now.tm_hour * 3600 + now.tm_min * 60 + now.tm_sec))
+    elif args.cmd == "trace":
+        save_trace(port, frames, args.file)
+    elif args.cmd == "profile":
+        save_profile(port, frames, args.file)
+    elif args.cmd == "bench":
+        run_bench(port, frames, args.zone, args.states, args.seconds)
+    elif args.cmd == "decode":
+        port.write(encode(GET_DECODE_STATS, bytes([args.zone])))
+        show_decode_stats(wait_for(port, frames, DECODE_STATS))
+    elif args.cmd == "telemetry":
+        command(port, frames, TELEMETRY, struct.pack("<H", args.period))
+        end = time.monotonic() + args.duration
+        underruns = {}
+        failed = False
+
+        try:
+            while args.duration == 0 or time.monotonic() < end:
+                for cmd, payload in frames.feed(port.read(64)):
+                    if cmd == TELEMETRY_DATA:
+                        failed |= show_telemetry(payload, underruns)
+        except KeyboardInterrupt:
+            pass
+        finally:
+            port.write(encode(TELEMETRY, struct.pack("<H", 0)))
+
+        if failed and args.fail_on_underrun:
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
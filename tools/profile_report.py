@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+"""
+Flat profile from the picosounds_profile build.
+
+Each bucket of the program counter histogram is shared between the
+functions it overlaps, using the placement in the linker map, so no
+toolchain is needed. The functions are then grouped, to show the share of
+each refill period spent on the DMA blocks, reading and decoding files,
+FatFs and the SD card, and waiting for the next event.
+
+    picosounds_cli.py PORT profile night.json
+    profile_report.py picosounds_profile.elf.map night.json [--period-ms 50] [--top 30]
+"""
+import argparse
+import json
+import os
+import sys
+
+from map_report import read_map, symbol_of
+
+XIP_BASE = 0x10000000
+SRAM_BASE = 0x20000000
+
+# Group of a function, the first match is used: name, symbols, parts of the object path
+GROUPS = [
+    ("DMA block refill", ("audioZonePopulateDma", "gainRampBlockStart", "gainRampNext"), ()),
+    ("File read and decode", (), ("picomp3lib", "music_file", "sound_file", "adpcm_file", "flac_file", "decode_stats")),
+    ("FatFs and SD card", (), ("FatFs", "sd_driver", "sd_stats", "fs_mount", "spi.c")),
+    ("Noise and tones", (), ("colour_noise", "noise_shaper", "oscillator")),
+    ("Waiting for events", (), ("queue.c", "lock_core", "sem.c")),
+    ("Boot ROM (float and memory routines)", ("boot ROM",), ()),
+]
+OTHER = "Other"
+
+
+def read_functions(map_path):
+    """Code sections of the map, sorted by address"""
+    _, sections = read_map(map_path)
+    functions = []
+    for section, address, size, source in sections:
+        if size and (section.startswith(".text") or section.startswith(".time_critical")):
+            functions.append((address, address + size, symbol_of(section), source))
+    return sorted(functions)
+
+
+def bucket_range(profile, index):
+    """Address range of a histogram bucket"""
+    size = 1 << profile["shift"]
+    flash = profile["flash_buckets"]
+    ram = profile["ram_buckets"]
+    if index < flash:
+        start = XIP_BASE + index * size
+    elif index < flash + ram:
+        start = SRAM_BASE + (index - flash) * size
+    else:
+        start = (index - flash - ram) * size
+    return start, start + size
+
+
+def attribute(profile, functions):
+    """Samples of each function, a bucket is shared in proportion to the bytes of each function in it"""
+    totals = {}
+    rom_start = profile["flash_buckets"] + profile["ram_buckets"]
+
+    for index, count in profile["buckets"].items():
+        index = int(index)
+        if index >= rom_start:
+            key = ("boot ROM", "")
+            totals[key] = totals.get(key, 0) + count
+            continue
+
+        start, end = bucket_range(profile, index)
+        covered = 0
+        for f_start, f_end, name, source in functions:
+            if f_end <= start:
+                continue
+            if f_start >= end:
+                break
+            overlap = min(end, f_end) - max(start, f_start)
+            covered += overlap
+            key = (name, source)
+            totals[key] = totals.get(key, 0) + count * overlap / (end - start)
+        if covered < end - start:
+            key = ("unknown", "")
+            totals[key] = totals.get(key, 0) + count * (end - start - covered) / (end - start)
+
+    if profile["other"]:
+        totals[("outside histogram", "")] = profile["other"]
+    return totals
+
+
+def group_of(name, source):
+    for group, symbols, paths in GROUPS:
+        if name in symbols or any(part in source for part in paths):
+            return group
+    return OTHER
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Symbolise a picosounds program counter profile")
+    parser.add_argument("map", help="linker map, normally picosounds_profile.elf.map")
+    parser.add_argument("profile", help="histogram written by picosounds_cli.py profile")
+    parser.add_argument("--period-ms", type=float, default=50.0, help="refill period, one DMA block")
+    parser.add_argument("--top", type=int, default=30, help="functions to list")
+    args = parser.parse_args()
+
+    with open(args.profile) as f:
+        profile = json.load(f)
+    functions = read_functions(args.map)
+    if not functions:
+        sys.exit("No code sections found in " + args.map)
+
+    samples = profile["samples"]
+    if samples == 0:
+        sys.exit("No samples in " + args.profile)
+    totals = attribute(profile, functions)
+
+    print("%d samples, %.1f s at %d us" % (samples, samples * profile["interval_us"] / 1e6, profile["interval_us"]))
+    print()
+    print("%7s %9s  %-40s %s" % ("%", "Samples", "Function", "Object"))
+    for (name, source), count in sorted(totals.items(), key=lambda t: -t[1])[:args.top]:
+        obj = os.path.basename(source.split("(")[-1].rstrip(")")) if source else ""
+        print("%6.2f%% %9.1f  %-40s %s" % (100.0 * count / samples, count, name, obj))
+
+    groups = {}
+    for (name, source), count in totals.items():
+        group = group_of(name, source)
+        groups[group] = groups.get(group, 0) + count
+
+    print()
+    print("%-40s %7s %10s" % ("Group", "%", "ms/period"))
+    for group, count in sorted(groups.items(), key=lambda g: -g[1]):
+        share = count / samples
+        print("%-40s %6.2f%% %10.2f" % (group, 100.0 * share, share * args.period_ms))
+
+
+if __name__ == "__main__":
+    main()
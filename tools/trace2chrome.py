@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""
+Convert a trace dumped by picosounds_cli.py into Chrome trace JSON, which
+can be opened in chrome://tracing or https://ui.perfetto.dev
+
+    picosounds_cli.py PORT trace night.trace
+    trace2chrome.py night.trace > night.json
+
+The board must be built with -DPICOSOUNDS_TRACE=ON. Interrupt events are
+shown on one track and main loop events on another, so a DMA interrupt can
+be followed to the refill of the DMA block and the RAM buffer behind it.
+"""
+import argparse
+import json
+import struct
+import sys
+
+RECORD = struct.Struct("<IHH")
+
+MAIN = 1
+IRQ = 2
+
+# Same order as trace_id in trace.h: name, phase, track, name of the argument.
+# X events are recorded when they end, with their duration as the argument
+EVENTS = [
+    ("DMA block complete", "i", IRQ, "zone"),
+    ("populateDma", "B", MAIN, "zone"),
+    ("populateDma", "E", MAIN, "zone"),
+    ("doubleBufferPopulateNext", "B", MAIN, "zone"),
+    ("doubleBufferPopulateNext", "E", MAIN, "zone"),
+    ("f_read", "X", MAIN, "us"),
+    ("decode frame", "X", MAIN, "us"),
+    ("underrun", "i", MAIN, "zone"),
+    ("button", "i", IRQ, "gpio"),
+    ("command", "i", MAIN, "cmd"),
+    ("sound", "i", MAIN, "zone_state"),
+    ("timeline", "i", MAIN, "op"),
+]
+
+
+def read_records(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    return [RECORD.unpack_from(data, offset) for offset in range(0, len(data) - RECORD.size + 1, RECORD.size)]
+
+
+def convert(records):
+    events = [
+        {"ph": "M", "name": "thread_name", "pid": 1, "tid": MAIN, "args": {"name": "main loop"}},
+        {"ph": "M", "name": "thread_name", "pid": 1, "tid": IRQ, "args": {"name": "interrupts"}},
+    ]
+    last = None
+    high = 0
+
+    for time_us, trace_id, arg in records:
+        # The board records the low 32 bits of the timer
+        if last is not None and time_us < last:
+            high += 1 << 32
+        last = time_us
+        ts = high + time_us
+
+        if trace_id >= len(EVENTS):
+            events.append({"ph": "i", "s": "t", "name": "id %d" % trace_id, "pid": 1, "tid": MAIN, "ts": ts,
+                           "args": {"arg": arg}})
+            continue
+
+        name, phase, tid, arg_name = EVENTS[trace_id]
+        event = {"ph": phase, "name": name, "pid": 1, "tid": tid, "ts": ts, "args": {arg_name: arg}}
+
+        if phase == "X":
+            event["ts"] = ts - arg
+            event["dur"] = arg
+        elif phase == "i":
+            event["s"] = "t"
+        if arg_name == "zone_state":
+            event["args"] = {"zone": arg >> 8, "state": arg & 0xFF}
+        events.append(event)
+
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert a picosounds trace to Chrome trace JSON")
+    parser.add_argument("trace", help="binary trace written by picosounds_cli.py trace")
+    parser.add_argument("-o", "--output", help="JSON file to write, default stdout")
+    args = parser.parse_args()
+
+    trace = convert(read_records(args.trace))
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
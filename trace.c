@@ -0,0 +1,61 @@
+#ifdef EVENT_TRACE
+#include "hardware/sync.h"
+#include "hardware/structs/timer.h"
+#include "trace.h"
+#include "hot_path.h"
+/*
+   The M0+ has no exclusive access instructions, so a record is claimed and
+   written with interrupts masked for a few cycles, rather than with a lock.
+   Records are never read whilst being written, as the trace is frozen before
+   it is dumped
+ */
+
+static trace_record HOT_PATH_DATA("trace") records[TRACE_LENGTH];
+static uint32_t head = 0;               // Records written, the next is written at head % TRACE_LENGTH
+static bool frozen = false;             // true whilst the trace is being dumped
+
+/*
+ * traceRecord
+ * id           Event to record
+ * arg          Detail of the event, limited to 16 bits
+ */
+void HOT_PATH(traceRecord)(trace_id id, uint32_t arg)
+{
+    uint32_t save = save_and_disable_interrupts();
+
+    if (!frozen)
+    {
+        trace_record* r = &records[head++ & (TRACE_LENGTH - 1)];
+
+        r->time_us = timer_hw->timerawl;
+        r->id = (uint16_t)id;
+        r->arg = (arg > UINT16_MAX) ? UINT16_MAX : (uint16_t)arg;
+    }
+    restore_interrupts(save);
+}
+
+// Stop recording, so the trace can be read. Returns the number of records held
+uint32_t traceFreeze(void)
+{
+    frozen = true;
+    return (head < TRACE_LENGTH) ? head : TRACE_LENGTH;
+}
+
+// Return a record of a frozen trace, index 0 is the oldest
+const trace_record* traceGet(uint32_t index)
+{
+    uint32_t first = (head < TRACE_LENGTH) ? 0 : head - TRACE_LENGTH;
+
+    return &records[(first + index) & (TRACE_LENGTH - 1)];
+}
+
+// Discard the records and start recording again
+void traceRestart(void)
+{
+    uint32_t save = save_and_disable_interrupts();
+
+    head = 0;
+    frozen = false;
+    restore_interrupts(save);
+}
+#endif
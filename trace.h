@@ -0,0 +1,46 @@
+#pragma once
+#include "pico/stdlib.h"
+
+/*
+ * Event trace.
+ * A fixed ring of timestamped records, written from interrupts and the main
+ * loop, so the order of DMA interrupts, refills, SD reads, decodes and button
+ * events can be seen after a glitch. Only built with the PICOSOUNDS_TRACE
+ * option, otherwise TRACE compiles to nothing
+ */
+#define TRACE_BITS      9                       // 512 records, 4KB
+#define TRACE_LENGTH    (1 << TRACE_BITS)
+
+typedef enum trace_id       // Recorded events, tools/trace2chrome.py has the same list
+{
+    trace_dma_irq = 0,                          // DMA block completed, arg zone
+    trace_dma_begin = trace_dma_irq + 1,        // Refill of a DMA block, arg zone
+    trace_dma_end = trace_dma_begin + 1,
+    trace_double_begin = trace_dma_end + 1,     // Refill of a RAM buffer, arg zone
+    trace_double_end = trace_double_begin + 1,
+    trace_sd_read = trace_double_end + 1,       // SD card read completed, arg duration us
+    trace_decode = trace_sd_read + 1,           // Frame decoded, arg duration us
+    trace_underrun = trace_decode + 1,          // DMA block refilled too late, arg zone
+    trace_button = trace_underrun + 1,          // Button event, arg gpio
+    trace_command = trace_button + 1,           // Command received, arg cmd
+    trace_state = trace_command + 1,            // Sound changed, arg zone << 8 | state
+    trace_timeline = trace_state + 1            // Timeline action run, arg op
+} trace_id;
+
+typedef struct trace_record
+{
+    uint32_t time_us;                           // Low 32 bits of the timer
+    uint16_t id;
+    uint16_t arg;
+} trace_record;
+
+#ifdef EVENT_TRACE
+#define TRACE(id, arg) traceRecord((id), (arg))
+#else
+#define TRACE(id, arg)
+#endif
+
+extern void traceRecord(trace_id id, uint32_t arg);
+extern uint32_t traceFreeze(void);
+extern const trace_record* traceGet(uint32_t index);
+extern void traceRestart(void);